@@ -0,0 +1,293 @@
+/**
+ * This file is part of prototype.
+ *
+ * (c) 2014 Nicolas Hillegeer <nicolas@hillegeer.com>
+ *
+ * For the full copyright and license information, please view the LICENSE
+ * file that was distributed with the source code.
+ *
+ * Builds a BVH over 10k up to 1M random boxes and measures the build, the
+ * refit and the queries: frustum culling (against culling all boxes with
+ * gfxCullBoxes), picking rays and box overlaps (against brute force). All
+ * of them have to agree with the linear versions.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include <math/math.h>
+
+#include "bvh.h"
+
+#define ARRAY_SIZE(x) ((sizeof(x)/sizeof(0[x])) / ((size_t)(!(sizeof(x) % sizeof(0[x])))))
+
+#define NUM_RAYS     10000
+#define NUM_OVERLAPS 10000
+#define NUM_CHECKED  200
+
+static uint64_t xorshift(uint64_t *state) {
+    uint64_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    return *state = x;
+}
+
+static float randf(uint64_t *state, float lo, float hi) {
+    return lo + (hi - lo) * (float) (xorshift(state) >> 40) / (float) (1 << 24);
+}
+
+static double elapsedMs(struct timeval *t1, struct timeval *t2) {
+    double elapsedTime = (t2->tv_sec - t1->tv_sec) * 1000.0; /* sec to ms */
+    elapsedTime += (t2->tv_usec - t1->tv_usec) / 1000.0;     /* us to ms */
+    return elapsedTime;
+}
+
+static void setBit(uint32_t id, void *userdata) {
+    uint32_t *mask = userdata;
+    mask[id >> 5] |= 1u << (id & 31);
+}
+
+static void countOne(uint32_t id, void *userdata) {
+    ++*(size_t *) userdata;
+}
+
+/* where the ray enters box i, negative on a miss */
+static float slab(const struct gfxBoxes *boxes, size_t i, const float o[3], const float d[3], float maxT) {
+    const float min[3] = { boxes->minX[i], boxes->minY[i], boxes->minZ[i] };
+    const float max[3] = { boxes->maxX[i], boxes->maxY[i], boxes->maxZ[i] };
+
+    float tnear = 0.0f;
+    float tfar = maxT;
+
+    for (int a = 0; a < 3; ++a) {
+        const float inv = 1.0f / d[a];
+        float t1 = (min[a] - o[a]) * inv;
+        float t2 = (max[a] - o[a]) * inv;
+        if (t1 > t2) { const float tmp = t1; t1 = t2; t2 = tmp; }
+        tnear = (t1 > tnear) ? t1 : tnear;
+        tfar = (t2 < tfar) ? t2 : tfar;
+    }
+
+    return (tnear <= tfar) ? tnear : -1.0f;
+}
+
+static void randomBox(uint64_t *state, aabb *box) {
+    const float cx = randf(state, -100.0f, 100.0f);
+    const float cy = randf(state, -100.0f, 100.0f);
+    const float cz = randf(state, -100.0f, 100.0f);
+    const float e = randf(state, 0.1f, 2.0f);
+
+    box->min = vec(cx - e, cy - e, cz - e, 1.0f);
+    box->max = vec(cx + e, cy + e, cz + e, 1.0f);
+}
+
+/* the BVH has to find exactly what gfxCullBoxes finds */
+static size_t cullMismatches(const struct gfxBvh *bvh, const struct gfxBoxes *boxes, const frustum *fru,
+                             uint32_t *linear, uint32_t *tree) {
+    const size_t words = GFX_CULL_WORDS(boxes->count);
+
+    gfxCullBoxes(boxes, fru, linear);
+    memset(tree, 0x0, words * sizeof(uint32_t));
+    gfxBvhCullFrustum(bvh, fru, setBit, tree);
+
+    size_t mismatches = 0;
+    for (size_t w = 0; w < words; ++w) mismatches += (size_t) __builtin_popcount(linear[w] ^ tree[w]);
+
+    return mismatches;
+}
+
+int main(int argc, char* argv[]) {
+    struct timeval t1, t2;
+
+    const size_t counts[] = { 10000, 100000, 1000000 };
+
+    /* a camera in the middle of the scene looking down -z, once seeing
+     * about a tenth of it and once with a far plane that's a lot closer */
+    const float fars[] = { 100.0f, 20.0f };
+    static frustum frustums[ARRAY_SIZE(fars)];
+
+    for (int f = 0; f < (int) ARRAY_SIZE(fars); ++f) {
+        frustum_from_mat(&frustums[f], mat_perspective_fovy(3.14159265f / 3.0f, 16.0f / 9.0f, 0.1f, fars[f]));
+    }
+
+    printf("random boxes in [-100, 100]^3, %d rays, %d overlap queries\n", NUM_RAYS, NUM_OVERLAPS);
+
+    for (int c = 0; c < (int) ARRAY_SIZE(counts); ++c) {
+        const size_t count = counts[c];
+        const size_t words = GFX_CULL_WORDS(count);
+        const size_t iterations = 10000000 / count;
+
+        uint64_t state = 0x9E3779B97F4A7C15ULL + count;
+
+        struct gfxBoxes boxes;
+        gfxBoxesInit(&boxes, count);
+
+        for (size_t i = 0; i < count; ++i) {
+            aabb box;
+            randomBox(&state, &box);
+            gfxBoxesAdd(&boxes, &box);
+        }
+
+        uint32_t *linear = malloc(words * sizeof(uint32_t));
+        uint32_t *tree = malloc(words * sizeof(uint32_t));
+
+        struct gfxBvh bvh;
+
+        gettimeofday(&t1, NULL);
+        gfxBvhBuild(&bvh, &boxes);
+        gettimeofday(&t2, NULL);
+
+        const double buildMs = elapsedMs(&t1, &t2);
+
+        printf("%7zu boxes: build %8.2f ms (%5.2f Mboxes/s), %zu nodes (%.2f children per node)\n",
+            count, buildMs, (double) count / buildMs / 1000.0, bvh.numNodes,
+            (double) (bvh.numNodes - 1 + count) / (double) bvh.numNodes);
+
+        for (int f = 0; f < (int) ARRAY_SIZE(fars); ++f) {
+            const frustum *fru = &frustums[f];
+            size_t visible = 0;
+
+            gettimeofday(&t1, NULL);
+            for (size_t it = 0; it < iterations; ++it) {
+                visible = 0;
+                gfxBvhCullFrustum(&bvh, fru, countOne, &visible);
+            }
+            gettimeofday(&t2, NULL);
+
+            const double bvhMs = elapsedMs(&t1, &t2) / (double) iterations;
+
+            gettimeofday(&t1, NULL);
+            for (size_t it = 0; it < iterations; ++it) {
+                gfxCullBoxes(&boxes, fru, linear);
+            }
+            gettimeofday(&t2, NULL);
+
+            const double linearMs = elapsedMs(&t1, &t2) / (double) iterations;
+
+            const size_t mismatches = cullMismatches(&bvh, &boxes, fru, linear, tree);
+
+            printf("    frustum (far %3.0f): %6zu visible, BVH %7.3f ms, gfxCullBoxes %7.3f ms, %zu mismatches\n",
+                (double) fars[f], visible, bvhMs, linearMs, mismatches);
+
+            if (mismatches) {
+                printf("BROKEN: the BVH and gfxCullBoxes disagree\n");
+                return 1;
+            }
+        }
+
+        /* rays from random spots in random directions */
+        static float origins[NUM_RAYS][3];
+        static float dirs[NUM_RAYS][3];
+        static float ts[NUM_RAYS];
+
+        for (int r = 0; r < NUM_RAYS; ++r) {
+            for (int a = 0; a < 3; ++a) {
+                origins[r][a] = randf(&state, -100.0f, 100.0f);
+                dirs[r][a] = randf(&state, -1.0f, 1.0f);
+            }
+        }
+
+        size_t hits = 0;
+
+        gettimeofday(&t1, NULL);
+        for (int r = 0; r < NUM_RAYS; ++r) {
+            ts[r] = -1.0f;
+            hits += gfxBvhRaycast(&bvh, origins[r], dirs[r], 1000.0f, NULL, NULL, &ts[r]) != GFX_BVH_NONE;
+        }
+        gettimeofday(&t2, NULL);
+
+        const double rayMs = elapsedMs(&t1, &t2);
+
+        for (int r = 0; r < NUM_CHECKED; ++r) {
+            float best = -1.0f;
+
+            for (size_t i = 0; i < count; ++i) {
+                const float t = slab(&boxes, i, origins[r], dirs[r], 1000.0f);
+                if (t >= 0.0f && (best < 0.0f || t < best)) best = t;
+            }
+
+            if (fabsf(best - ts[r]) > 1e-3f * (1.0f + fabsf(best))) {
+                printf("BROKEN: ray %d hits at %f, brute force says %f\n", r, (double) ts[r], (double) best);
+                return 1;
+            }
+        }
+
+        printf("    rays:    %5zu of %d hit, %7.3f us per ray\n", hits, NUM_RAYS, rayMs * 1000.0 / NUM_RAYS);
+
+        /* overlaps with boxes of about the same size as the objects */
+        size_t overlaps = 0;
+        size_t checkedOverlaps = 0;
+        double overlapMs = 0.0;
+
+        for (int q = 0; q < NUM_OVERLAPS; ++q) {
+            aabb box;
+            randomBox(&state, &box);
+
+            size_t found = 0;
+
+            gettimeofday(&t1, NULL);
+            gfxBvhOverlap(&bvh, &box, countOne, &found);
+            gettimeofday(&t2, NULL);
+
+            overlapMs += elapsedMs(&t1, &t2);
+            overlaps += found;
+
+            if (q < NUM_CHECKED) {
+                size_t expected = 0;
+
+                for (size_t i = 0; i < count; ++i) {
+                    expected += boxes.maxX[i] >= box.min[0] && boxes.minX[i] <= box.max[0] &&
+                                boxes.maxY[i] >= box.min[1] && boxes.minY[i] <= box.max[1] &&
+                                boxes.maxZ[i] >= box.min[2] && boxes.minZ[i] <= box.max[2];
+                }
+
+                if (found != expected) {
+                    printf("BROKEN: overlap query %d found %zu boxes instead of %zu\n", q, found, expected);
+                    return 1;
+                }
+
+                checkedOverlaps += expected;
+            }
+        }
+
+        printf("    overlap: %5.2f boxes per query, %7.3f us per query\n",
+            (double) overlaps / NUM_OVERLAPS, overlapMs * 1000.0 / NUM_OVERLAPS);
+
+        /* everything moves a bit, refit and check again */
+        for (size_t i = 0; i < count; ++i) {
+            const float dx = randf(&state, -1.0f, 1.0f);
+            const float dy = randf(&state, -1.0f, 1.0f);
+            const float dz = randf(&state, -1.0f, 1.0f);
+
+            const aabb box = {
+                vec(boxes.minX[i] + dx, boxes.minY[i] + dy, boxes.minZ[i] + dz, 1.0f),
+                vec(boxes.maxX[i] + dx, boxes.maxY[i] + dy, boxes.maxZ[i] + dz, 1.0f)
+            };
+            gfxBoxesSet(&boxes, i, &box);
+        }
+
+        gettimeofday(&t1, NULL);
+        gfxBvhRefit(&bvh, &boxes);
+        gettimeofday(&t2, NULL);
+
+        const size_t mismatches = cullMismatches(&bvh, &boxes, &frustums[0], linear, tree);
+
+        printf("    refit:   %8.2f ms, %zu mismatches after moving everything\n", elapsedMs(&t1, &t2), mismatches);
+
+        if (mismatches) {
+            printf("BROKEN: the refitted BVH and gfxCullBoxes disagree\n");
+            return 1;
+        }
+
+        gfxBvhDestroy(&bvh);
+        gfxBoxesDestroy(&boxes);
+        free(linear);
+        free(tree);
+    }
+
+    return 0;
+}
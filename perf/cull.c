@@ -0,0 +1,199 @@
+/**
+ * This file is part of prototype.
+ *
+ * (c) 2014 Nicolas Hillegeer <nicolas@hillegeer.com>
+ *
+ * For the full copyright and license information, please view the LICENSE
+ * file that was distributed with the source code.
+ *
+ * Compares batched frustum culling (gfxCullBoxes) with calling the
+ * per-box tests from math/geometry.h in a loop, for 10k up to 1M boxes
+ * scattered around a perspective frustum. Everything has to agree on
+ * which boxes are visible.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include <math/math.h>
+
+#include "cull.h"
+
+#define ARRAY_SIZE(x) ((sizeof(x)/sizeof(0[x])) / ((size_t)(!(sizeof(x) % sizeof(0[x])))))
+
+static uint64_t xorshift(uint64_t *state) {
+    uint64_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    return *state = x;
+}
+
+static float randf(uint64_t *state, float lo, float hi) {
+    return lo + (hi - lo) * (float) (xorshift(state) >> 40) / (float) (1 << 24);
+}
+
+static double elapsedMs(struct timeval *t1, struct timeval *t2) {
+    double elapsedTime = (t2->tv_sec - t1->tv_sec) * 1000.0; /* sec to ms */
+    elapsedTime += (t2->tv_usec - t1->tv_usec) / 1000.0;     /* us to ms */
+    return elapsedTime;
+}
+
+/* the plane through a, b and c, facing towards inside */
+static vec4 planeFrom(vec4 a, vec4 b, vec4 c, vec4 inside) {
+    const float u[3] = { b[0] - a[0], b[1] - a[1], b[2] - a[2] };
+    const float v[3] = { c[0] - a[0], c[1] - a[1], c[2] - a[2] };
+
+    float n[3] = { u[1] * v[2] - u[2] * v[1], u[2] * v[0] - u[0] * v[2], u[0] * v[1] - u[1] * v[0] };
+    const float len = sqrtf(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+    for (int i = 0; i < 3; ++i) n[i] /= len;
+
+    float d = -(n[0] * a[0] + n[1] * a[1] + n[2] * a[2]);
+
+    if (n[0] * inside[0] + n[1] * inside[1] + n[2] * inside[2] + d < 0.0f) {
+        for (int i = 0; i < 3; ++i) n[i] = -n[i];
+        d = -d;
+    }
+
+    return vec(n[0], n[1], n[2], d);
+}
+
+/* a camera in the origin looking down -z, 60 degrees vertical fov */
+static void makeFrustum(frustum *fru, float aspect, float near, float far) {
+    const float tanHalf = tanf(30.0f * (float) M_PI / 180.0f);
+
+    for (int i = 0; i < 8; ++i) {
+        const float z = (i & 4) ? far : near;
+        const float y = ((i & 2) ? 1.0f : -1.0f) * z * tanHalf;
+        const float x = ((i & 1) ? 1.0f : -1.0f) * z * tanHalf * aspect;
+        fru->points[i] = vec(x, y, -z, 1.0f);
+    }
+
+    const vec4 *p = fru->points;
+    const vec4 inside = vec(0.0f, 0.0f, -(near + far) * 0.5f, 1.0f);
+
+    fru->planes[0] = planeFrom(p[0], p[2], p[4], inside); /* left */
+    fru->planes[1] = planeFrom(p[1], p[3], p[5], inside); /* right */
+    fru->planes[2] = planeFrom(p[0], p[1], p[4], inside); /* bottom */
+    fru->planes[3] = planeFrom(p[2], p[3], p[6], inside); /* top */
+    fru->planes[4] = planeFrom(p[0], p[1], p[2], inside); /* near */
+    fru->planes[5] = planeFrom(p[4], p[5], p[6], inside); /* far */
+}
+
+/* one box at a time, the test gets inlined into the loop */
+#define PER_BOX(name, test) \
+    static void name(const frustum *fru, const aabb *boxes, size_t count, uint32_t *visible) { \
+        memset(visible, 0x0, GFX_CULL_WORDS(count) * sizeof(uint32_t)); \
+        for (size_t i = 0; i < count; ++i) { \
+            visible[i >> 5] |= (uint32_t) test(*fru, boxes[i]) << (i & 31); \
+        } \
+    }
+
+PER_BOX(cullScalar, box_in_frustum_scalar)
+PER_BOX(cullSoa, box_in_frustum_soa)
+PER_BOX(cullSoaEarly, box_in_frustum_soa_early)
+
+static const struct {
+    const char *name;
+    void (*cull)(const frustum *fru, const aabb *boxes, size_t count, uint32_t *visible);
+} perBox[] = {
+    { "box_in_frustum_scalar", cullScalar },
+    { "box_in_frustum_soa", cullSoa },
+    { "box_in_frustum_soa_early", cullSoaEarly },
+};
+
+int main(int argc, char* argv[]) {
+    struct timeval t1, t2;
+
+    const size_t counts[] = { 10000, 100000, 1000000 };
+
+    /* about the same amount of work for every size */
+    const size_t boxesPerRun = 10000000;
+
+    static frustum fru;
+    makeFrustum(&fru, 16.0f / 9.0f, 0.1f, 100.0f);
+
+    printf("culling random boxes in [-100, 100]^3, %s paths\n",
+#if defined(__AVX__)
+        "AVX + SSE"
+#else
+        "SSE"
+#endif
+    );
+
+    for (int c = 0; c < (int) ARRAY_SIZE(counts); ++c) {
+        const size_t count = counts[c];
+        const size_t iterations = boxesPerRun / count;
+
+        aabb *aos = NULL;
+        if (posix_memalign((void **) &aos, 16, count * sizeof(aabb))) return 1;
+
+        struct gfxBoxes boxes;
+        gfxBoxesInit(&boxes, count);
+
+        uint64_t state = 0x9E3779B97F4A7C15ULL + count;
+
+        for (size_t i = 0; i < count; ++i) {
+            const float cx = randf(&state, -100.0f, 100.0f);
+            const float cy = randf(&state, -100.0f, 100.0f);
+            const float cz = randf(&state, -100.0f, 100.0f);
+            const float e = randf(&state, 0.1f, 2.0f);
+
+            aos[i].min = vec(cx - e, cy - e, cz - e, 1.0f);
+            aos[i].max = vec(cx + e, cy + e, cz + e, 1.0f);
+
+            gfxBoxesAdd(&boxes, &aos[i]);
+        }
+
+        uint32_t *visible = malloc(GFX_CULL_WORDS(count) * sizeof(uint32_t));
+        uint32_t *reference = malloc(GFX_CULL_WORDS(count) * sizeof(uint32_t));
+
+        gettimeofday(&t1, NULL);
+        for (size_t it = 0; it < iterations; ++it) {
+            gfxCullBoxes(&boxes, &fru, visible);
+        }
+        gettimeofday(&t2, NULL);
+
+        const double batchMs = elapsedMs(&t1, &t2) / (double) iterations;
+
+        size_t numVisible = 0;
+        for (size_t i = 0; i < count; ++i) numVisible += (visible[i >> 5] >> (i & 31)) & 1;
+
+        printf("%7zu boxes, %zu visible\n", count, numVisible);
+        printf("    %-26s %8.3f ms, %7.1f Mboxes/s\n", "gfxCullBoxes",
+            batchMs, (double) count / batchMs / 1000.0);
+
+        for (int f = 0; f < (int) ARRAY_SIZE(perBox); ++f) {
+            gettimeofday(&t1, NULL);
+            for (size_t it = 0; it < iterations; ++it) {
+                perBox[f].cull(&fru, aos, count, reference);
+            }
+            gettimeofday(&t2, NULL);
+
+            const double ms = elapsedMs(&t1, &t2) / (double) iterations;
+
+            size_t mismatches = 0;
+            for (size_t i = 0; i < count; ++i) {
+                mismatches += ((visible[i >> 5] ^ reference[i >> 5]) >> (i & 31)) & 1;
+            }
+
+            printf("    %-26s %8.3f ms, %7.1f Mboxes/s, %5.1fx slower, %zu mismatches\n", perBox[f].name,
+                ms, (double) count / ms / 1000.0, ms / batchMs, mismatches);
+
+            if (mismatches) {
+                printf("BROKEN: %s and gfxCullBoxes disagree\n", perBox[f].name);
+                return 1;
+            }
+        }
+
+        free(visible);
+        free(reference);
+        gfxBoxesDestroy(&boxes);
+        free(aos);
+    }
+
+    return 0;
+}
@@ -0,0 +1,284 @@
+/**
+ * This file is part of prototype.
+ *
+ * (c) 2014 Nicolas Hillegeer <nicolas@hillegeer.com>
+ *
+ * For the full copyright and license information, please view the LICENSE
+ * file that was distributed with the source code.
+ *
+ * Moves 10k up to 1M units around in a loose grid, frame after frame, and
+ * measures what the updates and the queries cost. Every frame some units
+ * die and get replaced, and the frustum and radius queries have to find
+ * exactly what testing every unit finds (with gfxCullBoxes for the
+ * frustum). The queries also run from a few threads at once while the next
+ * frame gets queued, like they would in the engine.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+#include <sys/time.h>
+
+#include <math/math.h>
+
+#include "cull.h"
+#include "grid.h"
+
+#define ARRAY_SIZE(x) ((sizeof(x)/sizeof(0[x])) / ((size_t)(!(sizeof(x) % sizeof(0[x])))))
+
+#define NUM_FRAMES  16
+#define NUM_THREADS 4
+#define WORLD       100.0f
+
+/* a few units are a lot bigger than the rest, some of them bigger than
+ * the biggest cells */
+#define BIG_EVERY  100
+#define HUGE_EVERY 10000
+
+struct unit {
+    aabb box;
+    float velocity[3];
+    gfxGridHandle handle;
+};
+
+struct reader {
+    pthread_t thread;
+    const struct gfxGrid *grid;
+    const frustum *fru;
+    size_t visible;
+    size_t nearby;
+};
+
+static const float gCenter[3] = { 10.0f, -5.0f, -30.0f };
+static const float gRadius = 15.0f;
+
+static uint64_t xorshift(uint64_t *state) {
+    uint64_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    return *state = x;
+}
+
+static float randf(uint64_t *state, float lo, float hi) {
+    return lo + (hi - lo) * (float) (xorshift(state) >> 40) / (float) (1 << 24);
+}
+
+static double elapsedMs(struct timeval *t1, struct timeval *t2) {
+    double elapsedTime = (t2->tv_sec - t1->tv_sec) * 1000.0; /* sec to ms */
+    elapsedTime += (t2->tv_usec - t1->tv_usec) / 1000.0;     /* us to ms */
+    return elapsedTime;
+}
+
+static void spawn(uint64_t *state, struct unit *u, size_t i) {
+    const float cx = randf(state, -WORLD, WORLD);
+    const float cy = randf(state, -WORLD, WORLD);
+    const float cz = randf(state, -WORLD, WORLD);
+
+    float e = randf(state, 0.25f, 1.0f);
+    if (i % BIG_EVERY == 0) e *= 20.0f;
+    if (i % HUGE_EVERY == 0) e = 1e6f;
+
+    u->box.min = vec(cx - e, cy - e, cz - e, 1.0f);
+    u->box.max = vec(cx + e, cy + e, cz + e, 1.0f);
+
+    for (int a = 0; a < 3; ++a) u->velocity[a] = randf(state, -0.1f, 0.1f);
+}
+
+static void setBit(uint32_t id, void *userdata) {
+    uint32_t *mask = userdata;
+    mask[id >> 5] |= 1u << (id & 31);
+}
+
+static void countOne(uint32_t id, void *userdata) {
+    ++*(size_t *) userdata;
+}
+
+/* the same test as the grid, so the answers have to be exactly the same */
+static int touchesSphere(const aabb *box, const float center[3], float radius) {
+    const vec4 c = vec(center[0], center[1], center[2], 1.0f);
+    const vec4 d = vmax(vmax(box->min - c, c - box->max), vzero());
+    return vdot3(d, d)[0] <= radius * radius;
+}
+
+static size_t mismatches(const uint32_t *a, const uint32_t *b, size_t words) {
+    size_t count = 0;
+    for (size_t w = 0; w < words; ++w) count += (size_t) __builtin_popcount(a[w] ^ b[w]);
+    return count;
+}
+
+static size_t check(const struct gfxGrid *grid, const struct unit *units, struct gfxBoxes *boxes,
+                    const frustum *fru, uint32_t *expected, uint32_t *found) {
+    const size_t count = boxes->count;
+    const size_t words = GFX_CULL_WORDS(count);
+    size_t wrong = 0;
+
+    for (size_t i = 0; i < count; ++i) gfxBoxesSet(boxes, i, &units[i].box);
+
+    gfxCullBoxes(boxes, fru, expected);
+    memset(found, 0x0, words * sizeof(uint32_t));
+    gfxGridCullFrustum(grid, fru, setBit, found);
+    wrong += mismatches(expected, found, words);
+
+    memset(expected, 0x0, words * sizeof(uint32_t));
+    memset(found, 0x0, words * sizeof(uint32_t));
+    for (size_t i = 0; i < count; ++i) {
+        if (touchesSphere(&units[i].box, gCenter, gRadius)) setBit((uint32_t) i, expected);
+    }
+    gfxGridRadius(grid, gCenter, gRadius, setBit, found);
+    wrong += mismatches(expected, found, words);
+
+    return wrong;
+}
+
+static void *query(void *arg) {
+    struct reader *r = arg;
+
+    r->visible = 0;
+    r->nearby = 0;
+    gfxGridCullFrustum(r->grid, r->fru, countOne, &r->visible);
+    gfxGridRadius(r->grid, gCenter, gRadius, countOne, &r->nearby);
+
+    return NULL;
+}
+
+/* queues the next frame: everything moves, a few units die and new ones
+ * take their place (and id) */
+static void step(struct gfxGrid *grid, struct unit *units, size_t count, uint64_t *state) {
+    for (size_t i = 0; i < count; ++i) {
+        struct unit *u = &units[i];
+
+        if (xorshift(state) % 100 == 0) {
+            gfxGridRemove(grid, u->handle);
+            spawn(state, u, i);
+            u->handle = gfxGridInsert(grid, &u->box, (uint32_t) i);
+            continue;
+        }
+
+        const vec4 v = vec(u->velocity[0], u->velocity[1], u->velocity[2], 0.0f);
+        u->box.min += v;
+        u->box.max += v;
+        gfxGridMove(grid, u->handle, &u->box);
+    }
+}
+
+int main(int argc, char* argv[]) {
+    struct timeval t1, t2;
+
+    const size_t counts[] = { 10000, 100000, 1000000 };
+
+    static frustum fru;
+    frustum_from_mat(&fru, mat_perspective_fovy(3.14159265f / 3.0f, 16.0f / 9.0f, 0.1f, 100.0f));
+
+    printf("units in [-%.0f, %.0f]^3 moving every frame, %d frames, %d reader threads\n",
+        (double) WORLD, (double) WORLD, NUM_FRAMES, NUM_THREADS);
+
+    for (int c = 0; c < (int) ARRAY_SIZE(counts); ++c) {
+        const size_t count = counts[c];
+        const size_t words = GFX_CULL_WORDS(count);
+
+        uint64_t state = 0x9E3779B97F4A7C15ULL + count;
+
+        struct unit *units = NULL;
+        if (posix_memalign((void **) &units, 16, count * sizeof(struct unit))) return 1;
+
+        uint32_t *expected = malloc(words * sizeof(uint32_t));
+        uint32_t *found = malloc(words * sizeof(uint32_t));
+
+        struct gfxGrid *grid = gfxGridCreate(1.0f);
+
+        /* the brute force reference */
+        struct gfxBoxes boxes;
+        gfxBoxesInit(&boxes, count);
+        boxes.count = count;
+
+        gettimeofday(&t1, NULL);
+        for (size_t i = 0; i < count; ++i) {
+            spawn(&state, &units[i], i);
+            units[i].handle = gfxGridInsert(grid, &units[i].box, (uint32_t) i);
+        }
+        gfxGridCommit(grid);
+        gettimeofday(&t2, NULL);
+
+        printf("%7zu units: insert %8.2f ms\n", count, elapsedMs(&t1, &t2));
+
+        double queueMs = 0.0, commitMs = 0.0, cullMs = 0.0, radiusMs = 0.0;
+        size_t visible = 0, nearby = 0;
+
+        for (int frame = 0; frame < NUM_FRAMES; ++frame) {
+            visible = 0;
+            gettimeofday(&t1, NULL);
+            gfxGridCullFrustum(grid, &fru, countOne, &visible);
+            gettimeofday(&t2, NULL);
+            cullMs += elapsedMs(&t1, &t2);
+
+            nearby = 0;
+            gettimeofday(&t1, NULL);
+            gfxGridRadius(grid, gCenter, gRadius, countOne, &nearby);
+            gettimeofday(&t2, NULL);
+            radiusMs += elapsedMs(&t1, &t2);
+
+            /* the brute force check moves along with the units, so it has
+             * to happen before the next frame gets queued */
+            const size_t wrong = check(grid, units, &boxes, &fru, expected, found);
+            if (wrong) {
+                printf("BROKEN: frame %d, the grid and brute force disagree on %zu units\n", frame, wrong);
+                return 1;
+            }
+
+            /* every other frame, the readers query the committed frame
+             * while the next one gets queued. The others time the queueing
+             * without them getting in the way. */
+            const int concurrent = frame & 1;
+
+            struct reader readers[NUM_THREADS];
+            for (int t = 0; concurrent && t < NUM_THREADS; ++t) {
+                readers[t].grid = grid;
+                readers[t].fru = &fru;
+                pthread_create(&readers[t].thread, NULL, query, &readers[t]);
+            }
+
+            gettimeofday(&t1, NULL);
+            step(grid, units, count, &state);
+            gettimeofday(&t2, NULL);
+            if (!concurrent) queueMs += elapsedMs(&t1, &t2);
+
+            for (int t = 0; concurrent && t < NUM_THREADS; ++t) {
+                pthread_join(readers[t].thread, NULL);
+
+                if (readers[t].visible != visible || readers[t].nearby != nearby) {
+                    printf("BROKEN: reader %d found %zu + %zu units instead of %zu + %zu\n",
+                        t, readers[t].visible, readers[t].nearby, visible, nearby);
+                    return 1;
+                }
+            }
+
+            gettimeofday(&t1, NULL);
+            gfxGridCommit(grid);
+            gettimeofday(&t2, NULL);
+            commitMs += elapsedMs(&t1, &t2);
+        }
+
+        const size_t wrong = check(grid, units, &boxes, &fru, expected, found);
+        if (wrong || gfxGridCount(grid) != count) {
+            printf("BROKEN: the grid has %zu units and disagrees with brute force on %zu\n",
+                gfxGridCount(grid), wrong);
+            return 1;
+        }
+
+        printf("    per frame: queue %7.3f ms, commit %7.3f ms (%5.1f ns per unit)\n",
+            queueMs / (NUM_FRAMES / 2), commitMs / NUM_FRAMES, commitMs * 1e6 / NUM_FRAMES / (double) count);
+        printf("    frustum: %6zu visible, %7.3f ms\n", visible, cullMs / NUM_FRAMES);
+        printf("    radius:  %6zu nearby,  %7.3f ms\n", nearby, radiusMs / NUM_FRAMES);
+
+        gfxGridDestroy(grid);
+        gfxBoxesDestroy(&boxes);
+        free(expected);
+        free(found);
+        free(units);
+    }
+
+    return 0;
+}
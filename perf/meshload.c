@@ -0,0 +1,182 @@
+/**
+ * This file is part of prototype.
+ *
+ * (c) 2014 Nicolas Hillegeer <nicolas@hillegeer.com>
+ *
+ * For the full copyright and license information, please view the LICENSE
+ * file that was distributed with the source code.
+ *
+ * Compares getting a mesh ready for upload from an OBJ file (parsing the
+ * text, merging the corners into vertices) against mapping the binary mesh
+ * that meshconv makes out of it. The mapped mesh gets read completely, like
+ * glBufferData() would, so the page faults are part of the measurement.
+ *
+ * Also measures the attribute quantizer (see quantize.h) and what it does
+ * to the size of the vertices.
+ *
+ * The files are written to the current directory.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include "mesh.h"
+
+#define ARRAY_SIZE(x) ((sizeof(x)/sizeof(0[x])) / ((size_t)(!(sizeof(x) % sizeof(0[x])))))
+
+#define OBJ_FILE  "meshload.obj"
+#define MESH_FILE "meshload.mesh"
+#define QUANTIZED_FILE "meshload_quantized.mesh"
+
+/* a grid with positions, normals and texcoords, like most real meshes */
+static int writeObj(const char *filename, unsigned int subdiv) {
+    FILE *file = fopen(filename, "w");
+    if (!file) return 0;
+
+    const unsigned int stride = subdiv + 1;
+
+    for (unsigned int i = 0; i < stride; ++i) {
+        for (unsigned int j = 0; j < stride; ++j) {
+            fprintf(file, "v %f %f %f\n", (float) i / subdiv, 0.0f, (float) j / subdiv);
+            fprintf(file, "vt %f %f\n", (float) i / subdiv, (float) j / subdiv);
+        }
+    }
+
+    fprintf(file, "vn 0.0 1.0 0.0\n");
+
+    for (unsigned int i = 0; i < subdiv; ++i) {
+        for (unsigned int j = 0; j < subdiv; ++j) {
+            const unsigned int a = i * stride + j + 1;
+            const unsigned int b = a + 1;
+            const unsigned int c = a + stride;
+            const unsigned int d = c + 1;
+
+            fprintf(file, "f %u/%u/1 %u/%u/1 %u/%u/1 %u/%u/1\n", a, a, b, b, d, d, c, c);
+        }
+    }
+
+    return fclose(file) == 0;
+}
+
+static double elapsedMs(struct timeval *t1, struct timeval *t2) {
+    double elapsedTime = (t2->tv_sec - t1->tv_sec) * 1000.0; /* sec to ms */
+    elapsedTime += (t2->tv_usec - t1->tv_usec) / 1000.0;     /* us to ms */
+    return elapsedTime;
+}
+
+/* keeps the compiler from throwing the reads away */
+static volatile uint64_t gSink;
+
+/* stands in for the upload, which has to read every byte */
+static uint64_t touch(const void *data, size_t size) {
+    const unsigned char *p = data;
+    uint64_t sum = 0;
+
+    for (size_t i = 0; i < size; i += 64) sum += p[i];
+
+    return sum;
+}
+
+int main(int argc, char* argv[]) {
+    struct timeval t1, t2;
+
+    const unsigned int subdivs[] = { 32, 128, 512 };
+    const int iterations = 10;
+
+    printf("loading meshes, %d iterations per size\n", iterations);
+
+    for (int s = 0; s < (int) ARRAY_SIZE(subdivs); ++s) {
+        const unsigned int subdiv = subdivs[s];
+
+        struct gfxMesh mesh;
+
+        if (!writeObj(OBJ_FILE, subdiv) || gfxParseObj(&mesh, OBJ_FILE) != GFX_MESH_OK) {
+            printf("could not prepare the OBJ for subdiv = %u\n", subdiv);
+            return 1;
+        }
+
+        gfxMeshNarrowIndices(&mesh);
+
+        if (gfxWriteMesh(&mesh, MESH_FILE) != GFX_MESH_OK) {
+            printf("could not write the binary mesh for subdiv = %u\n", subdiv);
+            return 1;
+        }
+
+        const uint32_t numVertices = mesh.header.numVertices;
+        const uint32_t numIndices = mesh.header.numIndices;
+        const uint32_t stride = mesh.header.stride;
+        gfxFreeMesh(&mesh);
+
+        double objMs = 0.0;
+        double meshMs = 0.0;
+        double quantizeMs = 0.0;
+        double quantizedMs = 0.0;
+        uint32_t quantizedStride = 0;
+
+        for (int i = 0; i < iterations; ++i) {
+            gettimeofday(&t1, NULL);
+            gfxParseObj(&mesh, OBJ_FILE);
+            gSink += touch(mesh.vertices, (size_t) mesh.header.numVertices * mesh.header.stride);
+            gettimeofday(&t2, NULL);
+            objMs += elapsedMs(&t1, &t2);
+
+            gettimeofday(&t1, NULL);
+            gfxQuantizeMesh(&mesh);
+            gettimeofday(&t2, NULL);
+            quantizeMs += elapsedMs(&t1, &t2);
+
+            quantizedStride = mesh.header.stride;
+
+            if (i == 0 && gfxWriteMesh(&mesh, QUANTIZED_FILE) != GFX_MESH_OK) {
+                printf("could not write the quantized mesh for subdiv = %u\n", subdiv);
+                return 1;
+            }
+
+            gfxFreeMesh(&mesh);
+
+            gettimeofday(&t1, NULL);
+            if (gfxMapMesh(&mesh, QUANTIZED_FILE) != GFX_MESH_OK) {
+                printf("could not map %s\n", QUANTIZED_FILE);
+                return 1;
+            }
+            gSink += touch(mesh.vertices, (size_t) mesh.header.vertexSize);
+            gSink += touch(mesh.indices, (size_t) mesh.header.indexSize);
+            gettimeofday(&t2, NULL);
+            quantizedMs += elapsedMs(&t1, &t2);
+
+            gfxFreeMesh(&mesh);
+
+            gettimeofday(&t1, NULL);
+            if (gfxMapMesh(&mesh, MESH_FILE) != GFX_MESH_OK) {
+                printf("could not map %s\n", MESH_FILE);
+                return 1;
+            }
+            gSink += touch(mesh.vertices, (size_t) mesh.header.vertexSize);
+            gSink += touch(mesh.indices, (size_t) mesh.header.indexSize);
+            gettimeofday(&t2, NULL);
+            meshMs += elapsedMs(&t1, &t2);
+
+            if (mesh.header.numVertices != numVertices || mesh.header.numIndices != numIndices) {
+                printf("MISMATCH between the OBJ and the binary mesh for subdiv = %u\n", subdiv);
+                return 1;
+            }
+
+            gfxFreeMesh(&mesh);
+        }
+
+        printf("%7u vertices, %8u indices: %8.3f ms (obj) %8.3f ms (mapped) per load, %6.1fx\n",
+            numVertices, numIndices, objMs / iterations, meshMs / iterations, objMs / meshMs);
+        printf("%7s quantized %u -> %u bytes per vertex: %8.3f ms (%.1f Mvertices/s) %8.3f ms (mapped)\n",
+            "", stride, quantizedStride, quantizeMs / iterations,
+            numVertices * (double) iterations / quantizeMs / 1000.0, quantizedMs / iterations);
+    }
+
+    remove(OBJ_FILE);
+    remove(MESH_FILE);
+    remove(QUANTIZED_FILE);
+
+    return 0;
+}
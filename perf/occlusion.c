@@ -0,0 +1,200 @@
+/**
+ * This file is part of prototype.
+ *
+ * (c) 2014 Nicolas Hillegeer <nicolas@hillegeer.com>
+ *
+ * For the full copyright and license information, please view the LICENSE
+ * file that was distributed with the source code.
+ *
+ * A city of box-shaped buildings as occluders and 10k up to 1M small
+ * objects between them. Measures what it takes to set up the occluders,
+ * rasterize them into a 256x128 buffer, build the pyramid and test the
+ * objects that survive frustum culling, and how many of those objects the
+ * occlusion culling gets rid of. The batched test has to agree with
+ * testing one box at a time.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include <math/math.h>
+
+#include "cull.h"
+#include "occlusion.h"
+
+#define ARRAY_SIZE(x) ((sizeof(x)/sizeof(0[x])) / ((size_t)(!(sizeof(x) % sizeof(0[x])))))
+
+#define WIDTH  256
+#define HEIGHT 128
+
+/* buildings on a grid of streets */
+#define BLOCKS 16
+#define BLOCK  12.0f
+#define STREET 4.0f
+
+#define ITERATIONS 64
+
+/* the unit cube, counter-clockwise from the outside */
+static const float gCube[] = {
+    0.0f, 0.0f, 0.0f,   1.0f, 0.0f, 0.0f,   0.0f, 1.0f, 0.0f,   1.0f, 1.0f, 0.0f,
+    0.0f, 0.0f, 1.0f,   1.0f, 0.0f, 1.0f,   0.0f, 1.0f, 1.0f,   1.0f, 1.0f, 1.0f
+};
+
+static const uint32_t gCubeIndices[] = {
+    0, 4, 6, 0, 6, 2,   1, 3, 7, 1, 7, 5,
+    0, 1, 5, 0, 5, 4,   2, 6, 7, 2, 7, 3,
+    0, 2, 3, 0, 3, 1,   4, 5, 7, 4, 7, 6
+};
+
+static uint64_t xorshift(uint64_t *state) {
+    uint64_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    return *state = x;
+}
+
+static float randf(uint64_t *state, float lo, float hi) {
+    return lo + (hi - lo) * (float) (xorshift(state) >> 40) / (float) (1 << 24);
+}
+
+static double elapsedMs(struct timeval *t1, struct timeval *t2) {
+    double elapsedTime = (t2->tv_sec - t1->tv_sec) * 1000.0; /* sec to ms */
+    elapsedTime += (t2->tv_usec - t1->tv_usec) / 1000.0;     /* us to ms */
+    return elapsedTime;
+}
+
+static size_t countBits(const uint32_t *mask, size_t words) {
+    size_t count = 0;
+    for (size_t w = 0; w < words; ++w) count += (size_t) __builtin_popcount(mask[w]);
+    return count;
+}
+
+int main(int argc, char* argv[]) {
+    struct timeval t1, t2;
+
+    const size_t counts[] = { 10000, 100000, 1000000 };
+    const float extent = BLOCKS * (BLOCK + STREET);
+
+    uint64_t state = 0x9E3779B97F4A7C15ULL;
+
+    /* the buildings, the city starts a bit in front of the camera */
+    static mat4 buildings[BLOCKS * BLOCKS];
+
+    for (int bz = 0; bz < BLOCKS; ++bz) {
+        for (int bx = 0; bx < BLOCKS; ++bx) {
+            const float x = -extent * 0.5f + (float) bx * (BLOCK + STREET) + STREET * 0.5f;
+            const float z = -10.0f - (float) (bz + 1) * (BLOCK + STREET);
+            const float height = randf(&state, 6.0f, 30.0f);
+
+            buildings[bz * BLOCKS + bx] = mmmul(mtranslate(vec(x, 0.0f, z, 0.0f)),
+                                                mscale(vec(BLOCK, height, BLOCK, 1.0f)));
+        }
+    }
+
+    /* standing in the street, looking down it */
+    const mat4 view = mtranslate(vec(-STREET * 0.25f, -1.8f, 0.0f, 0.0f));
+    const mat4 proj = mat_perspective_fovy(3.14159265f / 3.0f, (float) WIDTH / (float) HEIGHT, 0.1f, 1000.0f);
+
+    static mat4 viewproj;
+    viewproj = mmmul(proj, view);
+
+    static frustum fru;
+    frustum_from_mat(&fru, viewproj);
+
+    struct gfxOcclusion *oc = gfxOcclusionCreate(WIDTH, HEIGHT);
+
+    double setupMs = 0.0, rasterMs = 0.0, finishMs = 0.0;
+
+    for (int it = 0; it < ITERATIONS; ++it) {
+        gettimeofday(&t1, NULL);
+        gfxOcclusionBegin(oc, &viewproj);
+        for (int b = 0; b < BLOCKS * BLOCKS; ++b) {
+            gfxOcclusionAddOccluder(oc, &buildings[b], gCube, 3 * sizeof(float), 8, gCubeIndices, ARRAY_SIZE(gCubeIndices));
+        }
+        gettimeofday(&t2, NULL);
+        setupMs += elapsedMs(&t1, &t2);
+
+        gettimeofday(&t1, NULL);
+        gfxOcclusionRasterize(oc);
+        gettimeofday(&t2, NULL);
+        rasterMs += elapsedMs(&t1, &t2);
+
+        gettimeofday(&t1, NULL);
+        gfxOcclusionFinish(oc);
+        gettimeofday(&t2, NULL);
+        finishMs += elapsedMs(&t1, &t2);
+    }
+
+    printf("%d buildings (%d triangles) into %dx%d, %d tiles\n", BLOCKS * BLOCKS,
+        BLOCKS * BLOCKS * (int) ARRAY_SIZE(gCubeIndices) / 3, WIDTH, HEIGHT, gfxOcclusionNumTiles(oc));
+    printf("    setup %7.3f ms, rasterize %7.3f ms, pyramid %7.3f ms\n",
+        setupMs / ITERATIONS, rasterMs / ITERATIONS, finishMs / ITERATIONS);
+
+    for (int c = 0; c < (int) ARRAY_SIZE(counts); ++c) {
+        const size_t count = counts[c];
+        const size_t words = GFX_CULL_WORDS(count);
+
+        struct gfxBoxes boxes;
+        gfxBoxesInit(&boxes, count);
+
+        /* everywhere, also inside of the buildings */
+        for (size_t i = 0; i < count; ++i) {
+            const float x = randf(&state, -extent * 0.5f, extent * 0.5f);
+            const float z = randf(&state, -10.0f - extent, -10.0f);
+            const float e = randf(&state, 0.2f, 1.0f);
+
+            const aabb box = { vec(x - e, 0.0f, z - e, 1.0f), vec(x + e, 2.0f * e, z + e, 1.0f) };
+            gfxBoxesAdd(&boxes, &box);
+        }
+
+        uint32_t *visible = malloc(words * sizeof(uint32_t));
+        uint32_t *batch = malloc(words * sizeof(uint32_t));
+
+        gfxCullBoxes(&boxes, &fru, visible);
+        const size_t inFrustum = countBits(visible, words);
+
+        const size_t iterations = (size_t) (10000000 / count);
+
+        gettimeofday(&t1, NULL);
+        for (size_t it = 0; it < iterations; ++it) {
+            memcpy(batch, visible, words * sizeof(uint32_t));
+            gfxOcclusionCullBoxes(oc, &boxes, batch);
+        }
+        gettimeofday(&t2, NULL);
+
+        const double testMs = elapsedMs(&t1, &t2) / (double) iterations;
+        const size_t survivors = countBits(batch, words);
+
+        size_t mismatches = 0;
+        for (size_t i = 0; i < count; ++i) {
+            if (!((visible[i >> 5] >> (i & 31)) & 1)) continue;
+
+            const aabb box = {
+                vec(boxes.minX[i], boxes.minY[i], boxes.minZ[i], 1.0f),
+                vec(boxes.maxX[i], boxes.maxY[i], boxes.maxZ[i], 1.0f)
+            };
+            mismatches += (size_t) (gfxOcclusionTestBox(oc, &box) != (int) ((batch[i >> 5] >> (i & 31)) & 1));
+        }
+
+        printf("%7zu objects: %6zu in the frustum, %6zu not occluded (%4.1f%%), %7.3f ms, %5.1f Mboxes/s, %zu mismatches\n",
+            count, inFrustum, survivors, 100.0 * (double) survivors / (double) inFrustum,
+            testMs, (double) inFrustum / testMs / 1000.0, mismatches);
+
+        if (mismatches) {
+            printf("BROKEN: gfxOcclusionCullBoxes and gfxOcclusionTestBox disagree\n");
+            return 1;
+        }
+
+        free(visible);
+        free(batch);
+        gfxBoxesDestroy(&boxes);
+    }
+
+    gfxOcclusionDestroy(oc);
+
+    return 0;
+}
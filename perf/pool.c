@@ -0,0 +1,173 @@
+/**
+ * This file is part of prototype.
+ *
+ * (c) 2014 Nicolas Hillegeer <nicolas@hillegeer.com>
+ *
+ * For the full copyright and license information, please view the LICENSE
+ * file that was distributed with the source code.
+ *
+ * Churns objects the size of a gfxRenderParams: every step picks a random
+ * slot out of a few thousand, frees the object in it or allocates a new
+ * one, so about half of them are alive at any time. Compares zmalloc with
+ * a pool, with and without a cache in front of it, on one thread and on a
+ * few threads at once (which all allocate from the same pool).
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+#include <sys/time.h>
+
+#include "pool.h"
+#include "zmalloc.h"
+
+#define ARRAY_SIZE(x) ((sizeof(x)/sizeof(0[x])) / ((size_t)(!(sizeof(x) % sizeof(0[x])))))
+
+#define NUM_SLOTS   4096
+#define NUM_OPS     4000000
+#define NUM_THREADS 4
+
+struct object {
+    _Alignas(16) float matrix[16];
+    unsigned int id;
+    unsigned char blend;
+    unsigned char cull;
+};
+
+enum allocator {
+    ZMALLOC,
+    POOL,
+    POOL_CACHE
+};
+
+static const char *gNames[] = { "zmalloc", "pool", "pool + cache" };
+
+struct worker {
+    pthread_t thread;
+    enum allocator allocator;
+    struct wfPool *pool;
+    uint64_t seed;
+    size_t ops;
+    size_t live;
+};
+
+static uint64_t xorshift(uint64_t *state) {
+    uint64_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    return *state = x;
+}
+
+static double elapsedMs(struct timeval *t1, struct timeval *t2) {
+    double elapsedTime = (t2->tv_sec - t1->tv_sec) * 1000.0; /* sec to ms */
+    elapsedTime += (t2->tv_usec - t1->tv_usec) / 1000.0;     /* us to ms */
+    return elapsedTime;
+}
+
+static void *churn(void *arg) {
+    struct worker *w = arg;
+    struct object **slots = calloc(NUM_SLOTS, sizeof(struct object *));
+    uint64_t state = w->seed;
+
+    struct wfPoolCache cache;
+    wfPoolCacheInit(&cache, w->pool);
+
+    for (size_t op = 0; op < w->ops; ++op) {
+        struct object **slot = &slots[xorshift(&state) % NUM_SLOTS];
+
+        if (*slot) {
+            switch (w->allocator) {
+                case ZMALLOC:    zfree(*slot); break;
+                case POOL:       wfPoolFree(w->pool, *slot); break;
+                case POOL_CACHE: wfPoolCacheFree(&cache, *slot); break;
+            }
+            *slot = NULL;
+        } else {
+            switch (w->allocator) {
+                case ZMALLOC:    *slot = zmalloc(sizeof(struct object)); break;
+                case POOL:       *slot = wfPoolAlloc(w->pool); break;
+                case POOL_CACHE: *slot = wfPoolCacheAlloc(&cache); break;
+            }
+            (*slot)->id = (unsigned int) op;
+        }
+    }
+
+    w->live = 0;
+    for (size_t i = 0; i < NUM_SLOTS; ++i) {
+        if (!slots[i]) continue;
+
+        ++w->live;
+        switch (w->allocator) {
+            case ZMALLOC:    zfree(slots[i]); break;
+            case POOL:       wfPoolFree(w->pool, slots[i]); break;
+            case POOL_CACHE: wfPoolCacheFree(&cache, slots[i]); break;
+        }
+    }
+
+    wfPoolCacheFlush(&cache);
+    free(slots);
+
+    return NULL;
+}
+
+static double run(enum allocator allocator, int threads) {
+    struct timeval t1, t2;
+    struct worker workers[NUM_THREADS];
+
+    struct wfPool pool;
+    wfPoolCreate(&pool, sizeof(struct object), _Alignof(struct object), WF_MEM_GFX);
+    pool.poison = 0;
+
+    gettimeofday(&t1, NULL);
+    for (int t = 0; t < threads; ++t) {
+        workers[t].allocator = allocator;
+        workers[t].pool = &pool;
+        workers[t].seed = 0x9E3779B97F4A7C15ULL * (uint64_t) (t + 1);
+        workers[t].ops = NUM_OPS / (size_t) threads;
+        pthread_create(&workers[t].thread, NULL, churn, &workers[t]);
+    }
+
+    for (int t = 0; t < threads; ++t) {
+        pthread_join(workers[t].thread, NULL);
+    }
+    gettimeofday(&t2, NULL);
+
+    if (pool.live != 0) {
+        printf("BROKEN: %zu objects are still live in the pool\n", pool.live);
+        exit(1);
+    }
+
+    wfPoolDestroy(&pool);
+
+    return elapsedMs(&t1, &t2);
+}
+
+int main(int argc, char* argv[]) {
+    zmalloc_enable_thread_safeness();
+
+    const int threads[] = { 1, NUM_THREADS };
+
+    printf("%d allocations and frees of %zu bytes over %d slots\n",
+        NUM_OPS, sizeof(struct object), NUM_SLOTS);
+
+    for (int t = 0; t < (int) ARRAY_SIZE(threads); ++t) {
+        const double base = run(ZMALLOC, threads[t]);
+
+        for (int a = ZMALLOC; a <= POOL_CACHE; ++a) {
+            const double ms = (a == ZMALLOC) ? base : run((enum allocator) a, threads[t]);
+
+            printf("%d thread(s), %-12s %8.2f ms, %6.1f ns per operation, %5.2fx\n",
+                threads[t], gNames[a], ms, ms * 1e6 / NUM_OPS, base / ms);
+        }
+    }
+
+    if (zmalloc_used_memory() != 0) {
+        printf("BROKEN: %zu bytes are still allocated\n", zmalloc_used_memory());
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,126 @@
+/**
+ * This file is part of prototype.
+ *
+ * (c) 2014 Nicolas Hillegeer <nicolas@hillegeer.com>
+ *
+ * For the full copyright and license information, please view the LICENSE
+ * file that was distributed with the source code.
+ *
+ * Compares the radix sort used by the drawlist against the qsort() it
+ * replaced, on entries that look like drawlist entries (16 bytes, 64-bit
+ * key first).
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include "radix_sort.h"
+
+#define ARRAY_SIZE(x) ((sizeof(x)/sizeof(0[x])) / ((size_t)(!(sizeof(x) % sizeof(0[x])))))
+
+/* same layout as the drawlist entries */
+struct entry {
+    uint64_t key;
+    void *op;
+};
+
+static int compare(const void *p1, const void *p2) {
+    uint64_t a = ((const struct entry *)p1)->key;
+    uint64_t b = ((const struct entry *)p2)->key;
+
+    return (a < b) ? -1 : (a > b) ? 1 : 0;
+}
+
+static uint64_t xorshift(uint64_t *state) {
+    uint64_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    return *state = x;
+}
+
+/* generate keys that look like what a real scene produces: only a few
+ * layers, most objects in viewport 0, and a limited number of distinct
+ * shaders/textures/models. The depth bits are fully random. */
+static void fillEntries(struct entry *entries, size_t n, uint64_t seed) {
+    uint64_t state = seed;
+
+    for (size_t i = 0; i < n; ++i) {
+        uint64_t r = xorshift(&state);
+
+        uint64_t layer    = r % 3;
+        uint64_t shader   = (r >> 8) % 8;
+        uint64_t texture  = (r >> 16) % 16;
+        uint64_t model    = (r >> 24) % 32;
+        uint64_t depth    = (r >> 32) & 0xFFFF;
+        uint64_t material = (r >> 48) % 4;
+
+        entries[i].key = (layer << 61) | (shader << 46) | (texture << 38) |
+            (model << 24) | (depth << 8) | material;
+        entries[i].op = (void *)(uintptr_t)i;
+    }
+}
+
+static double elapsedMs(struct timeval *t1, struct timeval *t2) {
+    double elapsedTime = (t2->tv_sec - t1->tv_sec) * 1000.0; /* sec to ms */
+    elapsedTime += (t2->tv_usec - t1->tv_usec) / 1000.0;     /* us to ms */
+    return elapsedTime;
+}
+
+int main(int argc, char* argv[]) {
+    struct timeval t1, t2;
+
+    const size_t sizes[] = { 1024, 8192, 65536 };
+    const int iterations = 200;
+
+    printf("sorting drawlist-like entries, %d iterations per size\n", iterations);
+
+    for (int s = 0; s < (int)ARRAY_SIZE(sizes); ++s) {
+        const size_t n = sizes[s];
+
+        struct entry *original = malloc(n * sizeof(struct entry));
+        struct entry *a        = malloc(n * sizeof(struct entry));
+        struct entry *b        = malloc(n * sizeof(struct entry));
+        struct entry *scratch  = malloc(n * sizeof(struct entry));
+
+        fillEntries(original, n, 0x9E3779B97F4A7C15ULL + n);
+
+        double qsortMs = 0.0;
+        double radixMs = 0.0;
+
+        for (int i = 0; i < iterations; ++i) {
+            memcpy(a, original, n * sizeof(struct entry));
+            gettimeofday(&t1, NULL);
+            qsort(a, n, sizeof(struct entry), compare);
+            gettimeofday(&t2, NULL);
+            qsortMs += elapsedMs(&t1, &t2);
+
+            memcpy(b, original, n * sizeof(struct entry));
+            gettimeofday(&t1, NULL);
+            radix_sort_u64(b, scratch, n, sizeof(struct entry));
+            gettimeofday(&t2, NULL);
+            radixMs += elapsedMs(&t1, &t2);
+        }
+
+        /* qsort isn't stable, so only compare the keys */
+        for (size_t i = 0; i < n; ++i) {
+            if (a[i].key != b[i].key) {
+                printf("MISMATCH at %zu for n = %zu\n", i, n);
+                return 1;
+            }
+        }
+
+        printf("%6zu entries: %8.3f ms (qsort) %8.3f ms (radix) per sort, %5.1fx\n",
+            n, qsortMs / iterations, radixMs / iterations, qsortMs / radixMs);
+
+        free(original);
+        free(a);
+        free(b);
+        free(scratch);
+    }
+
+    return 0;
+}
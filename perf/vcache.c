@@ -0,0 +1,159 @@
+/**
+ * This file is part of prototype.
+ *
+ * (c) 2014 Nicolas Hillegeer <nicolas@hillegeer.com>
+ *
+ * For the full copyright and license information, please view the LICENSE
+ * file that was distributed with the source code.
+ *
+ * Measures how fast the vertex cache optimizer gets through a mesh (in
+ * triangles per second) and what it does to the ACMR/ATVR. The meshes are
+ * grids like gfxSheet() generates, once in generation order and once with
+ * the triangles shuffled, which is about as bad as a mesh can get.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include "vcache.h"
+
+#define ARRAY_SIZE(x) ((sizeof(x)/sizeof(0[x])) / ((size_t)(!(sizeof(x) % sizeof(0[x])))))
+
+/* gfxSheet() doesn't need more, and neither do we */
+struct vertex {
+    float position[4];
+};
+
+static uint64_t xorshift(uint64_t *state) {
+    uint64_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    return *state = x;
+}
+
+/* same layout as gfxSheet() */
+static void fillGrid(struct vertex *vertices, uint32_t *indices, unsigned int subdiv) {
+    const uint32_t stride = subdiv + 1;
+
+    for (uint32_t i = 0; i < stride; ++i) {
+        for (uint32_t j = 0; j < stride; ++j) {
+            struct vertex *v = &vertices[i * stride + j];
+            v->position[0] = (float) i;
+            v->position[1] = 0.0f;
+            v->position[2] = (float) j;
+            v->position[3] = 1.0f;
+        }
+    }
+
+    for (uint32_t i = 0; i < subdiv; ++i) {
+        for (uint32_t j = 0; j < subdiv; ++j) {
+            const uint32_t offset = i * stride + j;
+
+            *indices++ = offset;
+            *indices++ = offset + 1;
+            *indices++ = offset + stride;
+
+            *indices++ = offset + 1;
+            *indices++ = offset + stride + 1;
+            *indices++ = offset + stride;
+        }
+    }
+}
+
+static void shuffleTriangles(uint32_t *indices, size_t numTriangles, uint64_t seed) {
+    uint64_t state = seed;
+
+    for (size_t i = numTriangles - 1; i > 0; --i) {
+        const size_t j = (size_t) (xorshift(&state) % (i + 1));
+
+        uint32_t tmp[3];
+        memcpy(tmp, &indices[i * 3], sizeof(tmp));
+        memcpy(&indices[i * 3], &indices[j * 3], sizeof(tmp));
+        memcpy(&indices[j * 3], tmp, sizeof(tmp));
+    }
+}
+
+static double elapsedMs(struct timeval *t1, struct timeval *t2) {
+    double elapsedTime = (t2->tv_sec - t1->tv_sec) * 1000.0; /* sec to ms */
+    elapsedTime += (t2->tv_usec - t1->tv_usec) / 1000.0;     /* us to ms */
+    return elapsedTime;
+}
+
+int main(int argc, char* argv[]) {
+    struct timeval t1, t2;
+
+    const unsigned int subdivs[] = { 16, 64, 256 };
+    const int iterations = 10;
+
+    printf("optimizing grids, %d iterations per size, ACMR/ATVR for a FIFO of %d\n",
+        iterations, GFX_VCACHE_SIZE);
+
+    for (int s = 0; s < (int) ARRAY_SIZE(subdivs); ++s) {
+        const unsigned int subdiv = subdivs[s];
+        const size_t numVertices = (size_t) (subdiv + 1) * (subdiv + 1);
+        const size_t numTriangles = (size_t) subdiv * subdiv * 2;
+        const size_t numIndices = numTriangles * 3;
+
+        struct vertex *originalVertices = malloc(numVertices * sizeof(struct vertex));
+        struct vertex *vertices = malloc(numVertices * sizeof(struct vertex));
+        uint32_t *originalIndices = malloc(numIndices * sizeof(uint32_t));
+        uint32_t *indices = malloc(numIndices * sizeof(uint32_t));
+
+        for (int shuffled = 0; shuffled < 2; ++shuffled) {
+            fillGrid(originalVertices, originalIndices, subdiv);
+            if (shuffled) shuffleTriangles(originalIndices, numTriangles, 0x9E3779B97F4A7C15ULL + subdiv);
+
+            struct gfxVertexCacheStats before, after;
+            gfxVertexCacheStats(&before, originalIndices, numIndices, numVertices, GFX_VCACHE_SIZE);
+
+            double triangleMs = 0.0;
+            double vertexMs = 0.0;
+
+            for (int i = 0; i < iterations; ++i) {
+                memcpy(vertices, originalVertices, numVertices * sizeof(struct vertex));
+                memcpy(indices, originalIndices, numIndices * sizeof(uint32_t));
+
+                gettimeofday(&t1, NULL);
+                gfxOptimizeTriangles(indices, numIndices, numVertices);
+                gettimeofday(&t2, NULL);
+                triangleMs += elapsedMs(&t1, &t2);
+
+                gettimeofday(&t1, NULL);
+                gfxOptimizeVertexFetch(vertices, sizeof(struct vertex), numVertices, indices, numIndices);
+                gettimeofday(&t2, NULL);
+                vertexMs += elapsedMs(&t1, &t2);
+            }
+
+            gfxVertexCacheStats(&after, indices, numIndices, numVertices, GFX_VCACHE_SIZE);
+
+            /* every triangle has to survive, with the same positions */
+            for (size_t t = 0; t < numTriangles; ++t) {
+                const struct vertex *v = &vertices[indices[t * 3]];
+
+                if (v->position[3] != 1.0f || v->position[1] != 0.0f) {
+                    printf("BROKEN triangle %zu for subdiv = %u\n", t, subdiv);
+                    return 1;
+                }
+            }
+
+            const double triangleSec = triangleMs / iterations / 1000.0;
+
+            printf("%7zu triangles (%s): %8.3f ms triangles + %6.3f ms vertices, %6.2f Mtris/s, "
+                "ACMR %.3f -> %.3f, ATVR %.3f -> %.3f\n",
+                numTriangles, shuffled ? "shuffled" : "in order",
+                triangleMs / iterations, vertexMs / iterations, (double) numTriangles / triangleSec / 1e6,
+                before.acmr, after.acmr, before.atvr, after.atvr);
+        }
+
+        free(originalVertices);
+        free(vertices);
+        free(originalIndices);
+        free(indices);
+    }
+
+    return 0;
+}
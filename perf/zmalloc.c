@@ -0,0 +1,191 @@
+/**
+ * This file is part of prototype.
+ *
+ * (c) 2014 Nicolas Hillegeer <nicolas@hillegeer.com>
+ *
+ * For the full copyright and license information, please view the LICENSE
+ * file that was distributed with the source code.
+ *
+ * Allocates and frees blocks of random sizes from a bunch of threads at
+ * once: plain malloc, malloc with one global counter that every thread
+ * updates atomically (the way zmalloc used to count) and zmalloc with its
+ * per-thread counters. The difference between the last two is what the
+ * accounting costs, and how it grows with the threads.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+#include <sys/time.h>
+
+#include "zmalloc.h"
+
+#define ARRAY_SIZE(x) ((sizeof(x)/sizeof(0[x])) / ((size_t)(!(sizeof(x) % sizeof(0[x])))))
+
+#define NUM_SLOTS       1024
+#define NUM_OPS         4000000
+#define MAX_THREADS     8
+#define MAX_SIZE        512
+
+enum allocator {
+    MALLOC,
+    MALLOC_ATOMIC,
+    ZMALLOC
+};
+
+static const char *gNames[] = { "malloc", "malloc + atomic", "zmalloc" };
+
+static size_t gUsed;
+
+struct worker {
+    pthread_t thread;
+    enum allocator allocator;
+    uint64_t seed;
+    size_t ops;
+    size_t allocs;
+    zmalloc_stats stats;
+};
+
+static uint64_t xorshift(uint64_t *state) {
+    uint64_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    return *state = x;
+}
+
+static double elapsedMs(struct timeval *t1, struct timeval *t2) {
+    double elapsedTime = (t2->tv_sec - t1->tv_sec) * 1000.0; /* sec to ms */
+    elapsedTime += (t2->tv_usec - t1->tv_usec) / 1000.0;     /* us to ms */
+    return elapsedTime;
+}
+
+/* the old accounting: the size goes in front of the block, the counter
+ * is shared by all threads */
+static void *atomicMalloc(size_t size) {
+    size_t *ptr = malloc(size + sizeof(size_t));
+    *ptr = size;
+    __atomic_add_fetch(&gUsed, size, __ATOMIC_SEQ_CST);
+    return ptr + 1;
+}
+
+static void atomicFree(void *ptr) {
+    size_t *real = (size_t *) ptr - 1;
+    __atomic_sub_fetch(&gUsed, *real, __ATOMIC_SEQ_CST);
+    free(real);
+}
+
+static void *churn(void *arg) {
+    struct worker *w = arg;
+    void **slots = calloc(NUM_SLOTS, sizeof(void *));
+    uint64_t state = w->seed;
+
+    w->allocs = 0;
+
+    for (size_t op = 0; op < w->ops; ++op) {
+        const uint64_t r = xorshift(&state);
+        void **slot = &slots[r % NUM_SLOTS];
+
+        if (*slot) {
+            switch (w->allocator) {
+                case MALLOC:        free(*slot); break;
+                case MALLOC_ATOMIC: atomicFree(*slot); break;
+                case ZMALLOC:       zfree(*slot); break;
+            }
+            *slot = NULL;
+        } else {
+            const size_t size = 1 + (size_t) ((r >> 32) % MAX_SIZE);
+            switch (w->allocator) {
+                case MALLOC:        *slot = malloc(size); break;
+                case MALLOC_ATOMIC: *slot = atomicMalloc(size); break;
+                case ZMALLOC:       *slot = zmalloc(size); break;
+            }
+            *(char *) *slot = (char) op;
+            ++w->allocs;
+        }
+    }
+
+    for (size_t i = 0; i < NUM_SLOTS; ++i) {
+        if (!slots[i]) continue;
+
+        switch (w->allocator) {
+            case MALLOC:        free(slots[i]); break;
+            case MALLOC_ATOMIC: atomicFree(slots[i]); break;
+            case ZMALLOC:       zfree(slots[i]); break;
+        }
+    }
+
+    free(slots);
+
+    /* what this thread did, before its counters get retired */
+    zmalloc_get_thread_stats(&w->stats);
+
+    return NULL;
+}
+
+static double run(enum allocator allocator, int threads, struct worker *workers) {
+    struct timeval t1, t2;
+
+    gettimeofday(&t1, NULL);
+    for (int t = 0; t < threads; ++t) {
+        workers[t].allocator = allocator;
+        workers[t].seed = 0x9E3779B97F4A7C15ULL * (uint64_t) (t + 1);
+        workers[t].ops = NUM_OPS / (size_t) threads;
+        pthread_create(&workers[t].thread, NULL, churn, &workers[t]);
+    }
+
+    for (int t = 0; t < threads; ++t) {
+        pthread_join(workers[t].thread, NULL);
+    }
+    gettimeofday(&t2, NULL);
+
+    return elapsedMs(&t1, &t2);
+}
+
+int main(int argc, char* argv[]) {
+    zmalloc_enable_thread_safeness();
+
+    const int threads[] = { 1, 2, 4, MAX_THREADS };
+    struct worker workers[MAX_THREADS];
+
+    printf("%d allocations and frees of 1 to %d bytes over %d slots per thread\n",
+        NUM_OPS, MAX_SIZE, NUM_SLOTS);
+
+    for (int t = 0; t < (int) ARRAY_SIZE(threads); ++t) {
+        const double base = run(MALLOC, threads[t], workers);
+
+        for (int a = MALLOC; a <= ZMALLOC; ++a) {
+            const double ms = (a == MALLOC) ? base : run((enum allocator) a, threads[t], workers);
+
+            printf("%d thread(s), %-16s %8.2f ms, %6.1f ns per operation, %5.2fx\n",
+                threads[t], gNames[a], ms, ms * 1e6 / NUM_OPS, base / ms);
+        }
+
+        /* the last run was zmalloc, every thread should have counted its
+         * own allocations, and only those */
+        for (int w = 0; w < threads[t]; ++w) {
+            const zmalloc_stats *stats = &workers[w].stats;
+
+            size_t histogram = 0;
+            for (int i = 0; i < ZMALLOC_HISTOGRAM_BUCKETS; ++i) histogram += stats->histogram[i];
+
+            if (stats->allocs != workers[w].allocs || stats->frees != workers[w].allocs ||
+                histogram != workers[w].allocs || stats->used != 0) {
+                printf("BROKEN: thread %d counted %zu allocations and %zu frees instead of %zu\n",
+                    w, stats->allocs, stats->frees, workers[w].allocs);
+                return 1;
+            }
+        }
+
+        printf("%d thread(s), peak of the first thread: %zu bytes\n", threads[t], workers[0].stats.peak);
+    }
+
+    if (zmalloc_used_memory() != 0 || gUsed != 0) {
+        printf("BROKEN: %zu bytes are still allocated\n", zmalloc_used_memory());
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,265 @@
+/**
+ * This file is part of prototype.
+ *
+ * (c) 2014 Nicolas Hillegeer <nicolas@hillegeer.com>
+ *
+ * For the full copyright and license information, please view the LICENSE
+ * file that was distributed with the source code.
+ *
+ * Arenas and memory tags (see arena.h). The blocks of an arena form a
+ * singly linked list, from the first block the arena ever allocated to the
+ * last. Allocating bumps the offset into the current block, and when that
+ * runs out it moves on to the next block in the list, which is still there
+ * from an earlier frame, or allocates a new one. Resetting and rewinding
+ * only move the current block and the offset back, the blocks after it
+ * stay in the list until the arena gets trimmed or destroyed.
+ *
+ * The tags are plain counters, updated with relaxed atomics because they
+ * are only statistics. They change when an arena gets a new block, not on
+ * every arena allocation.
+ *
+ * Memory tracking, per-frame and linear allocators:
+ * http://www.swedishcoding.com/2008/08/31/are-we-out-of-memory/
+ *
+ * Doesn't touch GL.
+ */
+
+#include <assert.h>
+#include <string.h>
+
+#include "arena.h"
+#include "zmalloc.h"
+
+/* the header of a block, the memory it hands out comes right after it */
+struct wfArenaBlock {
+  struct wfArenaBlock *next;
+  size_t size;
+};
+
+/* every tag on its own cache line, so threads that allocate under
+ * different tags don't fight over it */
+struct tag {
+  size_t used;
+  size_t peak;
+  size_t allocs;
+  char padding[64 - 3 * sizeof(size_t)];
+};
+
+static struct tag gTags[WF_MEM_TAGS];
+
+static const char *gTagNames[WF_MEM_TAGS] = {
+  [WF_MEM_FRAME] = "frame",
+  [WF_MEM_SCRATCH] = "scratch",
+  [WF_MEM_DRAWLIST] = "drawlist",
+  [WF_MEM_GFX] = "gfx",
+  [WF_MEM_SCRIPT] = "script"
+};
+
+static struct wfArena gFrame = { .blockSize = 256 * 1024, .tag = WF_MEM_FRAME };
+static struct wfArena gScratch = { .blockSize = 1024 * 1024, .tag = WF_MEM_SCRATCH };
+
+static char *blockData(struct wfArenaBlock *block) {
+  return (char *)(block + 1);
+}
+
+/* the offset in the block where an aligned allocation would start */
+static size_t alignedOffset(struct wfArenaBlock *block, size_t offset, size_t align) {
+  const uintptr_t start = (uintptr_t)blockData(block) + offset;
+  const uintptr_t aligned = (start + align - 1) & ~(uintptr_t)(align - 1);
+  return offset + (size_t)(aligned - start);
+}
+
+static void updatePeak(size_t *peak, size_t value) {
+  size_t current = __atomic_load_n(peak, __ATOMIC_RELAXED);
+  while (value > current &&
+         !__atomic_compare_exchange_n(peak, &current, value, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+  }
+}
+
+void wfMemTagAlloc(enum wfMemTag tag, size_t size) {
+  assert(tag < WF_MEM_TAGS);
+
+  struct tag *t = &gTags[tag];
+  const size_t used = __atomic_add_fetch(&t->used, size, __ATOMIC_RELAXED);
+  __atomic_add_fetch(&t->allocs, 1, __ATOMIC_RELAXED);
+  updatePeak(&t->peak, used);
+}
+
+void wfMemTagFree(enum wfMemTag tag, size_t size) {
+  assert(tag < WF_MEM_TAGS);
+  __atomic_sub_fetch(&gTags[tag].used, size, __ATOMIC_RELAXED);
+}
+
+void wfMemTagGetStats(enum wfMemTag tag, struct wfMemTagStats *stats) {
+  assert(tag < WF_MEM_TAGS);
+
+  const struct tag *t = &gTags[tag];
+  stats->used = __atomic_load_n(&t->used, __ATOMIC_RELAXED);
+  stats->peak = __atomic_load_n(&t->peak, __ATOMIC_RELAXED);
+  stats->allocs = __atomic_load_n(&t->allocs, __ATOMIC_RELAXED);
+}
+
+const char *wfMemTagName(enum wfMemTag tag) {
+  return (tag < WF_MEM_TAGS) ? gTagNames[tag] : "unknown";
+}
+
+void *wfTagMalloc(enum wfMemTag tag, size_t size) {
+  void *ptr = zmalloc(size);
+  wfMemTagAlloc(tag, zmalloc_size(ptr));
+  return ptr;
+}
+
+void *wfTagCalloc(enum wfMemTag tag, size_t size) {
+  void *ptr = zcalloc(size);
+  wfMemTagAlloc(tag, zmalloc_size(ptr));
+  return ptr;
+}
+
+void *wfTagRealloc(enum wfMemTag tag, void *ptr, size_t size) {
+  if (ptr) wfMemTagFree(tag, zmalloc_size(ptr));
+
+  ptr = zrealloc(ptr, size);
+  wfMemTagAlloc(tag, zmalloc_size(ptr));
+  return ptr;
+}
+
+void wfTagFree(enum wfMemTag tag, void *ptr) {
+  if (!ptr) return;
+
+  wfMemTagFree(tag, zmalloc_size(ptr));
+  zfree(ptr);
+}
+
+void wfArenaCreate(struct wfArena *arena, size_t blockSize, enum wfMemTag tag) {
+  memset(arena, 0x0, sizeof(struct wfArena));
+  arena->blockSize = blockSize;
+  arena->tag = tag;
+}
+
+static void freeBlocks(struct wfArena *arena, struct wfArenaBlock *block) {
+  while (block) {
+    struct wfArenaBlock *next = block->next;
+    const size_t size = sizeof(struct wfArenaBlock) + block->size;
+
+    wfMemTagFree(arena->tag, size);
+    arena->reserved -= size;
+    zfree(block);
+
+    block = next;
+  }
+}
+
+void wfArenaDestroy(struct wfArena *arena) {
+  freeBlocks(arena, arena->first);
+
+  const size_t blockSize = arena->blockSize;
+  const enum wfMemTag tag = arena->tag;
+  wfArenaCreate(arena, blockSize, tag);
+}
+
+/* the current block is full: move on to the next block if the allocation
+ * fits in there, otherwise put a new block in front of it */
+static void *allocSlow(struct wfArena *arena, size_t size, size_t align) {
+  struct wfArenaBlock **link = arena->current ? &arena->current->next : &arena->first;
+  struct wfArenaBlock *block = *link;
+
+  if (!block || alignedOffset(block, 0, align) + size > block->size) {
+    const size_t blockSize = arena->blockSize ? arena->blockSize : WF_ARENA_BLOCK;
+    const size_t capacity = (size + align > blockSize) ? size + align : blockSize;
+
+    block = zmalloc(sizeof(struct wfArenaBlock) + capacity);
+    block->size = capacity;
+    block->next = *link;
+    *link = block;
+
+    wfMemTagAlloc(arena->tag, sizeof(struct wfArenaBlock) + capacity);
+    arena->reserved += sizeof(struct wfArenaBlock) + capacity;
+  }
+
+  const size_t start = alignedOffset(block, 0, align);
+
+  arena->current = block;
+  arena->offset = start + size;
+  arena->used += start + size;
+  if (arena->used > arena->peak) arena->peak = arena->used;
+
+  return blockData(block) + start;
+}
+
+void *wfArenaAllocAligned(struct wfArena *arena, size_t size, size_t align) {
+  assert(align != 0 && (align & (align - 1)) == 0);
+
+  struct wfArenaBlock *block = arena->current;
+  if (block) {
+    const size_t start = alignedOffset(block, arena->offset, align);
+
+    if (start + size <= block->size) {
+      arena->used += start + size - arena->offset;
+      arena->offset = start + size;
+      if (arena->used > arena->peak) arena->peak = arena->used;
+
+      return blockData(block) + start;
+    }
+  }
+
+  return allocSlow(arena, size, align);
+}
+
+void *wfArenaAlloc(struct wfArena *arena, size_t size) {
+  return wfArenaAllocAligned(arena, size, WF_ARENA_ALIGN);
+}
+
+void *wfArenaCalloc(struct wfArena *arena, size_t size) {
+  return memset(wfArenaAlloc(arena, size), 0x0, size);
+}
+
+void wfArenaMark(const struct wfArena *arena, struct wfArenaMarker *marker) {
+  marker->block = arena->current;
+  marker->offset = arena->offset;
+  marker->used = arena->used;
+}
+
+/* everything allocated after the marker was taken is gone */
+void wfArenaRewind(struct wfArena *arena, const struct wfArenaMarker *marker) {
+  assert(marker->used <= arena->used);
+
+  arena->current = marker->block;
+  arena->offset = marker->offset;
+  arena->used = marker->used;
+}
+
+void wfArenaReset(struct wfArena *arena) {
+  arena->current = NULL;
+  arena->offset = 0;
+  arena->used = 0;
+}
+
+/* gives back the blocks that aren't in use right now, after a frame that
+ * needed a lot more than usual */
+void wfArenaTrim(struct wfArena *arena) {
+  struct wfArenaBlock **link = arena->current ? &arena->current->next : &arena->first;
+
+  freeBlocks(arena, *link);
+  *link = NULL;
+}
+
+struct wfArena *wfFrame(void) {
+  return &gFrame;
+}
+
+struct wfArena *wfScratch(void) {
+  return &gScratch;
+}
+
+void wfFrameEnd(void) {
+  /* whoever used the scratch arena during the frame should have rewound
+   * it by now */
+  assert(gScratch.used == 0);
+
+  wfArenaReset(&gFrame);
+}
+
+void wfMemDestroy(void) {
+  wfArenaDestroy(&gFrame);
+  wfArenaDestroy(&gScratch);
+}
@@ -0,0 +1,116 @@
+/**
+ * This file is part of prototype.
+ *
+ * (c) 2014 Nicolas Hillegeer <nicolas@hillegeer.com>
+ *
+ * For the full copyright and license information, please view the LICENSE
+ * file that was distributed with the source code.
+ */
+
+#ifndef __arena_h__
+#define __arena_h__
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Linear allocators on top of zmalloc, and per-subsystem accounting.
+ *
+ * An arena hands out memory by bumping an offset into big blocks it got
+ * from zmalloc. Nothing gets freed on its own: either the whole arena is
+ * reset at once (the frame arena, at the end of every frame) or it gets
+ * rewound to a marker taken earlier, which makes it a stack allocator for
+ * temporary scratch memory:
+ *
+ *   struct wfArena *scratch = wfScratch();
+ *   struct wfArenaMarker marker;
+ *   wfArenaMark(scratch, &marker);
+ *   float *vertices = wfArenaAlloc(scratch, size);
+ *   ...
+ *   wfArenaRewind(scratch, &marker);
+ *
+ * Both are O(1). The blocks are kept around after a reset or a rewind, so
+ * once an arena has seen its biggest frame it doesn't touch the heap
+ * anymore. An arena belongs to one thread at a time.
+ *
+ * Every subsystem that allocates a lot gets a tag, the bytes it has
+ * allocated under that tag are counted (and can be read from any thread).
+ * Arenas count the blocks they hold, the wfTag* functions count a single
+ * zmalloc'd allocation.
+ */
+
+enum wfMemTag {
+  WF_MEM_FRAME,
+  WF_MEM_SCRATCH,
+  WF_MEM_DRAWLIST,
+  WF_MEM_GFX,
+  WF_MEM_SCRIPT,
+  WF_MEM_TAGS
+};
+
+struct wfMemTagStats {
+  size_t used;   /* bytes currently allocated */
+  size_t peak;   /* the most that was ever allocated at once */
+  size_t allocs; /* the number of allocations so far */
+};
+
+/* the default size of the blocks, allocations that don't fit get a block
+ * of their own */
+#define WF_ARENA_BLOCK (64 * 1024)
+
+/* what wfArenaAlloc() aligns to, enough for SSE */
+#define WF_ARENA_ALIGN 16
+
+struct wfArenaBlock;
+
+/* a zeroed arena is an empty arena with the default block size, that
+ * counts under the first tag */
+struct wfArena {
+  struct wfArenaBlock *first;
+  struct wfArenaBlock *current;
+  size_t offset;
+
+  size_t used; /* bytes handed out since the last reset */
+  size_t peak; /* the most that was handed out between two resets */
+  size_t reserved;
+
+  size_t blockSize;
+  enum wfMemTag tag;
+};
+
+struct wfArenaMarker {
+  struct wfArenaBlock *block;
+  size_t offset;
+  size_t used;
+};
+
+void wfArenaCreate(struct wfArena *arena, size_t blockSize, enum wfMemTag tag);
+void wfArenaDestroy(struct wfArena *arena);
+
+void *wfArenaAlloc(struct wfArena *arena, size_t size);
+void *wfArenaAllocAligned(struct wfArena *arena, size_t size, size_t align);
+void *wfArenaCalloc(struct wfArena *arena, size_t size);
+
+void wfArenaMark(const struct wfArena *arena, struct wfArenaMarker *marker);
+void wfArenaRewind(struct wfArena *arena, const struct wfArenaMarker *marker);
+void wfArenaReset(struct wfArena *arena);
+void wfArenaTrim(struct wfArena *arena);
+
+/* the arenas of the main thread: the frame arena gets reset by
+ * wfFrameEnd(), the scratch arena has to be rewound by whoever uses it */
+struct wfArena *wfFrame(void);
+struct wfArena *wfScratch(void);
+void wfFrameEnd(void);
+void wfMemDestroy(void);
+
+void wfMemTagAlloc(enum wfMemTag tag, size_t size);
+void wfMemTagFree(enum wfMemTag tag, size_t size);
+void wfMemTagGetStats(enum wfMemTag tag, struct wfMemTagStats *stats);
+const char *wfMemTagName(enum wfMemTag tag);
+
+void *wfTagMalloc(enum wfMemTag tag, size_t size);
+void *wfTagCalloc(enum wfMemTag tag, size_t size);
+void *wfTagRealloc(enum wfMemTag tag, void *ptr, size_t size);
+void wfTagFree(enum wfMemTag tag, void *ptr);
+
+#endif
@@ -0,0 +1,673 @@
+/**
+ * This file is part of prototype.
+ *
+ * (c) 2014 Nicolas Hillegeer <nicolas@hillegeer.com>
+ *
+ * For the full copyright and license information, please view the LICENSE
+ * file that was distributed with the source code.
+ *
+ * A 4-wide bounding volume hierarchy (see bvh.h). It gets built as a binary
+ * tree first, top-down with the surface area heuristic evaluated over a
+ * few bins per axis, all the way down to single boxes. That tree then gets
+ * collapsed into the 4-wide one: a node takes the 2 children of its binary
+ * counterpart and keeps replacing the biggest of them by its own children
+ * until it has 4. The nodes are laid out depth-first, so a child always
+ * comes after its parent, which is all the refit needs to go bottom-up.
+ *
+ * The frustum test is the p-vertex one of cull.c, 4 children at a time.
+ * When a child is completely inside of all planes, its whole subtree is
+ * visible and gets emitted without testing anything else.
+ *
+ * http://www.sci.utah.edu/~wald/Publications/2007/ParallelBVHBuild/fastbuild.pdf
+ * http://www.uni-ulm.de/fileadmin/website_uni_ulm/iui.inst.100/institut/Papers/QBVH.pdf
+ *
+ * Doesn't touch GL.
+ */
+
+#include <assert.h>
+#include <float.h>
+#include <math.h>
+#include <string.h>
+#include <xmmintrin.h>
+
+#include "bvh.h"
+#include "zmalloc.h"
+
+#define BVH_BINS 16
+
+/* ranges of at most this many boxes get split in the middle */
+#define BVH_SMALL 8
+
+/* past this depth the builder stops looking for good splits and just
+ * halves, which bounds the depth of the tree and so the traversal stacks:
+ * the binary tree is at most 48 + 31 levels deep, a 4-wide node never
+ * has more than 3 siblings waiting on the stack per level */
+#define BVH_SAH_DEPTH 48
+#define BVH_STACK     256
+
+/* on the frustum traversal stack: the node is known to be inside */
+#define BVH_INSIDE 0x80000000u
+
+struct buildNode {
+  float min[3];
+  float max[3];
+
+  uint32_t left;
+  uint32_t right;
+  uint32_t id; /* the box of a leaf, GFX_BVH_NONE for inner nodes */
+};
+
+/* the boxes get partitioned in place, so keep everything about them
+ * together instead of going back to the set */
+struct buildRef {
+  float min[3];
+  float max[3];
+  float centroid[3];
+  uint32_t id;
+};
+
+struct builder {
+  struct buildRef *refs;
+
+  struct buildNode *nodes;
+  size_t numNodes;
+};
+
+struct bin {
+  float min[3];
+  float max[3];
+  uint32_t count;
+};
+
+static void emptyBounds(float min[3], float max[3]) {
+  for (int i = 0; i < 3; ++i) {
+    min[i] = FLT_MAX;
+    max[i] = -FLT_MAX;
+  }
+}
+
+static void growBounds(float min[3], float max[3], const float bmin[3], const float bmax[3]) {
+  for (int i = 0; i < 3; ++i) {
+    min[i] = (bmin[i] < min[i]) ? bmin[i] : min[i];
+    max[i] = (bmax[i] > max[i]) ? bmax[i] : max[i];
+  }
+}
+
+static float halfArea(const float min[3], const float max[3]) {
+  const float dx = max[0] - min[0];
+  const float dy = max[1] - min[1];
+  const float dz = max[2] - min[2];
+
+  return dx * dy + dy * dz + dz * dx;
+}
+
+static void boxBounds(const struct gfxBoxes *boxes, uint32_t id, float min[3], float max[3]) {
+  min[0] = boxes->minX[id];
+  min[1] = boxes->minY[id];
+  min[2] = boxes->minZ[id];
+  max[0] = boxes->maxX[id];
+  max[1] = boxes->maxY[id];
+  max[2] = boxes->maxZ[id];
+}
+
+static unsigned int binOf(float centroid, float min, float scale) {
+  const int bin = (int)((centroid - min) * scale);
+  return (unsigned int)((bin < 0) ? 0 : (bin >= BVH_BINS) ? BVH_BINS - 1 : bin);
+}
+
+/* the best SAH split of [begin, end) over the bins, returns where the
+ * right half starts or end if there's nothing to split */
+static uint32_t splitSah(struct buildRef *refs, uint32_t begin, uint32_t end, const float cmin[3], const float cmax[3]) {
+  float bestCost = FLT_MAX;
+  int bestAxis = -1;
+  unsigned int bestSplit = 0;
+  float bestScale = 0.0f;
+
+  for (int axis = 0; axis < 3; ++axis) {
+    const float extent = cmax[axis] - cmin[axis];
+    if (extent <= 0.0f) continue;
+
+    const float scale = (float)BVH_BINS / extent;
+
+    struct bin bins[BVH_BINS];
+    for (int k = 0; k < BVH_BINS; ++k) {
+      emptyBounds(bins[k].min, bins[k].max);
+      bins[k].count = 0;
+    }
+
+    for (uint32_t i = begin; i < end; ++i) {
+      struct bin *bin = &bins[binOf(refs[i].centroid[axis], cmin[axis], scale)];
+      growBounds(bin->min, bin->max, refs[i].min, refs[i].max);
+      ++bin->count;
+    }
+
+    /* split k puts bins [0, k) on the left */
+    float rightArea[BVH_BINS];
+    uint32_t rightCount[BVH_BINS];
+
+    float min[3], max[3];
+    uint32_t count = 0;
+    emptyBounds(min, max);
+
+    for (int k = BVH_BINS - 1; k > 0; --k) {
+      growBounds(min, max, bins[k].min, bins[k].max);
+      count += bins[k].count;
+      rightArea[k] = count ? halfArea(min, max) : 0.0f;
+      rightCount[k] = count;
+    }
+
+    emptyBounds(min, max);
+    count = 0;
+
+    for (int k = 1; k < BVH_BINS; ++k) {
+      growBounds(min, max, bins[k - 1].min, bins[k - 1].max);
+      count += bins[k - 1].count;
+
+      if (count == 0 || rightCount[k] == 0) continue;
+
+      const float cost = halfArea(min, max) * (float)count + rightArea[k] * (float)rightCount[k];
+
+      if (cost < bestCost) {
+        bestCost = cost;
+        bestAxis = axis;
+        bestSplit = (unsigned int)k;
+        bestScale = scale;
+      }
+    }
+  }
+
+  if (bestAxis < 0) return end;
+
+  uint32_t i = begin;
+  uint32_t j = end;
+
+  while (i < j) {
+    if (binOf(refs[i].centroid[bestAxis], cmin[bestAxis], bestScale) < bestSplit) {
+      ++i;
+    } else {
+      const struct buildRef tmp = refs[i];
+      refs[i] = refs[--j];
+      refs[j] = tmp;
+    }
+  }
+
+  return i;
+}
+
+/* a handful of boxes isn't worth binning: sort them along the longest
+ * axis and cut in the middle */
+static uint32_t splitSmall(struct buildRef *refs, uint32_t begin, uint32_t end, const float cmin[3], const float cmax[3]) {
+  int axis = 0;
+  for (int i = 1; i < 3; ++i) {
+    if (cmax[i] - cmin[i] > cmax[axis] - cmin[axis]) axis = i;
+  }
+
+  for (uint32_t i = begin + 1; i < end; ++i) {
+    const struct buildRef ref = refs[i];
+    uint32_t j = i;
+
+    for (; j > begin && refs[j - 1].centroid[axis] > ref.centroid[axis]; --j) {
+      refs[j] = refs[j - 1];
+    }
+
+    refs[j] = ref;
+  }
+
+  return begin + (end - begin) / 2;
+}
+
+static uint32_t build(struct builder *b, uint32_t begin, uint32_t end, unsigned int depth) {
+  const uint32_t index = (uint32_t)b->numNodes++;
+  struct buildRef *refs = b->refs;
+
+  struct buildNode node;
+  node.id = GFX_BVH_NONE;
+
+  if (end - begin == 1) {
+    memcpy(node.min, refs[begin].min, sizeof(node.min));
+    memcpy(node.max, refs[begin].max, sizeof(node.max));
+    node.id = refs[begin].id;
+    b->nodes[index] = node;
+    return index;
+  }
+
+  float cmin[3], cmax[3];
+  emptyBounds(node.min, node.max);
+  emptyBounds(cmin, cmax);
+
+  for (uint32_t i = begin; i < end; ++i) {
+    growBounds(node.min, node.max, refs[i].min, refs[i].max);
+    growBounds(cmin, cmax, refs[i].centroid, refs[i].centroid);
+  }
+
+  uint32_t mid = end;
+
+  if (end - begin <= BVH_SMALL) {
+    mid = splitSmall(refs, begin, end, cmin, cmax);
+  } else if (depth < BVH_SAH_DEPTH) {
+    mid = splitSah(refs, begin, end, cmin, cmax);
+  }
+
+  /* when there's no split, the boxes are all in the same spot and it
+   * doesn't matter where we cut */
+  if (mid == begin || mid == end) {
+    mid = begin + (end - begin) / 2;
+  }
+
+  node.left = build(b, begin, mid, depth + 1);
+  node.right = build(b, mid, end, depth + 1);
+
+  b->nodes[index] = node;
+  return index;
+}
+
+/* turns the binary subtree at root into 4-wide nodes */
+static uint32_t collapse(const struct builder *b, struct gfxBvh *bvh, uint32_t root) {
+  const uint32_t index = (uint32_t)bvh->numNodes++;
+
+  uint32_t slots[4];
+  int n = 0;
+
+  const struct buildNode *r = &b->nodes[root];
+
+  if (r->id != GFX_BVH_NONE) {
+    slots[n++] = root;
+  } else {
+    slots[n++] = r->left;
+    slots[n++] = r->right;
+  }
+
+  while (n < 4) {
+    int best = -1;
+    float bestArea = -1.0f;
+
+    for (int k = 0; k < n; ++k) {
+      const struct buildNode *c = &b->nodes[slots[k]];
+      if (c->id != GFX_BVH_NONE) continue;
+
+      const float area = halfArea(c->min, c->max);
+      if (area > bestArea) {
+        bestArea = area;
+        best = k;
+      }
+    }
+
+    if (best < 0) break;
+
+    const struct buildNode *expand = &b->nodes[slots[best]];
+    slots[best] = expand->left;
+    slots[n++] = expand->right;
+  }
+
+  struct gfxBvhNode node;
+  memset(&node, 0x0, sizeof(node));
+
+  for (int k = 0; k < 4; ++k) {
+    if (k >= n) {
+      node.child[k] = GFX_BVH_EMPTY;
+      continue;
+    }
+
+    const struct buildNode *c = &b->nodes[slots[k]];
+
+    node.minX[k] = c->min[0];
+    node.minY[k] = c->min[1];
+    node.minZ[k] = c->min[2];
+    node.maxX[k] = c->max[0];
+    node.maxY[k] = c->max[1];
+    node.maxZ[k] = c->max[2];
+
+    node.child[k] = (c->id != GFX_BVH_NONE) ? (c->id | GFX_BVH_LEAF) : collapse(b, bvh, slots[k]);
+  }
+
+  bvh->nodes[index] = node;
+  return index;
+}
+
+void gfxBvhBuild(struct gfxBvh *bvh, const struct gfxBoxes *boxes) {
+  memset(bvh, 0x0, sizeof(*bvh));
+
+  const size_t count = boxes->count;
+  bvh->numBoxes = count;
+
+  if (count == 0) return;
+
+  assert(count < GFX_BVH_LEAF && "box ids have to fit in 31 bits");
+
+  struct builder b;
+  b.refs = zmalloc(count * sizeof(struct buildRef));
+  b.nodes = zmalloc((2 * count - 1) * sizeof(struct buildNode));
+  b.numNodes = 0;
+
+  for (size_t i = 0; i < count; ++i) {
+    struct buildRef *ref = &b.refs[i];
+    boxBounds(boxes, (uint32_t)i, ref->min, ref->max);
+
+    for (int axis = 0; axis < 3; ++axis) {
+      ref->centroid[axis] = (ref->min[axis] + ref->max[axis]) * 0.5f;
+    }
+
+    ref->id = (uint32_t)i;
+  }
+
+  build(&b, 0, (uint32_t)count, 0);
+
+  /* every 4-wide node starts at a different inner node of the binary
+   * tree, which has count - 1 of them */
+  bvh->nodes = zmalloc(((count > 1) ? count - 1 : 1) * sizeof(struct gfxBvhNode));
+  collapse(&b, bvh, 0);
+  bvh->nodes = zrealloc(bvh->nodes, bvh->numNodes * sizeof(struct gfxBvhNode));
+
+  zfree(b.refs);
+  zfree(b.nodes);
+}
+
+/* recomputes the bounds of every node from the boxes, which have to be the
+ * same set the tree was built from */
+void gfxBvhRefit(struct gfxBvh *bvh, const struct gfxBoxes *boxes) {
+  assert(boxes->count == bvh->numBoxes);
+
+  for (size_t i = bvh->numNodes; i-- > 0;) {
+    struct gfxBvhNode *node = &bvh->nodes[i];
+
+    for (int k = 0; k < 4; ++k) {
+      const uint32_t c = node->child[k];
+      if (c == GFX_BVH_EMPTY) continue;
+
+      float min[3], max[3];
+
+      if (c & GFX_BVH_LEAF) {
+        boxBounds(boxes, c & ~GFX_BVH_LEAF, min, max);
+      } else {
+        const struct gfxBvhNode *child = &bvh->nodes[c];
+        emptyBounds(min, max);
+
+        for (int j = 0; j < 4; ++j) {
+          if (child->child[j] == GFX_BVH_EMPTY) continue;
+
+          const float cmin[3] = { child->minX[j], child->minY[j], child->minZ[j] };
+          const float cmax[3] = { child->maxX[j], child->maxY[j], child->maxZ[j] };
+          growBounds(min, max, cmin, cmax);
+        }
+      }
+
+      node->minX[k] = min[0];
+      node->minY[k] = min[1];
+      node->minZ[k] = min[2];
+      node->maxX[k] = max[0];
+      node->maxY[k] = max[1];
+      node->maxZ[k] = max[2];
+    }
+  }
+}
+
+void gfxBvhDestroy(struct gfxBvh *bvh) {
+  zfree(bvh->nodes);
+  memset(bvh, 0x0, sizeof(*bvh));
+}
+
+struct bvhFrustum {
+  __m128 a[6], b[6], c[6], d[6];
+
+  /* all ones where the p-vertex takes the max of the axis */
+  __m128 px[6], py[6], pz[6];
+
+  /* the bounds of the frustum corners */
+  __m128 min[3];
+  __m128 max[3];
+};
+
+static void prepareFrustum(struct bvhFrustum *bf, const frustum *fru) {
+  const __m128 all = _mm_castsi128_ps(_mm_set1_epi32(-1));
+  const __m128 none = _mm_setzero_ps();
+
+  for (int i = 0; i < 6; ++i) {
+    bf->a[i] = _mm_set1_ps(fru->planes[i][0]);
+    bf->b[i] = _mm_set1_ps(fru->planes[i][1]);
+    bf->c[i] = _mm_set1_ps(fru->planes[i][2]);
+    bf->d[i] = _mm_set1_ps(fru->planes[i][3]);
+
+    bf->px[i] = (fru->planes[i][0] >= 0.0f) ? all : none;
+    bf->py[i] = (fru->planes[i][1] >= 0.0f) ? all : none;
+    bf->pz[i] = (fru->planes[i][2] >= 0.0f) ? all : none;
+  }
+
+  for (int axis = 0; axis < 3; ++axis) {
+    float min = fru->points[0][axis];
+    float max = min;
+
+    for (int i = 1; i < 8; ++i) {
+      min = fminf(min, fru->points[i][axis]);
+      max = fmaxf(max, fru->points[i][axis]);
+    }
+
+    bf->min[axis] = _mm_set1_ps(min);
+    bf->max[axis] = _mm_set1_ps(max);
+  }
+}
+
+static __m128 pick(__m128 mask, __m128 a, __m128 b) {
+  return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));
+}
+
+/* a bit per visible child, inside gets a bit per child that's inside all planes */
+static unsigned int frustumMask(const struct gfxBvhNode *node, const struct bvhFrustum *bf, unsigned int *inside) {
+  const __m128 zero = _mm_setzero_ps();
+
+  const __m128 minX = _mm_loadu_ps(node->minX);
+  const __m128 minY = _mm_loadu_ps(node->minY);
+  const __m128 minZ = _mm_loadu_ps(node->minZ);
+  const __m128 maxX = _mm_loadu_ps(node->maxX);
+  const __m128 maxY = _mm_loadu_ps(node->maxY);
+  const __m128 maxZ = _mm_loadu_ps(node->maxZ);
+
+  __m128 visible = _mm_and_ps(_mm_cmpge_ps(maxX, bf->min[0]), _mm_cmple_ps(minX, bf->max[0]));
+  visible = _mm_and_ps(visible, _mm_and_ps(_mm_cmpge_ps(maxY, bf->min[1]), _mm_cmple_ps(minY, bf->max[1])));
+  visible = _mm_and_ps(visible, _mm_and_ps(_mm_cmpge_ps(maxZ, bf->min[2]), _mm_cmple_ps(minZ, bf->max[2])));
+
+  __m128 in = visible;
+
+  for (int j = 0; j < 6; ++j) {
+    /* the p-vertex is the corner furthest along the normal, the n-vertex
+     * the one on the other side */
+    __m128 p = bf->d[j];
+    p = _mm_add_ps(p, _mm_mul_ps(bf->a[j], pick(bf->px[j], maxX, minX)));
+    p = _mm_add_ps(p, _mm_mul_ps(bf->b[j], pick(bf->py[j], maxY, minY)));
+    p = _mm_add_ps(p, _mm_mul_ps(bf->c[j], pick(bf->pz[j], maxZ, minZ)));
+
+    __m128 n = bf->d[j];
+    n = _mm_add_ps(n, _mm_mul_ps(bf->a[j], pick(bf->px[j], minX, maxX)));
+    n = _mm_add_ps(n, _mm_mul_ps(bf->b[j], pick(bf->py[j], minY, maxY)));
+    n = _mm_add_ps(n, _mm_mul_ps(bf->c[j], pick(bf->pz[j], minZ, maxZ)));
+
+    visible = _mm_and_ps(visible, _mm_cmpge_ps(p, zero));
+    in = _mm_and_ps(in, _mm_cmpge_ps(n, zero));
+  }
+
+  *inside = (unsigned int)_mm_movemask_ps(_mm_and_ps(in, visible));
+  return (unsigned int)_mm_movemask_ps(visible);
+}
+
+/* visits every box that's (partially) inside the frustum, which has to be
+ * in the same space as the boxes. Returns how many there were. Gives the
+ * same answers as gfxCullBoxes(). */
+size_t gfxBvhCullFrustum(const struct gfxBvh *bvh, const frustum *fru, gfxBvhVisitFunc visit, void *userdata) {
+  if (bvh->numNodes == 0) return 0;
+
+  struct bvhFrustum bf;
+  prepareFrustum(&bf, fru);
+
+  uint32_t stack[BVH_STACK];
+  size_t top = 0;
+  size_t found = 0;
+
+  stack[top++] = 0;
+
+  while (top) {
+    const uint32_t entry = stack[--top];
+    const struct gfxBvhNode *node = &bvh->nodes[entry & ~BVH_INSIDE];
+
+    unsigned int visible;
+    unsigned int inside;
+
+    if (entry & BVH_INSIDE) {
+      visible = inside = 0xF;
+    } else {
+      visible = frustumMask(node, &bf, &inside);
+    }
+
+    for (int k = 0; k < 4; ++k) {
+      const uint32_t c = node->child[k];
+      if (!((visible >> k) & 1) || c == GFX_BVH_EMPTY) continue;
+
+      if (c & GFX_BVH_LEAF) {
+        visit(c & ~GFX_BVH_LEAF, userdata);
+        ++found;
+      } else {
+        assert(top < BVH_STACK);
+        stack[top++] = c | (((inside >> k) & 1) ? BVH_INSIDE : 0);
+      }
+    }
+  }
+
+  return found;
+}
+
+/* visits every box that overlaps box, returns how many there were */
+size_t gfxBvhOverlap(const struct gfxBvh *bvh, const aabb *box, gfxBvhVisitFunc visit, void *userdata) {
+  if (bvh->numNodes == 0) return 0;
+
+  const __m128 bminX = _mm_set1_ps(box->min[0]);
+  const __m128 bminY = _mm_set1_ps(box->min[1]);
+  const __m128 bminZ = _mm_set1_ps(box->min[2]);
+  const __m128 bmaxX = _mm_set1_ps(box->max[0]);
+  const __m128 bmaxY = _mm_set1_ps(box->max[1]);
+  const __m128 bmaxZ = _mm_set1_ps(box->max[2]);
+
+  uint32_t stack[BVH_STACK];
+  size_t top = 0;
+  size_t found = 0;
+
+  stack[top++] = 0;
+
+  while (top) {
+    const struct gfxBvhNode *node = &bvh->nodes[stack[--top]];
+
+    __m128 overlap = _mm_and_ps(_mm_cmpge_ps(_mm_loadu_ps(node->maxX), bminX), _mm_cmple_ps(_mm_loadu_ps(node->minX), bmaxX));
+    overlap = _mm_and_ps(overlap, _mm_and_ps(_mm_cmpge_ps(_mm_loadu_ps(node->maxY), bminY), _mm_cmple_ps(_mm_loadu_ps(node->minY), bmaxY)));
+    overlap = _mm_and_ps(overlap, _mm_and_ps(_mm_cmpge_ps(_mm_loadu_ps(node->maxZ), bminZ), _mm_cmple_ps(_mm_loadu_ps(node->minZ), bmaxZ)));
+
+    const unsigned int mask = (unsigned int)_mm_movemask_ps(overlap);
+
+    for (int k = 0; k < 4; ++k) {
+      const uint32_t c = node->child[k];
+      if (!((mask >> k) & 1) || c == GFX_BVH_EMPTY) continue;
+
+      if (c & GFX_BVH_LEAF) {
+        visit(c & ~GFX_BVH_LEAF, userdata);
+        ++found;
+      } else {
+        assert(top < BVH_STACK);
+        stack[top++] = c;
+      }
+    }
+  }
+
+  return found;
+}
+
+/* returns the closest box the ray hits within maxT (in units of dir), or
+ * GFX_BVH_NONE. Without a test function the distance is where the ray
+ * enters the box, with one the boxes only decide what gets tested and the
+ * order. t receives the distance of the hit. */
+uint32_t gfxBvhRaycast(const struct gfxBvh *bvh, const float origin[3], const float dir[3], float maxT,
+                       gfxBvhRayFunc test, void *userdata, float *t) {
+  if (bvh->numNodes == 0) return GFX_BVH_NONE;
+
+  __m128 o[3], inv[3];
+
+  for (int i = 0; i < 3; ++i) {
+    /* keep the slabs finite for axis-aligned rays */
+    float d = dir[i];
+    if (fabsf(d) < 1e-20f) d = (d < 0.0f) ? -1e-20f : 1e-20f;
+
+    o[i] = _mm_set1_ps(origin[i]);
+    inv[i] = _mm_set1_ps(1.0f / d);
+  }
+
+  struct {
+    uint32_t node;
+    float t;
+  } stack[BVH_STACK];
+  size_t top = 0;
+
+  stack[top].node = 0;
+  stack[top++].t = 0.0f;
+
+  float best = maxT;
+  uint32_t hit = GFX_BVH_NONE;
+
+  while (top) {
+    --top;
+    if (stack[top].t > best) continue;
+
+    const struct gfxBvhNode *node = &bvh->nodes[stack[top].node];
+
+    const __m128 t1x = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(node->minX), o[0]), inv[0]);
+    const __m128 t2x = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(node->maxX), o[0]), inv[0]);
+    const __m128 t1y = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(node->minY), o[1]), inv[1]);
+    const __m128 t2y = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(node->maxY), o[1]), inv[1]);
+    const __m128 t1z = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(node->minZ), o[2]), inv[2]);
+    const __m128 t2z = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(node->maxZ), o[2]), inv[2]);
+
+    const __m128 tnear = _mm_max_ps(_mm_max_ps(_mm_min_ps(t1x, t2x), _mm_min_ps(t1y, t2y)),
+                                    _mm_max_ps(_mm_min_ps(t1z, t2z), _mm_setzero_ps()));
+    const __m128 tfar = _mm_min_ps(_mm_min_ps(_mm_max_ps(t1x, t2x), _mm_max_ps(t1y, t2y)),
+                                   _mm_min_ps(_mm_max_ps(t1z, t2z), _mm_set1_ps(best)));
+
+    const unsigned int mask = (unsigned int)_mm_movemask_ps(_mm_cmple_ps(tnear, tfar));
+
+    float near[4];
+    _mm_storeu_ps(near, tnear);
+
+    /* the inner nodes that got hit, furthest first so the nearest ends up
+     * on top of the stack */
+    uint32_t inner[4];
+    float innerT[4];
+    int numInner = 0;
+
+    for (int k = 0; k < 4; ++k) {
+      const uint32_t c = node->child[k];
+      if (!((mask >> k) & 1) || c == GFX_BVH_EMPTY) continue;
+
+      if (c & GFX_BVH_LEAF) {
+        const uint32_t id = c & ~GFX_BVH_LEAF;
+        const float d = test ? test(id, origin, dir, userdata) : near[k];
+
+        if (d >= 0.0f && d < best) {
+          best = d;
+          hit = id;
+        }
+      } else {
+        int j = numInner++;
+        for (; j > 0 && innerT[j - 1] < near[k]; --j) {
+          inner[j] = inner[j - 1];
+          innerT[j] = innerT[j - 1];
+        }
+
+        inner[j] = c;
+        innerT[j] = near[k];
+      }
+    }
+
+    for (int k = 0; k < numInner; ++k) {
+      assert(top < BVH_STACK);
+      stack[top].node = inner[k];
+      stack[top++].t = innerT[k];
+    }
+  }
+
+  if (hit != GFX_BVH_NONE && t) *t = best;
+
+  return hit;
+}
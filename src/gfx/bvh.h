@@ -0,0 +1,69 @@
+/**
+ * This file is part of prototype.
+ *
+ * (c) 2014 Nicolas Hillegeer <nicolas@hillegeer.com>
+ *
+ * For the full copyright and license information, please view the LICENSE
+ * file that was distributed with the source code.
+ */
+
+#ifndef __bvh_h__
+#define __bvh_h__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "math/types.h"
+#include "cull.h"
+
+/**
+ * Bounding volume hierarchy over the boxes of a gfxBoxes set, for culling
+ * and picking in scenes that are too big to test linearly. Every node has
+ * 4 children with their bounds stored as SoA, so a node gets tested with
+ * one SSE pass. A child is either another node or a single box, the ids
+ * handed out by the queries are the indices of the boxes in the set.
+ *
+ * Moving objects: update their boxes with gfxBoxesSet() and refit, which
+ * keeps the tree but recomputes all bounds. The tree degrades when objects
+ * move far, rebuild it every now and then.
+ */
+
+/* child slots: a node index, a box id with GFX_BVH_LEAF set, or empty */
+#define GFX_BVH_LEAF  0x80000000u
+#define GFX_BVH_EMPTY 0xFFFFFFFFu
+#define GFX_BVH_NONE  0xFFFFFFFFu
+
+struct gfxBvhNode {
+  float minX[4];
+  float minY[4];
+  float minZ[4];
+  float maxX[4];
+  float maxY[4];
+  float maxZ[4];
+
+  uint32_t child[4];
+};
+
+struct gfxBvh {
+  struct gfxBvhNode *nodes; /* the root is node 0, children come after their parents */
+  size_t numNodes;
+  size_t numBoxes;
+};
+
+/* called for every box a query finds */
+typedef void (*gfxBvhVisitFunc)(uint32_t id, void *userdata);
+
+/* exact ray test for picking, returns the distance along the ray (in units
+ * of dir) or something negative on a miss */
+typedef float (*gfxBvhRayFunc)(uint32_t id, const float origin[3], const float dir[3], void *userdata);
+
+void gfxBvhBuild(struct gfxBvh *bvh, const struct gfxBoxes *boxes);
+void gfxBvhRefit(struct gfxBvh *bvh, const struct gfxBoxes *boxes);
+void gfxBvhDestroy(struct gfxBvh *bvh);
+
+size_t gfxBvhCullFrustum(const struct gfxBvh *bvh, const frustum *fru, gfxBvhVisitFunc visit, void *userdata);
+size_t gfxBvhOverlap(const struct gfxBvh *bvh, const aabb *box, gfxBvhVisitFunc visit, void *userdata);
+uint32_t gfxBvhRaycast(const struct gfxBvh *bvh, const float origin[3], const float dir[3], float maxT,
+                       gfxBvhRayFunc test, void *userdata, float *t);
+
+#endif
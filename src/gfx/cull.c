@@ -0,0 +1,215 @@
+/**
+ * This file is part of prototype.
+ *
+ * (c) 2014 Nicolas Hillegeer <nicolas@hillegeer.com>
+ *
+ * For the full copyright and license information, please view the LICENSE
+ * file that was distributed with the source code.
+ *
+ * Frustum culling of a whole batch of boxes at once (see cull.h), it gives
+ * the same answers as box_in_frustum() in math/geometry.h but doesn't look
+ * at one box at a time.
+ *
+ * Instead of testing all 8 corners against a plane we only test the corner
+ * that lies furthest along the plane normal (the "p-vertex"): if that one
+ * is behind the plane, the others are too. Which corner that is only
+ * depends on the signs of the plane, so per plane we just pick the min or
+ * max stream of every axis and the test becomes a dot product over 4 or 8
+ * boxes at a time. Boxes that straddle two planes outside of a corner of
+ * the frustum would pass, so like box_in_frustum() we also reject the boxes
+ * that don't overlap the bounds of the frustum corners.
+ *
+ * http://zeuxcg.org/2009/01/31/view-frustum-culling-optimization-introduction/
+ *
+ * Doesn't touch GL.
+ */
+
+#include <string.h>
+#include <xmmintrin.h>
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#endif
+
+#include "cull.h"
+#include "zmalloc.h"
+
+struct cullPlane {
+  const float *x;
+  const float *y;
+  const float *z;
+  float a, b, c, d;
+};
+
+struct cullFrustum {
+  struct cullPlane planes[6];
+
+  /* the bounds of the frustum corners */
+  float min[3];
+  float max[3];
+};
+
+static void setStreams(struct gfxBoxes *boxes, size_t capacity) {
+  float **streams[] = { &boxes->minX, &boxes->minY, &boxes->minZ, &boxes->maxX, &boxes->maxY, &boxes->maxZ };
+
+  for (size_t i = 0; i < sizeof(streams) / sizeof(streams[0]); ++i) {
+    *streams[i] = zrealloc(*streams[i], capacity * sizeof(float));
+  }
+
+  boxes->capacity = capacity;
+}
+
+void gfxBoxesInit(struct gfxBoxes *boxes, size_t capacity) {
+  memset(boxes, 0x0, sizeof(*boxes));
+  setStreams(boxes, capacity ? capacity : 64);
+}
+
+void gfxBoxesDestroy(struct gfxBoxes *boxes) {
+  zfree(boxes->minX);
+  zfree(boxes->minY);
+  zfree(boxes->minZ);
+  zfree(boxes->maxX);
+  zfree(boxes->maxY);
+  zfree(boxes->maxZ);
+
+  memset(boxes, 0x0, sizeof(*boxes));
+}
+
+/* returns the index of the box, which is its bit in the visibility mask */
+size_t gfxBoxesAdd(struct gfxBoxes *boxes, const aabb *box) {
+  if (boxes->count == boxes->capacity) {
+    setStreams(boxes, boxes->capacity * 2);
+  }
+
+  const size_t index = boxes->count++;
+  gfxBoxesSet(boxes, index, box);
+
+  return index;
+}
+
+void gfxBoxesSet(struct gfxBoxes *boxes, size_t index, const aabb *box) {
+  boxes->minX[index] = box->min[0];
+  boxes->minY[index] = box->min[1];
+  boxes->minZ[index] = box->min[2];
+  boxes->maxX[index] = box->max[0];
+  boxes->maxY[index] = box->max[1];
+  boxes->maxZ[index] = box->max[2];
+}
+
+static void prepare(struct cullFrustum *cf, const struct gfxBoxes *boxes, const frustum *fru) {
+  for (int i = 0; i < 6; ++i) {
+    struct cullPlane *p = &cf->planes[i];
+
+    p->a = fru->planes[i][0];
+    p->b = fru->planes[i][1];
+    p->c = fru->planes[i][2];
+    p->d = fru->planes[i][3];
+
+    /* the p-vertex */
+    p->x = (p->a >= 0.0f) ? boxes->maxX : boxes->minX;
+    p->y = (p->b >= 0.0f) ? boxes->maxY : boxes->minY;
+    p->z = (p->c >= 0.0f) ? boxes->maxZ : boxes->minZ;
+  }
+
+  for (int axis = 0; axis < 3; ++axis) {
+    cf->min[axis] = cf->max[axis] = fru->points[0][axis];
+
+    for (int i = 1; i < 8; ++i) {
+      const float v = fru->points[i][axis];
+      cf->min[axis] = (v < cf->min[axis]) ? v : cf->min[axis];
+      cf->max[axis] = (v > cf->max[axis]) ? v : cf->max[axis];
+    }
+  }
+}
+
+static int cullScalar(const struct cullFrustum *cf, const struct gfxBoxes *boxes, size_t i) {
+  for (int j = 0; j < 6; ++j) {
+    const struct cullPlane *p = &cf->planes[j];
+
+    if (p->a * p->x[i] + p->b * p->y[i] + p->c * p->z[i] + p->d < 0.0f) return 0;
+  }
+
+  return boxes->maxX[i] >= cf->min[0] && boxes->minX[i] <= cf->max[0] &&
+         boxes->maxY[i] >= cf->min[1] && boxes->minY[i] <= cf->max[1] &&
+         boxes->maxZ[i] >= cf->min[2] && boxes->minZ[i] <= cf->max[2];
+}
+
+/* 4 boxes starting at i, returns a bit per visible box */
+static unsigned int cullSSE(const struct cullFrustum *cf, const struct gfxBoxes *boxes, size_t i) {
+  const __m128 zero = _mm_setzero_ps();
+
+  __m128 visible = _mm_and_ps(_mm_cmpge_ps(_mm_loadu_ps(boxes->maxX + i), _mm_set1_ps(cf->min[0])),
+                              _mm_cmple_ps(_mm_loadu_ps(boxes->minX + i), _mm_set1_ps(cf->max[0])));
+  visible = _mm_and_ps(visible, _mm_cmpge_ps(_mm_loadu_ps(boxes->maxY + i), _mm_set1_ps(cf->min[1])));
+  visible = _mm_and_ps(visible, _mm_cmple_ps(_mm_loadu_ps(boxes->minY + i), _mm_set1_ps(cf->max[1])));
+  visible = _mm_and_ps(visible, _mm_cmpge_ps(_mm_loadu_ps(boxes->maxZ + i), _mm_set1_ps(cf->min[2])));
+  visible = _mm_and_ps(visible, _mm_cmple_ps(_mm_loadu_ps(boxes->minZ + i), _mm_set1_ps(cf->max[2])));
+
+  for (int j = 0; j < 6; ++j) {
+    const struct cullPlane *p = &cf->planes[j];
+
+    __m128 dist = _mm_set1_ps(p->d);
+    dist = _mm_add_ps(dist, _mm_mul_ps(_mm_set1_ps(p->a), _mm_loadu_ps(p->x + i)));
+    dist = _mm_add_ps(dist, _mm_mul_ps(_mm_set1_ps(p->b), _mm_loadu_ps(p->y + i)));
+    dist = _mm_add_ps(dist, _mm_mul_ps(_mm_set1_ps(p->c), _mm_loadu_ps(p->z + i)));
+
+    visible = _mm_and_ps(visible, _mm_cmpge_ps(dist, zero));
+  }
+
+  return (unsigned int)_mm_movemask_ps(visible);
+}
+
+#if defined(__AVX__)
+/* 8 boxes starting at i */
+static unsigned int cullAVX(const struct cullFrustum *cf, const struct gfxBoxes *boxes, size_t i) {
+  const __m256 zero = _mm256_setzero_ps();
+
+  __m256 visible = _mm256_and_ps(_mm256_cmp_ps(_mm256_loadu_ps(boxes->maxX + i), _mm256_set1_ps(cf->min[0]), _CMP_GE_OQ),
+                                 _mm256_cmp_ps(_mm256_loadu_ps(boxes->minX + i), _mm256_set1_ps(cf->max[0]), _CMP_LE_OQ));
+  visible = _mm256_and_ps(visible, _mm256_cmp_ps(_mm256_loadu_ps(boxes->maxY + i), _mm256_set1_ps(cf->min[1]), _CMP_GE_OQ));
+  visible = _mm256_and_ps(visible, _mm256_cmp_ps(_mm256_loadu_ps(boxes->minY + i), _mm256_set1_ps(cf->max[1]), _CMP_LE_OQ));
+  visible = _mm256_and_ps(visible, _mm256_cmp_ps(_mm256_loadu_ps(boxes->maxZ + i), _mm256_set1_ps(cf->min[2]), _CMP_GE_OQ));
+  visible = _mm256_and_ps(visible, _mm256_cmp_ps(_mm256_loadu_ps(boxes->minZ + i), _mm256_set1_ps(cf->max[2]), _CMP_LE_OQ));
+
+  for (int j = 0; j < 6; ++j) {
+    const struct cullPlane *p = &cf->planes[j];
+
+    __m256 dist = _mm256_set1_ps(p->d);
+    dist = _mm256_add_ps(dist, _mm256_mul_ps(_mm256_set1_ps(p->a), _mm256_loadu_ps(p->x + i)));
+    dist = _mm256_add_ps(dist, _mm256_mul_ps(_mm256_set1_ps(p->b), _mm256_loadu_ps(p->y + i)));
+    dist = _mm256_add_ps(dist, _mm256_mul_ps(_mm256_set1_ps(p->c), _mm256_loadu_ps(p->z + i)));
+
+    visible = _mm256_and_ps(visible, _mm256_cmp_ps(dist, zero, _CMP_GE_OQ));
+  }
+
+  return (unsigned int)_mm256_movemask_ps(visible);
+}
+#endif
+
+/* visible needs GFX_CULL_WORDS(boxes->count) words, all of them get
+ * written. The boxes have to be in the same space as the frustum. */
+void gfxCullBoxes(const struct gfxBoxes *boxes, const frustum *fru, uint32_t *visible) {
+  struct cullFrustum cf;
+  prepare(&cf, boxes, fru);
+
+  const size_t count = boxes->count;
+  memset(visible, 0x0, GFX_CULL_WORDS(count) * sizeof(uint32_t));
+
+  /* the groups are 4 or 8 boxes wide and start at a multiple of that, so
+   * their bits never straddle two words */
+  size_t i = 0;
+
+#if defined(__AVX__)
+  for (; i + 8 <= count; i += 8) {
+    visible[i >> 5] |= (uint32_t)cullAVX(&cf, boxes, i) << (i & 31);
+  }
+#endif
+
+  for (; i + 4 <= count; i += 4) {
+    visible[i >> 5] |= (uint32_t)cullSSE(&cf, boxes, i) << (i & 31);
+  }
+
+  for (; i < count; ++i) {
+    visible[i >> 5] |= (uint32_t)cullScalar(&cf, boxes, i) << (i & 31);
+  }
+}
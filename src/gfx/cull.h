@@ -0,0 +1,45 @@
+/**
+ * This file is part of prototype.
+ *
+ * (c) 2014 Nicolas Hillegeer <nicolas@hillegeer.com>
+ *
+ * For the full copyright and license information, please view the LICENSE
+ * file that was distributed with the source code.
+ */
+
+#ifndef __cull_h__
+#define __cull_h__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "math/types.h"
+
+/**
+ * World-space bounding boxes, stored as one stream per component so the
+ * culler can load 4 (SSE) or 8 (AVX) boxes with a single load. Indices
+ * are stable, boxes are only ever appended or overwritten.
+ */
+struct gfxBoxes {
+  float *minX;
+  float *minY;
+  float *minZ;
+  float *maxX;
+  float *maxY;
+  float *maxZ;
+
+  size_t count;
+  size_t capacity;
+};
+
+/* the visibility bitmask has one bit per box: bit (i % 32) of word (i / 32) */
+#define GFX_CULL_WORDS(count) (((count) + 31) / 32)
+
+void gfxBoxesInit(struct gfxBoxes *boxes, size_t capacity);
+void gfxBoxesDestroy(struct gfxBoxes *boxes);
+size_t gfxBoxesAdd(struct gfxBoxes *boxes, const aabb *box);
+void gfxBoxesSet(struct gfxBoxes *boxes, size_t index, const aabb *box);
+
+void gfxCullBoxes(const struct gfxBoxes *boxes, const frustum *fru, uint32_t *visible);
+
+#endif
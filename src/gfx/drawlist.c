@@ -7,65 +7,231 @@
  * file that was distributed with the source code.
  */
 
+#include <float.h>
+#include <math.h>
 #include <unistd.h>
 
-#include "binary_search.h"
+#include "math/math.h"
+
 #include "drawlist.h"
+#include "radix_sort.h"
 #include "util.h"
 
-#define MAX_DRAWLIST_ENTRIES 8192
-
-/* 16 bytes (128 bits) */
+/* the drawlist grows by doubling, starting at this many entries */
+#define DRAWLIST_INITIAL_CAPACITY 1024
+
+/* a handle is a slot index in the lower bits and the generation of that
+ * slot in the upper bits. 20 bits of index allows for ~1M live draw
+ * operations, the 12 bits of generation make it quite unlikely that a
+ * stale handle goes unnoticed. */
+#define HANDLE_INDEX_BITS 20
+#define HANDLE_INDEX_MASK ((1u << HANDLE_INDEX_BITS) - 1)
+#define HANDLE_GEN_MASK   ((1u << (32 - HANDLE_INDEX_BITS)) - 1)
+#define HANDLE_MAX_SLOTS  (1u << HANDLE_INDEX_BITS)
+
+#define SLOT_NONE UINT32_MAX
+
+/* the amount of bits of depth in a model key */
+#define DEPTH_BITS 16
+#define DEPTH_MASK ((1u << DEPTH_BITS) - 1)
+
+/* per-instance attributes need glVertexAttribDivisor() */
+#ifdef GL_VERSION_3_3
+#define DRAWLIST_INSTANCING
+#endif
+
+/* glMultiDrawElementsIndirect, with the base instance in the command */
+#if defined(DRAWLIST_INSTANCING) && (defined(GL_VERSION_4_3) || defined(GL_ARB_multi_draw_indirect))
+#define DRAWLIST_INDIRECT
+#endif
+
+/* the longest run of models that gets drawn in one call, and the size of
+ * the streamed instance buffer (in matrices). Every frame appends
+ * to the buffer, when it's full it gets orphaned and we start over at 0. */
+#define DRAWLIST_MAX_INSTANCES  1024
+#define DRAWLIST_INSTANCE_SLOTS (16 * DRAWLIST_MAX_INSTANCES)
+
+/* offsets into the uniform ring of a batch, nothing has to be bound for
+ * NONE, PENDING means it still has to be pushed */
+#define UNIFORMS_NONE    ((GLintptr)-1)
+#define UNIFORMS_PENDING ((GLintptr)-2)
+
+/* enable this to sort the drawlist with qsort() instead of the radix sort,
+ * handy for comparing the two. */
+/* #define DRAWLIST_QSORT */
+
+/* 24 bytes (192 bits) */
 struct entry {
   /* key to sort on */
   union gfxDrawlistKey key;
 
   /* pointer to the actual element */
   struct gfxDrawOperation *op;
+
+  /* the handle slot that refers to this entry */
+  uint32_t slot;
+};
+
+typedef enum {
+  DRAW_SINGLE = 0,
+  DRAW_INSTANCED,
+  DRAW_INDIRECT
+} draw_mode_t;
+
+/* how an entry of the frame gets drawn, decided before drawing starts */
+struct batch {
+  /* the amount of entries drawn together with this one */
+  size_t run;
+  draw_mode_t mode;
+
+  GLintptr layerUniforms;
+  GLintptr drawUniforms;
+};
+
+/* the layout glMultiDrawElementsIndirect expects */
+struct indirectCommand {
+  GLuint count;
+  GLuint instanceCount;
+  GLuint firstIndex;
+  GLint baseVertex;
+  GLuint baseInstance;
+};
+
+/* while a slot is in use, index is the position of its entry in the
+ * entries array, while it's free, index is the next free slot. */
+struct slot {
+  uint32_t index;
+  uint32_t generation;
+};
+
+/* a registered command, the id of a command is its index + 1 */
+struct command {
+  gfxDrawCommandFunc func;
+  void *userdata;
 };
 
 struct gfxDrawlist {
   int dirty;
 
-  unsigned int nextId;
+  /* [0, count) is in use, though it can contain deleted entries until the
+     * next sort compacts them away */
+  size_t count;
+  size_t capacity;
+
+  struct entry *entries;
+
+  /* the radix sort ping-pongs between the entries and this buffer */
+  struct entry *scratch;
+
+  struct slot *slots;
+  uint32_t numSlots;
+  uint32_t slotCapacity;
+  uint32_t freeList;
+
+  /* buckets submitted this frame, the counter is bumped atomically by
+   * gfxDrawBucketSubmit, the slots are owned by whoever bumped it */
+  struct gfxDrawBucket *buckets[DRAWLIST_MAX_BUCKETS];
+  unsigned int numBuckets;
+
+  /* the retained list merged with the buckets, only used when there's
+   * actually something to merge */
+  struct entry *frame;
+  size_t frameCapacity;
+
+  /* streamed per-instance modelview matrices, 0 if we can't instance */
+  GLuint instanceVbo;
+  size_t instanceOffset;
+
+  /* streamed glMultiDrawElementsIndirect commands, 0 if we can't */
+  GLuint indirectBuffer;
+  size_t indirectOffset;
+
+  struct gfxDrawlistStats stats;
+
+  struct command *commands;
+  unsigned int numCommands;
 
-  struct entry entries[MAX_DRAWLIST_ENTRIES];
+  /* how far (in pixels) a LOD may be off on screen, and half the height of
+   * the viewport in pixels. 0 means always the full model. */
+  float lodPixels;
+  float lodHalfHeight;
 };
 
-static struct gfxDrawlist gDrawlist;
+/* a bucket is only ever touched by one thread at a time, the thread that
+ * fills it also sorts it, so the main thread only has to merge */
+struct gfxDrawBucket {
+  size_t count;
+  size_t capacity;
 
-ALWAYS_INLINE static ssize_t searchEntry(uint64_t key, struct entry array[], size_t size) {
-  struct entry *low = array;
+  struct entry *entries;
+  struct entry *scratch;
 
-  /* this should unroll... check this manually */
-  for (unsigned int i = lb(size); i != 0; --i) {
-    size /= 2;
+  int submitted;
+};
 
-    /* unconditionally unset the deleted flag, when deleting items, they
-         * are not actually removed, the deleted flag is just set to 1. This
-         * messes with binary search of course, as now the array is no longer
-         * sorted. That's why we just "ignore" that bit by setting it back to
-         * 0 in our temporary copy. */
-    union gfxDrawlistKey midkey = low[size].key;
-    midkey.gen.deleted = 0;
+static struct gfxDrawlist gDrawlist = {.freeList = SLOT_NONE};
 
-    uint64_t mid = midkey.intrep;
+static gfxDrawHandle makeHandle(uint32_t slot, uint32_t generation) {
+  return (generation << HANDLE_INDEX_BITS) | slot;
+}
 
-    if (mid <= key) {
-      low += size;
-    }
+/* returns the slot the handle refers to, or SLOT_NONE if the handle is
+ * stale (i.e.: the draw operation was already removed). */
+static uint32_t resolveHandle(gfxDrawHandle handle) {
+  const uint32_t slot = handle & HANDLE_INDEX_MASK;
+  const uint32_t generation = handle >> HANDLE_INDEX_BITS;
+
+  if (slot >= gDrawlist.numSlots || gDrawlist.slots[slot].generation != generation) {
+    return SLOT_NONE;
+  }
+
+  return slot;
+}
+
+static uint32_t allocSlot(void) {
+  if (gDrawlist.freeList != SLOT_NONE) {
+    const uint32_t slot = gDrawlist.freeList;
+    gDrawlist.freeList = gDrawlist.slots[slot].index;
+    return slot;
+  }
+
+  if (gDrawlist.numSlots == gDrawlist.slotCapacity) {
+    assert(gDrawlist.slotCapacity < HANDLE_MAX_SLOTS);
+
+    gDrawlist.slotCapacity = gDrawlist.slotCapacity ? gDrawlist.slotCapacity * 2 : DRAWLIST_INITIAL_CAPACITY;
+    gDrawlist.slotCapacity = MIN(gDrawlist.slotCapacity, HANDLE_MAX_SLOTS);
+    gDrawlist.slots = wfTagRealloc(WF_MEM_DRAWLIST, gDrawlist.slots, gDrawlist.slotCapacity * sizeof(struct slot));
   }
 
-  return (low->key.intrep > key) ? -1 : (low - array);
+  const uint32_t slot = gDrawlist.numSlots++;
+
+  /* generation 0 is never handed out, so a handle is never 0 */
+  gDrawlist.slots[slot].generation = 1;
+
+  return slot;
 }
 
-static void clearEntry(size_t index) {
-  gDrawlist.entries[index].key.gen.deleted = 1;
+static void freeSlot(uint32_t slot) {
+  struct slot *s = &gDrawlist.slots[slot];
+
+  /* invalidate all outstanding handles to this slot */
+  s->generation = (s->generation + 1) & HANDLE_GEN_MASK;
+  if (s->generation == 0) s->generation = 1;
+
+  s->index = gDrawlist.freeList;
+  gDrawlist.freeList = slot;
 }
 
-/* assume a sorted list, ignore already removed items */
-static ssize_t findIndex(struct gfxDrawOperation *op) {
-  return searchEntry(op->key.intrep, gDrawlist.entries, MAX_DRAWLIST_ENTRIES);
+static void growEntries(void) {
+  gDrawlist.capacity = gDrawlist.capacity ? gDrawlist.capacity * 2 : DRAWLIST_INITIAL_CAPACITY;
+
+  trace("growing drawlist to %zu entries\n", gDrawlist.capacity);
+
+  gDrawlist.entries = wfTagRealloc(WF_MEM_DRAWLIST, gDrawlist.entries, gDrawlist.capacity * sizeof(struct entry));
+
+  /* the scratch buffer doesn't hold anything between sorts, no need to copy */
+  wfTagFree(WF_MEM_DRAWLIST, gDrawlist.scratch);
+  gDrawlist.scratch = wfTagMalloc(WF_MEM_DRAWLIST, gDrawlist.capacity * sizeof(struct entry));
 }
 
 static void printKey(union gfxDrawlistKey *k) {
@@ -78,13 +244,14 @@ static void printKey(union gfxDrawlistKey *k) {
 
   switch (k->gen.type) {
   case KEY_TYPE_MODEL:
-    trace("the specific fields are:\n\tmodel = %u\n\ttexture = %u\n\tshader = %u\n\tparams = %u\n\tdepth = %u\n\tmaterial = %u\n",
-          k->mod.model,
-          k->mod.texture,
-          k->mod.shader,
-          k->mod.params,
-          k->mod.depth,
-          k->mod.material);
+    trace("the specific fields are:\n\tmodel = %u\n\tlod = %u\n\ttexture = %u\n\tshader = %u\n\tparams = %u\n\tdepth = %u\n\tmaterial = %u\n",
+          GFX_KEY_GET(*k, model),
+          GFX_KEY_GET(*k, lod),
+          GFX_KEY_GET(*k, texture),
+          GFX_KEY_GET(*k, shader),
+          GFX_KEY_GET(*k, params),
+          GFX_KEY_GET(*k, depth),
+          GFX_KEY_GET(*k, material));
     break;
   case KEY_TYPE_COMMAND:
     trace("the specific fields are:\n\tsequence = %u\n\tid = %u\n",
@@ -103,55 +270,46 @@ static void printDrawlist(const struct gfxDrawlist *dl, size_t count) {
   }
 }
 
+#ifdef DRAWLIST_QSORT
 static int compare(const void *p1, const void *p2) {
-  /* TODO: branch on translucency... (sort back to front only when translucent) */
   uint64_t a = ((const struct entry *)p1)->key.intrep;
   uint64_t b = ((const struct entry *)p2)->key.intrep;
 
   return (a < b) ? -1 : (a > b) ? 1 : 0;
 }
+#endif
 
-/**
- * TODO: take care of translucency, sort translucent materials back-to-front
- */
+/* sorts the drawlist and compacts away the deleted entries, this happens
+ * at most once per frame. Removals just flag their entry, so they never
+ * have to search or shift anything. Translucent models come out back to
+ * front, their keys have the depth above the state (see
+ * TRANSLUCENT_FIELDS). */
 static void sortDrawlist() {
   if (gDrawlist.dirty) {
     trace("before sort:\n");
-    printDrawlist(&gDrawlist, 8);
+    printDrawlist(&gDrawlist, MIN(gDrawlist.count, 8));
 
-    /* sort */
-    qsort(gDrawlist.entries, MAX_DRAWLIST_ENTRIES, sizeof(gDrawlist.entries[0]), compare);
+#ifdef DRAWLIST_QSORT
+    qsort(gDrawlist.entries, gDrawlist.count, sizeof(gDrawlist.entries[0]), compare);
+#else
+    radix_sort_u64(gDrawlist.entries, gDrawlist.scratch, gDrawlist.count, sizeof(gDrawlist.entries[0]));
+#endif
 
     trace("after sort:\n");
-    printDrawlist(&gDrawlist, 8);
-
-    /* find out where the last active member is
-         * optimization: to start searching upwards/downwards
-         * from the last position. Since the deleted flag is in the
-         * most significant bit, all deleted entries will naturally
-         * float to the top of the list when sorting. */
-    struct entry lastmark = gDrawlist.entries[gDrawlist.nextId];
-    if (lastmark.key.gen.deleted) {
-      /* loop down */
-      unsigned int i;
-      for (i = gDrawlist.nextId; i != 0; --i) {
-        if (gDrawlist.entries[i].key.gen.deleted || i == 0) {
-          gDrawlist.nextId = i;
-          break;
-        }
-      }
-    } else {
-      /* loop up */
-      unsigned int i;
-      for (i = gDrawlist.nextId; i < MAX_DRAWLIST_ENTRIES; ++i) {
-        if (gDrawlist.entries[i].key.gen.deleted) {
-          gDrawlist.nextId = i;
-          break;
-        }
-      }
+    printDrawlist(&gDrawlist, MIN(gDrawlist.count, 8));
+
+    /* the deleted flag is the most significant bit, so all deleted entries
+         * naturally float to the end of the list when sorting, chop them
+         * off. */
+    size_t live = gDrawlist.count;
+    while (live != 0 && gDrawlist.entries[live - 1].key.gen.deleted) {
+      --live;
+    }
+    gDrawlist.count = live;
 
-      /* check that the list is not somehow entirely filled */
-      assert(i != MAX_DRAWLIST_ENTRIES - 1);
+    /* entries have moved, point their slots at the new positions */
+    for (size_t i = 0; i < live; ++i) {
+      gDrawlist.slots[gDrawlist.entries[i].slot].index = (uint32_t)i;
     }
 
     gDrawlist.dirty = 0;
@@ -160,70 +318,911 @@ static void sortDrawlist() {
   }
 }
 
-/* as per http://aras-p.info/blog/2014/01/16/rough-sorting-by-depth/ */
+/* as per http://aras-p.info/blog/2014/01/16/rough-sorting-by-depth/
+ *
+ * for positive floats the bit pattern sorts the same way as the float
+ * itself, so the upper bits (below the sign) make a fine coarse depth.
+ * Anything behind the camera (or NaN) ends up at 0. */
 static unsigned int quantizeDepth(float depth, unsigned char bits) {
+  if (!(depth > 0.0f)) return 0;
+
   /* interpret float representation as int */
   union {
     float f;
-    unsigned i;
+    uint32_t i;
   } f2i;
   f2i.f = depth;
 
-  /* take the upper X bits */
-  return f2i.i >> bits;
+  /* take the upper X bits, skipping the sign bit */
+  return (unsigned int)(f2i.i >> (31 - bits));
+}
+
+/* opaque geometry goes front-to-back so early-z can reject as much as
+ * possible, translucent geometry has to be drawn back-to-front, so we
+ * invert the depth. */
+static unsigned int depthKey(float depth, unsigned int translucency) {
+  const unsigned int q = quantizeDepth(depth, DEPTH_BITS);
+
+  return (translucency == OPAQUE) ? q : DEPTH_MASK - q;
+}
+
+/* the modelview matrix an operation gets drawn with, quantized models get
+ * their position decode (see quantize.h) folded in so the shaders don't
+ * have to know about it */
+static void drawMatrix(const struct gfxDrawOperation *op, float *out) {
+  const struct gfxModel *model = op->model;
+
+  if (!model->quantized) {
+    memcpy(out, &op->params->modelviewMatrix, sizeof(mat4));
+    return;
+  }
+
+  const float *d = model->decode;
+  const mat4 decode = mat(vec(d[3], 0.0f, 0.0f, 0.0f), vec(0.0f, d[3], 0.0f, 0.0f), vec(0.0f, 0.0f, d[3], 0.0f),
+                          vec(d[0], d[1], d[2], 1.0f));
+
+  mstoreu(out, mmmul(mloadu((const float *)&op->params->modelviewMatrix), decode));
+}
+
+/* view-space depth of the centres of the bounds of 4 draw operations at
+ * once. Only the z row of every modelview matrix matters, so we transpose
+ * into SoA form and do all 4 dot products in one go. The camera looks down
+ * -z, hence the negation. */
+static vec4 viewDepth4(const struct gfxDrawOperation *const ops[4]) {
+  const vec4 half = vscalar(0.5f);
+
+  vec4 c[4];
+  const mat4 *m[4];
+
+  for (int i = 0; i < 4; ++i) {
+    c[i] = vmul(vadd(ops[i]->model->bounds.min, ops[i]->model->bounds.max), half);
+    m[i] = &ops[i]->params->modelviewMatrix;
+  }
+
+  const vec4 cx = vec(c[0][0], c[1][0], c[2][0], c[3][0]);
+  const vec4 cy = vec(c[0][1], c[1][1], c[2][1], c[3][1]);
+  const vec4 cz = vec(c[0][2], c[1][2], c[2][2], c[3][2]);
+
+  const vec4 r0 = vec(m[0]->cols[0][2], m[1]->cols[0][2], m[2]->cols[0][2], m[3]->cols[0][2]);
+  const vec4 r1 = vec(m[0]->cols[1][2], m[1]->cols[1][2], m[2]->cols[1][2], m[3]->cols[1][2]);
+  const vec4 r2 = vec(m[0]->cols[2][2], m[1]->cols[2][2], m[2]->cols[2][2], m[3]->cols[2][2]);
+  const vec4 r3 = vec(m[0]->cols[3][2], m[1]->cols[3][2], m[2]->cols[3][2], m[3]->cols[3][2]);
+
+  const vec4 z = vadd(vadd(vmul(r0, cx), vmul(r1, cy)), vadd(vmul(r2, cz), r3));
+
+  return vsub(vzero(), z);
+}
+
+/* picks the coarsest LOD of the model whose error stays under
+ * gDrawlist.lodPixels on screen. The bounding sphere of the model goes
+ * through the modelview and projection matrices: its nearest point sets
+ * how many pixels an object-space unit covers, for perspective and
+ * orthographic projections alike. */
+static unsigned int selectLod(const struct gfxDrawOperation *op) {
+  const struct gfxModel *model = op->model;
+
+  if (model->numLods < 2 || gDrawlist.lodPixels <= 0.0f) return 0;
+
+  const mat4 *mv = &op->params->modelviewMatrix;
+  const mat4 *proj = &op->layer->uniforms.projectionMatrix;
+
+  float c[4], e[4];
+  vstoreu(c, vmul(vadd(model->bounds.min, model->bounds.max), vscalar(0.5f)));
+  vstoreu(e, vsub(model->bounds.max, model->bounds.min));
+
+  const float radius = 0.5f * sqrtf(e[0] * e[0] + e[1] * e[1] + e[2] * e[2]);
+
+  /* the largest scale of the modelview matrix */
+  float scale = 0.0f;
+  for (int i = 0; i < 3; ++i) {
+    const float s = mv->cols[i][0] * mv->cols[i][0] + mv->cols[i][1] * mv->cols[i][1] + mv->cols[i][2] * mv->cols[i][2];
+    scale = fmaxf(scale, s);
+  }
+  scale = sqrtf(scale);
+
+  /* the camera looks down -z, so the nearest point is at +radius */
+  const float z = mv->cols[0][2] * c[0] + mv->cols[1][2] * c[1] + mv->cols[2][2] * c[2] + mv->cols[3][2] + radius * scale;
+  const float w = proj->cols[2][3] * z + proj->cols[3][3];
+
+  /* the camera is inside the sphere */
+  if (w <= FLT_EPSILON) return 0;
+
+  const float pixelsPerUnit = scale * proj->cols[1][1] / w * gDrawlist.lodHalfHeight;
+
+  unsigned int lod = model->numLods - 1;
+  while (lod > 0 && model->lods[lod].error * pixelsPerUnit > gDrawlist.lodPixels) --lod;
+
+  return lod;
+}
+
+/* regenerates the depth of a batch of (at most 4) entries, returns how
+ * many keys actually changed */
+static size_t depthBatch(struct entry *const batch[4], size_t n) {
+  const struct gfxDrawOperation *ops[4];
+
+  /* pad the batch by repeating the first operation */
+  for (size_t i = 0; i < 4; ++i) {
+    ops[i] = batch[i < n ? i : 0]->op;
+  }
+
+  float depth[4];
+  vstoreu(depth, viewDepth4(ops));
+
+  size_t changed = 0;
+
+  for (size_t i = 0; i < n; ++i) {
+    struct entry *e = batch[i];
+    const unsigned int d = depthKey(depth[i], e->key.gen.translucency);
+
+    const unsigned int lod = selectLod(e->op);
+
+    if (GFX_KEY_GET(e->key, depth) != d || GFX_KEY_GET(e->key, lod) != lod) {
+      GFX_KEY_SET(e->key, depth, d & DEPTH_MASK);
+      GFX_KEY_SET(e->op->key, depth, d & DEPTH_MASK);
+      GFX_KEY_SET(e->key, lod, lod & (GFX_MAX_LODS - 1));
+      GFX_KEY_SET(e->op->key, lod, lod & (GFX_MAX_LODS - 1));
+
+      ++changed;
+    }
+  }
+
+  return changed;
+}
+
+/* the per-frame depth pass, call this after the camera or any of the
+ * models moved (i.e.: every frame), before rendering. It picks the LODs
+ * again as well. The drawlist only gets re-sorted when a depth or LOD
+ * actually changed. */
+void gfxDrawlistUpdateDepth() {
+  struct entry *batch[4];
+  size_t n = 0;
+  size_t changed = 0;
+
+  for (size_t i = 0; i < gDrawlist.count; ++i) {
+    struct entry *e = &gDrawlist.entries[i];
+
+    if (e->key.gen.deleted || e->key.gen.type != KEY_TYPE_MODEL) continue;
+
+    batch[n++] = e;
+
+    if (n == 4) {
+      changed += depthBatch(batch, n);
+      n = 0;
+    }
+  }
+
+  if (n != 0) {
+    changed += depthBatch(batch, n);
+  }
+
+  if (changed) {
+    gDrawlist.dirty = 1;
+  }
+}
+
+/* LODs get picked so that they're off by at most `pixels` on a viewport
+ * that's viewportHeight pixels high, 0 turns LODs off. Takes effect with
+ * the next gfxGenRenderKey() or gfxDrawlistUpdateDepth(). */
+void gfxDrawlistSetLodError(float pixels, float viewportHeight) {
+  gDrawlist.lodPixels = pixels;
+  gDrawlist.lodHalfHeight = 0.5f * viewportHeight;
 }
 
 void gfxGenRenderKey(struct gfxDrawOperation *op) {
   union gfxDrawlistKey key = {0};
 
   key.gen.layer = op->layer->id;
-  key.mod.texture = op->model->texture[0];
-  key.mod.model = op->model->id;
-  key.mod.shader = op->program->id;
+  key.gen.type = KEY_TYPE_MODEL;
+  key.gen.translucency = (op->params->blend == GFX_NONE) ? OPAQUE : NORMAL;
+  GFX_KEY_SET(key, texture, op->model->texture[0]);
+  GFX_KEY_SET(key, model, op->model->id);
+  GFX_KEY_SET(key, shader, op->program->id);
 
-  /* TODO: how to efficiently calculate the depth...
-     * (in which pass?), obviously this just needs an
-     * approximation so we could go for the center of the
-     * AABB or OBB. and transform that...
-     * key.mod.depth = quantizeDepth(34.4f, 10); */
+  /* the initial depth, gfxDrawlistUpdateDepth keeps it up to date */
+  const struct gfxDrawOperation *ops[4] = {op, op, op, op};
+  GFX_KEY_SET(key, depth, depthKey(vfirst(viewDepth4(ops)), key.gen.translucency) & DEPTH_MASK);
+  GFX_KEY_SET(key, lod, selectLod(op) & (GFX_MAX_LODS - 1));
 
   op->key = key;
 
   printKey(&key);
 }
 
-void gfxDrawlistAdd(struct gfxDrawOperation *op) {
-  /* at some point we might try to re-allocate or something... */
-  assert(gDrawlist.nextId < MAX_DRAWLIST_ENTRIES);
+unsigned int gfxDrawlistRegisterCommand(gfxDrawCommandFunc func, void *userdata) {
+  assert(func);
 
-  gDrawlist.dirty = 1;
+  /* there's never a lot of commands, just look for a hole first */
+  unsigned int index = 0;
+  while (index < gDrawlist.numCommands && gDrawlist.commands[index].func) {
+    ++index;
+  }
+
+  if (index == gDrawlist.numCommands) {
+    gDrawlist.commands = wfTagRealloc(WF_MEM_DRAWLIST, gDrawlist.commands, (index + 1) * sizeof(struct command));
+    ++gDrawlist.numCommands;
+  }
+
+  gDrawlist.commands[index].func = func;
+  gDrawlist.commands[index].userdata = userdata;
+
+  return index + 1;
+}
+
+/* draw operations that still refer to the command are skipped */
+void gfxDrawlistUnregisterCommand(unsigned int id) {
+  if (id == 0 || id > gDrawlist.numCommands) return;
+
+  gDrawlist.commands[id - 1].func = NULL;
+  gDrawlist.commands[id - 1].userdata = NULL;
+}
+
+/* command operations don't need a model, params or program. If op->layer
+ * is set, the layer gets bound when the command executes, like for
+ * models. */
+void gfxGenCommandKey(struct gfxDrawOperation *op, unsigned int layer, unsigned int id, unsigned int sequence) {
+  union gfxDrawlistKey key = {0};
+
+  key.gen.layer = layer & 0x3;
+  key.gen.type = KEY_TYPE_COMMAND;
+  key.cmd.id = id;
+  key.cmd.sequence = sequence & 0xFF;
+
+  op->key = key;
+}
+
+static void runCommand(const struct gfxDrawOperation *op, unsigned int id) {
+  if (id == 0 || id > gDrawlist.numCommands || !gDrawlist.commands[id - 1].func) {
+    trace("skipping unknown drawlist command %u\n", id);
+    return;
+  }
+
+  const struct command *cmd = &gDrawlist.commands[id - 1];
+  cmd->func(op, cmd->userdata);
+
+  gDrawlist.stats.commands++;
+}
+
+gfxDrawHandle gfxDrawlistAdd(struct gfxDrawOperation *op) {
+  if (gDrawlist.count == gDrawlist.capacity) {
+    growEntries();
+  }
+
+  const uint32_t slot = allocSlot();
+  const uint32_t index = (uint32_t)gDrawlist.count++;
+
+  gDrawlist.slots[slot].index = index;
 
   struct entry e = {
       .key = op->key,
-      .op = op};
+      .op = op,
+      .slot = slot};
+
+  /* the deleted flag is our business, never the callers' */
+  e.key.gen.deleted = 0;
 
-  gDrawlist.entries[gDrawlist.nextId++] = e;
+  gDrawlist.entries[index] = e;
+  gDrawlist.dirty = 1;
+
+  return makeHandle(slot, gDrawlist.slots[slot].generation);
 }
 
-/* remove culled objects */
-void gfxDrawlistRemove(struct gfxDrawOperation *op) {
-  /* assume the list is sorted */
-  ssize_t idx = findIndex(op);
+/* re-reads the key of the draw operation, call this after regenerating it */
+void gfxDrawlistUpdate(gfxDrawHandle handle) {
+  const uint32_t slot = resolveHandle(handle);
+  if (slot == SLOT_NONE) {
+    trace("stale drawlist handle 0x%08x\n", handle);
+    return;
+  }
+
+  struct entry *e = &gDrawlist.entries[gDrawlist.slots[slot].index];
+
+  e->key = e->op->key;
+  e->key.gen.deleted = 0;
 
-  if (idx != -1) {
-    clearEntry((size_t)idx);
+  gDrawlist.dirty = 1;
+}
+
+/* remove culled objects, O(1), the entry just gets flagged and will be
+ * compacted away by the next sort */
+void gfxDrawlistRemove(gfxDrawHandle handle) {
+  const uint32_t slot = resolveHandle(handle);
+  if (slot == SLOT_NONE) {
+    trace("stale drawlist handle 0x%08x\n", handle);
+    return;
   }
 
+  gDrawlist.entries[gDrawlist.slots[slot].index].key.gen.deleted = 1;
+  freeSlot(slot);
+
   gDrawlist.dirty = 1;
 }
 
+/* brings the drawlist in line with a visibility mask (see gfxCullBoxes()),
+ * bit i says whether ops[i] should be drawn. handles[i] is the handle of
+ * ops[i] or GFX_DRAW_HANDLE_NONE if it isn't in the drawlist, newly visible
+ * operations get added and newly culled ones removed. */
+void gfxDrawlistSetVisibility(struct gfxDrawOperation **ops, gfxDrawHandle *handles,
+                              const uint32_t *visible, size_t count) {
+  for (size_t i = 0; i < count; ++i) {
+    const int show = (visible[i >> 5] >> (i & 31)) & 1;
+
+    if (show && handles[i] == GFX_DRAW_HANDLE_NONE) {
+      handles[i] = gfxDrawlistAdd(ops[i]);
+    } else if (!show && handles[i] != GFX_DRAW_HANDLE_NONE) {
+      gfxDrawlistRemove(handles[i]);
+      handles[i] = GFX_DRAW_HANDLE_NONE;
+    }
+  }
+}
+
+/* removes everything, all outstanding handles become stale */
 void gfxDrawlistClear() {
-  for (unsigned int i = 0; i < MAX_DRAWLIST_ENTRIES; ++i) {
-    clearEntry(i);
+  for (size_t i = 0; i < gDrawlist.count; ++i) {
+    struct entry *e = &gDrawlist.entries[i];
+
+    if (!e->key.gen.deleted) {
+      freeSlot(e->slot);
+    }
   }
 
   gDrawlist.dirty = 1;
-  gDrawlist.nextId = 0;
+  gDrawlist.count = 0;
+}
+
+void gfxDrawlistInit(const struct gfxRenderer *renderer) {
+  if (gDrawlist.instanceVbo) {
+    glDeleteBuffers(1, &gDrawlist.instanceVbo);
+    gDrawlist.instanceVbo = 0;
+  }
+
+  if (gDrawlist.indirectBuffer) {
+    glDeleteBuffers(1, &gDrawlist.indirectBuffer);
+    gDrawlist.indirectBuffer = 0;
+  }
+
+#ifdef DRAWLIST_INSTANCING
+  if (renderer->instancing) {
+    glGenBuffers(1, &gDrawlist.instanceVbo);
+    glBindBuffer(GL_ARRAY_BUFFER, gDrawlist.instanceVbo);
+    glBufferData(GL_ARRAY_BUFFER, DRAWLIST_INSTANCE_SLOTS * sizeof(mat4), NULL, GL_STREAM_DRAW);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+    GL_ERROR("create instance buffer");
+
+    gDrawlist.instanceOffset = 0;
+  }
+#endif
+
+#ifdef DRAWLIST_INDIRECT
+  /* the per-draw matrices come from the instance buffer */
+  if (renderer->multiDrawIndirect && gDrawlist.instanceVbo) {
+    glGenBuffers(1, &gDrawlist.indirectBuffer);
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, gDrawlist.indirectBuffer);
+    glBufferData(GL_DRAW_INDIRECT_BUFFER, DRAWLIST_INSTANCE_SLOTS * sizeof(struct indirectCommand), NULL, GL_STREAM_DRAW);
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+
+    GL_ERROR("create indirect buffer");
+
+    gDrawlist.indirectOffset = 0;
+  }
+#endif
+
+  trace("drawlist instancing is %s, multi-draw indirect is %s\n",
+        gDrawlist.instanceVbo ? "enabled" : "disabled",
+        gDrawlist.indirectBuffer ? "enabled" : "disabled");
+}
+
+void gfxDrawlistGetStats(struct gfxDrawlistStats *stats) {
+  *stats = gDrawlist.stats;
+}
+
+void gfxDrawlistDestroy() {
+  if (gDrawlist.instanceVbo) {
+    glDeleteBuffers(1, &gDrawlist.instanceVbo);
+  }
+
+  if (gDrawlist.indirectBuffer) {
+    glDeleteBuffers(1, &gDrawlist.indirectBuffer);
+  }
+
+  wfTagFree(WF_MEM_DRAWLIST, gDrawlist.entries);
+  wfTagFree(WF_MEM_DRAWLIST, gDrawlist.scratch);
+  wfTagFree(WF_MEM_DRAWLIST, gDrawlist.slots);
+  wfTagFree(WF_MEM_DRAWLIST, gDrawlist.frame);
+  wfTagFree(WF_MEM_DRAWLIST, gDrawlist.commands);
+
+  memset(&gDrawlist, 0x0, sizeof(gDrawlist));
+  gDrawlist.freeList = SLOT_NONE;
+}
+
+struct gfxDrawBucket *gfxDrawBucketCreate() {
+  return wfTagCalloc(WF_MEM_DRAWLIST, sizeof(struct gfxDrawBucket));
+}
+
+void gfxDrawBucketDestroy(struct gfxDrawBucket *bucket) {
+  if (!bucket) return;
+
+  assert(!bucket->submitted);
+
+  wfTagFree(WF_MEM_DRAWLIST, bucket->entries);
+  wfTagFree(WF_MEM_DRAWLIST, bucket->scratch);
+  wfTagFree(WF_MEM_DRAWLIST, bucket);
+}
+
+void gfxDrawBucketAdd(struct gfxDrawBucket *bucket, struct gfxDrawOperation *op) {
+  assert(!bucket->submitted);
+
+  if (bucket->count == bucket->capacity) {
+    bucket->capacity = bucket->capacity ? bucket->capacity * 2 : DRAWLIST_INITIAL_CAPACITY;
+    bucket->entries = wfTagRealloc(WF_MEM_DRAWLIST, bucket->entries, bucket->capacity * sizeof(struct entry));
+
+    wfTagFree(WF_MEM_DRAWLIST, bucket->scratch);
+    bucket->scratch = wfTagMalloc(WF_MEM_DRAWLIST, bucket->capacity * sizeof(struct entry));
+  }
+
+  struct entry e = {
+      .key = op->key,
+      .op = op,
+      .slot = SLOT_NONE};
+
+  e.key.gen.deleted = 0;
+
+  bucket->entries[bucket->count++] = e;
+}
+
+/* a gfxBvhVisitFunc, for feeding the results of scene queries straight
+ * into a bucket. userdata is a struct gfxDrawVisible. */
+void gfxDrawBucketAddVisible(uint32_t id, void *userdata) {
+  const struct gfxDrawVisible *visible = userdata;
+
+  if (visible->occlusion) {
+    const struct gfxBoxes *boxes = visible->boxes;
+
+    aabb box;
+    box.min = vec(boxes->minX[id], boxes->minY[id], boxes->minZ[id], 1.0f);
+    box.max = vec(boxes->maxX[id], boxes->maxY[id], boxes->maxZ[id], 1.0f);
+
+    if (!gfxOcclusionTestBox(visible->occlusion, &box)) return;
+  }
+
+  gfxDrawBucketAdd(visible->bucket, visible->ops[id]);
+}
+
+/* sorts the bucket on the calling thread and hands it to the drawlist */
+void gfxDrawBucketSubmit(struct gfxDrawBucket *bucket) {
+  assert(!bucket->submitted);
+
+  radix_sort_u64(bucket->entries, bucket->scratch, bucket->count, sizeof(bucket->entries[0]));
+
+  const unsigned int index = __atomic_fetch_add(&gDrawlist.numBuckets, 1, __ATOMIC_ACQ_REL);
+
+  /* no room left this frame, the bucket doesn't get drawn but it's empty
+   * and usable again next frame */
+  if (index >= DRAWLIST_MAX_BUCKETS) {
+    trace("[WARNING] more than %d buckets submitted this frame, dropping %zu draw operations\n",
+          DRAWLIST_MAX_BUCKETS, bucket->count);
+    bucket->count = 0;
+    return;
+  }
+
+  bucket->submitted = 1;
+  gDrawlist.buckets[index] = bucket;
+}
+
+/* the buckets only live for one frame, empty them and make them available
+ * to their threads again */
+static void releaseBuckets() {
+  const unsigned int numBuckets = MIN(gDrawlist.numBuckets, DRAWLIST_MAX_BUCKETS);
+
+  for (unsigned int i = 0; i < numBuckets; ++i) {
+    struct gfxDrawBucket *bucket = gDrawlist.buckets[i];
+
+    bucket->count = 0;
+    bucket->submitted = 0;
+  }
+
+  gDrawlist.numBuckets = 0;
+}
+
+/* one sorted input of the k-way merge */
+struct run {
+  const struct entry *cur;
+  const struct entry *end;
+};
+
+/* on equal keys the run that came first wins, which keeps the merge stable
+ * (retained entries before bucket entries, buckets in submission order) */
+static int runLess(const struct run *runs, unsigned int a, unsigned int b) {
+  const uint64_t ka = runs[a].cur->key.intrep;
+  const uint64_t kb = runs[b].cur->key.intrep;
+
+  return ka < kb || (ka == kb && a < b);
+}
+
+static void siftDown(const struct run *runs, unsigned int *heap, unsigned int n, unsigned int i) {
+  for (;;) {
+    unsigned int smallest = i;
+    const unsigned int l = 2 * i + 1;
+    const unsigned int r = l + 1;
+
+    if (l < n && runLess(runs, heap[l], heap[smallest])) smallest = l;
+    if (r < n && runLess(runs, heap[r], heap[smallest])) smallest = r;
+    if (smallest == i) return;
+
+    const unsigned int tmp = heap[i];
+    heap[i] = heap[smallest];
+    heap[smallest] = tmp;
+
+    i = smallest;
+  }
+}
+
+/* produces the final, sorted stream of entries for this frame: the
+ * (sorted) retained drawlist merged with every submitted (and already
+ * sorted) bucket. The merge keeps a binary min-heap of run heads, so it's
+ * O(n log k) for k runs. If nothing was submitted, the retained list is
+ * returned as-is, no copying.
+ *
+ * All submitting threads need to be done (joined, past a barrier, ...)
+ * before this gets called. */
+static const struct entry *mergeFrame(size_t *count) {
+  sortDrawlist();
+
+  const unsigned int submitted = __atomic_load_n(&gDrawlist.numBuckets, __ATOMIC_ACQUIRE);
+  const unsigned int numBuckets = MIN(submitted, DRAWLIST_MAX_BUCKETS);
+
+  if (numBuckets == 0) {
+    *count = gDrawlist.count;
+    return gDrawlist.entries;
+  }
+
+  struct run runs[DRAWLIST_MAX_BUCKETS + 1];
+  unsigned int heap[DRAWLIST_MAX_BUCKETS + 1];
+  unsigned int numRuns = 0;
+  size_t total = 0;
+
+  runs[numRuns++] = (struct run){gDrawlist.entries, gDrawlist.entries + gDrawlist.count};
+  total += gDrawlist.count;
+
+  for (unsigned int i = 0; i < numBuckets; ++i) {
+    const struct gfxDrawBucket *bucket = gDrawlist.buckets[i];
+
+    runs[numRuns++] = (struct run){bucket->entries, bucket->entries + bucket->count};
+    total += bucket->count;
+  }
+
+  if (total > gDrawlist.frameCapacity) {
+    gDrawlist.frameCapacity = MAX(total, gDrawlist.frameCapacity * 2);
+
+    wfTagFree(WF_MEM_DRAWLIST, gDrawlist.frame);
+    gDrawlist.frame = wfTagMalloc(WF_MEM_DRAWLIST, gDrawlist.frameCapacity * sizeof(struct entry));
+  }
+
+  /* only non-empty runs go in the heap */
+  unsigned int n = 0;
+  for (unsigned int i = 0; i < numRuns; ++i) {
+    if (runs[i].cur != runs[i].end) heap[n++] = i;
+  }
+
+  for (unsigned int i = n / 2; i-- > 0;) {
+    siftDown(runs, heap, n, i);
+  }
+
+  struct entry *out = gDrawlist.frame;
+
+  while (n != 0) {
+    struct run *run = &runs[heap[0]];
+
+    *out++ = *run->cur++;
+
+    if (run->cur == run->end) {
+      heap[0] = heap[--n];
+    }
+
+    siftDown(runs, heap, n, 0);
+  }
+
+  *count = total;
+  return gDrawlist.frame;
+}
+
+/* does everything gfxDrawlistRender does, except for the rendering, the
+ * merged frame is copied out instead (at most max entries, either array
+ * can be NULL). Returns the total amount of entries in the frame. Meant for
+ * tools and tests that don't have a GL context. */
+size_t gfxDrawlistCollect(union gfxDrawlistKey *keys, struct gfxDrawOperation **ops, size_t max) {
+  size_t count;
+  const struct entry *frame = mergeFrame(&count);
+
+  const size_t n = MIN(count, max);
+  for (size_t i = 0; i < n; ++i) {
+    if (keys) keys[i] = frame[i].key;
+    if (ops) ops[i] = frame[i].op;
+  }
+
+  releaseBuckets();
+
+  return count;
+}
+
+/* the indices of the LOD an entry was keyed with, in the index buffer of
+ * its model. Models without a LOD chain draw all of their indices. */
+static void lodRange(const struct entry *e, GLuint *first, GLsizei *count) {
+  const struct gfxModel *model = e->op->model;
+  const unsigned int lod = GFX_KEY_GET(e->key, lod);
+
+  if (lod < model->numLods) {
+    *first = model->firstIndex + model->lods[lod].firstIndex;
+    *count = (GLsizei)model->lods[lod].numIndices;
+  } else {
+    *first = model->firstIndex;
+    *count = model->numIndices;
+  }
+}
+
+/* the byte offset of an index of a model in its index buffer */
+static GLvoid *indexOffset(const struct gfxModel *model, GLuint index) {
+  return (GLvoid *)(uintptr_t)(index * gfxIndexSize(model->indexType));
+}
+
+/* whether the draw operation of entry e can go in the same draw call as the
+ * first one of a run: same layer/viewport/translucency, same program and
+ * texture and the same fixed-function state. */
+static int sameBatch(const struct entry *first, const struct entry *e) {
+  const union gfxDrawlistKey fk = first->key;
+  const union gfxDrawlistKey k = e->key;
+  const struct gfxDrawOperation *fop = first->op;
+  const struct gfxDrawOperation *op = e->op;
+
+  return k.gen.type == KEY_TYPE_MODEL &&
+         k.gen.layer == fk.gen.layer &&
+         k.gen.viewport == fk.gen.viewport &&
+         k.gen.viewportLayer == fk.gen.viewportLayer &&
+         k.gen.translucency == fk.gen.translucency &&
+         GFX_KEY_GET(k, shader) == GFX_KEY_GET(fk, shader) &&
+         GFX_KEY_GET(k, texture) == GFX_KEY_GET(fk, texture) &&
+         op->model->texture[0] == fop->model->texture[0] &&
+         op->program == fop->program &&
+         op->layer == fop->layer &&
+         op->params->blend == fop->params->blend &&
+         op->params->cull == fop->params->cull;
+}
+
+/* returns the length of the run of draw operations starting at i that can
+ * be drawn with a single instanced call, they have to be the same model.
+ * Only the modelview matrix may differ. */
+static size_t instanceRun(const struct entry *frame, size_t i, size_t max) {
+  const struct gfxDrawOperation *first = frame[i].op;
+
+  if (!gDrawlist.instanceVbo || !first->program->instanced) return 1;
+
+  const size_t end = MIN(max, i + DRAWLIST_MAX_INSTANCES);
+
+  size_t j = i + 1;
+  while (j < end && frame[j].op->model == first->model && GFX_KEY_GET(frame[j].key, lod) == GFX_KEY_GET(frame[i].key, lod) &&
+         sameBatch(&frame[i], &frame[j])) {
+    ++j;
+  }
+
+  return j - i;
+}
+
+/* like instanceRun, but the models only have to share their geometry */
+static size_t indirectRun(const struct entry *frame, size_t i, size_t max) {
+  const struct gfxDrawOperation *first = frame[i].op;
+
+  if (!gDrawlist.indirectBuffer || !first->model->geometry || !first->program->instanced) return 1;
+
+  const size_t end = MIN(max, i + DRAWLIST_MAX_INSTANCES);
+
+  size_t j = i + 1;
+  while (j < end && frame[j].op->model->geometry == first->model->geometry && sameBatch(&frame[i], &frame[j])) ++j;
+
+  return j - i;
+}
+
+#ifdef DRAWLIST_INSTANCING
+/* streams the modelview matrices of the run into the instance buffer,
+ * returns the index of the first one */
+static size_t streamMatrices(const struct entry *run, size_t count) {
+  const GLsizeiptr size = (GLsizeiptr)(count * sizeof(mat4));
+
+  glBindBuffer(GL_ARRAY_BUFFER, gDrawlist.instanceVbo);
+
+  /* orphan the buffer when it's full, the driver hands us fresh storage
+   * while the GPU keeps reading the old one */
+  if (gDrawlist.instanceOffset + count > DRAWLIST_INSTANCE_SLOTS) {
+    glBufferData(GL_ARRAY_BUFFER, DRAWLIST_INSTANCE_SLOTS * sizeof(mat4), NULL, GL_STREAM_DRAW);
+    gDrawlist.instanceOffset = 0;
+  }
+
+  const size_t first = gDrawlist.instanceOffset;
+
+  /* we never write to a range that's in flight, so no need to sync */
+  mat4 *matrices = glMapBufferRange(GL_ARRAY_BUFFER, (GLintptr)(first * sizeof(mat4)), size,
+                                    GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+
+  for (size_t i = 0; i < count; ++i) {
+    drawMatrix(run[i].op, (float *)&matrices[i]);
+  }
+
+  glUnmapBuffer(GL_ARRAY_BUFFER);
+
+  gDrawlist.instanceOffset += count;
+
+  return first;
+}
+
+/* points the per-instance attributes of the (bound) VAO at the instance
+ * buffer, starting at matrix `first` */
+static void instanceAttribs(size_t first) {
+  const GLintptr offset = (GLintptr)(first * sizeof(mat4));
+
+  for (GLuint col = 0; col < 4; ++col) {
+    const GLuint loc = GFX_INSTANCE_MATRIX + col;
+
+    glEnableVertexAttribArray(loc);
+    glVertexAttribPointer(loc, 4, GL_FLOAT, GL_FALSE, sizeof(mat4), (GLvoid *)(offset + (GLintptr)(col * sizeof(vec4))));
+    glVertexAttribDivisor(loc, 1);
+  }
+}
+
+static void drawInstanced(const struct entry *run, size_t count) {
+  instanceAttribs(streamMatrices(run, count));
+
+  const struct gfxModel *model = run[0].op->model;
+
+  GLuint first;
+  GLsizei numIndices;
+  lodRange(&run[0], &first, &numIndices);
+
+  glDrawElementsInstancedBaseVertex(GL_TRIANGLES, numIndices, model->indexType,
+                                    indexOffset(model, first), (GLsizei)count, model->baseVertex);
+
+  gDrawlist.stats.drawCalls++;
+  gDrawlist.stats.instancedDrawCalls++;
+  gDrawlist.stats.instances += (unsigned int)count;
+}
+#endif
+
+#ifdef DRAWLIST_INDIRECT
+/* one command per model in the run (consecutive operations with the same
+ * model become instances of one command). The instance attributes start
+ * at the beginning of the instance buffer, every command picks its
+ * matrices through its base instance. */
+static void drawIndirect(const struct entry *run, size_t count) {
+  const size_t firstMatrix = streamMatrices(run, count);
+
+  instanceAttribs(0);
+
+  glBindBuffer(GL_DRAW_INDIRECT_BUFFER, gDrawlist.indirectBuffer);
+
+  /* there's never more commands than matrices in a run */
+  if (gDrawlist.indirectOffset + count > DRAWLIST_INSTANCE_SLOTS) {
+    glBufferData(GL_DRAW_INDIRECT_BUFFER, DRAWLIST_INSTANCE_SLOTS * sizeof(struct indirectCommand), NULL, GL_STREAM_DRAW);
+    gDrawlist.indirectOffset = 0;
+  }
+
+  const GLintptr offset = (GLintptr)(gDrawlist.indirectOffset * sizeof(struct indirectCommand));
+
+  struct indirectCommand *commands = glMapBufferRange(GL_DRAW_INDIRECT_BUFFER, offset, (GLsizeiptr)(count * sizeof(struct indirectCommand)),
+                                                      GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+
+  size_t n = 0;
+  for (size_t i = 0; i < count; ++i) {
+    const struct gfxModel *model = run[i].op->model;
+
+    if (n != 0 && run[i - 1].op->model == model && GFX_KEY_GET(run[i - 1].key, lod) == GFX_KEY_GET(run[i].key, lod)) {
+      commands[n - 1].instanceCount++;
+      continue;
+    }
+
+    GLuint first;
+    GLsizei numIndices;
+    lodRange(&run[i], &first, &numIndices);
+
+    commands[n++] = (struct indirectCommand){
+        .count = (GLuint)numIndices,
+        .instanceCount = 1,
+        .firstIndex = first,
+        .baseVertex = model->baseVertex,
+        .baseInstance = (GLuint)(firstMatrix + i),
+    };
+  }
+
+  glUnmapBuffer(GL_DRAW_INDIRECT_BUFFER);
+
+  /* the whole run lives in the same geometry, so it has one index type */
+  glMultiDrawElementsIndirect(GL_TRIANGLES, run[0].op->model->indexType, (GLvoid *)offset, (GLsizei)n, 0);
+
+  glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+
+  gDrawlist.indirectOffset += n;
+
+  gDrawlist.stats.drawCalls++;
+  gDrawlist.stats.indirectDrawCalls++;
+  gDrawlist.stats.indirectCommands += (unsigned int)n;
+  gDrawlist.stats.instances += (unsigned int)count;
+}
+#endif
+
+/* decides how the frame gets drawn (where the layer changes, which runs
+ * get instanced) and writes all uniforms it needs into the uniform ring up
+ * front. With the orphaning fallback the ring can't stay mapped while we
+ * draw, so this can't be done on the fly. The plan goes in the frame
+ * arena, wfFrameEnd() throws it away. */
+static const struct batch *planFrame(const struct entry *frame, size_t max) {
+  /* one per entry, only needed until the frame is drawn */
+  struct batch *batches = wfArenaAlloc(wfFrame(), max * sizeof(struct batch));
+
+  const size_t layerSize = gfxRingAligned(sizeof(struct gfxLayerUbo));
+  const size_t drawSize = gfxRingAligned(sizeof(mat4));
+
+  const struct gfxLayer *lLayer = NULL;
+  size_t bytes = 0;
+
+  for (size_t i = 0; i < max; i += batches[i].run) {
+    const union gfxDrawlistKey k = frame[i].key;
+    const struct gfxDrawOperation *op = frame[i].op;
+    struct batch *b = &batches[i];
+
+    b->run = 1;
+    b->mode = DRAW_SINGLE;
+    b->layerUniforms = UNIFORMS_NONE;
+    b->drawUniforms = UNIFORMS_NONE;
+
+    /* commands don't need to have a layer, so track the layer that's
+     * actually bound instead of relying on the key */
+    if (op->layer && op->layer != lLayer) {
+      lLayer = op->layer;
+
+      b->layerUniforms = UNIFORMS_PENDING;
+      bytes += layerSize;
+    }
+
+    if (k.gen.type == KEY_TYPE_COMMAND) {
+      /* the command could have bound anything, rebind afterwards */
+      lLayer = NULL;
+
+      continue;
+    }
+
+    /* consecutive operations that only differ in their modelview matrix
+     * become a single instanced draw, if they share their geometry they
+     * can even be different models. The matrices go in the instance
+     * buffer then. */
+    if ((b->run = indirectRun(frame, i, max)) > 1) {
+      b->mode = DRAW_INDIRECT;
+    } else if ((b->run = instanceRun(frame, i, max)) > 1) {
+      b->mode = DRAW_INSTANCED;
+    }
+
+    if (b->mode == DRAW_SINGLE && op->program->loc.drawBlockIndex != GL_INVALID_INDEX) {
+      b->drawUniforms = UNIFORMS_PENDING;
+      bytes += drawSize;
+    }
+  }
+
+  gfxRingBegin(bytes);
+
+  for (size_t i = 0; i < max; i += batches[i].run) {
+    const struct gfxDrawOperation *op = frame[i].op;
+    struct batch *b = &batches[i];
+
+    if (b->layerUniforms == UNIFORMS_PENDING) {
+      b->layerUniforms = gfxRingPush(&op->layer->uniforms, sizeof(struct gfxLayerUbo));
+    }
+
+    if (b->drawUniforms == UNIFORMS_PENDING) {
+      float matrix[16];
+      drawMatrix(op, matrix);
+      b->drawUniforms = gfxRingPush(matrix, sizeof(matrix));
+    }
+  }
+
+  gfxRingEnd();
+
+  return batches;
 }
 
 /* gfxDrawlistRender renders the current drawlist
@@ -275,7 +1274,9 @@ void gfxDrawlistClear() {
  * - Primitives share material: can stitch together?
  * - Primitives are the same: hardware/pseudo-instancing */
 void gfxDrawlistRender() {
-  sortDrawlist();
+  size_t max;
+  const struct entry *frame = mergeFrame(&max);
+  const struct batch *batches = planFrame(frame, max);
 
   /* initialize local state */
   unsigned int lLayer = 0;
@@ -283,25 +1284,30 @@ void gfxDrawlistRender() {
   unsigned int lViewportLayer = 0;
   unsigned int lTranslucency = 0;
 
-  /* model local state */
-  unsigned int lShader = 0;
-  unsigned int lTexture = 0;
+  /* program, VAO, textures and the rest are filtered by the state cache,
+   * which can't know what happened to GL since the last frame */
+  gfxStateReset();
+
+  memset(&gDrawlist.stats, 0x0, sizeof(gDrawlist.stats));
+  gDrawlist.stats.entries = (unsigned int)max;
 
   /* scan the sorted drawlist and create ad-hoc batches */
-  unsigned int max = gDrawlist.nextId;
   // trace("drawing %u entities\n", max);
 
-  const struct gfxDrawOperation *prevOp = NULL;
-  for (unsigned int i = 0; i < max; ++i) {
-    const struct entry e = gDrawlist.entries[i];
+  for (size_t i = 0; i < max; i += batches[i].run) {
+    const struct entry e = frame[i];
     const union gfxDrawlistKey k = e.key;
     const struct gfxDrawOperation *op = e.op;
+    const struct batch *b = &batches[i];
 
     if (k.gen.layer != lLayer) {
       // trace("%u: switching layer %u to layer %u\n", i, lLayer, k.gen.layer);
 
       lLayer = k.gen.layer;
-      gfxBatch(op->layer);
+    }
+
+    if (b->layerUniforms != UNIFORMS_NONE) {
+      gfxRingBind(GFX_UBO_LAYER, b->layerUniforms, sizeof(struct gfxLayerUbo));
     }
 
     if (k.gen.viewport != lViewport) {
@@ -316,36 +1322,62 @@ void gfxDrawlistRender() {
       lTranslucency = k.gen.translucency;
     }
 
+    if (k.gen.type == KEY_TYPE_COMMAND) {
+      runCommand(op, k.cmd.id);
+
+      /* the command could have touched any GL state, forget ours */
+      gfxStateInvalidate();
+
+      continue;
+    }
+
     if (k.gen.type == KEY_TYPE_MODEL) {
-      if (k.mod.shader != lShader) {
-        // trace("%u: switching shader %u to shader %u\n", i, lShader, k.mod.shader);
+      const struct gfxShaderProgram *program = (b->mode != DRAW_SINGLE) ? op->program->instanced : op->program;
 
-        lShader = k.mod.shader;
-        glUseProgram(op->program->id);
+      gfxStateUseProgram(program->id);
+      gfxStateBindVertexArray(op->model->vao);
+
+      if (GFX_KEY_GET(k, texture)) {
+        gfxStateBindTexture(0, op->model->texture[0]);
       }
 
-      glBindVertexArray(op->model->vao);
+      gfxSetShaderParams(program, op->layer, op->params);
 
-      if (k.mod.texture && k.mod.texture != lTexture) {
-        // trace("%u: switching texture %u to texture %u\n", i, lTexture, k.mod.texture);
+      if (b->drawUniforms != UNIFORMS_NONE) {
+        gfxRingBind(GFX_UBO_DRAW, b->drawUniforms, sizeof(mat4));
+      }
 
-        lTexture = k.mod.texture;
+      /* fire draw batch */
+#ifdef DRAWLIST_INDIRECT
+      if (b->mode == DRAW_INDIRECT) {
+        drawIndirect(&frame[i], b->run);
 
-        glActiveTexture(GL_TEXTURE0 + 0);
-        glBindTexture(GL_TEXTURE_2D, op->model->texture[0]);
+        continue;
       }
+#endif
 
-      gfxSetShaderParams(op->program, op->layer, op->params, prevOp ? prevOp->params : NULL);
+#ifdef DRAWLIST_INSTANCING
+      if (b->mode == DRAW_INSTANCED) {
+        drawInstanced(&frame[i], b->run);
 
-      /* fire draw batch */
-      glDrawElements(GL_TRIANGLES, op->model->numIndices, GL_UNSIGNED_BYTE, (GLvoid *)0);
+        continue;
+      }
+#endif
 
-      prevOp = op;
+      GLuint first;
+      GLsizei numIndices;
+      lodRange(&frame[i], &first, &numIndices);
+
+      glDrawElementsBaseVertex(GL_TRIANGLES, numIndices, op->model->indexType,
+                               indexOffset(op->model, first), op->model->baseVertex);
+      gDrawlist.stats.drawCalls++;
     }
   }
 
-  glBindVertexArray(0);
-  glUseProgram(0);
+  gfxStateBindVertexArray(0);
+  gfxStateUseProgram(0);
+
+  releaseBuckets();
 }
 
 void gfxDrawlistDebug() {
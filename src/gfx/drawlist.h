@@ -10,6 +10,7 @@
 #ifndef __drawlist_h__
 #define __drawlist_h__
 
+#include <stddef.h>
 #include <stdint.h>
 
 #include "macros.h"
@@ -43,9 +44,12 @@ typedef enum {
   SUBTRACTIVE,
 } translucency_t;
 
+/* commands sort before the models of the same layer/viewport/viewport
+ * layer/translucency. To run a command after a group of models, give it a
+ * later viewport layer or translucency. */
 typedef enum {
-  KEY_TYPE_MODEL = 0,
-  KEY_TYPE_COMMAND = 1
+  KEY_TYPE_COMMAND = 0,
+  KEY_TYPE_MODEL = 1
 } keytype_t;
 
 /* 2 + 2 + 2 + 2 + 1 + 1 = 10 bits */
@@ -63,12 +67,15 @@ typedef enum {
   unsigned int id : 32; \
   unsigned int sequence : 8;
 
-/* 16 + 16 + 8 + 6 + 8 = 54 bits
+/* 5 + 16 + 3 + 8 + 6 + 8 + 8 = 54 bits
  *
  * we put model after texture, shader
  * and params because if something uses
  * the same model, it probably uses the
- * same parameters
+ * same parameters. The LOD comes right
+ * after the model so that operations that
+ * draw the same LOD of a model stay
+ * together (and can be instanced)
  * TODO: test if splitting up depth is feasible,
  * or possibly a coarse depth only for the
  * non-translucent case. i.e.: only 6-8 bits
@@ -76,13 +83,26 @@ typedef enum {
  * in depth buckets, and save shader state
  * inside of the buckets */
 #define MODEL_FIELDS         \
-  unsigned int material : 8; \
+  unsigned int material : 5; \
   unsigned int depth : 16;   \
+  unsigned int lod : 3;      \
   unsigned int model : 8;    \
   unsigned int params : 6;   \
   unsigned int texture : 8;  \
   unsigned int shader : 8;
 
+/* the same 54 bits for translucent models, which have to be drawn back to
+ * front no matter what state they need: the (inverted) depth comes right
+ * below the generic fields, above all the state */
+#define TRANSLUCENT_FIELDS   \
+  unsigned int material : 5; \
+  unsigned int lod : 3;      \
+  unsigned int model : 8;    \
+  unsigned int params : 6;   \
+  unsigned int texture : 8;  \
+  unsigned int shader : 8;   \
+  unsigned int depth : 16;
+
 /* 54 bits, padding */
 #define EMPTY_FIELDS \
   unsigned int : 32; \
@@ -103,22 +123,122 @@ struct gfxDrawOpEntity {
   GENERIC_FIELDS
 } PACKED;
 
+struct gfxDrawOpTranslucent {
+  TRANSLUCENT_FIELDS
+  GENERIC_FIELDS
+} PACKED;
+
 union gfxDrawlistKey {
   uint64_t intrep;
   struct gfxDrawOpGeneric gen;
   struct gfxDrawOpCommand cmd;
   struct gfxDrawOpEntity mod;
+  struct gfxDrawOpTranslucent tra;
+};
+
+/* the model fields sit elsewhere in the keys of translucent models, go
+ * through these once the translucency of the key is set */
+#define GFX_KEY_TRANSLUCENT(k) ((k).gen.type == KEY_TYPE_MODEL && (k).gen.translucency != OPAQUE)
+#define GFX_KEY_GET(k, field) (GFX_KEY_TRANSLUCENT(k) ? (k).tra.field : (k).mod.field)
+#define GFX_KEY_SET(k, field, value) \
+  do {                               \
+    if (GFX_KEY_TRANSLUCENT(k)) {    \
+      (k).tra.field = (value);       \
+    } else {                         \
+      (k).mod.field = (value);       \
+    }                                \
+  } while (0)
+
+/* returned by gfxDrawlistAdd, stays valid until the draw operation is
+ * removed (or the drawlist is cleared), no matter how often the drawlist
+ * gets sorted. Stale handles are detected and ignored. 0 is never a valid
+ * handle. */
+typedef uint32_t gfxDrawHandle;
+
+#define GFX_DRAW_HANDLE_NONE 0
+
+/* counted by gfxDrawlistRender, always describes the last rendered frame */
+struct gfxDrawlistStats {
+  unsigned int entries;            /* draw operations in the frame */
+  unsigned int drawCalls;          /* glDrawElements* calls, instanced or not */
+  unsigned int instancedDrawCalls; /* of which instanced */
+  unsigned int indirectDrawCalls;  /* of which multi-draw indirect */
+  unsigned int indirectCommands;   /* commands in the indirect calls */
+  unsigned int instances;          /* draw operations covered by the instanced and indirect calls */
+  unsigned int commands;           /* commands executed */
 };
 
 struct gfxDrawOperation;
+struct gfxRenderer;
+struct gfxOcclusion;
+struct gfxBoxes;
 
 void gfxGenRenderKey(struct gfxDrawOperation *op);
 
-void gfxDrawlistAdd(struct gfxDrawOperation *op);
+/* commands are draw operations that do something else than drawing a
+ * model: clearing, switching render targets, calling back into the game,
+ * ... They're registered once, which gives them an id that goes in the
+ * key, and are executed when the sorted drawlist reaches them. The
+ * userdata is passed to the function on every execution. */
+typedef void (*gfxDrawCommandFunc)(const struct gfxDrawOperation *op, void *userdata);
+
+unsigned int gfxDrawlistRegisterCommand(gfxDrawCommandFunc func, void *userdata);
+void gfxDrawlistUnregisterCommand(unsigned int id);
+void gfxGenCommandKey(struct gfxDrawOperation *op, unsigned int layer, unsigned int id, unsigned int sequence);
+
+void gfxDrawlistInit(const struct gfxRenderer *renderer);
+void gfxDrawlistUpdateDepth();
+void gfxDrawlistSetLodError(float pixels, float viewportHeight);
+void gfxDrawlistGetStats(struct gfxDrawlistStats *stats);
+
+gfxDrawHandle gfxDrawlistAdd(struct gfxDrawOperation *op);
+void gfxDrawlistUpdate(gfxDrawHandle handle);
+void gfxDrawlistRemove(gfxDrawHandle handle);
+void gfxDrawlistSetVisibility(struct gfxDrawOperation **ops, gfxDrawHandle *handles,
+                              const uint32_t *visible, size_t count);
 void gfxDrawlistClear();
-void gfxDrawlistRemove(struct gfxDrawOperation *op);
+void gfxDrawlistDestroy();
 void gfxDrawlistRender();
 void gfxDrawlistDebug();
+size_t gfxDrawlistCollect(union gfxDrawlistKey *keys, struct gfxDrawOperation **ops, size_t max);
+
+/* per-thread submission buckets, for draw operations that only live for
+ * one frame. Every worker thread owns a bucket, culls its part of the scene
+ * and adds whatever is visible, then submits the bucket, which sorts it on
+ * the worker. gfxDrawlistRender merges all submitted buckets with the
+ * retained drawlist and empties them again, so they can be refilled next
+ * frame. A bucket must only be touched by a single thread at a time, and
+ * all workers need to have submitted before the main thread renders.
+ *
+ * Buckets allocate through zmalloc, so call
+ * zmalloc_enable_thread_safeness() before filling them from worker
+ * threads.
+ *
+ * One per worker thread (and per viewport, if need be) is more than
+ * enough, buckets submitted past DRAWLIST_MAX_BUCKETS in a frame are
+ * dropped: they're emptied without being drawn. */
+#define DRAWLIST_MAX_BUCKETS 64
+
+struct gfxDrawBucket;
+
+struct gfxDrawBucket *gfxDrawBucketCreate();
+void gfxDrawBucketDestroy(struct gfxDrawBucket *bucket);
+void gfxDrawBucketAdd(struct gfxDrawBucket *bucket, struct gfxDrawOperation *op);
+void gfxDrawBucketSubmit(struct gfxDrawBucket *bucket);
+
+/* what gfxDrawBucketAddVisible() needs: the bucket to fill and the draw
+ * operations, indexed by the ids the query hands out. With an occlusion
+ * buffer, the boxes (indexed by the same ids) get tested against it first
+ * and only what's not hidden is added. */
+struct gfxDrawVisible {
+  struct gfxDrawBucket *bucket;
+  struct gfxDrawOperation **ops;
+
+  const struct gfxOcclusion *occlusion;
+  const struct gfxBoxes *boxes;
+};
+
+void gfxDrawBucketAddVisible(uint32_t id, void *userdata);
 
 /**
  * alternatively, we could use defines and macros...
@@ -0,0 +1,358 @@
+/**
+ * This file is part of prototype.
+ *
+ * (c) 2014 Nicolas Hillegeer <nicolas@hillegeer.com>
+ *
+ * For the full copyright and license information, please view the LICENSE
+ * file that was distributed with the source code.
+ *
+ * Shared vertex/index buffers. Models that live in the same geometry share
+ * a VAO, a vertex buffer and an index buffer and are told apart by their
+ * base vertex and first index, which is what multi-draw indirect needs.
+ *
+ * The vertex and index ranges of the models are sub-allocated first-fit
+ * from a free list. Models come and go, so the free list fragments, when
+ * a model doesn't fit we compact everything into fresh buffers with
+ * glCopyBufferSubData (the data never goes through the CPU), and make the
+ * buffers bigger while we're at it if that's still not enough.
+ *
+ * All models in a geometry share its index type (multi-draw indirect takes
+ * only one), indices of another type get converted when they're added.
+ */
+
+#include "util.h"
+
+#define RANGE_NONE SIZE_MAX
+
+static void rangeInsert(struct gfxRangeAllocator *allocator, size_t i, struct gfxRange range) {
+  if (allocator->numFree == allocator->freeCapacity) {
+    allocator->freeCapacity = allocator->freeCapacity ? allocator->freeCapacity * 2 : 16;
+    allocator->free = zrealloc(allocator->free, allocator->freeCapacity * sizeof(struct gfxRange));
+  }
+
+  memmove(&allocator->free[i + 1], &allocator->free[i], (allocator->numFree - i) * sizeof(struct gfxRange));
+  allocator->free[i] = range;
+  allocator->numFree++;
+}
+
+static void rangeErase(struct gfxRangeAllocator *allocator, size_t i) {
+  memmove(&allocator->free[i], &allocator->free[i + 1], (allocator->numFree - i - 1) * sizeof(struct gfxRange));
+  allocator->numFree--;
+}
+
+/* everything is free afterwards */
+static void rangeReset(struct gfxRangeAllocator *allocator, size_t capacity) {
+  allocator->capacity = capacity;
+  allocator->used = 0;
+  allocator->numFree = 0;
+
+  if (capacity) {
+    rangeInsert(allocator, 0, (struct gfxRange){0, capacity});
+  }
+}
+
+/* returns the offset of the range, or RANGE_NONE if there's no free range
+ * that's big enough */
+static size_t rangeAlloc(struct gfxRangeAllocator *allocator, size_t size) {
+  if (size == 0) return 0;
+
+  for (size_t i = 0; i < allocator->numFree; ++i) {
+    struct gfxRange *range = &allocator->free[i];
+
+    if (range->size < size) continue;
+
+    const size_t offset = range->offset;
+
+    range->offset += size;
+    range->size -= size;
+
+    if (range->size == 0) {
+      rangeErase(allocator, i);
+    }
+
+    allocator->used += size;
+
+    return offset;
+  }
+
+  return RANGE_NONE;
+}
+
+static void rangeFree(struct gfxRangeAllocator *allocator, size_t offset, size_t size) {
+  if (size == 0) return;
+
+  /* the first free range after the one we're freeing */
+  size_t i = 0;
+  while (i < allocator->numFree && allocator->free[i].offset < offset) ++i;
+
+  struct gfxRange *prev = (i > 0) ? &allocator->free[i - 1] : NULL;
+  struct gfxRange *next = (i < allocator->numFree) ? &allocator->free[i] : NULL;
+
+  assert(!prev || prev->offset + prev->size <= offset);
+  assert(!next || offset + size <= next->offset);
+
+  allocator->used -= size;
+
+  const int mergePrev = prev && prev->offset + prev->size == offset;
+  const int mergeNext = next && offset + size == next->offset;
+
+  if (mergePrev && mergeNext) {
+    prev->size += size + next->size;
+    rangeErase(allocator, i);
+  } else if (mergePrev) {
+    prev->size += size;
+  } else if (mergeNext) {
+    next->offset = offset;
+    next->size += size;
+  } else {
+    rangeInsert(allocator, i, (struct gfxRange){offset, size});
+  }
+}
+
+/* (re)points the VAO at the buffers of the geometry */
+static void bindBuffers(struct gfxGeometry *geometry) {
+  const struct gfxVertexFormat *format = &geometry->format;
+
+  glBindVertexArray(geometry->vao);
+  glBindBuffer(GL_ARRAY_BUFFER, geometry->vbo);
+
+  for (unsigned int i = 0; i < format->numAttribs; ++i) {
+    const struct gfxVertexAttrib *attrib = &format->attribs[i];
+
+    glVertexAttribPointer(attrib->index, attrib->size, attrib->type, attrib->normalized, format->stride, (GLvoid *)(uintptr_t)attrib->offset);
+    glEnableVertexAttribArray(attrib->index);
+  }
+
+  /* the element array binding is part of the VAO state */
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, geometry->ibo);
+
+  glBindVertexArray(0);
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+  GL_ERROR("bind shared geometry buffers");
+}
+
+/* moves all models to the front of new buffers of the given capacity, in
+ * the order of the model list, which leaves a single free range at the
+ * end */
+static void relocate(struct gfxGeometry *geometry, size_t vertexCapacity, size_t indexCapacity) {
+  const size_t stride = (size_t)geometry->format.stride;
+  const size_t indexSize = gfxIndexSize(geometry->indexType);
+
+  GLuint buffers[2];
+  glGenBuffers(2, buffers);
+
+  glBindBuffer(GL_COPY_WRITE_BUFFER, buffers[0]);
+  glBufferData(GL_COPY_WRITE_BUFFER, (GLsizeiptr)(vertexCapacity * stride), NULL, GL_STATIC_DRAW);
+  glBindBuffer(GL_COPY_READ_BUFFER, geometry->vbo);
+
+  size_t numVertices = 0;
+  for (unsigned int i = 0; i < geometry->numModels; ++i) {
+    struct gfxModel *model = geometry->models[i];
+    const size_t size = model->numVertices * stride;
+
+    if (size) {
+      glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER,
+                          (GLintptr)((size_t)model->baseVertex * stride), (GLintptr)(numVertices * stride), (GLsizeiptr)size);
+    }
+
+    model->baseVertex = (int)numVertices;
+    numVertices += model->numVertices;
+  }
+
+  glBindBuffer(GL_COPY_WRITE_BUFFER, buffers[1]);
+  glBufferData(GL_COPY_WRITE_BUFFER, (GLsizeiptr)(indexCapacity * indexSize), NULL, GL_STATIC_DRAW);
+  glBindBuffer(GL_COPY_READ_BUFFER, geometry->ibo);
+
+  size_t numIndices = 0;
+  for (unsigned int i = 0; i < geometry->numModels; ++i) {
+    struct gfxModel *model = geometry->models[i];
+    const size_t size = (size_t)model->numIndices * indexSize;
+
+    if (size) {
+      glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER,
+                          (GLintptr)(model->firstIndex * indexSize), (GLintptr)(numIndices * indexSize), (GLsizeiptr)size);
+    }
+
+    model->firstIndex = (unsigned int)numIndices;
+    numIndices += (size_t)model->numIndices;
+  }
+
+  glBindBuffer(GL_COPY_READ_BUFFER, 0);
+  glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+  GL_ERROR("relocate shared geometry");
+
+  glDeleteBuffers(1, &geometry->vbo);
+  glDeleteBuffers(1, &geometry->ibo);
+
+  geometry->vbo = buffers[0];
+  geometry->ibo = buffers[1];
+
+  rangeReset(&geometry->vertices, vertexCapacity);
+  rangeReset(&geometry->indices, indexCapacity);
+
+  rangeAlloc(&geometry->vertices, numVertices);
+  rangeAlloc(&geometry->indices, numIndices);
+
+  bindBuffers(geometry);
+}
+
+void gfxCreateGeometry(struct gfxGeometry *geometry, const struct gfxVertexFormat *format, GLenum indexType,
+                       size_t vertexCapacity, size_t indexCapacity) {
+  memset(geometry, 0x0, sizeof(struct gfxGeometry));
+
+  assert(format->numAttribs <= GFX_MAX_VERTEX_ATTRIBS);
+
+  geometry->format = *format;
+  geometry->indexType = indexType;
+
+  rangeReset(&geometry->vertices, vertexCapacity);
+  rangeReset(&geometry->indices, indexCapacity);
+
+  glGenVertexArrays(1, &geometry->vao);
+  glGenBuffers(1, &geometry->vbo);
+  glGenBuffers(1, &geometry->ibo);
+
+  GL_ERROR("create VAO");
+
+  glBindBuffer(GL_ARRAY_BUFFER, geometry->vbo);
+  glBufferData(GL_ARRAY_BUFFER, (GLsizeiptr)(vertexCapacity * (size_t)format->stride), NULL, GL_STATIC_DRAW);
+
+  glBindBuffer(GL_COPY_WRITE_BUFFER, geometry->ibo);
+  glBufferData(GL_COPY_WRITE_BUFFER, (GLsizeiptr)(indexCapacity * gfxIndexSize(indexType)), NULL, GL_STATIC_DRAW);
+  glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+  GL_ERROR("create shared geometry buffers");
+
+  bindBuffers(geometry);
+}
+
+/* models that are still in the geometry are left without buffers */
+void gfxDestroyGeometry(struct gfxGeometry *geometry) {
+  for (unsigned int i = 0; i < geometry->numModels; ++i) {
+    geometry->models[i]->geometry = NULL;
+    geometry->models[i]->vao = 0;
+  }
+
+  glBindVertexArray(0);
+
+  glDeleteBuffers(1, &geometry->vbo);
+  glDeleteBuffers(1, &geometry->ibo);
+  glDeleteVertexArrays(1, &geometry->vao);
+
+  GL_ERROR("delete shared geometry");
+
+  zfree(geometry->vertices.free);
+  zfree(geometry->indices.free);
+  zfree(geometry->models);
+
+  memset(geometry, 0x0, sizeof(struct gfxGeometry));
+}
+
+/* adds a model to the geometry, vertices have to be in the format of the
+ * geometry, indices get converted to the index type of the geometry (they
+ * have to fit). The geometry gets defragmented and/or grown if the model
+ * doesn't fit, which moves the other models around. Returns 0 if the model
+ * could not be added, the model is left alone then. */
+int gfxGeometryAdd(struct gfxGeometry *geometry, struct gfxModel *model,
+                   const void *vertices, size_t numVertices,
+                   const void *indices, GLenum indexType, size_t numIndices) {
+  assert(gfxIndexSize(gfxIndexType(numVertices)) <= gfxIndexSize(geometry->indexType));
+
+  size_t baseVertex = rangeAlloc(&geometry->vertices, numVertices);
+  size_t firstIndex = rangeAlloc(&geometry->indices, numIndices);
+
+  if (baseVertex == RANGE_NONE || firstIndex == RANGE_NONE) {
+    if (baseVertex != RANGE_NONE) rangeFree(&geometry->vertices, baseVertex, numVertices);
+    if (firstIndex != RANGE_NONE) rangeFree(&geometry->indices, firstIndex, numIndices);
+
+    /* compacting might be enough, only grow if it isn't */
+    size_t vertexCapacity = MAX(geometry->vertices.capacity, 1);
+    size_t indexCapacity = MAX(geometry->indices.capacity, 1);
+
+    while (geometry->vertices.used + numVertices > vertexCapacity) vertexCapacity *= 2;
+    while (geometry->indices.used + numIndices > indexCapacity) indexCapacity *= 2;
+
+    trace("defragmenting geometry %u, room for %zu vertices and %zu indices\n",
+          geometry->vao, vertexCapacity, indexCapacity);
+
+    relocate(geometry, vertexCapacity, indexCapacity);
+
+    baseVertex = rangeAlloc(&geometry->vertices, numVertices);
+    firstIndex = rangeAlloc(&geometry->indices, numIndices);
+
+    if (baseVertex == RANGE_NONE || firstIndex == RANGE_NONE) {
+      trace("no room for %zu vertices and %zu indices in geometry %u\n", numVertices, numIndices, geometry->vao);
+      return 0;
+    }
+  }
+
+  const size_t stride = (size_t)geometry->format.stride;
+  const size_t indexSize = gfxIndexSize(geometry->indexType);
+
+  struct wfArena *scratch = wfScratch();
+  struct wfArenaMarker marker;
+  wfArenaMark(scratch, &marker);
+
+  if (indexType != geometry->indexType) {
+    void *converted = wfArenaAlloc(scratch, numIndices * indexSize);
+    gfxConvertIndices(converted, geometry->indexType, indices, indexType, numIndices);
+    indices = converted;
+  }
+
+  glBindBuffer(GL_ARRAY_BUFFER, geometry->vbo);
+  glBufferSubData(GL_ARRAY_BUFFER, (GLintptr)(baseVertex * stride), (GLsizeiptr)(numVertices * stride), vertices);
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+  /* the element array binding belongs to the bound VAO, go through the
+   * copy target so we don't change it */
+  glBindBuffer(GL_COPY_WRITE_BUFFER, geometry->ibo);
+  glBufferSubData(GL_COPY_WRITE_BUFFER, (GLintptr)(firstIndex * indexSize), (GLsizeiptr)(numIndices * indexSize), indices);
+  glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+  wfArenaRewind(scratch, &marker);
+
+  GL_ERROR("upload to shared geometry");
+
+  if (geometry->numModels == geometry->modelCapacity) {
+    geometry->modelCapacity = geometry->modelCapacity ? geometry->modelCapacity * 2 : 16;
+    geometry->models = zrealloc(geometry->models, geometry->modelCapacity * sizeof(struct gfxModel *));
+  }
+
+  model->vao = geometry->vao;
+  model->geometry = geometry;
+  model->geometryIndex = geometry->numModels;
+  model->baseVertex = (int)baseVertex;
+  model->firstIndex = (unsigned int)firstIndex;
+  model->numVertices = (unsigned int)numVertices;
+  model->numIndices = (int)numIndices;
+  model->indexType = geometry->indexType;
+
+  geometry->models[geometry->numModels++] = model;
+
+  return 1;
+}
+
+/* gives the ranges of the model back to the geometry */
+void gfxGeometryRemove(struct gfxGeometry *geometry, struct gfxModel *model) {
+  assert(model->geometry == geometry && geometry->models[model->geometryIndex] == model);
+
+  rangeFree(&geometry->vertices, (size_t)model->baseVertex, model->numVertices);
+  rangeFree(&geometry->indices, model->firstIndex, (size_t)model->numIndices);
+
+  struct gfxModel *last = geometry->models[--geometry->numModels];
+  geometry->models[model->geometryIndex] = last;
+  last->geometryIndex = model->geometryIndex;
+
+  model->vao = 0;
+  model->geometry = NULL;
+  model->baseVertex = 0;
+  model->firstIndex = 0;
+}
+
+/* packs all models together at the front of the buffers, so that all free
+ * space is in one piece at the end */
+void gfxGeometryDefrag(struct gfxGeometry *geometry) {
+  relocate(geometry, geometry->vertices.capacity, geometry->indices.capacity);
+}
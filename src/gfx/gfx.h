@@ -12,6 +12,8 @@
 
 #include "math/types.h"
 
+#include "simplify.h"
+
 /* the maximum lenght of a glsl identifier. As far as I could find glsl
  * doesn't define a maximum. WebGL specifies 256 bytes, so we'll stick to
  * that. */
@@ -31,14 +33,18 @@
 #define GFX_TANGENT          0x0004
 #define GFX_MAX_ATTRIB_ARRAY 0x0005
 
+/* per-instance attributes, a mat4 takes up 4 consecutive locations */
+#define GFX_INSTANCE_MATRIX 0x0005
+
 /* blend modes */
 #define GFX_NONE               0x0000
 #define GFX_BLEND_ALPHA        0x0001
 #define GFX_BLEND_PREMUL_ALPHA 0x0002
 
 /* projection modes */
-#define GFX_PERSPECTIVE 0x0000
-#define GFX_ORTHO       0x0001
+#define GFX_PERSPECTIVE     0x0000
+#define GFX_ORTHO           0x0001
+#define GFX_PERSPECTIVE_INF 0x0002 /* no far plane, see mat_perspective_fovy_inf_z() */
 
 /* cull face modes */
 /* #define GFX_NONE                0x0000 */
@@ -46,6 +52,10 @@
 #define GFX_CULL_BACK  0x0002
 
 #define GFX_UBO_LAYER 0x0001
+#define GFX_UBO_DRAW  0x0002
+
+/* the amount of frames the uniform ring (ring.c) keeps in flight */
+#define GFX_RING_FRAMES 3
 
 typedef enum {
   GFX_VBO_VERTEX = 0,
@@ -111,12 +121,17 @@ struct gfxUniformLocations {
   int timer;
 
   unsigned int matricesBlockIndex;
+  unsigned int drawBlockIndex;
 };
 
 struct gfxShaderProgram {
   unsigned int id;
 
   struct gfxUniformLocations loc;
+
+  /* the GFX_INSTANCED variant of this program, NULL if the shader doesn't
+   * support instancing */
+  struct gfxShaderProgram *instanced;
   // struct gfxShaderProgram *next;
 };
 
@@ -163,8 +178,12 @@ struct gfxLayer {
   unsigned int id;
 
   /* what's the projection of this layer like?
-     * GFX_PERSPECTIVE, GFX_ORTHO */
+     * GFX_PERSPECTIVE, GFX_ORTHO, GFX_PERSPECTIVE_INF */
   unsigned char projection;
+
+  /* the culling frustum of the projection matrix and the view of the
+   * frame, see gfxUpdateLayerFrustum() */
+  frustum frustum;
 };
 
 struct gfxRenderParams {
@@ -177,6 +196,70 @@ struct gfxRenderParams {
   unsigned char cull;
 };
 
+/* one attribute of an interleaved vertex, offset is in bytes */
+struct gfxVertexAttrib {
+  GLuint index; /* GFX_VERTEX, GFX_COLOR, ... */
+  GLint size;
+  GLenum type;
+  GLboolean normalized;
+  GLuint offset;
+};
+
+#define GFX_MAX_VERTEX_ATTRIBS GFX_MAX_ATTRIB_ARRAY
+
+/* attributes are laid out one after the other, every attribute and the
+ * stride are aligned to GFX_VERTEX_ALIGN bytes, see gfxVertexFormatAdd() */
+#define GFX_VERTEX_ALIGN 4
+
+struct gfxVertexFormat {
+  GLsizei stride;
+
+  unsigned int numAttribs;
+  struct gfxVertexAttrib attribs[GFX_MAX_VERTEX_ATTRIBS];
+};
+
+/* a free range of a gfxRangeAllocator */
+struct gfxRange {
+  size_t offset;
+  size_t size;
+};
+
+/* first-fit allocator of ranges in [0, capacity), the free ranges are kept
+ * sorted on offset so neighbours can be merged when freeing */
+struct gfxRangeAllocator {
+  size_t capacity;
+  size_t used;
+
+  struct gfxRange *free;
+  size_t numFree;
+  size_t freeCapacity;
+};
+
+/* vertex and index storage shared by many models of the same vertex
+ * format, they all use the same VAO so the drawlist can batch them
+ * together (multi-draw indirect) even if they're different models.
+ * Indices are of indexType, relative to the base vertex of their model.
+ *
+ * Ranges are sub-allocated from the buffers, when a model doesn't fit
+ * anymore the geometry first gets defragmented and then grown. */
+struct gfxGeometry {
+  struct gfxVertexFormat format;
+
+  unsigned int vao;
+  unsigned int vbo;
+  unsigned int ibo;
+  GLenum indexType;
+
+  /* in vertices and indices respectively */
+  struct gfxRangeAllocator vertices;
+  struct gfxRangeAllocator indices;
+
+  /* the models that live in here, defragmenting moves them around */
+  struct gfxModel **models;
+  unsigned int numModels;
+  unsigned int modelCapacity;
+};
+
 /* best to allocate sub-arrays in one fell swoop or use a really good allocator */
 struct gfxModel {
   unsigned int vao;
@@ -185,8 +268,36 @@ struct gfxModel {
   unsigned int ibo;
   int numIndices;
 
+  /* GL_UNSIGNED_BYTE, GL_UNSIGNED_SHORT or GL_UNSIGNED_INT, the smallest
+   * one that fits the vertices, see gfxIndexType() */
+  GLenum indexType;
+
+  /* where the model lives in its geometry, NULL (and 0, 0) if the model
+   * owns its buffers */
+  struct gfxGeometry *geometry;
+  int baseVertex;
+  unsigned int firstIndex;
+  unsigned int numVertices;
+  unsigned int geometryIndex;
+
   unsigned int texture[1];
   unsigned int id;
+
+  /* object-space bounds, see gfxModelBounds() */
+  aabb bounds;
+
+  /* positions are snorm16 (see quantize.h) and get decoded as
+   * decode.xyz + decode.w * position, the drawlist folds that into the
+   * modelview matrix */
+  int quantized;
+  float decode[4];
+
+  /* the LOD chain, ranges of the indices of the model (numIndices covers
+   * all of them). The drawlist picks one per draw operation, see
+   * gfxDrawlistSetLodError(). Without a chain (numLods == 0) the whole
+   * index range is drawn. */
+  unsigned int numLods;
+  struct gfxLod lods[GFX_MAX_LODS];
 };
 
 struct gfxDrawOperation {
@@ -199,6 +310,39 @@ struct gfxDrawOperation {
   struct gfxLayer *layer;
 };
 
+/* userdata for the gfxCmdClear drawlist command, mask is a combination of
+ * GL_*_BUFFER_BIT's */
+struct gfxClear {
+  unsigned int mask;
+
+  float color[4];
+  float depth;
+};
+
+/* userdata for the gfxCmdBindFramebuffer drawlist command, fbo 0 is the
+ * default framebuffer */
+struct gfxRenderTarget {
+  unsigned int fbo;
+
+  int x;
+  int y;
+  int width;
+  int height;
+};
+
+/* counted by the GL state cache (gfx/state.c) since the last
+ * gfxStateReset(), i.e.: for the last frame */
+struct gfxStateStats {
+  unsigned int issued;   /* state changes that went through to GL */
+  unsigned int filtered; /* redundant state changes that were dropped */
+};
+
+/* per frame, see gfxRingGetStats() */
+struct gfxRingStats {
+  unsigned int bytes;  /* pushed into the ring, alignment included */
+  unsigned int stalls; /* times we had to wait on the GPU for a region */
+};
+
 /* not in use yet, still deciding on the right format */
 struct gfxRenderer {
   struct gfxLayer **layers;
@@ -215,6 +359,18 @@ struct gfxRenderer {
      * of that parameter must be a multiple of
      * GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT. */
   int uboOffsetAlign;
+
+  /* whether per-instance vertex attributes are supported (GL 3.3 or
+     * GL_ARB_instanced_arrays), which the drawlist needs to instance */
+  int instancing;
+
+  /* whether buffers can be persistently mapped (GL 4.4 or
+     * GL_ARB_buffer_storage), the uniform ring falls back to orphaning */
+  int bufferStorage;
+
+  /* whether glMultiDrawElementsIndirect is available (GL 4.3 or
+     * GL_ARB_multi_draw_indirect), for models that share their geometry */
+  int multiDrawIndirect;
 };
 
 /**
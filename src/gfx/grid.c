@@ -0,0 +1,758 @@
+/**
+ * This file is part of prototype.
+ *
+ * (c) 2014 Nicolas Hillegeer <nicolas@hillegeer.com>
+ *
+ * For the full copyright and license information, please view the LICENSE
+ * file that was distributed with the source code.
+ *
+ * A hierarchical hash grid (see grid.h). The cells are loose: an object
+ * belongs to the cell its center is in, and because it's never bigger than
+ * the cell, it can't stick out more than half a cell on any side. So a
+ * cell only needs bounds that are twice as wide, which never change, and
+ * an object that moves just relinks when its center crosses into another
+ * cell. The objects of a cell form a doubly linked list through the object
+ * array, which is indexed by the slot of the handle.
+ *
+ * Cells that become empty are taken out of the hash table and recycled.
+ * When more than half of them are empty the cell array gets compacted, so
+ * a frustum query, which walks all cells, doesn't waste its time on them.
+ * A radius query looks up the cells around the center instead, unless
+ * there's more of those than the level has cells.
+ *
+ * Boxes get tested against the frustum with the p-vertex test of cull.c,
+ * one box against 4 planes at a time, so the grid finds exactly what
+ * gfxCullBoxes finds. A cell that's completely inside hands out all of its
+ * objects without testing them.
+ *
+ * Real-Time Collision Detection (Christer Ericson), 7.2 Grids
+ * Loose Octrees (Thatcher Ulrich), Game Programming Gems 1
+ *
+ * Doesn't touch GL.
+ */
+
+#include <assert.h>
+#include <float.h>
+#include <math.h>
+#include <string.h>
+#include <xmmintrin.h>
+
+#include "math/vector.h"
+
+#include "grid.h"
+#include "zmalloc.h"
+
+/* the biggest cells are 2^15 times as big as the smallest, objects that
+ * are bigger than that go in a single cell that's never culled */
+#define GRID_LEVELS    16
+#define GRID_OVERSIZED GRID_LEVELS
+
+/* the loose bounds get padded a bit, so that rounding when picking the
+ * cell can never put an object outside of them */
+#define GRID_PADDING (1.0f / 64.0f)
+
+/* compact the cells when more than half are empty, and at least this many */
+#define GRID_MIN_FREE_CELLS 64
+
+#define GRID_INITIAL_CAPACITY 64
+
+/* like the drawlist handles: a slot index in the lower bits, its
+ * generation in the upper bits */
+#define HANDLE_INDEX_BITS 20
+#define HANDLE_INDEX_MASK ((1u << HANDLE_INDEX_BITS) - 1)
+#define HANDLE_GEN_MASK   ((1u << (32 - HANDLE_INDEX_BITS)) - 1)
+#define HANDLE_MAX_SLOTS  (1u << HANDLE_INDEX_BITS)
+
+#define NONE UINT32_MAX
+
+enum updateType {
+  UPDATE_INSERT,
+  UPDATE_MOVE,
+  UPDATE_REMOVE
+};
+
+/* only ever touched by the writer. While a slot is free, next is the next
+ * free slot. */
+struct slot {
+  uint32_t generation;
+  uint32_t next;
+};
+
+struct update {
+  uint32_t type;
+  uint32_t slot;
+  uint32_t id;
+  float min[3];
+  float max[3];
+};
+
+struct cellKey {
+  int32_t x, y, z;
+  uint32_t level;
+};
+
+struct object {
+  /* w is 1, so they load straight into a vec4 */
+  float min[4];
+  float max[4];
+
+  /* the key of its cell, so a move that stays in the cell doesn't need
+   * to look at the cell at all */
+  struct cellKey key;
+
+  uint32_t id;
+  uint32_t cell; /* NONE while it's not in the grid */
+  uint32_t prev;
+  uint32_t next;
+};
+
+struct cell {
+  /* the loose bounds */
+  float min[4];
+  float max[4];
+
+  struct cellKey key;
+  uint32_t hash;
+
+  uint32_t head;  /* the first object, or the next free cell while empty */
+  uint32_t count; /* 0 means the cell is free */
+};
+
+struct gfxGrid {
+  float cellSize;
+
+  /* the writer's side, handles and queued changes */
+  struct slot *slots;
+  uint32_t numSlots;
+  uint32_t slotCapacity;
+  uint32_t freeSlots;
+
+  struct update *updates;
+  size_t numUpdates;
+  size_t updateCapacity;
+
+  /* what's committed, this is all the queries read */
+  struct object *objects;
+  uint32_t objectCapacity;
+  size_t numObjects;
+
+  struct cell *cells;
+  uint32_t numCells;
+  uint32_t cellCapacity;
+  uint32_t freeCells;
+  uint32_t numFreeCells;
+
+  /* open addressing (linear probing) on cell indices, at most half full */
+  uint32_t *table;
+  uint32_t tableSize;
+
+  /* live cells per level, the oversized one included */
+  uint32_t levelCells[GRID_LEVELS + 1];
+};
+
+static gfxGridHandle makeHandle(uint32_t slot, uint32_t generation) {
+  return (generation << HANDLE_INDEX_BITS) | slot;
+}
+
+static uint32_t resolveHandle(const struct gfxGrid *grid, gfxGridHandle handle) {
+  const uint32_t slot = handle & HANDLE_INDEX_MASK;
+  const uint32_t generation = handle >> HANDLE_INDEX_BITS;
+
+  if (slot >= grid->numSlots || grid->slots[slot].generation != generation) {
+    return NONE;
+  }
+
+  return slot;
+}
+
+static uint32_t allocSlot(struct gfxGrid *grid) {
+  if (grid->freeSlots != NONE) {
+    const uint32_t slot = grid->freeSlots;
+    grid->freeSlots = grid->slots[slot].next;
+    return slot;
+  }
+
+  if (grid->numSlots == grid->slotCapacity) {
+    assert(grid->slotCapacity < HANDLE_MAX_SLOTS);
+
+    grid->slotCapacity = grid->slotCapacity ? grid->slotCapacity * 2 : GRID_INITIAL_CAPACITY;
+    grid->slotCapacity = (grid->slotCapacity < HANDLE_MAX_SLOTS) ? grid->slotCapacity : HANDLE_MAX_SLOTS;
+    grid->slots = zrealloc(grid->slots, grid->slotCapacity * sizeof(struct slot));
+  }
+
+  const uint32_t slot = grid->numSlots++;
+
+  /* generation 0 is never handed out, so a handle is never 0 */
+  grid->slots[slot].generation = 1;
+
+  return slot;
+}
+
+static void freeSlot(struct gfxGrid *grid, uint32_t slot) {
+  struct slot *s = &grid->slots[slot];
+
+  s->generation = (s->generation + 1) & HANDLE_GEN_MASK;
+  if (s->generation == 0) s->generation = 1;
+
+  s->next = grid->freeSlots;
+  grid->freeSlots = slot;
+}
+
+static void queue(struct gfxGrid *grid, enum updateType type, uint32_t slot, uint32_t id, const aabb *box) {
+  if (grid->numUpdates == grid->updateCapacity) {
+    grid->updateCapacity = grid->updateCapacity ? grid->updateCapacity * 2 : GRID_INITIAL_CAPACITY;
+    grid->updates = zrealloc(grid->updates, grid->updateCapacity * sizeof(struct update));
+  }
+
+  struct update *u = &grid->updates[grid->numUpdates++];
+  u->type = type;
+  u->slot = slot;
+  u->id = id;
+
+  if (box) {
+    for (int a = 0; a < 3; ++a) {
+      u->min[a] = box->min[a];
+      u->max[a] = box->max[a];
+    }
+  }
+}
+
+static float levelSize(const struct gfxGrid *grid, uint32_t level) {
+  return ldexpf(grid->cellSize, (int) level);
+}
+
+/* the cell of the smallest level that fits the object, by its center */
+static void keyOf(const struct gfxGrid *grid, const float min[3], const float max[3], struct cellKey *key) {
+  float extent = max[0] - min[0];
+  extent = (max[1] - min[1] > extent) ? max[1] - min[1] : extent;
+  extent = (max[2] - min[2] > extent) ? max[2] - min[2] : extent;
+
+  memset(key, 0x0, sizeof(struct cellKey));
+
+  float size = grid->cellSize;
+  while (key->level < GRID_LEVELS && extent > size) {
+    size *= 2.0f;
+    ++key->level;
+  }
+
+  if (key->level == GRID_LEVELS) {
+    key->level = GRID_OVERSIZED;
+    return;
+  }
+
+  const float inv = 1.0f / size;
+  key->x = (int32_t) floorf((min[0] + max[0]) * 0.5f * inv);
+  key->y = (int32_t) floorf((min[1] + max[1]) * 0.5f * inv);
+  key->z = (int32_t) floorf((min[2] + max[2]) * 0.5f * inv);
+}
+
+static int sameKey(const struct cellKey *a, const struct cellKey *b) {
+  return a->x == b->x && a->y == b->y && a->z == b->z && a->level == b->level;
+}
+
+static uint32_t hashKey(const struct cellKey *key) {
+  uint32_t h = ((uint32_t) key->x * 73856093u) ^ ((uint32_t) key->y * 19349663u) ^
+               ((uint32_t) key->z * 83492791u) ^ (key->level * 2654435761u);
+  return h ^ (h >> 16);
+}
+
+static uint32_t findCell(const struct gfxGrid *grid, const struct cellKey *key) {
+  if (!grid->tableSize) return NONE;
+
+  const uint32_t mask = grid->tableSize - 1;
+
+  for (uint32_t i = hashKey(key) & mask;; i = (i + 1) & mask) {
+    const uint32_t cell = grid->table[i];
+
+    if (cell == NONE) return NONE;
+    if (sameKey(&grid->cells[cell].key, key)) return cell;
+  }
+}
+
+static void hashCell(struct gfxGrid *grid, uint32_t cell) {
+  const uint32_t mask = grid->tableSize - 1;
+
+  uint32_t i = grid->cells[cell].hash & mask;
+  while (grid->table[i] != NONE) i = (i + 1) & mask;
+
+  grid->table[i] = cell;
+}
+
+/* takes the cell out of the table and shifts back whatever would otherwise
+ * become unreachable */
+static void unhashCell(struct gfxGrid *grid, uint32_t cell) {
+  const uint32_t mask = grid->tableSize - 1;
+
+  uint32_t hole = grid->cells[cell].hash & mask;
+  while (grid->table[hole] != cell) hole = (hole + 1) & mask;
+
+  for (uint32_t i = (hole + 1) & mask; grid->table[i] != NONE; i = (i + 1) & mask) {
+    const uint32_t home = grid->cells[grid->table[i]].hash & mask;
+
+    /* it can move to the hole if its home isn't in (hole, i] */
+    const int reachable = (hole < i) ? (home > hole && home <= i) : (home > hole || home <= i);
+    if (!reachable) {
+      grid->table[hole] = grid->table[i];
+      hole = i;
+    }
+  }
+
+  grid->table[hole] = NONE;
+}
+
+static void rehash(struct gfxGrid *grid, uint32_t size) {
+  zfree(grid->table);
+
+  grid->tableSize = size;
+  grid->table = zmalloc(size * sizeof(uint32_t));
+  memset(grid->table, 0xFF, size * sizeof(uint32_t));
+
+  for (uint32_t c = 0; c < grid->numCells; ++c) {
+    if (grid->cells[c].count) hashCell(grid, c);
+  }
+}
+
+static uint32_t createCell(struct gfxGrid *grid, const struct cellKey *key) {
+  const uint32_t live = grid->numCells - grid->numFreeCells;
+
+  if ((live + 1) * 2 > grid->tableSize) {
+    rehash(grid, grid->tableSize ? grid->tableSize * 2 : GRID_INITIAL_CAPACITY);
+  }
+
+  uint32_t index;
+
+  if (grid->freeCells != NONE) {
+    index = grid->freeCells;
+    grid->freeCells = grid->cells[index].head;
+    grid->numFreeCells--;
+  } else {
+    if (grid->numCells == grid->cellCapacity) {
+      grid->cellCapacity = grid->cellCapacity ? grid->cellCapacity * 2 : GRID_INITIAL_CAPACITY;
+      grid->cells = zrealloc(grid->cells, grid->cellCapacity * sizeof(struct cell));
+    }
+
+    index = grid->numCells++;
+  }
+
+  struct cell *cell = &grid->cells[index];
+  cell->key = *key;
+  cell->hash = hashKey(key);
+  cell->head = NONE;
+  cell->count = 0;
+
+  if (key->level == GRID_OVERSIZED) {
+    for (int a = 0; a < 3; ++a) {
+      cell->min[a] = -FLT_MAX;
+      cell->max[a] = FLT_MAX;
+    }
+  } else {
+    const float size = levelSize(grid, key->level);
+    const float margin = size * (0.5f + GRID_PADDING);
+    const int32_t coords[3] = { key->x, key->y, key->z };
+
+    for (int a = 0; a < 3; ++a) {
+      cell->min[a] = (float) coords[a] * size - margin;
+      cell->max[a] = (float) (coords[a] + 1) * size + margin;
+    }
+  }
+
+  cell->min[3] = cell->max[3] = 1.0f;
+
+  grid->levelCells[key->level]++;
+  hashCell(grid, index);
+
+  return index;
+}
+
+static void freeCell(struct gfxGrid *grid, uint32_t index) {
+  struct cell *cell = &grid->cells[index];
+
+  unhashCell(grid, index);
+  grid->levelCells[cell->key.level]--;
+
+  cell->count = 0;
+  cell->head = grid->freeCells;
+  grid->freeCells = index;
+  grid->numFreeCells++;
+}
+
+static void linkObject(struct gfxGrid *grid, uint32_t slot, const struct cellKey *key) {
+  uint32_t index = findCell(grid, key);
+  if (index == NONE) index = createCell(grid, key);
+
+  struct cell *cell = &grid->cells[index];
+  struct object *obj = &grid->objects[slot];
+
+  obj->cell = index;
+  obj->key = *key;
+  obj->prev = NONE;
+  obj->next = cell->head;
+
+  if (cell->head != NONE) grid->objects[cell->head].prev = slot;
+
+  cell->head = slot;
+  cell->count++;
+}
+
+static void unlinkObject(struct gfxGrid *grid, uint32_t slot) {
+  struct object *obj = &grid->objects[slot];
+  struct cell *cell = &grid->cells[obj->cell];
+
+  if (obj->prev != NONE) grid->objects[obj->prev].next = obj->next;
+  else cell->head = obj->next;
+
+  if (obj->next != NONE) grid->objects[obj->next].prev = obj->prev;
+
+  if (--cell->count == 0) freeCell(grid, obj->cell);
+
+  obj->cell = NONE;
+}
+
+static void setBox(struct object *obj, const struct update *u) {
+  for (int a = 0; a < 3; ++a) {
+    obj->min[a] = u->min[a];
+    obj->max[a] = u->max[a];
+  }
+
+  obj->min[3] = obj->max[3] = 1.0f;
+}
+
+/* moves the live cells to the front, which means telling their objects */
+static void compactCells(struct gfxGrid *grid) {
+  uint32_t live = 0;
+
+  for (uint32_t c = 0; c < grid->numCells; ++c) {
+    if (!grid->cells[c].count) continue;
+
+    if (c != live) {
+      grid->cells[live] = grid->cells[c];
+
+      for (uint32_t o = grid->cells[live].head; o != NONE; o = grid->objects[o].next) {
+        grid->objects[o].cell = live;
+      }
+    }
+
+    ++live;
+  }
+
+  grid->numCells = live;
+  grid->freeCells = NONE;
+  grid->numFreeCells = 0;
+
+  rehash(grid, grid->tableSize);
+}
+
+struct gfxGrid *gfxGridCreate(float cellSize) {
+  assert(cellSize > 0.0f);
+
+  struct gfxGrid *grid = zcalloc(sizeof(struct gfxGrid));
+  grid->cellSize = cellSize;
+  grid->freeSlots = NONE;
+  grid->freeCells = NONE;
+
+  return grid;
+}
+
+void gfxGridDestroy(struct gfxGrid *grid) {
+  zfree(grid->slots);
+  zfree(grid->updates);
+  zfree(grid->objects);
+  zfree(grid->cells);
+  zfree(grid->table);
+  zfree(grid);
+}
+
+/* the id is what the queries hand out, for example an index into an array
+ * of draw operations */
+gfxGridHandle gfxGridInsert(struct gfxGrid *grid, const aabb *box, uint32_t id) {
+  const uint32_t slot = allocSlot(grid);
+  queue(grid, UPDATE_INSERT, slot, id, box);
+
+  return makeHandle(slot, grid->slots[slot].generation);
+}
+
+void gfxGridMove(struct gfxGrid *grid, gfxGridHandle handle, const aabb *box) {
+  const uint32_t slot = resolveHandle(grid, handle);
+  if (slot == NONE) return;
+
+  queue(grid, UPDATE_MOVE, slot, 0, box);
+}
+
+/* the handle is stale right away, the object stays visible to the queries
+ * until the next commit */
+void gfxGridRemove(struct gfxGrid *grid, gfxGridHandle handle) {
+  const uint32_t slot = resolveHandle(grid, handle);
+  if (slot == NONE) return;
+
+  freeSlot(grid, slot);
+  queue(grid, UPDATE_REMOVE, slot, 0, NULL);
+}
+
+/* applies everything that was queued, in order. Nobody may be querying
+ * while this runs. */
+void gfxGridCommit(struct gfxGrid *grid) {
+  if (grid->objectCapacity < grid->numSlots) {
+    grid->objectCapacity = grid->slotCapacity;
+    grid->objects = zrealloc(grid->objects, grid->objectCapacity * sizeof(struct object));
+  }
+
+  for (size_t i = 0; i < grid->numUpdates; ++i) {
+    const struct update *u = &grid->updates[i];
+    struct object *obj = &grid->objects[u->slot];
+
+    switch (u->type) {
+      case UPDATE_INSERT: {
+        struct cellKey key;
+        keyOf(grid, u->min, u->max, &key);
+
+        setBox(obj, u);
+        obj->id = u->id;
+        linkObject(grid, u->slot, &key);
+        grid->numObjects++;
+      } break;
+
+      case UPDATE_MOVE: {
+        struct cellKey key;
+        keyOf(grid, u->min, u->max, &key);
+
+        setBox(obj, u);
+        if (!sameKey(&obj->key, &key)) {
+          unlinkObject(grid, u->slot);
+          linkObject(grid, u->slot, &key);
+        }
+      } break;
+
+      case UPDATE_REMOVE:
+        unlinkObject(grid, u->slot);
+        grid->numObjects--;
+        break;
+    }
+  }
+
+  grid->numUpdates = 0;
+
+  if (grid->numFreeCells > GRID_MIN_FREE_CELLS && grid->numFreeCells * 2 > grid->numCells) {
+    compactCells(grid);
+  }
+}
+
+/* the amount of committed objects */
+size_t gfxGridCount(const struct gfxGrid *grid) {
+  return grid->numObjects;
+}
+
+/* the frustum, ready to test one box against all planes in 2 passes of 4
+ * planes: the same p-vertex test as gfxCullBoxes (see cull.c), so the
+ * answers are the same. The last 2 planes are padding that's always
+ * passed. */
+struct gridFrustum {
+  __m128 a[2], b[2], c[2], d[2];
+
+  /* which planes take the max of an axis for their p-vertex */
+  __m128 maxX[2], maxY[2], maxZ[2];
+
+  /* the bounds of the frustum corners */
+  __m128 min, max;
+};
+
+enum {
+  OUTSIDE,
+  INTERSECTS,
+  INSIDE
+};
+
+static void prepare(struct gridFrustum *gf, const frustum *fru) {
+  float p[4][8];
+
+  for (int i = 0; i < 8; ++i) {
+    for (int j = 0; j < 4; ++j) {
+      p[j][i] = (i < 6) ? fru->planes[i][j] : (j == 3) ? 1.0f : 0.0f;
+    }
+  }
+
+  const __m128 zero = _mm_setzero_ps();
+
+  for (int i = 0; i < 2; ++i) {
+    gf->a[i] = _mm_loadu_ps(&p[0][i * 4]);
+    gf->b[i] = _mm_loadu_ps(&p[1][i * 4]);
+    gf->c[i] = _mm_loadu_ps(&p[2][i * 4]);
+    gf->d[i] = _mm_loadu_ps(&p[3][i * 4]);
+
+    gf->maxX[i] = _mm_cmpge_ps(gf->a[i], zero);
+    gf->maxY[i] = _mm_cmpge_ps(gf->b[i], zero);
+    gf->maxZ[i] = _mm_cmpge_ps(gf->c[i], zero);
+  }
+
+  gf->min = gf->max = fru->points[0];
+  for (int i = 1; i < 8; ++i) {
+    gf->min = _mm_min_ps(gf->min, fru->points[i]);
+    gf->max = _mm_max_ps(gf->max, fru->points[i]);
+  }
+}
+
+static __m128 pick(__m128 mask, __m128 ifSet, __m128 ifClear) {
+  return _mm_or_ps(_mm_and_ps(mask, ifSet), _mm_andnot_ps(mask, ifClear));
+}
+
+static int testBox(const struct gridFrustum *gf, const float min[4], const float max[4], int wantInside) {
+  const __m128 lo = _mm_loadu_ps(min);
+  const __m128 hi = _mm_loadu_ps(max);
+
+  if (_mm_movemask_ps(_mm_or_ps(_mm_cmplt_ps(hi, gf->min), _mm_cmpgt_ps(lo, gf->max))) & 0x7) return OUTSIDE;
+
+  const __m128 zero = _mm_setzero_ps();
+  const __m128 loX = _mm_shuffle_ps(lo, lo, _MM_SHUFFLE(0, 0, 0, 0));
+  const __m128 loY = _mm_shuffle_ps(lo, lo, _MM_SHUFFLE(1, 1, 1, 1));
+  const __m128 loZ = _mm_shuffle_ps(lo, lo, _MM_SHUFFLE(2, 2, 2, 2));
+  const __m128 hiX = _mm_shuffle_ps(hi, hi, _MM_SHUFFLE(0, 0, 0, 0));
+  const __m128 hiY = _mm_shuffle_ps(hi, hi, _MM_SHUFFLE(1, 1, 1, 1));
+  const __m128 hiZ = _mm_shuffle_ps(hi, hi, _MM_SHUFFLE(2, 2, 2, 2));
+
+  int inside = wantInside;
+
+  for (int i = 0; i < 2; ++i) {
+    __m128 dist = gf->d[i];
+    dist = _mm_add_ps(dist, _mm_mul_ps(gf->a[i], pick(gf->maxX[i], hiX, loX)));
+    dist = _mm_add_ps(dist, _mm_mul_ps(gf->b[i], pick(gf->maxY[i], hiY, loY)));
+    dist = _mm_add_ps(dist, _mm_mul_ps(gf->c[i], pick(gf->maxZ[i], hiZ, loZ)));
+
+    if (_mm_movemask_ps(_mm_cmplt_ps(dist, zero))) return OUTSIDE;
+
+    if (inside) {
+      /* the n-vertex, the corner that's the least far along the normal */
+      __m128 near = gf->d[i];
+      near = _mm_add_ps(near, _mm_mul_ps(gf->a[i], pick(gf->maxX[i], loX, hiX)));
+      near = _mm_add_ps(near, _mm_mul_ps(gf->b[i], pick(gf->maxY[i], loY, hiY)));
+      near = _mm_add_ps(near, _mm_mul_ps(gf->c[i], pick(gf->maxZ[i], loZ, hiZ)));
+
+      inside = !_mm_movemask_ps(_mm_cmplt_ps(near, zero));
+    }
+  }
+
+  return inside ? INSIDE : INTERSECTS;
+}
+
+static size_t visitAll(const struct gfxGrid *grid, const struct cell *cell, gfxGridVisitFunc visit, void *userdata) {
+  for (uint32_t o = cell->head; o != NONE; o = grid->objects[o].next) {
+    visit(grid->objects[o].id, userdata);
+  }
+
+  return cell->count;
+}
+
+size_t gfxGridCullFrustum(const struct gfxGrid *grid, const frustum *fru, gfxGridVisitFunc visit, void *userdata) {
+  struct gridFrustum gf;
+  prepare(&gf, fru);
+
+  size_t found = 0;
+
+  for (uint32_t c = 0; c < grid->numCells; ++c) {
+    const struct cell *cell = &grid->cells[c];
+
+    if (!cell->count) continue;
+
+    /* everything in a cell that's completely inside is visible */
+    if (cell->key.level != GRID_OVERSIZED) {
+      const int result = testBox(&gf, cell->min, cell->max, 1);
+
+      if (result == OUTSIDE) continue;
+      if (result == INSIDE) {
+        found += visitAll(grid, cell, visit, userdata);
+        continue;
+      }
+    }
+
+    for (uint32_t o = cell->head; o != NONE; o = grid->objects[o].next) {
+      const struct object *obj = &grid->objects[o];
+
+      if (testBox(&gf, obj->min, obj->max, 0) != OUTSIDE) {
+        visit(obj->id, userdata);
+        ++found;
+      }
+    }
+  }
+
+  return found;
+}
+
+/* whether the sphere touches the box */
+static int sphereOverlaps(vec4 center, float radius2, const float min[4], const float max[4]) {
+  const vec4 d = vmax(vmax(_mm_loadu_ps(min) - center, center - _mm_loadu_ps(max)), vzero());
+  return vdot3(d, d)[0] <= radius2;
+}
+
+static size_t radiusCell(const struct gfxGrid *grid, const struct cell *cell, vec4 center, float radius2,
+                         gfxGridVisitFunc visit, void *userdata) {
+  if (cell->key.level != GRID_OVERSIZED && !sphereOverlaps(center, radius2, cell->min, cell->max)) return 0;
+
+  size_t found = 0;
+
+  for (uint32_t o = cell->head; o != NONE; o = grid->objects[o].next) {
+    const struct object *obj = &grid->objects[o];
+
+    if (sphereOverlaps(center, radius2, obj->min, obj->max)) {
+      visit(obj->id, userdata);
+      ++found;
+    }
+  }
+
+  return found;
+}
+
+/* all objects that touch the sphere */
+size_t gfxGridRadius(const struct gfxGrid *grid, const float center[3], float radius,
+                     gfxGridVisitFunc visit, void *userdata) {
+  const vec4 c = vec(center[0], center[1], center[2], 1.0f);
+  const float radius2 = radius * radius;
+
+  size_t found = 0;
+
+  /* the levels where walking all cells is cheaper than looking them up */
+  uint32_t scan = grid->levelCells[GRID_OVERSIZED] ? (1u << GRID_OVERSIZED) : 0;
+
+  for (uint32_t level = 0; level < GRID_LEVELS; ++level) {
+    if (!grid->levelCells[level]) continue;
+
+    /* an object can stick out half a cell, so its center can be that
+     * much further away */
+    const float inv = 1.0f / levelSize(grid, level);
+    const float reach = 0.5f + GRID_PADDING;
+
+    float lo[3], hi[3];
+    float lookups = 1.0f;
+
+    for (int a = 0; a < 3; ++a) {
+      lo[a] = floorf((center[a] - radius) * inv - reach);
+      hi[a] = floorf((center[a] + radius) * inv + reach);
+      lookups *= hi[a] - lo[a] + 1.0f;
+    }
+
+    if (lookups > (float) grid->levelCells[level]) {
+      scan |= 1u << level;
+      continue;
+    }
+
+    struct cellKey key;
+    key.level = level;
+
+    for (key.z = (int32_t) lo[2]; key.z <= (int32_t) hi[2]; ++key.z) {
+      for (key.y = (int32_t) lo[1]; key.y <= (int32_t) hi[1]; ++key.y) {
+        for (key.x = (int32_t) lo[0]; key.x <= (int32_t) hi[0]; ++key.x) {
+          const uint32_t cell = findCell(grid, &key);
+
+          if (cell != NONE) found += radiusCell(grid, &grid->cells[cell], c, radius2, visit, userdata);
+        }
+      }
+    }
+  }
+
+  if (scan) {
+    for (uint32_t cell = 0; cell < grid->numCells; ++cell) {
+      if (grid->cells[cell].count && (scan >> grid->cells[cell].key.level) & 1) {
+        found += radiusCell(grid, &grid->cells[cell], c, radius2, visit, userdata);
+      }
+    }
+  }
+
+  return found;
+}
@@ -0,0 +1,62 @@
+/**
+ * This file is part of prototype.
+ *
+ * (c) 2014 Nicolas Hillegeer <nicolas@hillegeer.com>
+ *
+ * For the full copyright and license information, please view the LICENSE
+ * file that was distributed with the source code.
+ */
+
+#ifndef __grid_h__
+#define __grid_h__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "math/types.h"
+
+/**
+ * Loose hierarchical grid for objects that move every frame, where
+ * rebuilding a BVH (see bvh.h) would cost too much. Every level has cells
+ * twice as big as the one below it, an object goes into the cell of the
+ * first level that's at least as big as the object, picked by its center.
+ * Only cells that hold something exist, they live in a hash table, so the
+ * world doesn't have to be bounded. Inserting, moving and removing are O(1)
+ * (amortised).
+ *
+ * Threading: any number of threads can query at the same time. Insert,
+ * move and remove only queue the change, they can be called while the
+ * queries run, but only from a single thread. gfxGridCommit applies the
+ * queued changes and must be called when nobody is querying, e.g. between
+ * frames. Queries only see what was committed.
+ */
+
+/* returned by gfxGridInsert, stays valid until the object is removed.
+ * Stale handles are ignored, 0 is never a valid handle. */
+typedef uint32_t gfxGridHandle;
+
+#define GFX_GRID_HANDLE_NONE 0
+
+/* called for every object a query finds, with the id it was inserted
+ * with. Same signature as gfxBvhVisitFunc, so gfxDrawBucketAddVisible()
+ * works for both. */
+typedef void (*gfxGridVisitFunc)(uint32_t id, void *userdata);
+
+struct gfxGrid;
+
+/* cellSize is the size of the smallest cells, make it about the size of
+ * the smallest objects */
+struct gfxGrid *gfxGridCreate(float cellSize);
+void gfxGridDestroy(struct gfxGrid *grid);
+
+gfxGridHandle gfxGridInsert(struct gfxGrid *grid, const aabb *box, uint32_t id);
+void gfxGridMove(struct gfxGrid *grid, gfxGridHandle handle, const aabb *box);
+void gfxGridRemove(struct gfxGrid *grid, gfxGridHandle handle);
+void gfxGridCommit(struct gfxGrid *grid);
+
+size_t gfxGridCount(const struct gfxGrid *grid);
+size_t gfxGridCullFrustum(const struct gfxGrid *grid, const frustum *fru, gfxGridVisitFunc visit, void *userdata);
+size_t gfxGridRadius(const struct gfxGrid *grid, const float center[3], float radius,
+                     gfxGridVisitFunc visit, void *userdata);
+
+#endif
@@ -0,0 +1,673 @@
+/**
+ * This file is part of prototype.
+ *
+ * (c) 2014 Nicolas Hillegeer <nicolas@hillegeer.com>
+ *
+ * For the full copyright and license information, please view the LICENSE
+ * file that was distributed with the source code.
+ *
+ * Reading and writing binary mesh files (see mesh.h) and parsing OBJ files
+ * so the converter has something to convert. Doesn't touch GL, uploading
+ * a mapped mesh is done by gfxLoadMesh() in model.c.
+ *
+ * Binary meshes get mmap()'ed instead of read, the pages go straight to
+ * glBufferData() without ever being copied to the heap.
+ */
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "mesh.h"
+#include "quantize.h"
+#include "zmalloc.h"
+
+#define MESH_ALIGNED(x) (((x) + GFX_MESH_ALIGN - 1) & ~(uint64_t)(GFX_MESH_ALIGN - 1))
+
+/* the longest OBJ line we can parse, files with longer lines don't load */
+#define OBJ_MAX_LINE 512
+
+/* the most corners a polygon in an OBJ file can have, it gets triangulated
+ * as a fan. Files with bigger polygons don't load. */
+#define OBJ_MAX_CORNERS 64
+
+static gfx_mesh_error_t mapFile(const char *filename, void **data, size_t *size) {
+  const int fd = open(filename, O_RDONLY);
+  if (fd == -1) return GFX_MESH_ERROR_IO;
+
+  struct stat stats;
+  if (fstat(fd, &stats) == -1) {
+    close(fd);
+    return GFX_MESH_ERROR_IO;
+  }
+
+  /* can't map an empty file */
+  if (stats.st_size == 0) {
+    close(fd);
+    return GFX_MESH_ERROR_FORMAT;
+  }
+
+  *size = (size_t)stats.st_size;
+  *data = mmap(NULL, *size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+  /* the mapping stays valid after closing */
+  close(fd);
+
+  if (*data == MAP_FAILED) {
+    *data = NULL;
+    return GFX_MESH_ERROR_IO;
+  }
+
+  return GFX_MESH_OK;
+}
+
+/* the size of one component of an attribute */
+static size_t componentSize(uint32_t type) {
+  switch (type) {
+    case 0x1400: /* GL_BYTE */
+    case GFX_MESH_UNSIGNED_BYTE:
+      return 1;
+    case GFX_MESH_SHORT:
+    case GFX_MESH_UNSIGNED_SHORT:
+    case GFX_MESH_HALF_FLOAT:
+      return 2;
+    case 0x1404: /* GL_INT */
+    case GFX_MESH_UNSIGNED_INT:
+    case GFX_MESH_FLOAT:
+      return 4;
+    default:
+      return 0;
+  }
+}
+
+static size_t indexSize(uint32_t type) {
+  switch (type) {
+    case GFX_MESH_UNSIGNED_BYTE: return 1;
+    case GFX_MESH_UNSIGNED_SHORT: return 2;
+    case GFX_MESH_UNSIGNED_INT: return 4;
+    default: return 0;
+  }
+}
+
+static gfx_mesh_error_t validate(const struct gfxMeshHeader *header, size_t fileSize) {
+  if (fileSize < sizeof(struct gfxMeshHeader)) return GFX_MESH_ERROR_FORMAT;
+  if (memcmp(header->magic, GFX_MESH_MAGIC, sizeof(header->magic)) != 0) return GFX_MESH_ERROR_FORMAT;
+  if (header->version != GFX_MESH_VERSION) return GFX_MESH_ERROR_VERSION;
+  if (header->headerSize != sizeof(struct gfxMeshHeader)) return GFX_MESH_ERROR_FORMAT;
+
+  if (header->numAttribs > GFX_MESH_MAX_ATTRIBS || header->stride == 0) return GFX_MESH_ERROR_FORMAT;
+
+  for (uint32_t i = 0; i < header->numAttribs; ++i) {
+    const struct gfxMeshAttrib *attrib = &header->attribs[i];
+
+    const size_t size = attrib->size * componentSize(attrib->type);
+
+    if (attrib->size < 1 || attrib->size > 4 || size == 0 || attrib->offset + size > header->stride) {
+      return GFX_MESH_ERROR_FORMAT;
+    }
+  }
+
+  const size_t isize = indexSize(header->indexType);
+  if (isize == 0) return GFX_MESH_ERROR_FORMAT;
+
+  if (header->vertexSize != (uint64_t)header->numVertices * header->stride) return GFX_MESH_ERROR_FORMAT;
+  if (header->indexSize != (uint64_t)header->numIndices * isize) return GFX_MESH_ERROR_FORMAT;
+
+  if (header->numLods > GFX_MAX_LODS) return GFX_MESH_ERROR_FORMAT;
+
+  for (uint32_t i = 0; i < header->numLods; ++i) {
+    const struct gfxLod *lod = &header->lods[i];
+
+    if (lod->numIndices % 3 || (uint64_t)lod->firstIndex + lod->numIndices > header->numIndices) {
+      return GFX_MESH_ERROR_FORMAT;
+    }
+  }
+
+  if (header->vertexOffset % GFX_MESH_ALIGN || header->indexOffset % GFX_MESH_ALIGN) return GFX_MESH_ERROR_FORMAT;
+  if (header->vertexOffset < sizeof(struct gfxMeshHeader)) return GFX_MESH_ERROR_FORMAT;
+
+  /* written so that the sums can't wrap around */
+  if (header->vertexSize > fileSize || header->vertexOffset > fileSize - header->vertexSize) return GFX_MESH_ERROR_FORMAT;
+  if (header->indexSize > fileSize || header->indexOffset > fileSize - header->indexSize) return GFX_MESH_ERROR_FORMAT;
+
+  /* an index past the last vertex would have the GPU read outside of the
+   * buffer */
+  const void *indices = (const unsigned char *)header + header->indexOffset;
+
+  for (uint32_t i = 0; i < header->numIndices; ++i) {
+    uint32_t index;
+
+    switch (header->indexType) {
+      case GFX_MESH_UNSIGNED_BYTE: index = ((const uint8_t *)indices)[i]; break;
+      case GFX_MESH_UNSIGNED_SHORT: index = ((const uint16_t *)indices)[i]; break;
+      default: index = ((const uint32_t *)indices)[i]; break;
+    }
+
+    if (index >= header->numVertices) return GFX_MESH_ERROR_FORMAT;
+  }
+
+  return GFX_MESH_OK;
+}
+
+/* the vertex and index data of the mesh point into the mapped file, it
+ * has to stay mapped until they've been uploaded */
+gfx_mesh_error_t gfxMapMesh(struct gfxMesh *mesh, const char *filename) {
+  memset(mesh, 0x0, sizeof(struct gfxMesh));
+
+  void *data = NULL;
+  size_t size = 0;
+
+  gfx_mesh_error_t error = mapFile(filename, &data, &size);
+  if (error != GFX_MESH_OK) return error;
+
+  /* the header sits at the start of a page, so it's properly aligned */
+  const struct gfxMeshHeader *header = data;
+
+  error = validate(header, size);
+  if (error != GFX_MESH_OK) {
+    munmap(data, size);
+    return error;
+  }
+
+  /* all of it is going to be read by the upload, front to back (strict
+   * C11 hides madvise() on some platforms, it's just a hint) */
+#if defined(MADV_SEQUENTIAL) && defined(MADV_WILLNEED)
+  madvise(data, size, MADV_SEQUENTIAL | MADV_WILLNEED);
+#endif
+
+  mesh->header = *header;
+  mesh->vertices = (unsigned char *)data + header->vertexOffset;
+  mesh->indices = (unsigned char *)data + header->indexOffset;
+  mesh->mapping = data;
+  mesh->mappingSize = size;
+
+  return GFX_MESH_OK;
+}
+
+static int writePadding(FILE *file, uint64_t from, uint64_t to) {
+  static const unsigned char zeroes[GFX_MESH_ALIGN];
+  return fwrite(zeroes, 1, (size_t)(to - from), file) == (size_t)(to - from);
+}
+
+gfx_mesh_error_t gfxWriteMesh(const struct gfxMesh *mesh, const char *filename) {
+  struct gfxMeshHeader header = mesh->header;
+
+  memcpy(header.magic, GFX_MESH_MAGIC, sizeof(header.magic));
+  header.version = GFX_MESH_VERSION;
+  header.headerSize = sizeof(struct gfxMeshHeader);
+
+  header.vertexSize = (uint64_t)header.numVertices * header.stride;
+  header.indexSize = (uint64_t)header.numIndices * indexSize(header.indexType);
+  header.vertexOffset = MESH_ALIGNED(sizeof(struct gfxMeshHeader));
+  header.indexOffset = MESH_ALIGNED(header.vertexOffset + header.vertexSize);
+
+  FILE *file = fopen(filename, "wb");
+  if (!file) return GFX_MESH_ERROR_IO;
+
+  int ok = fwrite(&header, sizeof(header), 1, file) == 1;
+  ok = ok && writePadding(file, sizeof(header), header.vertexOffset);
+  ok = ok && fwrite(mesh->vertices, 1, (size_t)header.vertexSize, file) == header.vertexSize;
+  ok = ok && writePadding(file, header.vertexOffset + header.vertexSize, header.indexOffset);
+  ok = ok && fwrite(mesh->indices, 1, (size_t)header.indexSize, file) == header.indexSize;
+
+  if (fclose(file) != 0) ok = 0;
+
+  return ok ? GFX_MESH_OK : GFX_MESH_ERROR_IO;
+}
+
+/* one corner of an OBJ face, 0-based, -1 if it's not there */
+struct corner {
+  int32_t v;
+  int32_t t;
+  int32_t n;
+};
+
+struct objData {
+  float *positions;
+  float *texcoords;
+  float *normals;
+  size_t numPositions, numTexcoords, numNormals;
+  size_t positionCapacity, texcoordCapacity, normalCapacity;
+
+  struct corner *corners;
+  size_t numCorners;
+  size_t cornerCapacity;
+};
+
+static float *pushFloats(float *array, size_t *count, size_t *capacity, const float *values, size_t n) {
+  if (*count == *capacity) {
+    *capacity = *capacity ? *capacity * 2 : 1024;
+    array = zrealloc(array, *capacity * n * sizeof(float));
+  }
+
+  memcpy(&array[*count * n], values, n * sizeof(float));
+  (*count)++;
+
+  return array;
+}
+
+static void pushCorner(struct objData *obj, struct corner corner) {
+  if (obj->numCorners == obj->cornerCapacity) {
+    obj->cornerCapacity = obj->cornerCapacity ? obj->cornerCapacity * 2 : 1024;
+    obj->corners = zrealloc(obj->corners, obj->cornerCapacity * sizeof(struct corner));
+  }
+
+  obj->corners[obj->numCorners++] = corner;
+}
+
+static void parseFloats(const char *s, float *values, size_t n) {
+  char *end;
+
+  for (size_t i = 0; i < n; ++i) {
+    values[i] = strtof(s, &end);
+    s = end;
+  }
+}
+
+/* OBJ indices are 1-based, negative ones are relative to the end of what
+ * has been read so far, 0 means absent */
+static int32_t objIndex(long index, size_t count) {
+  if (index > 0) return (int32_t)(index - 1);
+  if (index < 0) return (int32_t)((long)count + index);
+  return -1;
+}
+
+static int parseFace(struct objData *obj, const char *s) {
+  struct corner polygon[OBJ_MAX_CORNERS];
+  size_t n = 0;
+
+  for (;;) {
+    char *end;
+
+    const long v = strtol(s, &end, 10);
+    if (end == s) break;
+    s = end;
+
+    if (n == OBJ_MAX_CORNERS) return 0;
+
+    long t = 0, vn = 0;
+
+    if (*s == '/') {
+      ++s;
+      if (*s != '/') {
+        t = strtol(s, &end, 10);
+        s = end;
+      }
+
+      if (*s == '/') {
+        ++s;
+        vn = strtol(s, &end, 10);
+        s = end;
+      }
+    }
+
+    polygon[n++] = (struct corner){
+        objIndex(v, obj->numPositions),
+        objIndex(t, obj->numTexcoords),
+        objIndex(vn, obj->numNormals)};
+  }
+
+  if (n < 3) return 0;
+
+  for (size_t i = 0; i < n; ++i) {
+    const struct corner *c = &polygon[i];
+
+    if (c->v < 0 || (size_t)c->v >= obj->numPositions ||
+        (c->t >= 0 && (size_t)c->t >= obj->numTexcoords) ||
+        (c->n >= 0 && (size_t)c->n >= obj->numNormals)) {
+      return 0;
+    }
+  }
+
+  for (size_t i = 1; i + 1 < n; ++i) {
+    pushCorner(obj, polygon[0]);
+    pushCorner(obj, polygon[i]);
+    pushCorner(obj, polygon[i + 1]);
+  }
+
+  return 1;
+}
+
+static uint32_t hashCorner(struct corner c) {
+  return (uint32_t)c.v * 73856093u ^ (uint32_t)c.t * 19349663u ^ (uint32_t)c.n * 83492791u;
+}
+
+/* turns the corners into a vertex/index buffer, corners that are exactly
+ * the same share a vertex */
+static void buildMesh(struct gfxMesh *mesh, const struct objData *obj) {
+  struct gfxMeshHeader *header = &mesh->header;
+
+  int hasTexcoords = 0, hasNormals = 0;
+  for (size_t i = 0; i < obj->numCorners; ++i) {
+    hasTexcoords |= obj->corners[i].t >= 0;
+    hasNormals |= obj->corners[i].n >= 0;
+  }
+
+  /* GFX_VERTEX, GFX_NORMAL and GFX_TEXCOORD */
+  uint32_t stride = 0;
+  header->attribs[header->numAttribs++] = (struct gfxMeshAttrib){0, 3, GFX_MESH_FLOAT, 0, stride};
+  stride += 3 * sizeof(float);
+
+  if (hasNormals) {
+    header->attribs[header->numAttribs++] = (struct gfxMeshAttrib){1, 3, GFX_MESH_FLOAT, 0, stride};
+    stride += 3 * sizeof(float);
+  }
+
+  if (hasTexcoords) {
+    header->attribs[header->numAttribs++] = (struct gfxMeshAttrib){2, 2, GFX_MESH_FLOAT, 0, stride};
+    stride += 2 * sizeof(float);
+  }
+
+  header->stride = stride;
+
+  /* open addressing, at most half full */
+  size_t buckets = 16;
+  while (buckets < obj->numCorners * 2) buckets *= 2;
+
+  uint32_t *table = zmalloc(buckets * sizeof(uint32_t));
+  memset(table, 0xFF, buckets * sizeof(uint32_t));
+
+  struct corner *unique = zmalloc((obj->numCorners + 1) * sizeof(struct corner));
+  uint32_t *indices = zmalloc((obj->numCorners + 1) * sizeof(uint32_t));
+  uint32_t numVertices = 0;
+
+  for (size_t i = 0; i < obj->numCorners; ++i) {
+    const struct corner c = obj->corners[i];
+    size_t bucket = hashCorner(c) & (buckets - 1);
+
+    while (table[bucket] != UINT32_MAX) {
+      const struct corner *u = &unique[table[bucket]];
+      if (u->v == c.v && u->t == c.t && u->n == c.n) break;
+
+      bucket = (bucket + 1) & (buckets - 1);
+    }
+
+    if (table[bucket] == UINT32_MAX) {
+      table[bucket] = numVertices;
+      unique[numVertices++] = c;
+    }
+
+    indices[i] = table[bucket];
+  }
+
+  zfree(table);
+
+  unsigned char *vertices = zmalloc(((size_t)numVertices + 1) * stride);
+
+  for (uint32_t i = 0; i < numVertices; ++i) {
+    const struct corner *c = &unique[i];
+    float *vertex = (float *)(vertices + (size_t)i * stride);
+    const float *p = &obj->positions[c->v * 3];
+
+    memcpy(vertex, p, 3 * sizeof(float));
+    vertex += 3;
+
+    for (int k = 0; k < 3; ++k) {
+      if (i == 0 || p[k] < header->min[k]) header->min[k] = p[k];
+      if (i == 0 || p[k] > header->max[k]) header->max[k] = p[k];
+    }
+
+    if (hasNormals) {
+      if (c->n >= 0) {
+        memcpy(vertex, &obj->normals[c->n * 3], 3 * sizeof(float));
+      } else {
+        memset(vertex, 0x0, 3 * sizeof(float));
+      }
+      vertex += 3;
+    }
+
+    if (hasTexcoords) {
+      if (c->t >= 0) {
+        memcpy(vertex, &obj->texcoords[c->t * 2], 2 * sizeof(float));
+      } else {
+        memset(vertex, 0x0, 2 * sizeof(float));
+      }
+    }
+  }
+
+  zfree(unique);
+
+  header->numVertices = numVertices;
+  header->numIndices = (uint32_t)obj->numCorners;
+  header->indexType = GFX_MESH_UNSIGNED_INT;
+
+  mesh->vertices = vertices;
+  mesh->indices = indices;
+}
+
+/* parses the positions, texcoords, normals and faces of an OBJ file, the
+ * rest (materials, groups, ...) is ignored. The mesh gets 32-bit indices,
+ * see gfxMeshNarrowIndices(). */
+gfx_mesh_error_t gfxParseObj(struct gfxMesh *mesh, const char *filename) {
+  memset(mesh, 0x0, sizeof(struct gfxMesh));
+
+  void *data = NULL;
+  size_t size = 0;
+
+  gfx_mesh_error_t error = mapFile(filename, &data, &size);
+  if (error != GFX_MESH_OK) return error;
+
+  struct objData obj;
+  memset(&obj, 0x0, sizeof(obj));
+
+  const char *p = data;
+  const char *end = p + size;
+
+  char line[OBJ_MAX_LINE];
+
+  while (p < end && error == GFX_MESH_OK) {
+    const char *eol = memchr(p, '\n', (size_t)(end - p));
+    if (!eol) eol = end;
+
+    /* the mapping isn't NUL-terminated, strtof() and friends need that */
+    const size_t length = (size_t)(eol - p);
+    if (length >= sizeof(line)) {
+      error = GFX_MESH_ERROR_PARSE;
+      break;
+    }
+
+    memcpy(line, p, length);
+    line[length] = '\0';
+
+    p = eol + 1;
+
+    float values[3];
+
+    if (strncmp(line, "v ", 2) == 0) {
+      parseFloats(line + 2, values, 3);
+      obj.positions = pushFloats(obj.positions, &obj.numPositions, &obj.positionCapacity, values, 3);
+    } else if (strncmp(line, "vt ", 3) == 0) {
+      parseFloats(line + 3, values, 2);
+      obj.texcoords = pushFloats(obj.texcoords, &obj.numTexcoords, &obj.texcoordCapacity, values, 2);
+    } else if (strncmp(line, "vn ", 3) == 0) {
+      parseFloats(line + 3, values, 3);
+      obj.normals = pushFloats(obj.normals, &obj.numNormals, &obj.normalCapacity, values, 3);
+    } else if (strncmp(line, "f ", 2) == 0) {
+      if (!parseFace(&obj, line + 2)) error = GFX_MESH_ERROR_PARSE;
+    }
+  }
+
+  munmap(data, size);
+
+  if (error == GFX_MESH_OK) {
+    buildMesh(mesh, &obj);
+  }
+
+  zfree(obj.positions);
+  zfree(obj.texcoords);
+  zfree(obj.normals);
+  zfree(obj.corners);
+
+  return error;
+}
+
+/* switches a mesh on the heap to the smallest index type that fits */
+void gfxMeshNarrowIndices(struct gfxMesh *mesh) {
+  struct gfxMeshHeader *header = &mesh->header;
+
+  if (mesh->mapping || header->indexType != GFX_MESH_UNSIGNED_INT) return;
+
+  unsigned char *indices = mesh->indices;
+
+  if (header->numVertices <= 0xFF + 1) {
+    header->indexType = GFX_MESH_UNSIGNED_BYTE;
+  } else if (header->numVertices <= 0xFFFF + 1) {
+    header->indexType = GFX_MESH_UNSIGNED_SHORT;
+  } else {
+    return;
+  }
+
+  /* in place, front to back, through memcpy because the old and new
+   * indices overlap */
+  const size_t size = indexSize(header->indexType);
+
+  for (uint32_t i = 0; i < header->numIndices; ++i) {
+    uint32_t index;
+    memcpy(&index, indices + i * sizeof(uint32_t), sizeof(index));
+
+    const uint16_t narrow16 = (uint16_t)index;
+    const uint8_t narrow8 = (uint8_t)index;
+    memcpy(indices + i * size, (size == 1) ? (const void *)&narrow8 : (const void *)&narrow16, size);
+  }
+}
+
+/* appends the LOD chain of a mesh on the heap to its indices, which have
+ * to be 32 bits (so before gfxMeshNarrowIndices()) and the positions have
+ * to be floats */
+void gfxMeshBuildLods(struct gfxMesh *mesh) {
+  struct gfxMeshHeader *header = &mesh->header;
+
+  if (mesh->mapping || header->numLods || header->indexType != GFX_MESH_UNSIGNED_INT) return;
+
+  const struct gfxMeshAttrib *position = NULL;
+
+  for (uint32_t i = 0; i < header->numAttribs; ++i) {
+    const struct gfxMeshAttrib *attrib = &header->attribs[i];
+    if (attrib->index == 0 && attrib->type == GFX_MESH_FLOAT && attrib->size >= 3) position = attrib;
+  }
+
+  if (!position) return;
+
+  uint32_t *chain;
+  header->numLods = gfxBuildLods(&chain, mesh->indices, header->numIndices,
+                                 (const unsigned char *)mesh->vertices + position->offset, header->stride,
+                                 header->numVertices, header->lods);
+
+  const struct gfxLod *last = &header->lods[header->numLods - 1];
+
+  zfree(mesh->indices);
+  mesh->indices = chain;
+  header->numIndices = last->firstIndex + last->numIndices;
+}
+
+/* packs the vertices of a mesh on the heap (see quantize.h): positions go
+ * to 3 x snorm16, normals to an octahedron in 2 x snorm16 and texcoords to
+ * 2 x half float, anything else is copied as it is. Only float attributes
+ * get quantized, the bounds are recomputed along the way. */
+void gfxQuantizeMesh(struct gfxMesh *mesh) {
+  struct gfxMeshHeader *header = &mesh->header;
+
+  if (mesh->mapping || (header->flags & GFX_MESH_QUANTIZED)) return;
+
+  const struct gfxMeshHeader old = *header;
+  const unsigned char *vertices = mesh->vertices;
+
+  /* the new layout, each attribute on a 4 byte boundary */
+  uint32_t stride = 0;
+
+  for (uint32_t i = 0; i < old.numAttribs; ++i) {
+    const struct gfxMeshAttrib *attrib = &old.attribs[i];
+    struct gfxMeshAttrib *packed = &header->attribs[i];
+
+    *packed = *attrib;
+    packed->offset = stride;
+
+    if (attrib->type == GFX_MESH_FLOAT && attrib->index == 0 && attrib->size >= 3) {
+      /* w is always 1 when it's left out */
+      *packed = (struct gfxMeshAttrib){0, 3, GFX_MESH_SHORT, 1, stride};
+      stride += GFX_QUANTIZED_POSITION_SIZE;
+    } else if (attrib->type == GFX_MESH_FLOAT && attrib->index == 1 && attrib->size == 3) {
+      *packed = (struct gfxMeshAttrib){1, 2, GFX_MESH_SHORT, 1, stride};
+      stride += GFX_QUANTIZED_NORMAL_SIZE;
+    } else if (attrib->type == GFX_MESH_FLOAT && attrib->index == 2 && attrib->size == 2) {
+      *packed = (struct gfxMeshAttrib){2, 2, GFX_MESH_HALF_FLOAT, 0, stride};
+      stride += GFX_QUANTIZED_TEXCOORD_SIZE;
+    } else {
+      stride += (uint32_t)(attrib->size * componentSize(attrib->type));
+    }
+
+    stride = (stride + 3) & ~3u;
+  }
+
+  header->stride = stride;
+
+  /* stays like this if there are no positions to quantize */
+  header->decode[0] = header->decode[1] = header->decode[2] = 0.0f;
+  header->decode[3] = 1.0f;
+
+  unsigned char *quantized = zcalloc((size_t)header->numVertices * stride);
+
+  for (uint32_t i = 0; i < old.numAttribs; ++i) {
+    const struct gfxMeshAttrib *attrib = &old.attribs[i];
+    const struct gfxMeshAttrib *packed = &header->attribs[i];
+
+    const unsigned char *src = vertices + attrib->offset;
+    unsigned char *dst = quantized + packed->offset;
+
+    if (packed->type == attrib->type) {
+      const size_t size = attrib->size * componentSize(attrib->type);
+
+      for (uint32_t v = 0; v < old.numVertices; ++v) {
+        memcpy(dst + (size_t)v * stride, src + (size_t)v * old.stride, size);
+      }
+    } else if (packed->index == 0) {
+      for (uint32_t v = 0; v < old.numVertices; ++v) {
+        float p[3];
+        memcpy(p, src + (size_t)v * old.stride, sizeof(p));
+
+        for (int k = 0; k < 3; ++k) {
+          if (v == 0 || p[k] < header->min[k]) header->min[k] = p[k];
+          if (v == 0 || p[k] > header->max[k]) header->max[k] = p[k];
+        }
+      }
+
+      gfxPositionDecode(header->min, header->max, header->decode, &header->decode[3]);
+      gfxQuantizePositions(dst, stride, src, old.stride, old.numVertices, header->decode, header->decode[3]);
+    } else if (packed->index == 1) {
+      gfxOctEncodeNormals(dst, stride, src, old.stride, old.numVertices);
+    } else {
+      gfxHalfTexcoords(dst, stride, src, old.stride, old.numVertices);
+    }
+  }
+
+  zfree(mesh->vertices);
+  mesh->vertices = quantized;
+
+  header->flags |= GFX_MESH_QUANTIZED;
+}
+
+void gfxFreeMesh(struct gfxMesh *mesh) {
+  if (mesh->mapping) {
+    munmap(mesh->mapping, mesh->mappingSize);
+  } else {
+    zfree(mesh->vertices);
+    zfree(mesh->indices);
+  }
+
+  memset(mesh, 0x0, sizeof(struct gfxMesh));
+}
+
+const char *gfxMeshErrorString(gfx_mesh_error_t error) {
+  switch (error) {
+    case GFX_MESH_OK: return "no error";
+    case GFX_MESH_ERROR_IO: return "could not read or write the file";
+    case GFX_MESH_ERROR_FORMAT: return "not a valid mesh file";
+    case GFX_MESH_ERROR_VERSION: return "unsupported mesh file version";
+    case GFX_MESH_ERROR_PARSE: return "could not parse the file";
+    default: return "unknown error";
+  }
+}
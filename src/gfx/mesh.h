@@ -0,0 +1,128 @@
+/**
+ * This file is part of prototype.
+ *
+ * (c) 2014 Nicolas Hillegeer <nicolas@hillegeer.com>
+ *
+ * For the full copyright and license information, please view the LICENSE
+ * file that was distributed with the source code.
+ */
+
+#ifndef __mesh_h__
+#define __mesh_h__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "simplify.h"
+
+/**
+ * Binary mesh container, the file is laid out like this:
+ *
+ *   struct gfxMeshHeader   (GFX_MESH_ALIGN aligned size)
+ *   vertex data            (interleaved, at header.vertexOffset)
+ *   index data             (at header.indexOffset)
+ *
+ * Both data sections start at a multiple of GFX_MESH_ALIGN, and since
+ * mmap() hands out page aligned memory they are aligned in memory as
+ * well, so they can go to GL straight from the mapping. Everything is in
+ * native byte order, which is little-endian everywhere we run.
+ *
+ * Types use the GL enum values so they can be passed on as they are, the
+ * attribute indices are GFX_VERTEX, GFX_NORMAL, ... (see gfx.h).
+ *
+ * A quantized mesh (GFX_MESH_QUANTIZED, see quantize.h) stores positions
+ * as snorm16 relative to its bounds, the decode is in header.decode:
+ * position = decode.xyz + decode.w * snorm.
+ *
+ * The index data can hold a LOD chain (see simplify.h), the LODs are
+ * ranges of the indices over the same vertices, LOD 0 is the full mesh.
+ * Without a chain numLods is 0.
+ */
+
+#define GFX_MESH_MAGIC   "PMSH"
+#define GFX_MESH_VERSION 3
+#define GFX_MESH_ALIGN   16
+
+#define GFX_MESH_MAX_ATTRIBS 8
+
+/* the same values as the GL enums of the same name */
+#define GFX_MESH_UNSIGNED_BYTE  0x1401
+#define GFX_MESH_SHORT          0x1402
+#define GFX_MESH_UNSIGNED_SHORT 0x1403
+#define GFX_MESH_UNSIGNED_INT   0x1405
+#define GFX_MESH_FLOAT          0x1406
+#define GFX_MESH_HALF_FLOAT     0x140B
+
+/* header.flags */
+#define GFX_MESH_QUANTIZED 0x1
+
+typedef enum {
+  GFX_MESH_OK = 0,
+  GFX_MESH_ERROR_IO,
+  GFX_MESH_ERROR_FORMAT,
+  GFX_MESH_ERROR_VERSION,
+  GFX_MESH_ERROR_PARSE
+} gfx_mesh_error_t;
+
+struct gfxMeshAttrib {
+  uint32_t index;
+  uint32_t size;
+  uint32_t type;
+  uint32_t normalized;
+  uint32_t offset;
+};
+
+struct gfxMeshHeader {
+  char magic[4];
+  uint32_t version;
+  uint32_t headerSize;
+  uint32_t flags;
+
+  uint32_t stride;
+  uint32_t numAttribs;
+  struct gfxMeshAttrib attribs[GFX_MESH_MAX_ATTRIBS];
+
+  uint32_t numVertices;
+  uint32_t numIndices;
+  uint32_t indexType;
+
+  /* object-space bounds */
+  float min[3];
+  float max[3];
+
+  /* offset xyz and scale of the quantized positions */
+  float decode[4];
+
+  uint32_t numLods;
+  struct gfxLod lods[GFX_MAX_LODS];
+
+  /* in bytes, from the start of the file */
+  uint64_t vertexOffset;
+  uint64_t vertexSize;
+  uint64_t indexOffset;
+  uint64_t indexSize;
+};
+
+/* a mesh in memory, either mapped from a binary mesh file (the vertices
+ * and indices point into the mapping) or parsed/generated (they're on the
+ * heap) */
+struct gfxMesh {
+  struct gfxMeshHeader header;
+
+  void *vertices;
+  void *indices;
+
+  void *mapping;
+  size_t mappingSize;
+};
+
+gfx_mesh_error_t gfxMapMesh(struct gfxMesh *mesh, const char *filename);
+gfx_mesh_error_t gfxParseObj(struct gfxMesh *mesh, const char *filename);
+gfx_mesh_error_t gfxWriteMesh(const struct gfxMesh *mesh, const char *filename);
+void gfxMeshNarrowIndices(struct gfxMesh *mesh);
+void gfxQuantizeMesh(struct gfxMesh *mesh);
+void gfxMeshBuildLods(struct gfxMesh *mesh);
+void gfxFreeMesh(struct gfxMesh *mesh);
+const char *gfxMeshErrorString(gfx_mesh_error_t error);
+
+#endif
@@ -7,9 +7,16 @@
  * file that was distributed with the source code.
  */
 
+#include "math/math.h"
 #include "util.h"
 
 void gfxDestroyModel(struct gfxModel *model) {
+  /* the buffers belong to the geometry, which outlives its models */
+  if (model->geometry) {
+    gfxGeometryRemove(model->geometry, model);
+    return;
+  }
+
   glBindVertexArray(model->vao);
 
   GL_ERROR("bind VAO");
@@ -35,3 +42,293 @@ void gfxDestroyModel(struct gfxModel *model) {
 
   GL_ERROR("delete buffer objects");
 }
+
+/* calculates the object-space bounds of a model from its vertex positions,
+ * stride is in floats. Generators and loaders should call this, the
+ * drawlist uses the bounds to sort by depth. */
+void gfxModelBounds(struct gfxModel *model, const float *positions, size_t count, size_t stride) {
+  if (count == 0) {
+    model->bounds.min = vzero();
+    model->bounds.max = vzero();
+    return;
+  }
+
+  vec4 min = vec(positions[0], positions[1], positions[2], 1.0f);
+  vec4 max = min;
+
+  for (size_t i = 1; i < count; ++i) {
+    const float *p = positions + i * stride;
+    const vec4 v = vec(p[0], p[1], p[2], 1.0f);
+
+    min = vmin(min, v);
+    max = vmax(max, v);
+  }
+
+  model->bounds.min = min;
+  model->bounds.max = max;
+}
+
+static size_t typeSize(GLenum type) {
+  switch (type) {
+    case GL_BYTE:
+    case GL_UNSIGNED_BYTE:
+      return 1;
+    case GL_SHORT:
+    case GL_UNSIGNED_SHORT:
+    case GL_HALF_FLOAT:
+      return 2;
+    case GL_INT:
+    case GL_UNSIGNED_INT:
+    case GL_FLOAT:
+      return 4;
+    default:
+      assert(0 && "unknown vertex attribute type");
+      return 4;
+  }
+}
+
+/* appends an attribute to an interleaved vertex format (which should start
+ * out zeroed), returns its offset in bytes. Attributes get padded up to
+ * GFX_VERTEX_ALIGN so every one of them starts aligned, which is what most
+ * hardware wants, and the stride grows along. */
+GLuint gfxVertexFormatAdd(struct gfxVertexFormat *format, GLuint index, GLint size, GLenum type, GLboolean normalized) {
+  assert(format->numAttribs < GFX_MAX_VERTEX_ATTRIBS);
+
+  const size_t bytes = (size_t)size * typeSize(type);
+  const GLuint offset = (GLuint)format->stride;
+
+  format->attribs[format->numAttribs++] = (struct gfxVertexAttrib){index, size, type, normalized, offset};
+  format->stride += (GLsizei)((bytes + GFX_VERTEX_ALIGN - 1) & ~(size_t)(GFX_VERTEX_ALIGN - 1));
+
+  return offset;
+}
+
+/* the smallest index type that can address every vertex */
+GLenum gfxIndexType(size_t numVertices) {
+  if (numVertices <= 0xFF + 1) return GL_UNSIGNED_BYTE;
+  if (numVertices <= 0xFFFF + 1) return GL_UNSIGNED_SHORT;
+
+  return GL_UNSIGNED_INT;
+}
+
+size_t gfxIndexSize(GLenum type) {
+  assert(type == GL_UNSIGNED_BYTE || type == GL_UNSIGNED_SHORT || type == GL_UNSIGNED_INT);
+
+  return typeSize(type);
+}
+
+static GLuint readIndex(const void *indices, GLenum type, size_t i) {
+  switch (type) {
+    case GL_UNSIGNED_BYTE: return ((const GLubyte *)indices)[i];
+    case GL_UNSIGNED_SHORT: return ((const GLushort *)indices)[i];
+    default: return ((const GLuint *)indices)[i];
+  }
+}
+
+static void writeIndex(void *indices, GLenum type, size_t i, GLuint index) {
+  switch (type) {
+    case GL_UNSIGNED_BYTE:
+      assert(index <= 0xFF);
+      ((GLubyte *)indices)[i] = (GLubyte)index;
+      break;
+    case GL_UNSIGNED_SHORT:
+      assert(index <= 0xFFFF);
+      ((GLushort *)indices)[i] = (GLushort)index;
+      break;
+    default:
+      ((GLuint *)indices)[i] = index;
+      break;
+  }
+}
+
+/* converts between index types, src and dst may be the same array (when
+ * narrowing we go front to back, when widening back to front) */
+void gfxConvertIndices(void *dst, GLenum dstType, const void *src, GLenum srcType, size_t count) {
+  if (gfxIndexSize(dstType) > gfxIndexSize(srcType)) {
+    for (size_t i = count; i-- > 0;) {
+      writeIndex(dst, dstType, i, readIndex(src, srcType, i));
+    }
+  } else {
+    for (size_t i = 0; i < count; ++i) {
+      writeIndex(dst, dstType, i, readIndex(src, srcType, i));
+    }
+  }
+}
+
+/* reorders the triangles of a mesh for the post-transform vertex cache and
+ * then the vertices for fetching, see vcache.c. Run it before uploading,
+ * the mesh stays the same otherwise. */
+void gfxOptimizeMesh(void *vertices, size_t stride, size_t numVertices, void *indices, GLenum indexType, size_t numIndices) {
+  struct wfArena *scratch = wfScratch();
+  struct wfArenaMarker marker;
+  wfArenaMark(scratch, &marker);
+
+  GLuint *wide = (indexType == GL_UNSIGNED_INT) ? indices : wfArenaAlloc(scratch, numIndices * sizeof(GLuint));
+  gfxConvertIndices(wide, GL_UNSIGNED_INT, indices, indexType, numIndices);
+
+  struct gfxVertexCacheStats before, after;
+  gfxVertexCacheStats(&before, wide, numIndices, numVertices, GFX_VCACHE_SIZE);
+
+  /* small meshes can fit the cache as they are, the optimizer scores for
+   * an LRU cache and might make them worse for a FIFO, keep the original
+   * order then */
+  GLuint *optimized = wfArenaAlloc(scratch, numIndices * sizeof(GLuint));
+  memcpy(optimized, wide, numIndices * sizeof(GLuint));
+  gfxOptimizeTriangles(optimized, numIndices, numVertices);
+
+  gfxVertexCacheStats(&after, optimized, numIndices, numVertices, GFX_VCACHE_SIZE);
+  if (after.acmr < before.acmr) {
+    memcpy(wide, optimized, numIndices * sizeof(GLuint));
+  } else {
+    after = before;
+  }
+
+  gfxOptimizeVertexFetch(vertices, stride, numVertices, wide, numIndices);
+
+  trace("%zu triangles: ACMR %.3f -> %.3f, ATVR %.3f -> %.3f\n",
+        numIndices / 3, before.acmr, after.acmr, before.atvr, after.atvr);
+
+  if (wide != indices) {
+    gfxConvertIndices(indices, indexType, wide, GL_UNSIGNED_INT, numIndices);
+  }
+
+  wfArenaRewind(scratch, &marker);
+}
+
+/* gives the model its own VAO, one interleaved vertex buffer in the given
+ * format and an index buffer, for models that don't live in a geometry */
+void gfxModelUpload(struct gfxModel *model, const struct gfxVertexFormat *format,
+                    const void *vertices, size_t numVertices,
+                    const void *indices, GLenum indexType, size_t numIndices) {
+  /* generate and bind VAO */
+  glGenVertexArrays(1, &(model->vao));
+  glBindVertexArray(model->vao);
+
+  GL_ERROR("create VAO");
+
+  /* send vertices to GPU */
+  glGenBuffers(1, &model->vbo[GFX_VBO_VERTEX]);
+  glBindBuffer(GL_ARRAY_BUFFER, model->vbo[GFX_VBO_VERTEX]);
+  glBufferData(GL_ARRAY_BUFFER, (GLsizeiptr)(numVertices * (size_t)format->stride), vertices, GL_STATIC_DRAW);
+
+  for (unsigned int i = 0; i < format->numAttribs; ++i) {
+    const struct gfxVertexAttrib *attrib = &format->attribs[i];
+
+    glVertexAttribPointer(attrib->index, attrib->size, attrib->type, attrib->normalized, format->stride, (GLvoid *)(uintptr_t)attrib->offset);
+    glEnableVertexAttribArray(attrib->index);
+  }
+
+  GL_ERROR("load model VBO's");
+
+  /* send vertex indices to the GPU */
+  glGenBuffers(1, &model->ibo);
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, model->ibo);
+  glBufferData(GL_ELEMENT_ARRAY_BUFFER, (GLsizeiptr)(numIndices * gfxIndexSize(indexType)), indices, GL_STATIC_DRAW);
+
+  model->numIndices = (int)numIndices;
+  model->numVertices = (unsigned int)numVertices;
+  model->indexType = indexType;
+
+  /* unbind to prevent modification */
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+  glBindVertexArray(0);
+}
+
+static int sameFormat(const struct gfxVertexFormat *a, const struct gfxVertexFormat *b) {
+  if (a->stride != b->stride || a->numAttribs != b->numAttribs) return 0;
+
+  for (unsigned int i = 0; i < a->numAttribs; ++i) {
+    const struct gfxVertexAttrib *x = &a->attribs[i];
+    const struct gfxVertexAttrib *y = &b->attribs[i];
+
+    if (x->index != y->index || x->size != y->size || x->type != y->type ||
+        x->normalized != y->normalized || x->offset != y->offset) {
+      return 0;
+    }
+  }
+
+  return 1;
+}
+
+/* uploads a mesh that was mapped, parsed or generated (see mesh.h). With
+ * a geometry the mesh has to be in the format of the geometry. Returns 0
+ * if the mesh could not be uploaded. */
+int gfxUploadMesh(struct gfxModel *model, struct gfxGeometry *geometry, const struct gfxMesh *mesh) {
+  memset(model, 0x0, sizeof(struct gfxModel));
+
+  const struct gfxMeshHeader *header = &mesh->header;
+
+  struct gfxVertexFormat format;
+  memset(&format, 0x0, sizeof(format));
+
+  format.stride = (GLsizei)header->stride;
+  format.numAttribs = header->numAttribs;
+
+  for (unsigned int i = 0; i < header->numAttribs; ++i) {
+    const struct gfxMeshAttrib *attrib = &header->attribs[i];
+
+    if (attrib->index >= GFX_MAX_VERTEX_ATTRIBS || i >= GFX_MAX_VERTEX_ATTRIBS) {
+      trace("mesh has an attribute we don't know: %u\n", attrib->index);
+      return 0;
+    }
+
+    format.attribs[i] = (struct gfxVertexAttrib){
+        attrib->index, (GLint)attrib->size, attrib->type, attrib->normalized ? GL_TRUE : GL_FALSE, attrib->offset};
+  }
+
+  if (geometry) {
+    if (!sameFormat(&format, &geometry->format)) {
+      trace("mesh is not in the format of geometry %u\n", geometry->vao);
+      return 0;
+    }
+
+    if (!gfxGeometryAdd(geometry, model, mesh->vertices, header->numVertices,
+                        mesh->indices, header->indexType, header->numIndices)) {
+      return 0;
+    }
+  } else {
+    gfxModelUpload(model, &format, mesh->vertices, header->numVertices,
+                   mesh->indices, header->indexType, header->numIndices);
+  }
+
+  model->bounds.min = vec(header->min[0], header->min[1], header->min[2], 1.0f);
+  model->bounds.max = vec(header->max[0], header->max[1], header->max[2], 1.0f);
+
+  model->quantized = (header->flags & GFX_MESH_QUANTIZED) != 0;
+  memcpy(model->decode, header->decode, sizeof(model->decode));
+
+  model->numLods = header->numLods;
+  memcpy(model->lods, header->lods, sizeof(model->lods));
+
+  return 1;
+}
+
+/* loads a binary mesh file (see mesh.h), the vertices and indices go to GL
+ * straight from the mapped file. Returns 0 if the mesh could not be
+ * loaded. */
+int gfxLoadMesh(struct gfxModel *model, struct gfxGeometry *geometry, const char *filename) {
+  memset(model, 0x0, sizeof(struct gfxModel));
+
+  struct gfxMesh mesh;
+  const gfx_mesh_error_t error = gfxMapMesh(&mesh, filename);
+
+  if (error != GFX_MESH_OK) {
+    trace("could not load mesh %s: %s\n", filename, gfxMeshErrorString(error));
+    return 0;
+  }
+
+  const int ok = gfxUploadMesh(model, geometry, &mesh);
+
+  if (ok) {
+    trace("loaded mesh %s: %u vertices, %u indices in %u LODs (%zu bytes mapped)%s\n", filename,
+          mesh.header.numVertices, mesh.header.numIndices, MAX(model->numLods, 1u), mesh.mappingSize,
+          model->quantized ? ", quantized" : "");
+  } else {
+    trace("could not upload mesh %s\n", filename);
+  }
+
+  /* GL has its own copy by now */
+  gfxFreeMesh(&mesh);
+
+  return ok;
+}
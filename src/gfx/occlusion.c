@@ -0,0 +1,554 @@
+/**
+ * This file is part of prototype.
+ *
+ * (c) 2014 Nicolas Hillegeer <nicolas@hillegeer.com>
+ *
+ * For the full copyright and license information, please view the LICENSE
+ * file that was distributed with the source code.
+ *
+ * A small software rasterizer for occlusion culling (see occlusion.h).
+ *
+ * Occluder triangles get transformed to clip space, clipped against the
+ * near and side planes (only those that actually cross one), projected
+ * and set up once: 3 edge functions that are positive inside and a plane
+ * for the depth. They're binned into the tiles their bounds overlap. A
+ * tile then walks its bin and tests 4 pixel centers at a time against all
+ * edges (half-space rasterization), keeping the nearest depth.
+ *
+ * The pyramid on top of the depth buffer keeps the farthest depth of
+ * every 2x2 block, so one texel tells how far away the occluders are at
+ * worst over its whole area. A box is projected to a screen rectangle and
+ * the nearest depth of its corners, which gets compared to the texels of
+ * the first level where the rectangle covers at most 2x2 of them.
+ *
+ * Coverage is sampled at pixel centers, so an occluder that doesn't cover
+ * the center of a pixel doesn't count there at all, and one that does
+ * counts for all of it. That's not conservative at the edges of the
+ * occluders, but close enough with occluders that are a bit smaller than
+ * what they stand in for.
+ *
+ * http://fgiesen.wordpress.com/2013/02/17/optimizing-sw-occlusion-culling-index/
+ * https://software.intel.com/en-us/articles/software-occlusion-culling
+ *
+ * Doesn't touch GL.
+ */
+
+#include <assert.h>
+#include <float.h>
+#include <math.h>
+#include <string.h>
+#include <xmmintrin.h>
+
+#include "math/vector.h"
+#include "math/matrix.h"
+
+#include "occlusion.h"
+#include "zmalloc.h"
+
+/* 8192 pixels is more than a low-res occlusion buffer will ever need */
+#define OCC_MAX_LEVELS 14
+
+/* the planes a triangle gets clipped against, in clip space: left, right,
+ * bottom, top and near. The far plane doesn't matter, what's behind it
+ * gets a depth above 1 and never makes it into the buffer. */
+#define OCC_CLIP_PLANES 5
+
+/* a triangle that got clipped by all planes has at most 3 + 5 corners */
+#define OCC_MAX_POLY (3 + OCC_CLIP_PLANES)
+
+static const float gClipPlanes[OCC_CLIP_PLANES][4] = {
+  {  1.0f,  0.0f, 0.0f, 1.0f },
+  { -1.0f,  0.0f, 0.0f, 1.0f },
+  {  0.0f,  1.0f, 0.0f, 1.0f },
+  {  0.0f, -1.0f, 0.0f, 1.0f },
+  {  0.0f,  0.0f, 1.0f, 1.0f }
+};
+
+/* a triangle ready to be rasterized, in pixels with y going up */
+struct occTriangle {
+  /* edge k is a[k] * x + b[k] * y + c[k], >= 0 inside */
+  float a[3];
+  float b[3];
+  float c[3];
+
+  /* depth = za * x + zb * y + zc */
+  float za, zb, zc;
+
+  /* the pixels whose centers can be covered, inclusive */
+  int x0, y0, x1, y1;
+};
+
+struct occBin {
+  uint32_t *triangles;
+  size_t count;
+  size_t capacity;
+};
+
+struct gfxOcclusion {
+  unsigned int width;
+  unsigned int height;
+  unsigned int tilesX;
+  unsigned int tilesY;
+
+  float viewproj[16];
+
+  struct occTriangle *triangles;
+  size_t numTriangles;
+  size_t triangleCapacity;
+
+  struct occBin *bins;
+
+  /* the clip-space vertices of the occluder being added, and where they
+   * are with respect to the clip planes */
+  float *clip;
+  uint8_t *outcodes;
+  size_t vertexCapacity;
+
+  /* level 0 is the depth buffer, every level after it has the farthest
+   * depth of 2x2 texels of the previous one */
+  unsigned int numLevels;
+  unsigned int levelWidth[OCC_MAX_LEVELS];
+  unsigned int levelHeight[OCC_MAX_LEVELS];
+  float *levels[OCC_MAX_LEVELS];
+};
+
+struct gfxOcclusion *gfxOcclusionCreate(unsigned int width, unsigned int height) {
+  assert(width && height);
+  assert(width % GFX_OCCLUSION_TILE == 0 && height % GFX_OCCLUSION_TILE == 0);
+
+  struct gfxOcclusion *oc = zcalloc(sizeof(struct gfxOcclusion));
+
+  oc->width = width;
+  oc->height = height;
+  oc->tilesX = width / GFX_OCCLUSION_TILE;
+  oc->tilesY = height / GFX_OCCLUSION_TILE;
+  oc->bins = zcalloc(oc->tilesX * oc->tilesY * sizeof(struct occBin));
+
+  unsigned int w = width, h = height;
+  for (;;) {
+    assert(oc->numLevels < OCC_MAX_LEVELS);
+
+    oc->levelWidth[oc->numLevels] = w;
+    oc->levelHeight[oc->numLevels] = h;
+    oc->levels[oc->numLevels] = zmalloc(w * h * sizeof(float));
+    oc->numLevels++;
+
+    if (w == 1 && h == 1) break;
+
+    w = (w + 1) / 2;
+    h = (h + 1) / 2;
+  }
+
+  /* nothing occludes anything until the first frame is finished */
+  for (unsigned int l = 0; l < oc->numLevels; ++l) {
+    for (unsigned int i = 0; i < oc->levelWidth[l] * oc->levelHeight[l]; ++i) oc->levels[l][i] = 1.0f;
+  }
+
+  mstoreu(oc->viewproj, midentity());
+
+  return oc;
+}
+
+void gfxOcclusionDestroy(struct gfxOcclusion *oc) {
+  for (unsigned int t = 0; t < oc->tilesX * oc->tilesY; ++t) {
+    zfree(oc->bins[t].triangles);
+  }
+
+  for (unsigned int l = 0; l < oc->numLevels; ++l) {
+    zfree(oc->levels[l]);
+  }
+
+  zfree(oc->bins);
+  zfree(oc->triangles);
+  zfree(oc->clip);
+  zfree(oc->outcodes);
+  zfree(oc);
+}
+
+/* starts a new frame, the occluders and the boxes that get tested are
+ * in world space and viewproj takes them to clip space */
+void gfxOcclusionBegin(struct gfxOcclusion *oc, const mat4 *viewproj) {
+  mstoreu(oc->viewproj, *viewproj);
+
+  oc->numTriangles = 0;
+
+  for (unsigned int t = 0; t < oc->tilesX * oc->tilesY; ++t) {
+    oc->bins[t].count = 0;
+  }
+}
+
+static void binTriangle(struct gfxOcclusion *oc, uint32_t index, const struct occTriangle *tri) {
+  const unsigned int tx0 = (unsigned int) tri->x0 / GFX_OCCLUSION_TILE;
+  const unsigned int tx1 = (unsigned int) tri->x1 / GFX_OCCLUSION_TILE;
+  const unsigned int ty0 = (unsigned int) tri->y0 / GFX_OCCLUSION_TILE;
+  const unsigned int ty1 = (unsigned int) tri->y1 / GFX_OCCLUSION_TILE;
+
+  for (unsigned int ty = ty0; ty <= ty1; ++ty) {
+    for (unsigned int tx = tx0; tx <= tx1; ++tx) {
+      struct occBin *bin = &oc->bins[ty * oc->tilesX + tx];
+
+      if (bin->count == bin->capacity) {
+        bin->capacity = bin->capacity ? bin->capacity * 2 : 64;
+        bin->triangles = zrealloc(bin->triangles, bin->capacity * sizeof(uint32_t));
+      }
+
+      bin->triangles[bin->count++] = index;
+    }
+  }
+}
+
+/* projects a triangle that's completely inside of the clip planes and
+ * sets it up for rasterization, back faces and triangles that don't cover
+ * a single pixel center are dropped */
+static void setupTriangle(struct gfxOcclusion *oc, const float *v0, const float *v1, const float *v2) {
+  const float *v[3] = { v0, v1, v2 };
+  float x[3], y[3], z[3];
+
+  for (int k = 0; k < 3; ++k) {
+    const float inv = 1.0f / v[k][3];
+    x[k] = (v[k][0] * inv * 0.5f + 0.5f) * (float) oc->width;
+    y[k] = (v[k][1] * inv * 0.5f + 0.5f) * (float) oc->height;
+    z[k] = v[k][2] * inv * 0.5f + 0.5f;
+  }
+
+  const float area = (x[1] - x[0]) * (y[2] - y[0]) - (x[2] - x[0]) * (y[1] - y[0]);
+  if (!(area > 0.0f)) return;
+
+  const float minX = fminf(x[0], fminf(x[1], x[2]));
+  const float maxX = fmaxf(x[0], fmaxf(x[1], x[2]));
+  const float minY = fminf(y[0], fminf(y[1], y[2]));
+  const float maxY = fmaxf(y[0], fmaxf(y[1], y[2]));
+
+  struct occTriangle tri;
+
+  /* pixel x has its center at x + 0.5 */
+  tri.x0 = (int) ceilf(minX - 0.5f);
+  tri.x1 = (int) floorf(maxX - 0.5f);
+  tri.y0 = (int) ceilf(minY - 0.5f);
+  tri.y1 = (int) floorf(maxY - 0.5f);
+
+  const int lastX = (int) oc->width - 1;
+  const int lastY = (int) oc->height - 1;
+
+  tri.x0 = (tri.x0 < 0) ? 0 : tri.x0;
+  tri.y0 = (tri.y0 < 0) ? 0 : tri.y0;
+  tri.x1 = (tri.x1 > lastX) ? lastX : tri.x1;
+  tri.y1 = (tri.y1 > lastY) ? lastY : tri.y1;
+
+  if (tri.x0 > tri.x1 || tri.y0 > tri.y1) return;
+
+  for (int k = 0; k < 3; ++k) {
+    const int j = (k + 1) % 3;
+
+    tri.a[k] = y[k] - y[j];
+    tri.b[k] = x[j] - x[k];
+    tri.c[k] = -(tri.a[k] * x[k] + tri.b[k] * y[k]);
+  }
+
+  tri.za = ((z[1] - z[0]) * (y[2] - y[0]) - (z[2] - z[0]) * (y[1] - y[0])) / area;
+  tri.zb = ((z[2] - z[0]) * (x[1] - x[0]) - (z[1] - z[0]) * (x[2] - x[0])) / area;
+  tri.zc = z[0] - tri.za * x[0] - tri.zb * y[0];
+
+  if (oc->numTriangles == oc->triangleCapacity) {
+    oc->triangleCapacity = oc->triangleCapacity ? oc->triangleCapacity * 2 : 256;
+    oc->triangles = zrealloc(oc->triangles, oc->triangleCapacity * sizeof(struct occTriangle));
+  }
+
+  const uint32_t index = (uint32_t) oc->numTriangles++;
+  oc->triangles[index] = tri;
+
+  binTriangle(oc, index, &tri);
+}
+
+static float planeDistance(int plane, const float *v) {
+  const float *p = gClipPlanes[plane];
+  return p[0] * v[0] + p[1] * v[1] + p[2] * v[2] + p[3] * v[3];
+}
+
+/* Sutherland-Hodgman against the planes in mask, then a fan */
+static void clipTriangle(struct gfxOcclusion *oc, const float *v0, const float *v1, const float *v2, unsigned int mask) {
+  float polys[2][OCC_MAX_POLY][4];
+
+  memcpy(polys[0][0], v0, sizeof(polys[0][0]));
+  memcpy(polys[0][1], v1, sizeof(polys[0][1]));
+  memcpy(polys[0][2], v2, sizeof(polys[0][2]));
+
+  int n = 3;
+  int cur = 0;
+
+  for (int plane = 0; plane < OCC_CLIP_PLANES; ++plane) {
+    if (!(mask & (1u << plane))) continue;
+
+    float (*in)[4] = polys[cur];
+    float (*out)[4] = polys[cur ^ 1];
+    int m = 0;
+
+    for (int i = 0; i < n; ++i) {
+      const float *a = in[i];
+      const float *b = in[(i + 1) % n];
+      const float da = planeDistance(plane, a);
+      const float db = planeDistance(plane, b);
+
+      if (da >= 0.0f) {
+        memcpy(out[m++], a, sizeof(out[0]));
+      }
+
+      if ((da >= 0.0f) != (db >= 0.0f)) {
+        const float t = da / (da - db);
+        for (int c = 0; c < 4; ++c) out[m][c] = a[c] + t * (b[c] - a[c]);
+        ++m;
+      }
+    }
+
+    n = m;
+    cur ^= 1;
+
+    if (n < 3) return;
+  }
+
+  for (int i = 1; i + 1 < n; ++i) {
+    setupTriangle(oc, polys[cur][0], polys[cur][i], polys[cur][i + 1]);
+  }
+}
+
+/* adds an indexed triangle mesh, the positions are 3 floats at the start
+ * of every vertex, world takes them to world space */
+void gfxOcclusionAddOccluder(struct gfxOcclusion *oc, const mat4 *world, const void *positions, size_t stride,
+                             size_t numVertices, const uint32_t *indices, size_t numIndices) {
+  if (oc->vertexCapacity < numVertices) {
+    oc->vertexCapacity = numVertices;
+    oc->clip = zrealloc(oc->clip, numVertices * 4 * sizeof(float));
+    oc->outcodes = zrealloc(oc->outcodes, numVertices);
+  }
+
+  const mat4 m = mmmul(mloadu(oc->viewproj), *world);
+
+  for (size_t i = 0; i < numVertices; ++i) {
+    const float *p = (const float *) ((const char *) positions + i * stride);
+    const vec4 v = m.cols[0] * vscalar(p[0]) + m.cols[1] * vscalar(p[1]) + m.cols[2] * vscalar(p[2]) + m.cols[3];
+
+    float *c = &oc->clip[i * 4];
+    vstoreu(c, v);
+
+    uint8_t code = 0;
+    for (int plane = 0; plane < OCC_CLIP_PLANES; ++plane) {
+      if (planeDistance(plane, c) < 0.0f) code |= (uint8_t) (1u << plane);
+    }
+    oc->outcodes[i] = code;
+  }
+
+  for (size_t i = 0; i + 2 < numIndices; i += 3) {
+    const uint32_t i0 = indices[i], i1 = indices[i + 1], i2 = indices[i + 2];
+    const uint8_t c0 = oc->outcodes[i0], c1 = oc->outcodes[i1], c2 = oc->outcodes[i2];
+
+    /* all corners outside of the same plane */
+    if (c0 & c1 & c2) continue;
+
+    if (c0 | c1 | c2) {
+      clipTriangle(oc, &oc->clip[i0 * 4], &oc->clip[i1 * 4], &oc->clip[i2 * 4], c0 | c1 | c2);
+    } else {
+      setupTriangle(oc, &oc->clip[i0 * 4], &oc->clip[i1 * 4], &oc->clip[i2 * 4]);
+    }
+  }
+}
+
+unsigned int gfxOcclusionNumTiles(const struct gfxOcclusion *oc) {
+  return oc->tilesX * oc->tilesY;
+}
+
+static void rasterizeTriangle(struct gfxOcclusion *oc, const struct occTriangle *tri,
+                              int tileX0, int tileY0, int tileX1, int tileY1) {
+  const int x0 = (tri->x0 > tileX0) ? tri->x0 : tileX0;
+  const int x1 = (tri->x1 < tileX1) ? tri->x1 : tileX1;
+  const int y0 = (tri->y0 > tileY0) ? tri->y0 : tileY0;
+  const int y1 = (tri->y1 < tileY1) ? tri->y1 : tileY1;
+
+  if (x0 > x1 || y0 > y1) return;
+
+  const __m128 zero = _mm_setzero_ps();
+  const __m128 lanes = _mm_setr_ps(0.5f, 1.5f, 2.5f, 3.5f);
+
+  const __m128 a0 = _mm_set1_ps(tri->a[0]), a1 = _mm_set1_ps(tri->a[1]), a2 = _mm_set1_ps(tri->a[2]);
+  const __m128 za = _mm_set1_ps(tri->za);
+
+  /* tiles start at a multiple of 4 pixels, so the groups of 4 never
+   * straddle two tiles */
+  const int start = x0 & ~3;
+
+  for (int y = y0; y <= y1; ++y) {
+    const float py = (float) y + 0.5f;
+
+    const __m128 r0 = _mm_set1_ps(tri->b[0] * py + tri->c[0]);
+    const __m128 r1 = _mm_set1_ps(tri->b[1] * py + tri->c[1]);
+    const __m128 r2 = _mm_set1_ps(tri->b[2] * py + tri->c[2]);
+    const __m128 rz = _mm_set1_ps(tri->zb * py + tri->zc);
+
+    float *row = &oc->levels[0][(size_t) y * oc->width];
+
+    for (int x = start; x <= x1; x += 4) {
+      const __m128 px = _mm_add_ps(_mm_set1_ps((float) x), lanes);
+
+      __m128 inside = _mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(a0, px), r0), zero);
+      inside = _mm_and_ps(inside, _mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(a1, px), r1), zero));
+      inside = _mm_and_ps(inside, _mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(a2, px), r2), zero));
+
+      if (!_mm_movemask_ps(inside)) continue;
+
+      const __m128 depth = _mm_add_ps(_mm_mul_ps(za, px), rz);
+      const __m128 old = _mm_loadu_ps(row + x);
+      const __m128 nearest = _mm_min_ps(old, depth);
+
+      _mm_storeu_ps(row + x, _mm_or_ps(_mm_and_ps(inside, nearest), _mm_andnot_ps(inside, old)));
+    }
+  }
+}
+
+/* clears the tile and rasterizes everything that got binned into it, any
+ * thread can do any tile, as long as no two threads do the same one */
+void gfxOcclusionRasterizeTile(struct gfxOcclusion *oc, unsigned int tile) {
+  assert(tile < oc->tilesX * oc->tilesY);
+
+  const int tileX0 = (int) ((tile % oc->tilesX) * GFX_OCCLUSION_TILE);
+  const int tileY0 = (int) ((tile / oc->tilesX) * GFX_OCCLUSION_TILE);
+  const int tileX1 = tileX0 + GFX_OCCLUSION_TILE - 1;
+  const int tileY1 = tileY0 + GFX_OCCLUSION_TILE - 1;
+
+  for (int y = tileY0; y <= tileY1; ++y) {
+    float *row = &oc->levels[0][(size_t) y * oc->width];
+    for (int x = tileX0; x <= tileX1; ++x) row[x] = 1.0f;
+  }
+
+  const struct occBin *bin = &oc->bins[tile];
+
+  for (size_t i = 0; i < bin->count; ++i) {
+    rasterizeTriangle(oc, &oc->triangles[bin->triangles[i]], tileX0, tileY0, tileX1, tileY1);
+  }
+}
+
+/* all tiles on the calling thread */
+void gfxOcclusionRasterize(struct gfxOcclusion *oc) {
+  for (unsigned int t = 0; t < oc->tilesX * oc->tilesY; ++t) {
+    gfxOcclusionRasterizeTile(oc, t);
+  }
+}
+
+/* builds the pyramid, after all tiles are rasterized */
+void gfxOcclusionFinish(struct gfxOcclusion *oc) {
+  for (unsigned int l = 1; l < oc->numLevels; ++l) {
+    const float *src = oc->levels[l - 1];
+    const unsigned int srcW = oc->levelWidth[l - 1];
+    const unsigned int srcH = oc->levelHeight[l - 1];
+
+    float *dst = oc->levels[l];
+    const unsigned int w = oc->levelWidth[l];
+    const unsigned int h = oc->levelHeight[l];
+
+    for (unsigned int y = 0; y < h; ++y) {
+      const float *row0 = &src[(size_t) (2 * y) * srcW];
+      const float *row1 = (2 * y + 1 < srcH) ? row0 + srcW : row0;
+
+      for (unsigned int x = 0; x < w; ++x) {
+        const unsigned int sx0 = 2 * x;
+        const unsigned int sx1 = (2 * x + 1 < srcW) ? 2 * x + 1 : 2 * x;
+
+        const float a = (row0[sx0] > row0[sx1]) ? row0[sx0] : row0[sx1];
+        const float b = (row1[sx0] > row1[sx1]) ? row1[sx0] : row1[sx1];
+
+        dst[(size_t) y * w + x] = (a > b) ? a : b;
+      }
+    }
+  }
+}
+
+/* 0 if the box is completely hidden behind the occluders, 1 otherwise.
+ * Boxes that cross the near plane or lie off-screen are always visible,
+ * there's nothing to say about them. */
+int gfxOcclusionTestBox(const struct gfxOcclusion *oc, const aabb *box) {
+  const mat4 m = mloadu(oc->viewproj);
+
+  /* the corners, transformed per axis so they can be combined */
+  const vec4 x0 = m.cols[0] * vsplat(box->min, 0), x1 = m.cols[0] * vsplat(box->max, 0);
+  const vec4 y0 = m.cols[1] * vsplat(box->min, 1), y1 = m.cols[1] * vsplat(box->max, 1);
+  const vec4 z0 = m.cols[2] * vsplat(box->min, 2) + m.cols[3];
+  const vec4 z1 = m.cols[2] * vsplat(box->max, 2) + m.cols[3];
+
+  vec4 lo = vscalar(FLT_MAX);
+  vec4 hi = vscalar(-FLT_MAX);
+
+  for (int i = 0; i < 8; ++i) {
+    const vec4 c = ((i & 1) ? x1 : x0) + ((i & 2) ? y1 : y0) + ((i & 4) ? z1 : z0);
+
+    if (c[3] <= 0.0f || c[2] < -c[3]) return 1;
+
+    const vec4 ndc = c / vsplat(c, 3);
+    lo = vmin(lo, ndc);
+    hi = vmax(hi, ndc);
+  }
+
+  const float sx0 = (lo[0] * 0.5f + 0.5f) * (float) oc->width;
+  const float sx1 = (hi[0] * 0.5f + 0.5f) * (float) oc->width;
+  const float sy0 = (lo[1] * 0.5f + 0.5f) * (float) oc->height;
+  const float sy1 = (hi[1] * 0.5f + 0.5f) * (float) oc->height;
+
+  if (sx1 < 0.0f || sy1 < 0.0f || sx0 > (float) oc->width || sy0 > (float) oc->height) return 1;
+
+  const float nearest = lo[2] * 0.5f + 0.5f;
+
+  int px0 = (int) floorf(sx0), px1 = (int) floorf(sx1);
+  int py0 = (int) floorf(sy0), py1 = (int) floorf(sy1);
+
+  const int maxX = (int) oc->width - 1;
+  const int maxY = (int) oc->height - 1;
+
+  px0 = (px0 < 0) ? 0 : px0;
+  py0 = (py0 < 0) ? 0 : py0;
+  px1 = (px1 > maxX) ? maxX : px1;
+  py1 = (py1 > maxY) ? maxY : py1;
+
+  /* the first level where the rectangle covers at most 2x2 texels */
+  unsigned int l = 0;
+  while (l + 1 < oc->numLevels && ((px1 >> l) - (px0 >> l) > 1 || (py1 >> l) - (py0 >> l) > 1)) ++l;
+
+  const float *level = oc->levels[l];
+  const unsigned int w = oc->levelWidth[l];
+
+  float farthest = 0.0f;
+  for (int y = py0 >> l; y <= py1 >> l; ++y) {
+    for (int x = px0 >> l; x <= px1 >> l; ++x) {
+      const float d = level[(size_t) y * w + (size_t) x];
+      farthest = (d > farthest) ? d : farthest;
+    }
+  }
+
+  return nearest <= farthest;
+}
+
+/* clears the bits of the boxes that are occluded in a visibility mask,
+ * like the one gfxCullBoxes() fills in. Returns how many were cleared. */
+size_t gfxOcclusionCullBoxes(const struct gfxOcclusion *oc, const struct gfxBoxes *boxes, uint32_t *visible) {
+  size_t occluded = 0;
+
+  for (size_t w = 0; w < GFX_CULL_WORDS(boxes->count); ++w) {
+    for (uint32_t bits = visible[w]; bits; bits &= bits - 1) {
+      const size_t i = w * 32 + (size_t) __builtin_ctz(bits);
+
+      aabb box;
+      box.min = vec(boxes->minX[i], boxes->minY[i], boxes->minZ[i], 1.0f);
+      box.max = vec(boxes->maxX[i], boxes->maxY[i], boxes->maxZ[i], 1.0f);
+
+      if (!gfxOcclusionTestBox(oc, &box)) {
+        visible[w] &= ~(1u << (i & 31));
+        ++occluded;
+      }
+    }
+  }
+
+  return occluded;
+}
+
+/* the depth buffer itself, for debugging, rows go from the bottom up */
+const float *gfxOcclusionDepth(const struct gfxOcclusion *oc, unsigned int *width, unsigned int *height) {
+  *width = oc->width;
+  *height = oc->height;
+  return oc->levels[0];
+}
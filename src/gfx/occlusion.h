@@ -0,0 +1,66 @@
+/**
+ * This file is part of prototype.
+ *
+ * (c) 2014 Nicolas Hillegeer <nicolas@hillegeer.com>
+ *
+ * For the full copyright and license information, please view the LICENSE
+ * file that was distributed with the source code.
+ */
+
+#ifndef __occlusion_h__
+#define __occlusion_h__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "math/types.h"
+#include "cull.h"
+
+/**
+ * Software occlusion culling. A handful of big occluders (walls, terrain,
+ * buildings) get rasterized into a small depth buffer on the CPU, then
+ * every object that survived frustum culling gets its screen-space
+ * bounding rectangle tested against a max-depth pyramid of that buffer.
+ * Whatever is completely behind the occluders doesn't need to be drawn.
+ *
+ * A frame goes like this:
+ *
+ *   gfxOcclusionBegin(oc, &viewproj);
+ *   gfxOcclusionAddOccluder(oc, ...);    (for every occluder)
+ *   gfxOcclusionRasterizeTile(oc, tile); (for every tile, from any thread)
+ *   gfxOcclusionFinish(oc);
+ *   gfxOcclusionTestBox(oc, &box);       (from any thread)
+ *
+ * Adding occluders, finishing and the queries happen on one thread at a
+ * time, but the tiles can be spread over worker threads, every tile only
+ * writes to its own part of the depth buffer. The result doesn't depend on
+ * how the tiles were spread, nor on the order of the threads.
+ *
+ * Occluders have counter-clockwise front faces (like GL's default), back
+ * faces don't occlude. Depth is the GL window depth: 0 is at the near
+ * plane, 1 at the far plane.
+ */
+
+/* tiles are this many pixels wide and high, the size of the buffer has to
+ * be a multiple of them */
+#define GFX_OCCLUSION_TILE 32
+
+struct gfxOcclusion;
+
+struct gfxOcclusion *gfxOcclusionCreate(unsigned int width, unsigned int height);
+void gfxOcclusionDestroy(struct gfxOcclusion *oc);
+
+void gfxOcclusionBegin(struct gfxOcclusion *oc, const mat4 *viewproj);
+void gfxOcclusionAddOccluder(struct gfxOcclusion *oc, const mat4 *world, const void *positions, size_t stride,
+                             size_t numVertices, const uint32_t *indices, size_t numIndices);
+
+unsigned int gfxOcclusionNumTiles(const struct gfxOcclusion *oc);
+void gfxOcclusionRasterizeTile(struct gfxOcclusion *oc, unsigned int tile);
+void gfxOcclusionRasterize(struct gfxOcclusion *oc);
+void gfxOcclusionFinish(struct gfxOcclusion *oc);
+
+int gfxOcclusionTestBox(const struct gfxOcclusion *oc, const aabb *box);
+size_t gfxOcclusionCullBoxes(const struct gfxOcclusion *oc, const struct gfxBoxes *boxes, uint32_t *visible);
+const float *gfxOcclusionDepth(const struct gfxOcclusion *oc, unsigned int *width, unsigned int *height);
+
+#endif
@@ -0,0 +1,257 @@
+/**
+ * This file is part of prototype.
+ *
+ * (c) 2014 Nicolas Hillegeer <nicolas@hillegeer.com>
+ *
+ * For the full copyright and license information, please view the LICENSE
+ * file that was distributed with the source code.
+ *
+ * Encoders for compressed vertex attributes (see quantize.h), they run
+ * when a mesh gets converted or loaded so they're SSE all the way. The
+ * decoders are scalar, the real decoding happens on the GPU (snorm and
+ * half float are done by the vertex fetch, the octahedron in the shader),
+ * these are for checking the results.
+ *
+ * Doesn't touch GL.
+ */
+
+#include <math.h>
+#include <string.h>
+#include <emmintrin.h>
+
+#if defined(__F16C__)
+#include <immintrin.h>
+#endif
+
+#include "quantize.h"
+
+#define SNORM16_MAX 32767.0f
+
+/* the offset is the center of the bounds, the scale the largest half
+ * extent so that everything ends up in [-1, 1] */
+void gfxPositionDecode(const float min[3], const float max[3], float offset[3], float *scale) {
+  float extent = 0.0f;
+
+  for (int i = 0; i < 3; ++i) {
+    offset[i] = (min[i] + max[i]) * 0.5f;
+    extent = fmaxf(extent, (max[i] - min[i]) * 0.5f);
+  }
+
+  /* a flat or empty mesh, anything but 0 will do */
+  *scale = (extent > 0.0f) ? extent : 1.0f;
+}
+
+/* reads 3 floats per vertex, writes 3 x snorm16 + 0 */
+void gfxQuantizePositions(void *dst, size_t dstStride, const void *src, size_t srcStride, size_t count,
+                          const float offset[3], float scale) {
+  const __m128 o = _mm_set_ps(0.0f, offset[2], offset[1], offset[0]);
+  const __m128 s = _mm_set1_ps(SNORM16_MAX / scale);
+  const __m128 lo = _mm_set1_ps(-SNORM16_MAX);
+  const __m128 hi = _mm_set1_ps(SNORM16_MAX);
+
+  const unsigned char *in = src;
+  unsigned char *out = dst;
+
+  for (size_t i = 0; i < count; ++i, in += srcStride, out += dstStride) {
+    float p[3];
+    memcpy(p, in, sizeof(p));
+
+    /* clamp before converting, rounding errors in the bounds could push
+     * a vertex a hair over 1 */
+    __m128 v = _mm_mul_ps(_mm_sub_ps(_mm_set_ps(0.0f, p[2], p[1], p[0]), o), s);
+    v = _mm_min_ps(_mm_max_ps(v, lo), hi);
+
+    const __m128i q = _mm_cvtps_epi32(v);
+    _mm_storel_epi64((__m128i *)out, _mm_packs_epi32(q, q));
+  }
+}
+
+static void octEncodeScalar(const float n[3], int16_t encoded[2]) {
+  const float l1 = fabsf(n[0]) + fabsf(n[1]) + fabsf(n[2]);
+  float x = (l1 > 0.0f) ? n[0] / l1 : 0.0f;
+  float y = (l1 > 0.0f) ? n[1] / l1 : 0.0f;
+
+  /* fold the lower hemisphere over the diagonals */
+  if (n[2] < 0.0f) {
+    const float fx = (1.0f - fabsf(y)) * (x >= 0.0f ? 1.0f : -1.0f);
+    const float fy = (1.0f - fabsf(x)) * (y >= 0.0f ? 1.0f : -1.0f);
+    x = fx;
+    y = fy;
+  }
+
+  encoded[0] = (int16_t)lrintf(fminf(fmaxf(x, -1.0f), 1.0f) * SNORM16_MAX);
+  encoded[1] = (int16_t)lrintf(fminf(fmaxf(y, -1.0f), 1.0f) * SNORM16_MAX);
+}
+
+/* reads 3 floats per normal, writes 2 x snorm16, 4 normals at a time */
+void gfxOctEncodeNormals(void *dst, size_t dstStride, const void *src, size_t srcStride, size_t count) {
+  const __m128 signMask = _mm_set1_ps(-0.0f);
+  const __m128 one = _mm_set1_ps(1.0f);
+  const __m128 zero = _mm_setzero_ps();
+  const __m128 s = _mm_set1_ps(SNORM16_MAX);
+
+  const unsigned char *in = src;
+  unsigned char *out = dst;
+
+  size_t i = 0;
+
+  for (; i + 4 <= count; i += 4) {
+    float n[4][3];
+    for (size_t j = 0; j < 4; ++j) memcpy(n[j], in + (i + j) * srcStride, sizeof(n[j]));
+
+    const __m128 nx = _mm_set_ps(n[3][0], n[2][0], n[1][0], n[0][0]);
+    const __m128 ny = _mm_set_ps(n[3][1], n[2][1], n[1][1], n[0][1]);
+    const __m128 nz = _mm_set_ps(n[3][2], n[2][2], n[1][2], n[0][2]);
+
+    const __m128 l1 = _mm_add_ps(_mm_add_ps(_mm_andnot_ps(signMask, nx), _mm_andnot_ps(signMask, ny)),
+                                 _mm_andnot_ps(signMask, nz));
+
+    /* degenerate normals become (0, 0) instead of NaN */
+    const __m128 valid = _mm_cmpgt_ps(l1, zero);
+    const __m128 inv = _mm_and_ps(_mm_div_ps(one, l1), valid);
+
+    const __m128 x = _mm_mul_ps(nx, inv);
+    const __m128 y = _mm_mul_ps(ny, inv);
+
+    /* sign() that says 1 for 0 */
+    const __m128 sx = _mm_or_ps(_mm_and_ps(x, signMask), one);
+    const __m128 sy = _mm_or_ps(_mm_and_ps(y, signMask), one);
+
+    const __m128 fx = _mm_mul_ps(_mm_sub_ps(one, _mm_andnot_ps(signMask, y)), sx);
+    const __m128 fy = _mm_mul_ps(_mm_sub_ps(one, _mm_andnot_ps(signMask, x)), sy);
+
+    const __m128 lower = _mm_cmplt_ps(nz, zero);
+    const __m128 ox = _mm_or_ps(_mm_and_ps(lower, fx), _mm_andnot_ps(lower, x));
+    const __m128 oy = _mm_or_ps(_mm_and_ps(lower, fy), _mm_andnot_ps(lower, y));
+
+    const __m128i qx = _mm_cvtps_epi32(_mm_mul_ps(_mm_min_ps(_mm_max_ps(ox, _mm_sub_ps(zero, one)), one), s));
+    const __m128i qy = _mm_cvtps_epi32(_mm_mul_ps(_mm_min_ps(_mm_max_ps(oy, _mm_sub_ps(zero, one)), one), s));
+
+    /* x0 y0 x1 y1 ... as 16 bit */
+    int16_t packed[8];
+    _mm_storeu_si128((__m128i *)packed, _mm_packs_epi32(_mm_unpacklo_epi32(qx, qy), _mm_unpackhi_epi32(qx, qy)));
+
+    for (size_t j = 0; j < 4; ++j) memcpy(out + (i + j) * dstStride, &packed[j * 2], 2 * sizeof(int16_t));
+  }
+
+  for (; i < count; ++i) {
+    float n[3];
+    int16_t encoded[2];
+    memcpy(n, in + i * srcStride, sizeof(n));
+    octEncodeScalar(n, encoded);
+    memcpy(out + i * dstStride, encoded, sizeof(encoded));
+  }
+}
+
+void gfxOctDecode(const int16_t encoded[2], float normal[3]) {
+  float x = fmaxf((float)encoded[0] / SNORM16_MAX, -1.0f);
+  float y = fmaxf((float)encoded[1] / SNORM16_MAX, -1.0f);
+  const float z = 1.0f - fabsf(x) - fabsf(y);
+
+  if (z < 0.0f) {
+    const float fx = (1.0f - fabsf(y)) * (x >= 0.0f ? 1.0f : -1.0f);
+    const float fy = (1.0f - fabsf(x)) * (y >= 0.0f ? 1.0f : -1.0f);
+    x = fx;
+    y = fy;
+  }
+
+  const float length = sqrtf(x * x + y * y + z * z);
+
+  normal[0] = x / length;
+  normal[1] = y / length;
+  normal[2] = z / length;
+}
+
+/* round to nearest even, overflows become infinity, underflows go through
+ * the denormals to 0 */
+uint16_t gfxFloatToHalf(float f) {
+  uint32_t bits;
+  memcpy(&bits, &f, sizeof(bits));
+
+  const uint16_t sign = (uint16_t)((bits >> 16) & 0x8000);
+  const uint32_t exponent = (bits >> 23) & 0xFF;
+  uint32_t mantissa = bits & 0x7FFFFF;
+
+  /* infinity or NaN */
+  if (exponent == 0xFF) return sign | 0x7C00 | (mantissa ? 0x200 : 0);
+
+  const int e = (int)exponent - 127 + 15;
+
+  if (e >= 0x1F) return sign | 0x7C00;
+
+  if (e <= 0) {
+    if (e < -10) return sign;
+
+    /* denormal, put the implicit 1 back and shift it into place */
+    mantissa |= 0x800000;
+    const int shift = 14 - e;
+    uint32_t half = mantissa >> shift;
+    const uint32_t rest = mantissa & ((1u << shift) - 1);
+    const uint32_t midway = 1u << (shift - 1);
+
+    if (rest > midway || (rest == midway && (half & 1))) ++half;
+
+    return sign | (uint16_t)half;
+  }
+
+  uint32_t half = ((uint32_t)e << 10) | (mantissa >> 13);
+  const uint32_t rest = mantissa & 0x1FFF;
+
+  /* a carry out of the mantissa bumps the exponent, which is right */
+  if (rest > 0x1000 || (rest == 0x1000 && (half & 1))) ++half;
+
+  return sign | (uint16_t)half;
+}
+
+float gfxHalfToFloat(uint16_t h) {
+  const uint32_t sign = (uint32_t)(h & 0x8000) << 16;
+  const uint32_t exponent = (h >> 10) & 0x1F;
+  const uint32_t mantissa = h & 0x3FF;
+
+  uint32_t bits;
+
+  if (exponent == 0x1F) {
+    bits = sign | 0x7F800000 | (mantissa << 13);
+  } else if (exponent == 0) {
+    /* zero or denormal, which is exact in a float */
+    const float f = ldexpf((float)mantissa, -24);
+    return sign ? -f : f;
+  } else {
+    bits = sign | ((exponent + 127 - 15) << 23) | (mantissa << 13);
+  }
+
+  float f;
+  memcpy(&f, &bits, sizeof(f));
+  return f;
+}
+
+/* reads 2 floats per vertex, writes 2 x half float */
+void gfxHalfTexcoords(void *dst, size_t dstStride, const void *src, size_t srcStride, size_t count) {
+  const unsigned char *in = src;
+  unsigned char *out = dst;
+
+  size_t i = 0;
+
+#if defined(__F16C__)
+  /* 2 texcoords per conversion */
+  for (; i + 2 <= count; i += 2) {
+    float t[4];
+    memcpy(&t[0], in + i * srcStride, 2 * sizeof(float));
+    memcpy(&t[2], in + (i + 1) * srcStride, 2 * sizeof(float));
+
+    uint16_t half[8];
+    _mm_storeu_si128((__m128i *)half, _mm_cvtps_ph(_mm_loadu_ps(t), _MM_FROUND_TO_NEAREST_INT));
+
+    memcpy(out + i * dstStride, &half[0], 2 * sizeof(uint16_t));
+    memcpy(out + (i + 1) * dstStride, &half[2], 2 * sizeof(uint16_t));
+  }
+#endif
+
+  for (; i < count; ++i) {
+    float t[2];
+    memcpy(t, in + i * srcStride, sizeof(t));
+
+    const uint16_t half[2] = { gfxFloatToHalf(t[0]), gfxFloatToHalf(t[1]) };
+    memcpy(out + i * dstStride, half, sizeof(half));
+  }
+}
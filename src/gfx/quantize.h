@@ -0,0 +1,42 @@
+/**
+ * This file is part of prototype.
+ *
+ * (c) 2014 Nicolas Hillegeer <nicolas@hillegeer.com>
+ *
+ * For the full copyright and license information, please view the LICENSE
+ * file that was distributed with the source code.
+ */
+
+#ifndef __quantize_h__
+#define __quantize_h__
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Encoders for compressed vertex attributes, strides are in bytes:
+ *
+ * - positions: 3 x snorm16 (+ 16 bits of padding), relative to the bounds
+ *   of the model: position = offset + scale * snorm. The scale is the same
+ *   on all axes so the decode can be folded into the modelview matrix
+ *   without messing up the normals.
+ * - normals: octahedron encoded into 2 x snorm16
+ * - texcoords: 2 x half float
+ */
+
+/* the bytes per encoded attribute */
+#define GFX_QUANTIZED_POSITION_SIZE 8
+#define GFX_QUANTIZED_NORMAL_SIZE   4
+#define GFX_QUANTIZED_TEXCOORD_SIZE 4
+
+void gfxPositionDecode(const float min[3], const float max[3], float offset[3], float *scale);
+void gfxQuantizePositions(void *dst, size_t dstStride, const void *src, size_t srcStride, size_t count,
+                          const float offset[3], float scale);
+void gfxOctEncodeNormals(void *dst, size_t dstStride, const void *src, size_t srcStride, size_t count);
+void gfxHalfTexcoords(void *dst, size_t dstStride, const void *src, size_t srcStride, size_t count);
+
+void gfxOctDecode(const int16_t encoded[2], float normal[3]);
+uint16_t gfxFloatToHalf(float f);
+float gfxHalfToFloat(uint16_t h);
+
+#endif
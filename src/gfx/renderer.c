@@ -13,6 +13,16 @@
 static unsigned int gRenderParamsId;
 static unsigned int gLayerId;
 
+/* the objects a scene keeps creating and destroying, see
+ * gfxNewDrawOperation() and friends */
+WF_POOL_TYPE(opPool, struct gfxDrawOperation)
+WF_POOL_TYPE(paramsPool, struct gfxRenderParams)
+WF_POOL_TYPE(modelPool, struct gfxModel)
+
+static struct wfPool gOps = WF_POOL_INITIALIZER(struct gfxDrawOperation, WF_MEM_GFX);
+static struct wfPool gParams = WF_POOL_INITIALIZER(struct gfxRenderParams, WF_MEM_GFX);
+static struct wfPool gModels = WF_POOL_INITIALIZER(struct gfxModel, WF_MEM_GFX);
+
 void gfxCreateLayer(struct gfxLayer *layer) {
   memset(layer, 0x0, sizeof(struct gfxLayer));
 
@@ -28,6 +38,8 @@ void gfxCreateLayer(struct gfxLayer *layer) {
   layer->projection = GFX_PERSPECTIVE;
   layer->ubo = ubo;
   layer->id = ++gLayerId;
+
+  gfxUpdateLayerFrustum(layer, NULL);
 }
 
 /* call this when you've made changes to any of the uniforms of the layer */
@@ -39,6 +51,19 @@ void gfxUploadLayer(const struct gfxLayer *layer) {
   glBindBuffer(GL_UNIFORM_BUFFER, 0);
 }
 
+/* call this once per frame, after the camera moved and before culling.
+ * The frustum ends up in the space the view matrix maps from (world
+ * space, usually), without a view it's in view space. */
+void gfxUpdateLayerFrustum(struct gfxLayer *layer, const mat4 *view) {
+  const mat4 viewproj = view ? mmmul(layer->uniforms.projectionMatrix, *view) : layer->uniforms.projectionMatrix;
+
+  if (layer->projection == GFX_PERSPECTIVE_INF) {
+    frustum_from_mat_inf_z(&layer->frustum, viewproj);
+  } else {
+    frustum_from_mat(&layer->frustum, viewproj);
+  }
+}
+
 void gfxDestroyLayer(struct gfxLayer *layer) {
   glDeleteBuffers(1, &layer->ubo);
   GL_ERROR("delete ubo");
@@ -67,6 +92,50 @@ void gfxCreateRenderParams(struct gfxRenderParams *params) {
 
 void gfxDestroyRenderParams(struct gfxRenderParams *params) {}
 
+/* pool-backed versions of the render params, models and draw operations
+ * that would otherwise live on the stack or in a static, for scenes that
+ * create and destroy them all the time. A draw operation has to be out of
+ * the drawlist before it gets deleted. */
+struct gfxRenderParams *gfxNewRenderParams(void) {
+  struct gfxRenderParams *params = paramsPoolAlloc(&gParams);
+  gfxCreateRenderParams(params);
+  return params;
+}
+
+void gfxDeleteRenderParams(struct gfxRenderParams *params) {
+  gfxDestroyRenderParams(params);
+  paramsPoolFree(&gParams, params);
+}
+
+/* an empty model, to hand to gfxCube(), gfxLoadMesh() and the like */
+struct gfxModel *gfxNewModel(void) {
+  struct gfxModel *model = modelPoolAlloc(&gModels);
+  memset(model, 0x0, sizeof(struct gfxModel));
+  return model;
+}
+
+void gfxDeleteModel(struct gfxModel *model) {
+  gfxDestroyModel(model);
+  modelPoolFree(&gModels, model);
+}
+
+struct gfxDrawOperation *gfxNewDrawOperation(void) {
+  struct gfxDrawOperation *op = opPoolAlloc(&gOps);
+  memset(op, 0x0, sizeof(struct gfxDrawOperation));
+  return op;
+}
+
+void gfxDeleteDrawOperation(struct gfxDrawOperation *op) {
+  opPoolFree(&gOps, op);
+}
+
+/* everything that came from the pools is gone after this */
+void gfxDestroyPools(void) {
+  wfPoolDestroy(&gOps);
+  wfPoolDestroy(&gParams);
+  wfPoolDestroy(&gModels);
+}
+
 void gfxBatch(const struct gfxLayer *layer) {
   /* bind the static matrix stack to the correct binding point */
   glBindBufferBase(GL_UNIFORM_BUFFER, GFX_UBO_LAYER, layer->ubo);
@@ -77,3 +146,29 @@ void gfxBatch(const struct gfxLayer *layer) {
      * NOTE: when using range, you have to query GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT first:
      * http://stackoverflow.com/questions/13028852/issue-with-glbindbufferrange-opengl-3-1 */
 }
+
+/* drawlist commands, register them with gfxDrawlistRegisterCommand() and
+ * the matching struct as userdata */
+void gfxCmdClear(const struct gfxDrawOperation *op, void *userdata) {
+  const struct gfxClear *clear = userdata;
+
+  if (clear->mask & GL_COLOR_BUFFER_BIT) {
+    glClearColor(clear->color[0], clear->color[1], clear->color[2], clear->color[3]);
+  }
+
+  if (clear->mask & GL_DEPTH_BUFFER_BIT) {
+    glClearDepth(clear->depth);
+
+    /* a disabled depth mask also masks the clear */
+    gfxStateDepthWrite(1);
+  }
+
+  glClear(clear->mask);
+}
+
+void gfxCmdBindFramebuffer(const struct gfxDrawOperation *op, void *userdata) {
+  const struct gfxRenderTarget *target = userdata;
+
+  glBindFramebuffer(GL_FRAMEBUFFER, target->fbo);
+  glViewport(target->x, target->y, target->width, target->height);
+}
@@ -0,0 +1,238 @@
+/**
+ * This file is part of prototype.
+ *
+ * (c) 2014 Nicolas Hillegeer <nicolas@hillegeer.com>
+ *
+ * For the full copyright and license information, please view the LICENSE
+ * file that was distributed with the source code.
+ *
+ * A ring of uniform buffer storage for data that changes every frame (the
+ * layer uniforms, per-draw matrices). Every frame gets its own region, the
+ * data is written once and bound with glBindBufferRange().
+ *
+ * With ARB_buffer_storage the buffer is mapped persistently, there's one
+ * region per frame in flight (GFX_RING_FRAMES) and every region is fenced
+ * so we never write to something the GPU is still reading. Without it the
+ * buffer is orphaned and mapped again every frame, the driver takes care
+ * of handing us fresh storage.
+ *
+ * Usage, once per frame:
+ *
+ *   gfxRingBegin(bytes);          maps (or waits for) the region
+ *   offset = gfxRingPush(...);    as much as was asked for in begin
+ *   gfxRingEnd();                 nothing can be pushed after this
+ *   gfxRingBind(..., offset, ...) and draw
+ *
+ * The ring can't stay mapped while drawing in the orphaning mode, so
+ * everything has to be pushed before the first draw that uses it.
+ */
+
+#include "util.h"
+
+#if defined(GL_VERSION_4_4) || defined(GL_ARB_buffer_storage)
+#define RING_PERSISTENT
+#endif
+
+/* the size of a region when the ring gets created, it doubles when a frame
+ * needs more than that */
+#define RING_INITIAL_REGION (64 * 1024)
+
+/* how long to wait for a fence before trying again (in ns) */
+#define RING_FENCE_TIMEOUT 1000000
+
+struct gfxRing {
+  GLuint buffer;
+
+  /* the size of one region and the alignment of everything pushed into it
+   * (GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT) */
+  size_t regionSize;
+  size_t align;
+
+  int persistent;
+
+  /* the whole buffer when persistently mapped, the current region while
+   * it's mapped otherwise */
+  unsigned char *mapped;
+
+  /* the current region, the write offset in it and the end of what was
+   * reserved in gfxRingBegin */
+  unsigned int region;
+  size_t offset;
+  size_t end;
+
+  GLsync fences[GFX_RING_FRAMES];
+
+  struct gfxRingStats stats;
+};
+
+static struct gfxRing gRing;
+
+static void waitFence(unsigned int region) {
+  GLsync fence = gRing.fences[region];
+  if (!fence) return;
+
+  GLenum result = glClientWaitSync(fence, 0, 0);
+
+  if (result == GL_TIMEOUT_EXPIRED) {
+    /* the GPU is more than GFX_RING_FRAMES behind, we have to wait */
+    gRing.stats.stalls++;
+
+    do {
+      result = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, RING_FENCE_TIMEOUT);
+    } while (result == GL_TIMEOUT_EXPIRED);
+  }
+
+  assert(result != GL_WAIT_FAILED);
+
+  glDeleteSync(fence);
+  gRing.fences[region] = NULL;
+}
+
+static void createBuffer() {
+  glGenBuffers(1, &gRing.buffer);
+  glBindBuffer(GL_UNIFORM_BUFFER, gRing.buffer);
+
+#ifdef RING_PERSISTENT
+  if (gRing.persistent) {
+    const GLsizeiptr size = (GLsizeiptr)(gRing.regionSize * GFX_RING_FRAMES);
+    const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+
+    glBufferStorage(GL_UNIFORM_BUFFER, size, NULL, flags);
+    gRing.mapped = glMapBufferRange(GL_UNIFORM_BUFFER, 0, size, flags);
+
+    assert(gRing.mapped);
+  }
+#endif
+
+  if (!gRing.persistent) {
+    glBufferData(GL_UNIFORM_BUFFER, (GLsizeiptr)gRing.regionSize, NULL, GL_STREAM_DRAW);
+  }
+
+  glBindBuffer(GL_UNIFORM_BUFFER, 0);
+
+  GL_ERROR("create uniform ring");
+}
+
+static void destroyBuffer() {
+  for (unsigned int i = 0; i < GFX_RING_FRAMES; ++i) {
+    waitFence(i);
+  }
+
+  if (gRing.persistent && gRing.mapped) {
+    glBindBuffer(GL_UNIFORM_BUFFER, gRing.buffer);
+    glUnmapBuffer(GL_UNIFORM_BUFFER);
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+  }
+
+  glDeleteBuffers(1, &gRing.buffer);
+
+  gRing.buffer = 0;
+  gRing.mapped = NULL;
+}
+
+void gfxRingInit(const struct gfxRenderer *renderer) {
+  if (gRing.buffer) {
+    gfxRingDestroy();
+  }
+
+  gRing.align = (size_t)MAX(renderer->uboOffsetAlign, 16);
+  gRing.regionSize = RING_INITIAL_REGION;
+
+#ifdef RING_PERSISTENT
+  gRing.persistent = renderer->bufferStorage;
+#endif
+
+  createBuffer();
+
+  trace("uniform ring: %zu bytes per frame, %zu byte alignment, %s\n",
+        gRing.regionSize, gRing.align, gRing.persistent ? "persistently mapped" : "orphaning");
+}
+
+void gfxRingDestroy() {
+  if (gRing.buffer) {
+    destroyBuffer();
+  }
+
+  memset(&gRing, 0x0, sizeof(gRing));
+}
+
+size_t gfxRingAligned(size_t size) {
+  return (size + gRing.align - 1) & ~(gRing.align - 1);
+}
+
+void gfxRingBegin(size_t size) {
+  /* in the orphaning mode, the previous frame has to be ended */
+  assert(gRing.buffer && (gRing.persistent || !gRing.mapped));
+
+  memset(&gRing.stats, 0x0, sizeof(gRing.stats));
+
+  /* the previous region is done as soon as the GPU gets past everything
+   * that was submitted up until now */
+  if (gRing.persistent) {
+    gRing.fences[gRing.region] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    gRing.region = (gRing.region + 1) % GFX_RING_FRAMES;
+  }
+
+  if (size > gRing.regionSize) {
+    size_t regionSize = gRing.regionSize;
+    while (regionSize < size) regionSize *= 2;
+
+    trace("growing the uniform ring to %zu bytes per frame\n", regionSize);
+
+    destroyBuffer();
+    gRing.regionSize = regionSize;
+    gRing.region = 0;
+    createBuffer();
+  }
+
+  if (gRing.persistent) {
+    waitFence(gRing.region);
+  } else {
+    glBindBuffer(GL_UNIFORM_BUFFER, gRing.buffer);
+
+    /* orphan, then map the fresh storage */
+    glBufferData(GL_UNIFORM_BUFFER, (GLsizeiptr)gRing.regionSize, NULL, GL_STREAM_DRAW);
+    gRing.mapped = glMapBufferRange(GL_UNIFORM_BUFFER, 0, (GLsizeiptr)gRing.regionSize,
+                                    GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+
+    GL_ERROR("map uniform ring");
+    assert(gRing.mapped);
+  }
+
+  gRing.offset = gRing.persistent ? gRing.region * gRing.regionSize : 0;
+  gRing.end = gRing.offset + size;
+}
+
+GLintptr gfxRingPush(const void *data, size_t size) {
+  const size_t offset = gRing.offset;
+  const size_t aligned = gfxRingAligned(size);
+
+  assert(gRing.mapped && offset + aligned <= gRing.end);
+
+  memcpy(gRing.mapped + offset, data, size);
+
+  gRing.offset += aligned;
+  gRing.stats.bytes += (unsigned int)aligned;
+
+  return (GLintptr)offset;
+}
+
+void gfxRingEnd() {
+  if (!gRing.persistent) {
+    glBindBuffer(GL_UNIFORM_BUFFER, gRing.buffer);
+    glUnmapBuffer(GL_UNIFORM_BUFFER);
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+
+    gRing.mapped = NULL;
+  }
+}
+
+void gfxRingBind(GLuint index, GLintptr offset, size_t size) {
+  glBindBufferRange(GL_UNIFORM_BUFFER, index, gRing.buffer, offset, (GLsizeiptr)size);
+}
+
+void gfxRingGetStats(struct gfxRingStats *stats) {
+  *stats = gRing.stats;
+}
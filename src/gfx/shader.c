@@ -24,68 +24,29 @@ static int gfxCheckShaderProgram(GLuint program);
 static size_t gfxGlslTypeSize(GLint type);
 static const char *gfxGlslTypeString(GLint type);
 static int gfxUboInfoCompare(const void *p1, const void *p2);
+static void gfxBuildShader(struct gfxShaderProgram *shader, const char *vertsrc, const char *fragsrc);
+static char *gfxInstancedSource(const char *src);
 
+/* everything goes through the state cache, which filters out whatever
+ * is already set, so there's no need to diff against the previous params
+ * here */
 void gfxSetShaderParams(
     const struct gfxShaderProgram *shader,
     const struct gfxLayer *layer,
-    const struct gfxRenderParams *params,
-    const struct gfxRenderParams *prev) {
+    const struct gfxRenderParams *params) {
   /* TODO: glEnable(GL_DEPTH_TEST); */
 
-  /* blending: http://stackoverflow.com/questions/6853004/procedure-for-alpha-blending-textured-quads-in-opengl-3 */
-  if (!prev || params->blend != prev->blend) {
-    if (params->blend == GFX_NONE) {
-      glDisable(GL_BLEND);
-    } else {
-      glEnable(GL_BLEND);
-
-      switch (params->blend) {
-      case GFX_BLEND_ALPHA:
-        /* (almost) equivalent to the following
-         *
-         * glBlendEquation(GL_FUNC_ADD);
-         * glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-         *
-         * except that the alpha channel itself gets blended differently */
-        glBlendEquationSeparate(GL_FUNC_ADD, GL_FUNC_ADD);
-        glBlendFuncSeparate(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA, GL_ONE, GL_ZERO);
-        break;
-      case GFX_BLEND_PREMUL_ALPHA:
-        glBlendEquationSeparate(GL_FUNC_ADD, GL_FUNC_ADD);
-        glBlendFuncSeparate(GL_ONE, GL_ONE_MINUS_SRC_ALPHA, GL_ONE, GL_ZERO);
-        break;
-      }
-    }
-  }
-
-  /* culling */
-  if (!prev || params->cull != prev->cull) {
-    if (params->cull == GFX_NONE) {
-      glDisable(GL_CULL_FACE);
-    } else {
-      glEnable(GL_CULL_FACE);
-      glFrontFace(GL_CCW);
-
-      switch (params->cull) {
-      case GFX_CULL_FRONT:
-        glCullFace(GL_FRONT);
-        break;
-      case GFX_CULL_BACK:
-        glCullFace(GL_BACK);
-        break;
-      }
-    }
-  }
+  gfxStateBlend(params->blend);
+  gfxStateCull(params->cull);
 
-  if (shader->loc.modelviewMatrix != -1) glUniformMatrix4fv(shader->loc.modelviewMatrix, 1, GL_FALSE, (const GLfloat *)&params->modelviewMatrix);
+  if (shader->loc.modelviewMatrix != -1) gfxStateUniformMatrix4fv(shader->loc.modelviewMatrix, (const GLfloat *)&params->modelviewMatrix);
 
-  /* TODO: textures are possibly saved in the program state, don't need to call glUniform() all the time... */
-  if (shader->loc.texture0 != -1) glUniform1i(shader->loc.texture0, 0);
-  if (shader->loc.texture1 != -1) glUniform1i(shader->loc.texture1, 1);
-  if (shader->loc.texture2 != -1) glUniform1i(shader->loc.texture2, 2);
-  if (shader->loc.texture3 != -1) glUniform1i(shader->loc.texture3, 3);
+  if (shader->loc.texture0 != -1) gfxStateUniform1i(shader->loc.texture0, 0);
+  if (shader->loc.texture1 != -1) gfxStateUniform1i(shader->loc.texture1, 1);
+  if (shader->loc.texture2 != -1) gfxStateUniform1i(shader->loc.texture2, 2);
+  if (shader->loc.texture3 != -1) gfxStateUniform1i(shader->loc.texture3, 3);
 
-  if (shader->loc.timer != -1) glUniform1f(shader->loc.timer, layer->uniforms.timer);
+  if (shader->loc.timer != -1) gfxStateUniform1f(shader->loc.timer, layer->uniforms.timer);
 }
 
 void gfxLoadShaderFromFile(struct gfxShaderProgram *shader, const char *vertfile, const char *fragfile) {
@@ -98,7 +59,51 @@ void gfxLoadShaderFromFile(struct gfxShaderProgram *shader, const char *vertfile
   zfree(fragsrc);
 }
 
+/* if the vertex shader knows about GFX_INSTANCED, we also build a variant
+ * with it defined. That variant reads its modelview matrix from a
+ * per-instance attribute (GFX_INSTANCE_MATRIX) instead of a uniform, which
+ * allows the drawlist to draw runs of the same model in one call. */
 void gfxLoadShader(struct gfxShaderProgram *shader, const char *vertsrc, const char *fragsrc) {
+  gfxBuildShader(shader, vertsrc, fragsrc);
+
+  if (strstr(vertsrc, "GFX_INSTANCED")) {
+    char *instsrc = gfxInstancedSource(vertsrc);
+
+    trace("building instanced variant of shader %u\n", shader->id);
+
+    shader->instanced = zmalloc(sizeof(struct gfxShaderProgram));
+    gfxBuildShader(shader->instanced, instsrc, fragsrc);
+
+    zfree(instsrc);
+  }
+}
+
+/* inserts "#define GFX_INSTANCED" right after the #version directive, which
+ * has to stay the first thing in the shader */
+static char *gfxInstancedSource(const char *src) {
+  static const char define[] = "#define GFX_INSTANCED\n";
+
+  const char *version = strstr(src, "#version");
+  const char *split = src;
+
+  if (version) {
+    const char *eol = strchr(version, '\n');
+    split = eol ? eol + 1 : version + strlen(version);
+  }
+
+  const size_t head = (size_t)(split - src);
+  const size_t tail = strlen(split);
+
+  char *out = zmalloc(head + sizeof(define) + tail);
+
+  memcpy(out, src, head);
+  memcpy(out + head, define, sizeof(define) - 1);
+  memcpy(out + head + sizeof(define) - 1, split, tail + 1);
+
+  return out;
+}
+
+static void gfxBuildShader(struct gfxShaderProgram *shader, const char *vertsrc, const char *fragsrc) {
   memset(shader, 0x0, sizeof(struct gfxShaderProgram));
 
   trace("vertex shader: \n%s\n", vertsrc);
@@ -179,10 +184,23 @@ void gfxLoadShader(struct gfxShaderProgram *shader, const char *vertsrc, const c
     glUniformBlockBinding(program, shader->loc.matricesBlockIndex, GFX_UBO_LAYER);
   }
 
+  /* the per-draw matrices come from the uniform ring */
+  shader->loc.drawBlockIndex = glGetUniformBlockIndex(program, "DrawMatrices");
+
+  if (shader->loc.drawBlockIndex != GL_INVALID_INDEX) {
+    glUniformBlockBinding(program, shader->loc.drawBlockIndex, GFX_UBO_DRAW);
+  }
+
   shader->id = program;
 }
 
 void gfxDestroyShader(struct gfxShaderProgram *shader) {
+  if (shader->instanced) {
+    gfxDestroyShader(shader->instanced);
+    zfree(shader->instanced);
+    shader->instanced = NULL;
+  }
+
   glUseProgram(0);
   glDeleteProgram(shader->id);
 
@@ -0,0 +1,444 @@
+/**
+ * This file is part of prototype.
+ *
+ * (c) 2014 Nicolas Hillegeer <nicolas@hillegeer.com>
+ *
+ * For the full copyright and license information, please view the LICENSE
+ * file that was distributed with the source code.
+ *
+ * Mesh simplification for the LOD chains of models, meant to be run once
+ * when a mesh is converted or generated. Works on 32-bit indices and
+ * doesn't touch GL.
+ *
+ * It's an edge collapser driven by Garland and Heckbert's quadric error
+ * metric: every vertex accumulates the planes of the triangles around it,
+ * and collapsing a vertex onto a neighbour costs the squared distances of
+ * that neighbour to all those planes. Vertices only ever collapse onto
+ * other vertices, they never move, so every LOD is just another index
+ * buffer over the same vertices. Vertices on the border of the mesh and on
+ * attribute seams (the same position in more than one vertex) stay where
+ * they are, so there are no cracks and no stretched texcoords.
+ *
+ * The collapses happen in passes: we pick the cheapest collapse of every
+ * vertex, sort them and apply as many as we can without touching the same
+ * neighbourhood twice, then rebuild the triangles for the next pass.
+ *
+ * http://mgarland.org/files/papers/quadrics.pdf
+ */
+
+#include <float.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "simplify.h"
+#include "vcache.h"
+#include "zmalloc.h"
+
+/* every LOD has to be at most this much of the previous one (in 1/20ths),
+ * or the chain ends */
+#define SIMPLIFY_MIN_REDUCTION 17
+
+/* the cosine of the largest angle a triangle may turn in a collapse */
+#define SIMPLIFY_MAX_TURN 0.25
+
+/* LODs smaller than this aren't worth the bits */
+#define SIMPLIFY_MIN_TRIANGLES 8
+
+/* the plane quadric, symmetric so 10 of the 16 entries */
+struct quadric {
+  double a2, ab, ac, ad;
+  double b2, bc, bd;
+  double c2, cd;
+  double d2;
+};
+
+struct collapse {
+  uint32_t from;
+  uint32_t to;
+  double cost;
+};
+
+struct sortedPosition {
+  float p[3];
+  uint32_t vertex;
+};
+
+static void quadricAdd(struct quadric *q, const struct quadric *r) {
+  q->a2 += r->a2; q->ab += r->ab; q->ac += r->ac; q->ad += r->ad;
+  q->b2 += r->b2; q->bc += r->bc; q->bd += r->bd;
+  q->c2 += r->c2; q->cd += r->cd;
+  q->d2 += r->d2;
+}
+
+static void quadricPlane(struct quadric *q, double a, double b, double c, double d) {
+  const struct quadric plane = {
+    a * a, a * b, a * c, a * d,
+    b * b, b * c, b * d,
+    c * c, c * d,
+    d * d
+  };
+
+  quadricAdd(q, &plane);
+}
+
+/* the sum of the squared distances of p to the planes of q */
+static double quadricError(const struct quadric *q, const float *p) {
+  const double x = p[0], y = p[1], z = p[2];
+
+  const double e = q->a2 * x * x + q->b2 * y * y + q->c2 * z * z +
+                   2.0 * (q->ab * x * y + q->ac * x * z + q->bc * y * z) +
+                   2.0 * (q->ad * x + q->bd * y + q->cd * z) + q->d2;
+
+  /* rounding can take it a hair under 0 */
+  return (e > 0.0) ? e : 0.0;
+}
+
+static void normal(const float *p0, const float *p1, const float *p2, double n[3]) {
+  const double u[3] = { p1[0] - p0[0], p1[1] - p0[1], p1[2] - p0[2] };
+  const double v[3] = { p2[0] - p0[0], p2[1] - p0[1], p2[2] - p0[2] };
+
+  n[0] = u[1] * v[2] - u[2] * v[1];
+  n[1] = u[2] * v[0] - u[0] * v[2];
+  n[2] = u[0] * v[1] - u[1] * v[0];
+}
+
+static int comparePositions(const void *a, const void *b) {
+  const struct sortedPosition *x = a;
+  const struct sortedPosition *y = b;
+
+  for (int i = 0; i < 3; ++i) {
+    if (x->p[i] < y->p[i]) return -1;
+    if (x->p[i] > y->p[i]) return 1;
+  }
+
+  return 0;
+}
+
+static int compareEdges(const void *a, const void *b) {
+  const uint64_t x = *(const uint64_t *)a;
+  const uint64_t y = *(const uint64_t *)b;
+  return (x > y) - (x < y);
+}
+
+static int compareCollapses(const void *a, const void *b) {
+  const struct collapse *x = a;
+  const struct collapse *y = b;
+  return (x->cost > y->cost) - (x->cost < y->cost);
+}
+
+/* vertices that share their position with another one (seams) and
+ * vertices on an edge that only has a triangle on one side (borders) can't
+ * be collapsed */
+static void lockVertices(unsigned char *locked, const uint32_t *indices, size_t numIndices,
+                         const float *positions, size_t numVertices) {
+  struct sortedPosition *sorted = zmalloc(numVertices * sizeof(struct sortedPosition));
+
+  for (size_t i = 0; i < numVertices; ++i) {
+    memcpy(sorted[i].p, &positions[i * 3], sizeof(sorted[i].p));
+    sorted[i].vertex = (uint32_t)i;
+  }
+
+  qsort(sorted, numVertices, sizeof(struct sortedPosition), comparePositions);
+
+  for (size_t i = 1; i < numVertices; ++i) {
+    if (comparePositions(&sorted[i - 1], &sorted[i]) == 0) {
+      locked[sorted[i - 1].vertex] = 1;
+      locked[sorted[i].vertex] = 1;
+    }
+  }
+
+  zfree(sorted);
+
+  /* a directed edge without its twin is on the border */
+  uint64_t *edges = zmalloc(numIndices * sizeof(uint64_t));
+
+  for (size_t i = 0; i < numIndices; i += 3) {
+    for (size_t k = 0; k < 3; ++k) {
+      const uint64_t a = indices[i + k];
+      const uint64_t b = indices[i + (k + 1) % 3];
+      edges[i + k] = (a << 32) | b;
+    }
+  }
+
+  qsort(edges, numIndices, sizeof(uint64_t), compareEdges);
+
+  for (size_t i = 0; i < numIndices; ++i) {
+    const uint64_t twin = (edges[i] << 32) | (edges[i] >> 32);
+
+    if (!bsearch(&twin, edges, numIndices, sizeof(uint64_t), compareEdges)) {
+      locked[edges[i] >> 32] = 1;
+      locked[edges[i] & 0xFFFFFFFF] = 1;
+    }
+  }
+
+  zfree(edges);
+}
+
+/* how many triangles collapsing a onto b removes, or -1 if one of the
+ * triangles that stay would flip over */
+static int collapseRemoves(const uint32_t *indices, const uint32_t *adjacency, uint32_t begin, uint32_t end,
+                           const float *positions, uint32_t a, uint32_t b) {
+  int removed = 0;
+
+  for (uint32_t i = begin; i < end; ++i) {
+    const uint32_t *t = &indices[adjacency[i] * 3];
+
+    if (t[0] == b || t[1] == b || t[2] == b) {
+      ++removed;
+      continue;
+    }
+
+    const float *p[3];
+    const float *q[3];
+
+    for (int k = 0; k < 3; ++k) {
+      p[k] = &positions[t[k] * 3];
+      q[k] = (t[k] == a) ? &positions[b * 3] : p[k];
+    }
+
+    double before[3], after[3];
+    normal(p[0], p[1], p[2], before);
+    normal(q[0], q[1], q[2], after);
+
+    /* also refuse to turn a triangle more than about 75 degrees, those
+     * are the ones that end up cutting through the mesh */
+    const double dot = before[0] * after[0] + before[1] * after[1] + before[2] * after[2];
+    const double lengths = sqrt((before[0] * before[0] + before[1] * before[1] + before[2] * before[2]) *
+                                (after[0] * after[0] + after[1] * after[1] + after[2] * after[2]));
+
+    if (dot <= SIMPLIFY_MAX_TURN * lengths) return -1;
+  }
+
+  return removed;
+}
+
+/* simplifies the triangles in indices until there are at most
+ * targetIndices left, or nothing can be collapsed anymore. The positions
+ * are the first 3 floats of every vertex. Writes the simplified triangles
+ * to dst (which needs room for numIndices), returns how many indices it
+ * wrote, and sets error to how far off the result is, in object space.
+ * dst can be the same as indices. */
+size_t gfxSimplify(uint32_t *dst, const uint32_t *indices, size_t numIndices,
+                   const void *positions, size_t stride, size_t numVertices,
+                   size_t targetIndices, float *error) {
+  float *p = zmalloc(numVertices * 3 * sizeof(float));
+
+  for (size_t i = 0; i < numVertices; ++i) {
+    memcpy(&p[i * 3], (const unsigned char *)positions + i * stride, 3 * sizeof(float));
+  }
+
+  unsigned char *locked = zcalloc(numVertices);
+  lockVertices(locked, indices, numIndices, p, numVertices);
+
+  struct quadric *quadrics = zcalloc(numVertices * sizeof(struct quadric));
+
+  for (size_t i = 0; i < numIndices; i += 3) {
+    double n[3];
+    normal(&p[indices[i] * 3], &p[indices[i + 1] * 3], &p[indices[i + 2] * 3], n);
+
+    const double length = sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+    if (length <= 0.0) continue;
+
+    n[0] /= length;
+    n[1] /= length;
+    n[2] /= length;
+
+    const float *p0 = &p[indices[i] * 3];
+    const double d = -(n[0] * p0[0] + n[1] * p0[1] + n[2] * p0[2]);
+
+    for (size_t k = 0; k < 3; ++k) {
+      quadricPlane(&quadrics[indices[i + k]], n[0], n[1], n[2], d);
+    }
+  }
+
+  memmove(dst, indices, numIndices * sizeof(uint32_t));
+
+  uint32_t *offsets = zmalloc((numVertices + 1) * sizeof(uint32_t));
+  uint32_t *adjacency = zmalloc(numIndices * sizeof(uint32_t));
+  uint32_t *remap = zmalloc(numVertices * sizeof(uint32_t));
+  unsigned char *touched = zmalloc(numVertices);
+  struct collapse *best = zmalloc(numVertices * sizeof(struct collapse));
+  struct collapse *collapses = zmalloc(numVertices * sizeof(struct collapse));
+
+  size_t count = numIndices;
+  double maxCost = 0.0;
+
+  while (count > targetIndices) {
+    /* the triangles around every vertex */
+    memset(offsets, 0x0, (numVertices + 1) * sizeof(uint32_t));
+    for (size_t i = 0; i < count; ++i) offsets[dst[i] + 1]++;
+    for (size_t v = 0; v < numVertices; ++v) offsets[v + 1] += offsets[v];
+
+    for (size_t i = 0; i < count; ++i) {
+      adjacency[offsets[dst[i]]++] = (uint32_t)(i / 3);
+    }
+
+    /* the fill moved every offset to the start of the next vertex */
+    memmove(offsets + 1, offsets, numVertices * sizeof(uint32_t));
+    offsets[0] = 0;
+
+    /* the cheapest collapse of every vertex */
+    for (size_t v = 0; v < numVertices; ++v) {
+      best[v] = (struct collapse){ (uint32_t)v, (uint32_t)v, DBL_MAX };
+    }
+
+    for (size_t i = 0; i < count; ++i) {
+      const uint32_t a = dst[i];
+      const uint32_t b = dst[(i % 3 == 2) ? i - 2 : i + 1];
+
+      for (int k = 0; k < 2; ++k) {
+        const uint32_t from = k ? b : a;
+        const uint32_t to = k ? a : b;
+
+        if (locked[from]) continue;
+
+        struct quadric q = quadrics[from];
+        quadricAdd(&q, &quadrics[to]);
+
+        const double cost = quadricError(&q, &p[to * 3]);
+        if (cost < best[from].cost) best[from] = (struct collapse){ from, to, cost };
+      }
+    }
+
+    size_t numCollapses = 0;
+    for (size_t v = 0; v < numVertices; ++v) {
+      if (best[v].cost < DBL_MAX) collapses[numCollapses++] = best[v];
+    }
+
+    qsort(collapses, numCollapses, sizeof(struct collapse), compareCollapses);
+
+    for (size_t v = 0; v < numVertices; ++v) remap[v] = (uint32_t)v;
+    memset(touched, 0x0, numVertices);
+
+    const size_t triangles = count / 3;
+    const size_t targetTriangles = targetIndices / 3;
+    size_t removed = 0;
+    size_t applied = 0;
+
+    for (size_t i = 0; i < numCollapses && triangles - removed > targetTriangles; ++i) {
+      const uint32_t a = collapses[i].from;
+      const uint32_t b = collapses[i].to;
+
+      if (touched[a] || touched[b]) continue;
+
+      const int r = collapseRemoves(dst, adjacency, offsets[a], offsets[a + 1], p, a, b);
+      if (r < 0) continue;
+
+      remap[a] = b;
+      quadricAdd(&quadrics[b], &quadrics[a]);
+
+      /* nothing around a may change again this pass, or the flip test
+       * above would have been for nothing */
+      for (uint32_t j = offsets[a]; j < offsets[a + 1]; ++j) {
+        const uint32_t *t = &dst[adjacency[j] * 3];
+        touched[t[0]] = touched[t[1]] = touched[t[2]] = 1;
+      }
+
+      if (collapses[i].cost > maxCost) maxCost = collapses[i].cost;
+
+      removed += (size_t)r;
+      ++applied;
+    }
+
+    if (applied == 0) break;
+
+    /* drop the triangles that collapsed */
+    size_t kept = 0;
+
+    for (size_t i = 0; i < count; i += 3) {
+      const uint32_t a = remap[dst[i]];
+      const uint32_t b = remap[dst[i + 1]];
+      const uint32_t c = remap[dst[i + 2]];
+
+      if (a == b || b == c || a == c) continue;
+
+      dst[kept++] = a;
+      dst[kept++] = b;
+      dst[kept++] = c;
+    }
+
+    count = kept;
+  }
+
+  *error = (float)sqrt(maxCost);
+
+  zfree(p);
+  zfree(locked);
+  zfree(quadrics);
+  zfree(offsets);
+  zfree(adjacency);
+  zfree(remap);
+  zfree(touched);
+  zfree(best);
+  zfree(collapses);
+
+  return count;
+}
+
+/* builds the LOD chain of a mesh: the indices themselves as LOD 0, then
+ * every LOD about half of the one before it, for as long as that works
+ * out and the error stays below the size of the mesh. Every LOD is
+ * simplified from the full mesh and optimized for the vertex cache.
+ * Returns the number of LODs, chain gets all of their indices back to
+ * back and has to be zfree()'d. */
+unsigned int gfxBuildLods(uint32_t **chain, const uint32_t *indices, size_t numIndices,
+                          const void *positions, size_t stride, size_t numVertices,
+                          struct gfxLod lods[GFX_MAX_LODS]) {
+  size_t capacity = numIndices * 2;
+  uint32_t *out = zmalloc(capacity * sizeof(uint32_t));
+  uint32_t *scratch = zmalloc(numIndices * sizeof(uint32_t));
+
+  memcpy(out, indices, numIndices * sizeof(uint32_t));
+  lods[0] = (struct gfxLod){ 0, (uint32_t)numIndices, 0.0f };
+
+  /* a LOD that's off by more than the size of the mesh is no use to anyone */
+  float min[3] = { FLT_MAX, FLT_MAX, FLT_MAX };
+  float max[3] = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+
+  for (size_t i = 0; i < numVertices; ++i) {
+    float p[3];
+    memcpy(p, (const unsigned char *)positions + i * stride, sizeof(p));
+
+    for (int k = 0; k < 3; ++k) {
+      min[k] = fminf(min[k], p[k]);
+      max[k] = fmaxf(max[k], p[k]);
+    }
+  }
+
+  const float radius = 0.5f * sqrtf((max[0] - min[0]) * (max[0] - min[0]) + (max[1] - min[1]) * (max[1] - min[1]) +
+                                    (max[2] - min[2]) * (max[2] - min[2]));
+
+  unsigned int numLods = 1;
+  size_t end = numIndices;
+  size_t previous = numIndices;
+
+  while (numLods < GFX_MAX_LODS) {
+    const size_t target = previous / 6 * 3;
+    if (target / 3 < SIMPLIFY_MIN_TRIANGLES) break;
+
+    float error;
+    const size_t count = gfxSimplify(scratch, indices, numIndices, positions, stride, numVertices, target, &error);
+
+    if (count * 20 > previous * SIMPLIFY_MIN_REDUCTION || error > radius) break;
+
+    gfxOptimizeTriangles(scratch, count, numVertices);
+
+    if (end + count > capacity) {
+      capacity = (end + count) * 2;
+      out = zrealloc(out, capacity * sizeof(uint32_t));
+    }
+
+    memcpy(out + end, scratch, count * sizeof(uint32_t));
+    lods[numLods++] = (struct gfxLod){ (uint32_t)end, (uint32_t)count, error };
+
+    end += count;
+    previous = count;
+  }
+
+  zfree(scratch);
+
+  *chain = out;
+
+  return numLods;
+}
@@ -0,0 +1,35 @@
+/**
+ * This file is part of prototype.
+ *
+ * (c) 2014 Nicolas Hillegeer <nicolas@hillegeer.com>
+ *
+ * For the full copyright and license information, please view the LICENSE
+ * file that was distributed with the source code.
+ */
+
+#ifndef __simplify_h__
+#define __simplify_h__
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* the LOD goes in the draw key, which has 3 bits for it */
+#define GFX_MAX_LODS 8
+
+/* one level of detail of a model: a range of its indices (relative to the
+ * first index of the model) and how far, in object space, the simplified
+ * surface may be off from the full resolution one */
+struct gfxLod {
+  uint32_t firstIndex;
+  uint32_t numIndices;
+  float error;
+};
+
+size_t gfxSimplify(uint32_t *dst, const uint32_t *indices, size_t numIndices,
+                   const void *positions, size_t stride, size_t numVertices,
+                   size_t targetIndices, float *error);
+unsigned int gfxBuildLods(uint32_t **chain, const uint32_t *indices, size_t numIndices,
+                          const void *positions, size_t stride, size_t numVertices,
+                          struct gfxLod lods[GFX_MAX_LODS]);
+
+#endif
@@ -0,0 +1,419 @@
+/**
+ * This file is part of prototype.
+ *
+ * (c) 2014 Nicolas Hillegeer <nicolas@hillegeer.com>
+ *
+ * For the full copyright and license information, please view the LICENSE
+ * file that was distributed with the source code.
+ *
+ * A shadow copy of the GL state the renderer touches, so redundant state
+ * changes never reach the driver. Everything that goes through here is
+ * cached, anything that changes GL state behind our back has to call
+ * gfxStateInvalidate() afterwards.
+ */
+
+#include "util.h"
+
+/* enable this to check the shadow state against the real GL state (with
+ * glGet*) after every call that goes through the cache. Very slow. */
+/* #define GFX_STATE_DEBUG */
+
+/* uniform values are cached for locations below this, anything above
+ * always gets sent */
+#define STATE_MAX_UNIFORMS 32
+
+/* the uniform caches of the programs are direct-mapped on the program id,
+ * programs whose ids collide just evict each other */
+#define STATE_MAX_PROGRAMS 32
+
+#define STATE_MAX_TEXTURE_UNITS 8
+
+/* a value nothing ever gets set to, so the first set is never filtered */
+#define STATE_UNKNOWN 0xFFFFFFFFu
+
+typedef enum {
+  UNIFORM_NONE = 0,
+  UNIFORM_INT,
+  UNIFORM_FLOAT,
+  UNIFORM_MAT4
+} uniform_type_t;
+
+struct programState {
+  GLuint id;
+
+  unsigned char type[STATE_MAX_UNIFORMS];
+  GLfloat values[STATE_MAX_UNIFORMS][16];
+};
+
+struct glState {
+  GLuint program;
+  GLuint vao;
+
+  GLuint activeTexture;
+  GLuint textures[STATE_MAX_TEXTURE_UNITS];
+
+  unsigned int blend;
+  unsigned int cull;
+
+  unsigned int depthTest;
+  unsigned int depthWrite;
+  GLenum depthFunc;
+
+  /* the uniform cache of the bound program, NULL if none is bound */
+  struct programState *current;
+  struct programState programs[STATE_MAX_PROGRAMS];
+
+  struct gfxStateStats stats;
+};
+
+static struct glState gState;
+
+#ifdef GFX_STATE_DEBUG
+#define STATE_VALIDATE() gfxStateValidate()
+#else
+#define STATE_VALIDATE()
+#endif
+
+#define FILTERED()              \
+  do {                          \
+    gState.stats.filtered++;    \
+    return;                     \
+  } while (0)
+
+#define ISSUED() gState.stats.issued++
+
+/* forget everything we know, the next call of every kind goes through */
+void gfxStateInvalidate() {
+  gState.program = STATE_UNKNOWN;
+  gState.vao = STATE_UNKNOWN;
+
+  gState.activeTexture = STATE_UNKNOWN;
+  for (int i = 0; i < STATE_MAX_TEXTURE_UNITS; ++i) {
+    gState.textures[i] = STATE_UNKNOWN;
+  }
+
+  gState.blend = STATE_UNKNOWN;
+  gState.cull = STATE_UNKNOWN;
+
+  gState.depthTest = STATE_UNKNOWN;
+  gState.depthWrite = STATE_UNKNOWN;
+  gState.depthFunc = STATE_UNKNOWN;
+
+  gState.current = NULL;
+  memset(gState.programs, 0x0, sizeof(gState.programs));
+}
+
+/* invalidates and resets the counters, call this at the start of a frame */
+void gfxStateReset() {
+  gfxStateInvalidate();
+  memset(&gState.stats, 0x0, sizeof(gState.stats));
+}
+
+void gfxStateGetStats(struct gfxStateStats *stats) {
+  *stats = gState.stats;
+}
+
+void gfxStateUseProgram(GLuint program) {
+  if (gState.program == program) FILTERED();
+
+  glUseProgram(program);
+  ISSUED();
+
+  gState.program = program;
+
+  if (program == 0) {
+    gState.current = NULL;
+  } else {
+    struct programState *ps = &gState.programs[program % STATE_MAX_PROGRAMS];
+
+    /* evict whichever program was cached here before */
+    if (ps->id != program) {
+      memset(ps, 0x0, sizeof(struct programState));
+      ps->id = program;
+    }
+
+    gState.current = ps;
+  }
+
+  STATE_VALIDATE();
+}
+
+void gfxStateBindVertexArray(GLuint vao) {
+  if (gState.vao == vao) FILTERED();
+
+  glBindVertexArray(vao);
+  ISSUED();
+
+  gState.vao = vao;
+
+  STATE_VALIDATE();
+}
+
+/* only GL_TEXTURE_2D for now */
+void gfxStateBindTexture(GLuint unit, GLuint texture) {
+  assert(unit < STATE_MAX_TEXTURE_UNITS);
+
+  if (gState.textures[unit] == texture) FILTERED();
+
+  if (gState.activeTexture != unit) {
+    glActiveTexture(GL_TEXTURE0 + unit);
+    ISSUED();
+
+    gState.activeTexture = unit;
+  }
+
+  glBindTexture(GL_TEXTURE_2D, texture);
+  ISSUED();
+
+  gState.textures[unit] = texture;
+
+  STATE_VALIDATE();
+}
+
+/* blending: http://stackoverflow.com/questions/6853004/procedure-for-alpha-blending-textured-quads-in-opengl-3 */
+void gfxStateBlend(unsigned int blend) {
+  if (gState.blend == blend) FILTERED();
+
+  if (blend == GFX_NONE) {
+    glDisable(GL_BLEND);
+  } else {
+    /* no need to enable it again when we're switching between modes */
+    if (gState.blend == GFX_NONE || gState.blend == STATE_UNKNOWN) {
+      glEnable(GL_BLEND);
+    }
+
+    switch (blend) {
+    case GFX_BLEND_ALPHA:
+      /* (almost) equivalent to the following
+       *
+       * glBlendEquation(GL_FUNC_ADD);
+       * glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+       *
+       * except that the alpha channel itself gets blended differently */
+      glBlendEquationSeparate(GL_FUNC_ADD, GL_FUNC_ADD);
+      glBlendFuncSeparate(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA, GL_ONE, GL_ZERO);
+      break;
+    case GFX_BLEND_PREMUL_ALPHA:
+      glBlendEquationSeparate(GL_FUNC_ADD, GL_FUNC_ADD);
+      glBlendFuncSeparate(GL_ONE, GL_ONE_MINUS_SRC_ALPHA, GL_ONE, GL_ZERO);
+      break;
+    }
+  }
+
+  ISSUED();
+  gState.blend = blend;
+
+  STATE_VALIDATE();
+}
+
+void gfxStateCull(unsigned int cull) {
+  if (gState.cull == cull) FILTERED();
+
+  if (cull == GFX_NONE) {
+    glDisable(GL_CULL_FACE);
+  } else {
+    if (gState.cull == GFX_NONE || gState.cull == STATE_UNKNOWN) {
+      glEnable(GL_CULL_FACE);
+      glFrontFace(GL_CCW);
+    }
+
+    switch (cull) {
+    case GFX_CULL_FRONT:
+      glCullFace(GL_FRONT);
+      break;
+    case GFX_CULL_BACK:
+      glCullFace(GL_BACK);
+      break;
+    }
+  }
+
+  ISSUED();
+  gState.cull = cull;
+
+  STATE_VALIDATE();
+}
+
+void gfxStateDepthTest(int enable, GLenum func) {
+  const unsigned int test = enable ? 1 : 0;
+
+  if (gState.depthTest == test && (!test || gState.depthFunc == func)) FILTERED();
+
+  if (gState.depthTest != test) {
+    if (test) {
+      glEnable(GL_DEPTH_TEST);
+    } else {
+      glDisable(GL_DEPTH_TEST);
+    }
+
+    gState.depthTest = test;
+  }
+
+  if (test && gState.depthFunc != func) {
+    glDepthFunc(func);
+    gState.depthFunc = func;
+  }
+
+  ISSUED();
+
+  STATE_VALIDATE();
+}
+
+void gfxStateDepthWrite(int enable) {
+  const unsigned int write = enable ? 1 : 0;
+
+  if (gState.depthWrite == write) FILTERED();
+
+  glDepthMask(write ? GL_TRUE : GL_FALSE);
+  ISSUED();
+
+  gState.depthWrite = write;
+
+  STATE_VALIDATE();
+}
+
+/* returns 1 if the value is already set for the uniform at loc in the
+ * bound program, otherwise remembers it and returns 0 */
+static int uniformCached(GLint loc, uniform_type_t type, const void *value, size_t size) {
+  struct programState *ps = gState.current;
+
+  if (!ps || loc < 0 || loc >= STATE_MAX_UNIFORMS) return 0;
+
+  if (ps->type[loc] == type && memcmp(ps->values[loc], value, size) == 0) {
+    return 1;
+  }
+
+  ps->type[loc] = (unsigned char)type;
+  memcpy(ps->values[loc], value, size);
+
+  return 0;
+}
+
+/* the uniform setters work on the bound program, so bind it through
+ * gfxStateUseProgram() first */
+void gfxStateUniform1i(GLint loc, GLint value) {
+  if (uniformCached(loc, UNIFORM_INT, &value, sizeof(value))) FILTERED();
+
+  glUniform1i(loc, value);
+  ISSUED();
+
+  STATE_VALIDATE();
+}
+
+void gfxStateUniform1f(GLint loc, GLfloat value) {
+  if (uniformCached(loc, UNIFORM_FLOAT, &value, sizeof(value))) FILTERED();
+
+  glUniform1f(loc, value);
+  ISSUED();
+
+  STATE_VALIDATE();
+}
+
+void gfxStateUniformMatrix4fv(GLint loc, const GLfloat *value) {
+  if (uniformCached(loc, UNIFORM_MAT4, value, 16 * sizeof(GLfloat))) FILTERED();
+
+  glUniformMatrix4fv(loc, 1, GL_FALSE, value);
+  ISSUED();
+
+  STATE_VALIDATE();
+}
+
+#define CHECK(cond, ...)                      \
+  if (!(cond)) {                              \
+    trace("GL state mismatch: " __VA_ARGS__); \
+    ok = 0;                                   \
+  }
+
+/* compares the shadow state with the actual GL state, only the parts we
+ * know about are checked. Returns 1 if everything matches. */
+int gfxStateValidate() {
+  int ok = 1;
+  GLint v;
+
+  if (gState.program != STATE_UNKNOWN) {
+    glGetIntegerv(GL_CURRENT_PROGRAM, &v);
+    CHECK((GLuint)v == gState.program, "program is %d, shadow has %u\n", v, gState.program);
+  }
+
+  if (gState.vao != STATE_UNKNOWN) {
+    glGetIntegerv(GL_VERTEX_ARRAY_BINDING, &v);
+    CHECK((GLuint)v == gState.vao, "VAO is %d, shadow has %u\n", v, gState.vao);
+  }
+
+  GLint active;
+  glGetIntegerv(GL_ACTIVE_TEXTURE, &active);
+
+  if (gState.activeTexture != STATE_UNKNOWN) {
+    CHECK((GLuint)active == GL_TEXTURE0 + gState.activeTexture, "active texture unit is %d, shadow has %u\n", active - GL_TEXTURE0, gState.activeTexture);
+  }
+
+  for (GLuint unit = 0; unit < STATE_MAX_TEXTURE_UNITS; ++unit) {
+    if (gState.textures[unit] == STATE_UNKNOWN) continue;
+
+    glActiveTexture(GL_TEXTURE0 + unit);
+    glGetIntegerv(GL_TEXTURE_BINDING_2D, &v);
+    CHECK((GLuint)v == gState.textures[unit], "texture unit %u has %d, shadow has %u\n", unit, v, gState.textures[unit]);
+  }
+
+  glActiveTexture((GLenum)active);
+
+  if (gState.blend != STATE_UNKNOWN) {
+    CHECK((glIsEnabled(GL_BLEND) == GL_TRUE) == (gState.blend != GFX_NONE), "blending enabled doesn't match mode %u\n", gState.blend);
+
+    if (gState.blend != GFX_NONE) {
+      glGetIntegerv(GL_BLEND_SRC_RGB, &v);
+      CHECK(v == ((gState.blend == GFX_BLEND_ALPHA) ? GL_SRC_ALPHA : GL_ONE), "blend source factor 0x%x doesn't match mode %u\n", v, gState.blend);
+    }
+  }
+
+  if (gState.cull != STATE_UNKNOWN) {
+    CHECK((glIsEnabled(GL_CULL_FACE) == GL_TRUE) == (gState.cull != GFX_NONE), "culling enabled doesn't match mode %u\n", gState.cull);
+
+    if (gState.cull != GFX_NONE) {
+      glGetIntegerv(GL_CULL_FACE_MODE, &v);
+      CHECK(v == ((gState.cull == GFX_CULL_FRONT) ? GL_FRONT : GL_BACK), "cull face 0x%x doesn't match mode %u\n", v, gState.cull);
+    }
+  }
+
+  if (gState.depthTest != STATE_UNKNOWN) {
+    CHECK((glIsEnabled(GL_DEPTH_TEST) == GL_TRUE) == (gState.depthTest == 1), "depth test doesn't match shadow %u\n", gState.depthTest);
+  }
+
+  if (gState.depthFunc != STATE_UNKNOWN) {
+    glGetIntegerv(GL_DEPTH_FUNC, &v);
+    CHECK((GLenum)v == gState.depthFunc, "depth func is 0x%x, shadow has 0x%x\n", v, gState.depthFunc);
+  }
+
+  if (gState.depthWrite != STATE_UNKNOWN) {
+    GLboolean mask;
+    glGetBooleanv(GL_DEPTH_WRITEMASK, &mask);
+    CHECK((mask == GL_TRUE) == (gState.depthWrite == 1), "depth write mask doesn't match shadow %u\n", gState.depthWrite);
+  }
+
+  const struct programState *ps = gState.current;
+
+  for (GLint loc = 0; ps && loc < STATE_MAX_UNIFORMS; ++loc) {
+    GLfloat values[16];
+    GLint ivalue;
+
+    switch (ps->type[loc]) {
+    case UNIFORM_INT:
+      glGetUniformiv(ps->id, loc, &ivalue);
+      CHECK(memcmp(&ivalue, ps->values[loc], sizeof(ivalue)) == 0, "int uniform %d of program %u differs\n", loc, ps->id);
+      break;
+    case UNIFORM_FLOAT:
+      glGetUniformfv(ps->id, loc, values);
+      CHECK(memcmp(values, ps->values[loc], sizeof(GLfloat)) == 0, "float uniform %d of program %u differs\n", loc, ps->id);
+      break;
+    case UNIFORM_MAT4:
+      glGetUniformfv(ps->id, loc, values);
+      CHECK(memcmp(values, ps->values[loc], sizeof(values)) == 0, "mat4 uniform %d of program %u differs\n", loc, ps->id);
+      break;
+    }
+  }
+
+  GL_ERROR("validate GL state");
+
+  assert(ok && "the GL shadow state is out of sync");
+
+  return ok;
+}
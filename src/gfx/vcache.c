@@ -0,0 +1,292 @@
+/**
+ * This file is part of prototype.
+ *
+ * (c) 2014 Nicolas Hillegeer <nicolas@hillegeer.com>
+ *
+ * For the full copyright and license information, please view the LICENSE
+ * file that was distributed with the source code.
+ *
+ * Mesh optimization for the post-transform vertex cache (the order of the
+ * triangles) and the pre-transform vertex fetch (the order of the
+ * vertices), meant to be run once when a mesh is generated, converted or
+ * loaded. Works on 32-bit indices and doesn't touch GL, so it can run
+ * offline too.
+ *
+ * The triangle order is Tom Forsyth's "Linear-speed vertex cache
+ * optimisation": every vertex gets a score from its position in a
+ * simulated LRU cache and from how many triangles still need it, and we
+ * greedily emit the best triangle among the ones that use a vertex in the
+ * cache.
+ *
+ * http://home.comcast.net/~tom_forsyth/papers/fast_vert_cache_opt.html
+ */
+
+#include <assert.h>
+#include <math.h>
+#include <string.h>
+
+#include "vcache.h"
+#include "zmalloc.h"
+
+#define VCACHE_DECAY_POWER    1.5f
+#define VCACHE_LAST_TRI_SCORE 0.75f
+#define VCACHE_VALENCE_SCALE  2.0f
+#define VCACHE_VALENCE_POWER  0.5f
+
+/* valences above this get their score calculated instead of looked up */
+#define VCACHE_MAX_VALENCE 32
+
+#define VCACHE_NONE UINT32_MAX
+
+struct scoreTables {
+  float position[GFX_VCACHE_SIZE];
+  float valence[VCACHE_MAX_VALENCE];
+};
+
+static void initTables(struct scoreTables *tables) {
+  for (int i = 0; i < GFX_VCACHE_SIZE; ++i) {
+    if (i < 3) {
+      /* the vertices of the last triangle get a fixed score, so that we
+       * don't prefer using the exact same edge again */
+      tables->position[i] = VCACHE_LAST_TRI_SCORE;
+    } else {
+      const float scaler = 1.0f / (float)(GFX_VCACHE_SIZE - 3);
+      tables->position[i] = powf(1.0f - (float)(i - 3) * scaler, VCACHE_DECAY_POWER);
+    }
+  }
+
+  tables->valence[0] = 0.0f;
+  for (int i = 1; i < VCACHE_MAX_VALENCE; ++i) {
+    tables->valence[i] = VCACHE_VALENCE_SCALE * powf((float)i, -VCACHE_VALENCE_POWER);
+  }
+}
+
+static float vertexScore(const struct scoreTables *tables, int cachePosition, uint32_t activeTriangles) {
+  /* nothing left to draw with this vertex */
+  if (activeTriangles == 0) return -1.0f;
+
+  float score = (cachePosition >= 0) ? tables->position[cachePosition] : 0.0f;
+
+  /* boost vertices with only a few triangles left, so we don't leave
+   * lonely triangles behind that need a whole vertex transform later on */
+  score += (activeTriangles < VCACHE_MAX_VALENCE) ? tables->valence[activeTriangles]
+                                                 : VCACHE_VALENCE_SCALE * powf((float)activeTriangles, -VCACHE_VALENCE_POWER);
+
+  return score;
+}
+
+/* simulates a FIFO cache of the given size, which is what most hardware
+ * actually has */
+void gfxVertexCacheStats(struct gfxVertexCacheStats *stats, const uint32_t *indices, size_t numIndices,
+                         size_t numVertices, size_t cacheSize) {
+  memset(stats, 0x0, sizeof(struct gfxVertexCacheStats));
+
+  if (numIndices < 3 || numVertices == 0) return;
+
+  /* the "time" at which every vertex entered the cache, a vertex is still
+   * in there if less than cacheSize misses happened since */
+  size_t *entered = zcalloc(numVertices * sizeof(size_t));
+  size_t referenced = 0;
+
+  for (size_t i = 0; i < numIndices; ++i) {
+    const uint32_t v = indices[i];
+    assert(v < numVertices);
+
+    if (entered[v] == 0) {
+      referenced++;
+    } else if (stats->transforms - entered[v] < cacheSize) {
+      continue;
+    }
+
+    entered[v] = ++stats->transforms;
+  }
+
+  zfree(entered);
+
+  stats->acmr = (float)stats->transforms / (float)(numIndices / 3);
+  stats->atvr = (float)stats->transforms / (float)referenced;
+}
+
+/* reorders the triangles in place, the vertices stay where they are */
+void gfxOptimizeTriangles(uint32_t *indices, size_t numIndices, size_t numVertices) {
+  const size_t numTriangles = numIndices / 3;
+  if (numTriangles < 2) return;
+
+  struct scoreTables tables;
+  initTables(&tables);
+
+  /* per vertex: the triangles that use it (the active ones first), its
+   * position in the cache and its score */
+  uint32_t *active = zcalloc(numVertices * sizeof(uint32_t));
+  uint32_t *offsets = zmalloc((numVertices + 1) * sizeof(uint32_t));
+  uint32_t *triangles = zmalloc(numTriangles * 3 * sizeof(uint32_t));
+  int *cachePosition = zmalloc(numVertices * sizeof(int));
+  float *score = zmalloc(numVertices * sizeof(float));
+
+  /* per triangle */
+  float *triangleScore = zmalloc(numTriangles * sizeof(float));
+  unsigned char *emitted = zcalloc(numTriangles);
+
+  uint32_t *output = zmalloc(numTriangles * 3 * sizeof(uint32_t));
+
+  for (size_t i = 0; i < numTriangles * 3; ++i) {
+    assert(indices[i] < numVertices);
+    active[indices[i]]++;
+  }
+
+  offsets[0] = 0;
+  for (size_t v = 0; v < numVertices; ++v) {
+    offsets[v + 1] = offsets[v] + active[v];
+    active[v] = 0;
+  }
+
+  for (size_t t = 0; t < numTriangles; ++t) {
+    for (int k = 0; k < 3; ++k) {
+      const uint32_t v = indices[t * 3 + (size_t)k];
+      triangles[offsets[v] + active[v]++] = (uint32_t)t;
+    }
+  }
+
+  for (size_t v = 0; v < numVertices; ++v) {
+    cachePosition[v] = -1;
+    score[v] = vertexScore(&tables, -1, active[v]);
+  }
+
+  uint32_t best = 0;
+  for (size_t t = 0; t < numTriangles; ++t) {
+    const uint32_t *tri = &indices[t * 3];
+    triangleScore[t] = score[tri[0]] + score[tri[1]] + score[tri[2]];
+
+    if (triangleScore[t] > triangleScore[best]) best = (uint32_t)t;
+  }
+
+  /* the simulated LRU cache, with room for the vertices that get pushed
+   * out by the triangle we just emitted */
+  uint32_t cache[GFX_VCACHE_SIZE + 3];
+  uint32_t newCache[GFX_VCACHE_SIZE + 3];
+  size_t cacheCount = 0;
+
+  /* where to continue looking for a triangle when none of the vertices in
+   * the cache have any left */
+  size_t cursor = 0;
+
+  for (size_t n = 0; n < numTriangles; ++n) {
+    if (best == VCACHE_NONE) {
+      while (emitted[cursor]) ++cursor;
+      best = (uint32_t)cursor;
+    }
+
+    const uint32_t *tri = &indices[best * 3];
+    memcpy(&output[n * 3], tri, 3 * sizeof(uint32_t));
+    emitted[best] = 1;
+
+    /* the triangle isn't active anymore, move it to the back of the
+     * active part of the list of its vertices */
+    for (int k = 0; k < 3; ++k) {
+      const uint32_t v = tri[k];
+      uint32_t *list = &triangles[offsets[v]];
+
+      for (uint32_t i = 0; i < active[v]; ++i) {
+        if (list[i] == best) {
+          list[i] = list[active[v] - 1];
+          list[active[v] - 1] = best;
+          active[v]--;
+          break;
+        }
+      }
+    }
+
+    /* the vertices of the triangle go to the front of the cache */
+    size_t newCount = 0;
+    for (int k = 0; k < 3; ++k) {
+      const uint32_t v = tri[k];
+      if (k > 0 && (v == tri[0] || (k == 2 && v == tri[1]))) continue;
+      newCache[newCount++] = v;
+    }
+
+    for (size_t i = 0; i < cacheCount; ++i) {
+      const uint32_t v = cache[i];
+      if (v != tri[0] && v != tri[1] && v != tri[2]) newCache[newCount++] = v;
+    }
+
+    for (size_t i = 0; i < newCount; ++i) {
+      const uint32_t v = newCache[i];
+
+      cachePosition[v] = (i < GFX_VCACHE_SIZE) ? (int)i : -1;
+      score[v] = vertexScore(&tables, cachePosition[v], active[v]);
+    }
+
+    /* only triangles that use one of these vertices changed score, the
+     * best of them goes next */
+    best = VCACHE_NONE;
+    float bestScore = -1.0f;
+
+    for (size_t i = 0; i < newCount; ++i) {
+      const uint32_t v = newCache[i];
+      const uint32_t *list = &triangles[offsets[v]];
+
+      for (uint32_t j = 0; j < active[v]; ++j) {
+        const uint32_t t = list[j];
+        const uint32_t *other = &indices[t * 3];
+
+        triangleScore[t] = score[other[0]] + score[other[1]] + score[other[2]];
+
+        if (triangleScore[t] > bestScore) {
+          bestScore = triangleScore[t];
+          best = t;
+        }
+      }
+    }
+
+    cacheCount = (newCount < GFX_VCACHE_SIZE) ? newCount : GFX_VCACHE_SIZE;
+    memcpy(cache, newCache, cacheCount * sizeof(uint32_t));
+  }
+
+  memcpy(indices, output, numTriangles * 3 * sizeof(uint32_t));
+
+  zfree(output);
+  zfree(emitted);
+  zfree(triangleScore);
+  zfree(score);
+  zfree(cachePosition);
+  zfree(triangles);
+  zfree(offsets);
+  zfree(active);
+}
+
+/* renumbers the vertices in the order the indices first use them, so
+ * that vertex fetches walk through the buffer instead of jumping around.
+ * Vertices that aren't referenced end up at the back, returns how many
+ * are referenced. */
+size_t gfxOptimizeVertexFetch(void *vertices, size_t stride, size_t numVertices, uint32_t *indices, size_t numIndices) {
+  uint32_t *remap = zmalloc(numVertices * sizeof(uint32_t));
+  memset(remap, 0xFF, numVertices * sizeof(uint32_t));
+
+  uint32_t next = 0;
+
+  for (size_t i = 0; i < numIndices; ++i) {
+    const uint32_t v = indices[i];
+    assert(v < numVertices);
+
+    if (remap[v] == VCACHE_NONE) remap[v] = next++;
+    indices[i] = remap[v];
+  }
+
+  const size_t referenced = next;
+
+  for (size_t v = 0; v < numVertices; ++v) {
+    if (remap[v] == VCACHE_NONE) remap[v] = next++;
+  }
+
+  unsigned char *copy = zmalloc(numVertices * stride);
+  memcpy(copy, vertices, numVertices * stride);
+
+  for (size_t v = 0; v < numVertices; ++v) {
+    memcpy((unsigned char *)vertices + remap[v] * stride, copy + v * stride, stride);
+  }
+
+  zfree(copy);
+  zfree(remap);
+
+  return referenced;
+}
@@ -0,0 +1,36 @@
+/**
+ * This file is part of prototype.
+ *
+ * (c) 2014 Nicolas Hillegeer <nicolas@hillegeer.com>
+ *
+ * For the full copyright and license information, please view the LICENSE
+ * file that was distributed with the source code.
+ */
+
+#ifndef __vcache_h__
+#define __vcache_h__
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* the size of the LRU cache that the optimizer scores against, Forsyth
+ * recommends 32 even though real caches are smaller (or FIFO's), it does
+ * well on all of them */
+#define GFX_VCACHE_SIZE 32
+
+/* ACMR: average cache miss ratio, vertex shader invocations per triangle,
+ * between 0.5 (ideal for big regular meshes) and 3.0.
+ * ATVR: average transform to vertex ratio, vertex shader invocations per
+ * referenced vertex, 1.0 is ideal. */
+struct gfxVertexCacheStats {
+  size_t transforms;
+  float acmr;
+  float atvr;
+};
+
+void gfxVertexCacheStats(struct gfxVertexCacheStats *stats, const uint32_t *indices, size_t numIndices,
+                         size_t numVertices, size_t cacheSize);
+void gfxOptimizeTriangles(uint32_t *indices, size_t numIndices, size_t numVertices);
+size_t gfxOptimizeVertexFetch(void *vertices, size_t stride, size_t numVertices, uint32_t *indices, size_t numIndices);
+
+#endif
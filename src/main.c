@@ -23,6 +23,10 @@
 
 bool g_update_title = false;
 
+/* the frame time we aim for (60 Hz), the Lua collector gets part of what
+ * a frame leaves of it */
+#define FRAME_TARGET_US 16667
+
 const char *printv(vec4 vec) {
   static char buffer[256];
 
@@ -79,6 +83,9 @@ static void resize(struct gfxRenderer *renderer, int width, int height) {
     case GFX_PERSPECTIVE:
       layer->uniforms.projectionMatrix = mat_perspective_fovy(GFX_PI / 2.0f, (float)width / (float)height, 0.5f, 10.0f);
       break;
+    case GFX_PERSPECTIVE_INF:
+      layer->uniforms.projectionMatrix = mat_perspective_fovy_inf_z(GFX_PI / 2.0f, (float)width / (float)height, 0.5f);
+      break;
     case GFX_ORTHO:
       layer->uniforms.projectionMatrix = mat_ortho(0.0f, (float)width, 0.0f, (float)height, 0.0f, 1.0f);
       break;
@@ -87,6 +94,9 @@ static void resize(struct gfxRenderer *renderer, int width, int height) {
     /* after changing the uniforms we have to re-upload */
     gfxUploadLayer(layer);
   }
+
+  /* LODs may be off by a pixel */
+  gfxDrawlistSetLodError(1.0f, (float)height);
 }
 
 #ifdef GL_VERSION_4_3
@@ -133,6 +143,21 @@ static void fillRendererInfo(struct gfxRenderer *renderer) {
 
   glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &renderer->uboOffsetAlign);
   GL_ERROR("request uniform buffer offset alignment");
+
+  GLint major;
+  GLint minor;
+
+  glGetIntegerv(GL_MAJOR_VERSION, &major);
+  glGetIntegerv(GL_MINOR_VERSION, &minor);
+
+  renderer->instancing = (major > 3 || (major == 3 && minor >= 3)) ||
+                         SDL_GL_ExtensionSupported("GL_ARB_instanced_arrays");
+
+  renderer->bufferStorage = (major > 4 || (major == 4 && minor >= 4)) ||
+                            SDL_GL_ExtensionSupported("GL_ARB_buffer_storage");
+
+  renderer->multiDrawIndirect = (major > 4 || (major == 4 && minor >= 3)) ||
+                                SDL_GL_ExtensionSupported("GL_ARB_multi_draw_indirect");
 }
 
 static void printGlInfo() {
@@ -169,6 +194,25 @@ static void printGlInfo() {
   trace("context version double check: %d.%d\n", major, minor);
 }
 
+/* the bounds of the model, in the space its modelview matrix maps to */
+static void viewBox(aabb *box, const struct gfxDrawOperation *op) {
+  const aabb *bounds = &op->model->bounds;
+  const mat4 mv = op->params->modelviewMatrix;
+
+  box->min = vscalar(INFINITY);
+  box->max = vscalar(-INFINITY);
+
+  for (int i = 0; i < 8; ++i) {
+    const vec4 corner = vec((i & 1) ? bounds->max[0] : bounds->min[0],
+                            (i & 2) ? bounds->max[1] : bounds->min[1],
+                            (i & 4) ? bounds->max[2] : bounds->min[2], 1.0f);
+    const vec4 p = mvmul(mv, corner);
+
+    box->min = vmin(box->min, p);
+    box->max = vmax(box->max, p);
+  }
+}
+
 static void diagFrameDone(SDL_Window *window) {
   char title[1024];
 
@@ -183,6 +227,14 @@ static void diagFrameDone(SDL_Window *window) {
   elapsed = (current - last);
   totalElapsed += elapsed;
 
+  /* time spent collecting Lua garbage, per frame */
+  static unsigned int gcTotal = 0, gcMax = 0;
+
+  struct wfScriptGcStats gc;
+  wfScriptGetGcStats(&gc);
+  gcTotal += gc.frameUs;
+  gcMax = MAX(gcMax, gc.frameUs);
+
   ++counter;
 
   min = MIN(min, elapsed);
@@ -194,19 +246,56 @@ static void diagFrameDone(SDL_Window *window) {
     int avgfps = (int)(1000 / (float)avg);
     int fps = (int)(1000 * (float)counter / (float)totalElapsed);
 
+    struct gfxDrawlistStats stats;
+    gfxDrawlistGetStats(&stats);
+
+    struct gfxStateStats state;
+    gfxStateGetStats(&state);
+
+    /* what every subsystem holds, and the most the frame arena had to
+     * hand out in a single frame */
+    char tags[256];
+    size_t accum = 0;
+
+    for (int tag = 0; tag < WF_MEM_TAGS; ++tag) {
+      struct wfMemTagStats mem;
+      wfMemTagGetStats((enum wfMemTag)tag, &mem);
+      accum += (size_t)snprintf(tags + accum, sizeof(tags) - accum, "%s%s %zu kb",
+                                tag ? ", " : "", wfMemTagName((enum wfMemTag)tag), mem.used / 1024);
+    }
+
+    const size_t framePeak = wfFrame()->peak;
+    wfFrame()->peak = 0;
+
+    /* the most the main thread ever had allocated at once */
+    zmalloc_stats zstats;
+    zmalloc_get_thread_stats(&zstats);
+
+    /* how much Lua allocates per frame, which is what keeps its collector
+     * busy */
+    static size_t luaAllocated = 0;
+    struct wfScriptMemStats lua;
+    wfScriptGetMemStats(&lua);
+    const size_t luaRate = (lua.allocated - luaAllocated) / (size_t)counter;
+    luaAllocated = lua.allocated;
+
     if (g_update_title) {
       sprintf(title,
               "avg fps: %d, actual fps: %d, ms/f (min: %d, avg: %d, max: %d), "
-              "frames: %d, mem: %zu b, lua mem: %d kb\n",
-              avgfps, fps, min, avg, max, counter, zmalloc_used_memory(),
-              wfScriptMemUsed());
+              "frames: %d, mem: %zu b (%s, frame peak %zu b, peak %zu b), lua mem: %d kb (%zu b/f allocated, gc %u us/f, max %u us), draws: %u/%u (%u instanced), "
+              "gl state: %u issued, %u filtered\n",
+              avgfps, fps, min, avg, max, counter, zmalloc_used_memory(), tags, framePeak, zstats.peak,
+              wfScriptMemUsed(), luaRate, gcTotal / (unsigned int)counter, gcMax, stats.drawCalls, stats.entries, stats.instancedDrawCalls,
+              state.issued, state.filtered);
 
       SDL_SetWindowTitle(window, title);
     } else {
       printf("avg fps: %d, actual fps: %d, ms/f (min: %d, avg: %d, max: %d), "
-             "frames: %d, mem: %zu b, lua mem: %d kb\n",
-             avgfps, fps, min, avg, max, counter, zmalloc_used_memory(),
-             wfScriptMemUsed());
+             "frames: %d, mem: %zu b (%s, frame peak %zu b, peak %zu b), lua mem: %d kb (%zu b/f allocated, gc %u us/f, max %u us), draws: %u/%u (%u instanced), "
+             "gl state: %u issued, %u filtered\n",
+             avgfps, fps, min, avg, max, counter, zmalloc_used_memory(), tags, framePeak, zstats.peak,
+             wfScriptMemUsed(), luaRate, gcTotal / (unsigned int)counter, gcMax, stats.drawCalls, stats.entries, stats.instancedDrawCalls,
+             state.issued, state.filtered);
     }
 
     SDL_SetWindowTitle(window, title);
@@ -214,6 +303,9 @@ static void diagFrameDone(SDL_Window *window) {
     counter = 0;
     totalElapsed = 0;
 
+    gcTotal = 0;
+    gcMax = 0;
+
     min = INT32_MAX;
     max = 0;
     avg = 0;
@@ -368,7 +460,7 @@ int main(int argc, char *argv[]) {
   quad.id = modelId++;
 
   struct gfxModel axis;
-  gfxAxis(&axis);
+  gfxAxis(&axis, NULL);
   axis.id = modelId++;
 
   struct gfxModel crystal;
@@ -376,7 +468,7 @@ int main(int argc, char *argv[]) {
   crystal.id = modelId++;
 
   struct gfxModel cube;
-  gfxCube(&cube);
+  gfxCube(&cube, NULL);
   cube.id = modelId++;
 
   /* always picking the unit square is better, the shader kind of relies on it */
@@ -403,6 +495,12 @@ int main(int argc, char *argv[]) {
   trace("    - max uniform block size = %d bytes\n", rend.uboMaxBlockSize);
   trace("    - max UBO binding points = %d\n", rend.uboMaxBindings);
   trace("    - UBO offset align       = %d\n", rend.uboOffsetAlign);
+  trace("    - instancing             = %d\n", rend.instancing);
+  trace("    - buffer storage         = %d\n", rend.bufferStorage);
+  trace("    - multi-draw indirect    = %d\n", rend.multiDrawIndirect);
+
+  gfxDrawlistInit(&rend);
+  gfxRingInit(&rend);
 
   resize(&rend, width, height);
 
@@ -450,16 +548,48 @@ int main(int argc, char *argv[]) {
   gfxGenRenderKey(&guid);
   guid.key.gen.layer = LAYER_2;
 
-  gfxDrawlistAdd(&axisd);
+  /* the frame starts with clearing everything, before any of the layers,
+   * the gui gets a fresh depth buffer so the scene can't cover it */
+  struct gfxClear clearFrame = {
+      .mask = GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT,
+      .color = {0.0f, 0.0f, 0.0f, 1.0f},
+      .depth = 1.0f,
+  };
+  struct gfxDrawOperation clearFramed = {0};
+  gfxGenCommandKey(&clearFramed, LAYER_0, gfxDrawlistRegisterCommand(gfxCmdClear, &clearFrame), 0);
+
+  struct gfxClear clearDepth = {
+      .mask = GL_DEPTH_BUFFER_BIT,
+      .depth = 1.0f,
+  };
+  struct gfxDrawOperation clearGuid = {.layer = &guiLayer};
+  gfxGenCommandKey(&clearGuid, LAYER_2, gfxDrawlistRegisterCommand(gfxCmdClear, &clearDepth), 0);
+
+  gfxDrawlistAdd(&clearFramed);
+  gfxDrawlistAdd(&clearGuid);
   gfxDrawlistAdd(&sheetd);
-  gfxDrawlistAdd(&crystald);
-  gfxDrawlistAdd(&cubed);
   gfxDrawlistAdd(&guid);
 
+  /* these come and go with the frustum of the scene layer. The sheet
+   * stays, the wave shader moves its vertices away from its bounds. */
+  struct gfxDrawOperation *culled[] = {&axisd, &crystald, &cubed};
+  gfxDrawHandle culledHandles[ARRAY_SIZE(culled)] = {GFX_DRAW_HANDLE_NONE};
+
+  struct gfxBoxes culledBoxes;
+  gfxBoxesInit(&culledBoxes, ARRAY_SIZE(culled));
+
+  for (size_t i = 0; i < ARRAY_SIZE(culled); ++i) {
+    aabb box;
+    viewBox(&box, culled[i]);
+    gfxBoxesAdd(&culledBoxes, &box);
+  }
+
   struct gfxQuerySet queries = {0};
   gfxGenQueries(&queries);
 
   while (!done) {
+    const uint64_t frameStart = SDL_GetPerformanceCounter();
+
     while (SDL_PollEvent(&event)) {
       switch (event.type) {
       case SDL_WINDOWEVENT:
@@ -536,9 +666,6 @@ int main(int argc, char *argv[]) {
       }
     }
 
-    /* clear the screen before rendering */
-    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-
     uint32_t ticks = SDL_GetTicks();
     float ms = (float)ticks * 0.001f;
     // float alpha = (float) (ticks % 5000) / 5000.0f;
@@ -590,24 +717,46 @@ int main(int argc, char *argv[]) {
 
     gfxBeginQuery(&queries, GL_TIME_ELAPSED, GFX_TIMER_RENDER);
 
-    /**
-         * TODO: should factor out the changes and the re-uploading
-         *
-         * according to some, recreating the buffer is actually faster than changing the old buffer, maybe
-         * true if you're having sync issues?
-         * glBufferData(GL_UNIFORM_BUFFER, sizeof(struct gfxGlobalMatrices), &world.matrices, GL_STREAM_DRAW);
-         */
+    /* no need to upload, the drawlist streams the layer uniforms through
+     * the uniform ring every frame */
     sceneLayer.uniforms.timer = ms;
     guiLayer.uniforms.timer = ms;
-    gfxUploadLayer(&sceneLayer);
-    gfxUploadLayer(&guiLayer);
+
+    /* the camera is baked into the modelview matrices, so the scene culls
+     * in view space. Nothing in the gui gets culled, its frustum can stay
+     * as it is. */
+    gfxUpdateLayerFrustum(&sceneLayer, NULL);
+
+    /* the models move every frame, so do their boxes */
+    {
+      uint32_t visible[GFX_CULL_WORDS(ARRAY_SIZE(culled))];
+
+      for (size_t i = 0; i < ARRAY_SIZE(culled); ++i) {
+        aabb box;
+        viewBox(&box, culled[i]);
+        gfxBoxesSet(&culledBoxes, i, &box);
+      }
+
+      gfxCullBoxes(&culledBoxes, &sceneLayer.frustum, visible);
+      gfxDrawlistSetVisibility(culled, culledHandles, visible, ARRAY_SIZE(culled));
+    }
 
     gfxBeginQuery(&queries, GL_PRIMITIVES_GENERATED, GFX_PRIMITIVES_GENERATED);
+    gfxDrawlistUpdateDepth();
     gfxDrawlistRender();
     gfxEndQuery(&queries, GL_PRIMITIVES_GENERATED);
 
     gfxEndQuery(&queries, GL_TIME_ELAPSED);
 
+#ifdef HAVE_LUA
+    /* the GPU has the frame, collect Lua garbage with some of the time
+     * that's left before the next one */
+    {
+      const uint64_t frameUs = (SDL_GetPerformanceCounter() - frameStart) * 1000000 / SDL_GetPerformanceFrequency();
+      wfScriptCollect((frameUs < FRAME_TARGET_US) ? (unsigned int)(FRAME_TARGET_US - frameUs) : 0);
+    }
+#endif
+
     uint32_t beforeSwap = SDL_GetTicks();
     SDL_GL_SwapWindow(window);
     uint32_t elapsedSwap = SDL_GetTicks() - beforeSwap;
@@ -623,8 +772,13 @@ int main(int argc, char *argv[]) {
     gfxPerfFinishFrame(&queries);
 
     diagFrameDone(window);
+
+    /* everything allocated from the frame arena is gone now */
+    wfFrameEnd();
   }
 
+  gfxBoxesDestroy(&culledBoxes);
+
   gfxDestroyModel(&crystal);
   gfxDestroyModel(&quad);
   gfxDestroyModel(&cube);
@@ -647,6 +801,11 @@ int main(int argc, char *argv[]) {
 
   gfxDestroyQueries(&queries);
 
+  gfxDrawlistDestroy();
+  gfxRingDestroy();
+  gfxDestroyPools();
+  wfMemDestroy();
+
 #ifdef HAVE_LUA
   wfScriptDestroy();
 #endif
@@ -11,8 +11,11 @@
 #ifndef THREEDEE_GEOMETRY_H
 #define THREEDEE_GEOMETRY_H
 
+#include <float.h>
+
 #include <math/macros.h>
 #include <math/vector.h>
+#include <math/matrix.h>
 
 /* this will (hopefully) always be run in a tight loop on adjacent memory, so inline it
  * originally written by Iñigo Iquilez */
@@ -178,6 +181,79 @@ ALWAYS_INLINE static int box_in_frustum_soa_early(const frustum fru, const aabb
     return 1;
 }
 
+/* the plane order of frustum.planes */
+#define FRUSTUM_LEFT   0
+#define FRUSTUM_RIGHT  1
+#define FRUSTUM_BOTTOM 2
+#define FRUSTUM_TOP    3
+#define FRUSTUM_NEAR   4
+#define FRUSTUM_FAR    5
+
+/* Gribb/Hartmann: the clip planes of a (view-)projection matrix are the sums
+ * and differences of its last row with the others. They face inwards, and
+ * are normalized so that dot(plane, point) is a distance. An infinite far
+ * plane comes out as (0, 0, 0, 2 * near), which is never outside.
+ * http://www.cs.otago.ac.nz/postgrads/alexis/planeExtraction.pdf */
+ALWAYS_INLINE static void frustum_planes(vec4 planes[6], const mat4 m) {
+    const mat4 rows = mtranspose(m);
+
+    planes[FRUSTUM_LEFT]   = rows.cols[3] + rows.cols[0];
+    planes[FRUSTUM_RIGHT]  = rows.cols[3] - rows.cols[0];
+    planes[FRUSTUM_BOTTOM] = rows.cols[3] + rows.cols[1];
+    planes[FRUSTUM_TOP]    = rows.cols[3] - rows.cols[1];
+    planes[FRUSTUM_NEAR]   = rows.cols[3] + rows.cols[2];
+    planes[FRUSTUM_FAR]    = rows.cols[3] - rows.cols[2];
+
+    for (int i = 0; i < 6; ++i) {
+        const vec4 len = vmag3(planes[i]);
+        if (len[0] > 0.0f) planes[i] = planes[i] / len;
+    }
+}
+
+/* corner i of the frustum is the corner of the NDC cube with x = +1 if
+ * (i & 1), y = +1 if (i & 2) and z = +1 if (i & 4), -1 otherwise. The
+ * inverse maps them back, m has to be invertible. */
+ALWAYS_INLINE static void frustum_points(vec4 points[8], const mat4 m) {
+    const mat4 inv = minverse(m);
+
+    for (int i = 0; i < 8; ++i) {
+        const vec4 ndc = vec((i & 1) ? 1.0f : -1.0f, (i & 2) ? 1.0f : -1.0f, (i & 4) ? 1.0f : -1.0f, 1.0f);
+        const vec4 p = mvmul(inv, ndc);
+        points[i] = vxyz1(p / vsplat(p, 3));
+    }
+}
+
+/* builds the frustum of a view-projection matrix (projection * view),
+ * in world space. Just the projection gives a frustum in view space. */
+ALWAYS_INLINE static void frustum_from_mat(frustum *fru, const mat4 viewproj) {
+    frustum_planes(fru->planes, viewproj);
+    frustum_points(fru->points, viewproj);
+}
+
+/* the same for projections without a far plane (mat_perspective_fovy_inf_z
+ * and friends). The far corners are at infinity: NDC z = 1 unprojects to a
+ * direction, so those corners go as far out as floats go along it. That way
+ * the bounds of the corners only reject what's behind the near plane. */
+ALWAYS_INLINE static void frustum_from_mat_inf_z(frustum *fru, const mat4 viewproj) {
+    frustum_planes(fru->planes, viewproj);
+
+    const mat4 inv = minverse(viewproj);
+
+    for (int i = 0; i < 4; ++i) {
+        const vec4 ndc = vec((i & 1) ? 1.0f : -1.0f, (i & 2) ? 1.0f : -1.0f, -1.0f, 1.0f);
+        const vec4 near = mvmul(inv, ndc);
+        const vec4 dir = mvmul(inv, vec(ndc[0], ndc[1], 1.0f, 1.0f));
+
+        fru->points[i] = vxyz1(near / vsplat(near, 3));
+        fru->points[i + 4] = fru->points[i];
+
+        for (int c = 0; c < 3; ++c) {
+            if (dir[c] > 0.0f) fru->points[i + 4][c] = FLT_MAX;
+            else if (dir[c] < 0.0f) fru->points[i + 4][c] = -FLT_MAX;
+        }
+    }
+}
+
 ALWAYS_INLINE static int box_in_frustum(const frustum fru, const aabb box) {
     return box_in_frustum_scalar(fru, box);
 }
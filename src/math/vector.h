@@ -118,7 +118,7 @@ static inline void vstream(vec4 *ptr, vec4 v) { _mm_stream_ps((float*)ptr, v); }
 #else
 #define vshuffle_mask(a, b, c, d) (((a) << 0) | ((b) << 2) | ((c) << 4) | ((d) << 6))
 #define vshuffle(x, y, a, b, c, d) (__builtin_ia32_shufps((x), (y), vshuffle_mask((a),(b),(c),(d))))
-#define vadvshuffle(x, y, a, b, c, d) (__builtin_shuffle((x), (y), {(a), (b), (c), (d)}))
+#define vadvshuffle(x, y, a, b, c, d) (__builtin_shuffle((x), (y), (__v4si) {(a), (b), (c), (d)}))
 #define V_DONTCARE 0
 #endif
 
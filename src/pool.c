@@ -0,0 +1,244 @@
+/**
+ * This file is part of prototype.
+ *
+ * (c) 2014 Nicolas Hillegeer <nicolas@hillegeer.com>
+ *
+ * For the full copyright and license information, please view the LICENSE
+ * file that was distributed with the source code.
+ *
+ * Fixed-size object pools (see pool.h). Objects come from the free list
+ * first. When that's empty they get carved from the newest chunk, which
+ * is only touched when an object is actually handed out, so a fresh chunk
+ * doesn't cost more than the allocation. The stride of an object is its
+ * size rounded up to its alignment, and at least a pointer for the link.
+ *
+ * A cache keeps its own free list, it refills from the pool with a batch
+ * at a time and gives a batch back when it has twice that many, so a
+ * thread that keeps allocating and freeing about as many objects never
+ * takes the lock.
+ *
+ * Doesn't touch GL.
+ */
+
+#include <assert.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "pool.h"
+#include "zmalloc.h"
+
+struct wfPoolChunk {
+  struct wfPoolChunk *next;
+  size_t bytes;
+};
+
+static void *nextFree(void *obj) {
+  return *(void **)obj;
+}
+
+static void setNextFree(void *obj, void *next) {
+  *(void **)obj = next;
+}
+
+/* the bytes of a free object that don't belong to the link */
+static int isPoisoned(const struct wfPool *pool, const void *obj) {
+  const unsigned char *bytes = obj;
+
+  for (size_t i = sizeof(void *); i < pool->stride; ++i) {
+    if (bytes[i] != WF_POOL_FREED) return 0;
+  }
+
+  return 1;
+}
+
+static void poison(const struct wfPool *pool, void *obj) {
+  memset((char *)obj + sizeof(void *), WF_POOL_FREED, pool->stride - sizeof(void *));
+}
+
+/* an object that's about to be handed out: it should still look freed,
+ * otherwise someone wrote to it after freeing it */
+static void *handOut(const struct wfPool *pool, void *obj) {
+  if (pool->poison) {
+    assert(isPoisoned(pool, obj) && "pool object was written to after it was freed");
+    memset(obj, WF_POOL_FRESH, pool->stride);
+  }
+
+  return obj;
+}
+
+/* objects that are only as big as the link can't be checked for being
+ * freed twice */
+static void *takeBack(const struct wfPool *pool, void *obj) {
+  if (pool->poison) {
+    assert((pool->stride == sizeof(void *) || !isPoisoned(pool, obj)) && "pool object was freed twice");
+    poison(pool, obj);
+  }
+
+  return obj;
+}
+
+void wfPoolCreate(struct wfPool *pool, size_t size, size_t align, enum wfMemTag tag) {
+  memset(pool, 0x0, sizeof(struct wfPool));
+  pthread_mutex_init(&pool->lock, NULL);
+
+  pool->size = size;
+  pool->align = align;
+  pool->tag = tag;
+  pool->poison = WF_POOL_POISON;
+}
+
+/* everything the pool ever handed out is gone, the pool is empty and can
+ * be used again */
+void wfPoolDestroy(struct wfPool *pool) {
+  pthread_mutex_lock(&pool->lock);
+
+  struct wfPoolChunk *chunk = pool->chunks;
+  while (chunk) {
+    struct wfPoolChunk *next = chunk->next;
+
+    wfMemTagFree(pool->tag, chunk->bytes);
+    zfree(chunk);
+
+    chunk = next;
+  }
+
+  pool->free = NULL;
+  pool->next = pool->end = NULL;
+  pool->chunks = NULL;
+  pool->live = pool->capacity = 0;
+
+  pthread_mutex_unlock(&pool->lock);
+}
+
+static void newChunk(struct wfPool *pool) {
+  assert(pool->align != 0 && (pool->align & (pool->align - 1)) == 0);
+
+  if (!pool->stride) {
+    const size_t size = (pool->size > sizeof(void *)) ? pool->size : sizeof(void *);
+    pool->stride = (size + pool->align - 1) & ~(pool->align - 1);
+  }
+
+  const size_t align = (pool->align > WF_CACHE_LINE) ? pool->align : WF_CACHE_LINE;
+  const size_t count = (WF_POOL_CHUNK / pool->stride > WF_POOL_MIN_OBJECTS) ? WF_POOL_CHUNK / pool->stride : WF_POOL_MIN_OBJECTS;
+  const size_t bytes = sizeof(struct wfPoolChunk) + align + count * pool->stride;
+
+  struct wfPoolChunk *chunk = zmalloc(bytes);
+  chunk->next = pool->chunks;
+  chunk->bytes = bytes;
+  pool->chunks = chunk;
+
+  const uintptr_t start = ((uintptr_t)(chunk + 1) + align - 1) & ~(uintptr_t)(align - 1);
+  pool->next = (char *)start;
+  pool->end = pool->next + count * pool->stride;
+  pool->capacity += count;
+
+  if (pool->poison) {
+    memset(pool->next, WF_POOL_FREED, count * pool->stride);
+  }
+
+  wfMemTagAlloc(pool->tag, bytes);
+}
+
+/* an object from the free list or the newest chunk, with the lock held */
+static void *take(struct wfPool *pool) {
+  void *obj = pool->free;
+
+  if (obj) {
+    pool->free = nextFree(obj);
+  } else {
+    if (pool->next == pool->end) newChunk(pool);
+
+    obj = pool->next;
+    pool->next += pool->stride;
+  }
+
+  ++pool->live;
+  return obj;
+}
+
+void *wfPoolAlloc(struct wfPool *pool) {
+  pthread_mutex_lock(&pool->lock);
+  void *obj = take(pool);
+  pthread_mutex_unlock(&pool->lock);
+
+  return handOut(pool, obj);
+}
+
+void wfPoolFree(struct wfPool *pool, void *obj) {
+  if (!obj) return;
+
+  takeBack(pool, obj);
+
+  pthread_mutex_lock(&pool->lock);
+  setNextFree(obj, pool->free);
+  pool->free = obj;
+  --pool->live;
+  pthread_mutex_unlock(&pool->lock);
+}
+
+void wfPoolCacheInit(struct wfPoolCache *cache, struct wfPool *pool) {
+  cache->pool = pool;
+  cache->free = NULL;
+  cache->count = 0;
+}
+
+/* gives count objects from the front of the cache back to the pool */
+static void giveBack(struct wfPoolCache *cache, size_t count) {
+  if (!count) return;
+
+  void *first = cache->free;
+  void *last = first;
+  for (size_t i = 1; i < count; ++i) last = nextFree(last);
+
+  cache->free = nextFree(last);
+  cache->count -= count;
+
+  struct wfPool *pool = cache->pool;
+
+  pthread_mutex_lock(&pool->lock);
+  setNextFree(last, pool->free);
+  pool->free = first;
+  pool->live -= count;
+  pthread_mutex_unlock(&pool->lock);
+}
+
+/* gives everything in the cache back, do this before the thread that owns
+ * it is done */
+void wfPoolCacheFlush(struct wfPoolCache *cache) {
+  giveBack(cache, cache->count);
+}
+
+void *wfPoolCacheAlloc(struct wfPoolCache *cache) {
+  if (!cache->free) {
+    struct wfPool *pool = cache->pool;
+
+    pthread_mutex_lock(&pool->lock);
+    for (int i = 0; i < WF_POOL_BATCH; ++i) {
+      void *obj = take(pool);
+      setNextFree(obj, cache->free);
+      cache->free = obj;
+    }
+    pthread_mutex_unlock(&pool->lock);
+
+    cache->count = WF_POOL_BATCH;
+  }
+
+  void *obj = cache->free;
+  cache->free = nextFree(obj);
+  --cache->count;
+
+  return handOut(cache->pool, obj);
+}
+
+void wfPoolCacheFree(struct wfPoolCache *cache, void *obj) {
+  if (!obj) return;
+
+  takeBack(cache->pool, obj);
+
+  setNextFree(obj, cache->free);
+  cache->free = obj;
+
+  if (++cache->count >= 2 * WF_POOL_BATCH) {
+    giveBack(cache, WF_POOL_BATCH);
+  }
+}
@@ -0,0 +1,124 @@
+/**
+ * This file is part of prototype.
+ *
+ * (c) 2014 Nicolas Hillegeer <nicolas@hillegeer.com>
+ *
+ * For the full copyright and license information, please view the LICENSE
+ * file that was distributed with the source code.
+ */
+
+#ifndef __pool_h__
+#define __pool_h__
+
+#include <stddef.h>
+#include <pthread.h>
+
+#include "arena.h"
+
+/**
+ * Pools of fixed-size objects, for things that get created and destroyed
+ * all the time (draw operations, render params, models).
+ *
+ * A pool gets its memory from zmalloc in big chunks that are aligned to a
+ * cache line, and hands out objects from them with the alignment they ask
+ * for. That's enough for the vec4's and mat4's in them, unlike zmalloc
+ * (which only guarantees 8 bytes). Freed objects go on an intrusive free
+ * list: the first bytes of a free object point to the next free object.
+ * Chunks are never given back until the pool is destroyed.
+ *
+ * The pool itself is protected by a mutex, so it can be used from any
+ * thread. Threads that allocate and free a lot can put a cache in front
+ * of it (struct wfPoolCache, one per thread): that only takes the lock to
+ * move a batch of objects at once.
+ *
+ * With poisoning on (the default in debug builds), freed objects get
+ * filled with WF_POOL_FREED and new objects with WF_POOL_FRESH, and an
+ * object that got written to after being freed is caught the next time it
+ * is handed out.
+ *
+ * Use WF_POOL_TYPE to get type-safe wrappers:
+ *
+ *   WF_POOL_TYPE(paramsPool, struct gfxRenderParams)
+ *
+ *   static struct wfPool gParams = WF_POOL_INITIALIZER(struct gfxRenderParams, WF_MEM_GFX);
+ *   struct gfxRenderParams *params = paramsPoolAlloc(&gParams);
+ *   paramsPoolFree(&gParams, params);
+ */
+
+#define WF_CACHE_LINE 64
+
+/* how many objects a chunk holds at least, and how many bytes it wants */
+#define WF_POOL_MIN_OBJECTS 16
+#define WF_POOL_CHUNK       (16 * 1024)
+
+/* how many objects a cache moves from and to its pool at once */
+#define WF_POOL_BATCH 32
+
+#define WF_POOL_FRESH 0xCD
+#define WF_POOL_FREED 0xDD
+
+#ifdef DEBUG
+#define WF_POOL_POISON 1
+#else
+#define WF_POOL_POISON 0
+#endif
+
+struct wfPoolChunk;
+
+struct wfPool {
+  pthread_mutex_t lock;
+
+  void *free;
+  char *next; /* the untouched part of the newest chunk */
+  char *end;
+  struct wfPoolChunk *chunks;
+
+  size_t size;
+  size_t align;
+  size_t stride;
+
+  size_t live;     /* objects handed out (also the ones in caches) */
+  size_t capacity; /* objects in all chunks */
+
+  enum wfMemTag tag;
+  int poison;
+};
+
+#define WF_POOL_INITIALIZER(type, memtag)                                 \
+  {                                                                       \
+    .lock = PTHREAD_MUTEX_INITIALIZER, .size = sizeof(type),              \
+    .align = _Alignof(type), .tag = (memtag), .poison = WF_POOL_POISON    \
+  }
+
+struct wfPoolCache {
+  struct wfPool *pool;
+  void *free;
+  size_t count;
+};
+
+void wfPoolCreate(struct wfPool *pool, size_t size, size_t align, enum wfMemTag tag);
+void wfPoolDestroy(struct wfPool *pool);
+
+void *wfPoolAlloc(struct wfPool *pool);
+void wfPoolFree(struct wfPool *pool, void *obj);
+
+void wfPoolCacheInit(struct wfPoolCache *cache, struct wfPool *pool);
+void wfPoolCacheFlush(struct wfPoolCache *cache);
+void *wfPoolCacheAlloc(struct wfPoolCache *cache);
+void wfPoolCacheFree(struct wfPoolCache *cache, void *obj);
+
+#define WF_POOL_TYPE(name, type)                                                    \
+  static inline type *name##Alloc(struct wfPool *pool) {                            \
+    return wfPoolAlloc(pool);                                                       \
+  }                                                                                 \
+  static inline void name##Free(struct wfPool *pool, type *obj) {                   \
+    wfPoolFree(pool, obj);                                                          \
+  }                                                                                 \
+  static inline type *name##CacheAlloc(struct wfPoolCache *cache) {                 \
+    return wfPoolCacheAlloc(cache);                                                 \
+  }                                                                                 \
+  static inline void name##CacheFree(struct wfPoolCache *cache, type *obj) {        \
+    wfPoolCacheFree(cache, obj);                                                    \
+  }
+
+#endif
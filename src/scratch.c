@@ -33,18 +33,14 @@ void gfxQuad(struct gfxModel *model) {
   //     0.5f, 0.5f, 0.0f, 1.0f
   // };
 
-  const GLfloat vertices[] = {
-    -0.7f, -0.7f, 0.0f, 1.0f,
-    -0.7f, 0.7f, 0.0f, 1.0f,
-    0.7f, -0.7f, 0.0f, 1.0f,
-    0.7f, 0.7f, 0.0f, 1.0f
-  };
-
-  const GLfloat texcoords[] = {
-    0, 0,
-    0, 1,
-    1, 0,
-    1, 1
+  static const struct {
+    float vertices[4];
+    float texcoords[2];
+  } staticData[] = {
+    { { -0.7f, -0.7f, 0.0f, 1.0f }, { 0, 0 } },
+    { { -0.7f,  0.7f, 0.0f, 1.0f }, { 0, 1 } },
+    { {  0.7f, -0.7f, 0.0f, 1.0f }, { 1, 0 } },
+    { {  0.7f,  0.7f, 0.0f, 1.0f }, { 1, 1 } }
   };
 
   const GLubyte indices[] = {
@@ -54,50 +50,30 @@ void gfxQuad(struct gfxModel *model) {
 
   /* clang-format on */
 
-  /* generate and bind VAO */
-  glGenVertexArrays(1, &(model->vao));
-  glBindVertexArray(model->vao);
-
-  GL_ERROR("create VAO");
-
-  /* generate all VBO's */
-  glGenBuffers(GFX_VBO_NUM, model->vbo);
-
-  /* send vertices to GPU */
-  glBindBuffer(GL_ARRAY_BUFFER, model->vbo[GFX_VBO_VERTEX]);
-  glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
-  glVertexAttribPointer(GFX_VERTEX, 4, GL_FLOAT, GL_FALSE, 0, 0);
-  glEnableVertexAttribArray(GFX_VERTEX);
-
-  /* send texcoords to GPU */
-  glBindBuffer(GL_ARRAY_BUFFER, model->vbo[GFX_VBO_TEXCOORD]);
-  glBufferData(GL_ARRAY_BUFFER, sizeof(texcoords), texcoords, GL_STATIC_DRAW);
-  glVertexAttribPointer(GFX_TEXCOORD, 2, GL_FLOAT, GL_FALSE, 0, 0);
-  glEnableVertexAttribArray(GFX_TEXCOORD);
+  struct gfxVertexFormat format;
+  memset(&format, 0x0, sizeof(format));
+  gfxVertexFormatAdd(&format, GFX_VERTEX, 4, GL_FLOAT, GL_FALSE);
+  gfxVertexFormatAdd(&format, GFX_TEXCOORD, 2, GL_FLOAT, GL_FALSE);
 
-  GL_ERROR("load model VBO's");
+  assert(format.stride == sizeof(staticData[0]));
 
-  /* send vertex indices to the GPU */
-  glGenBuffers(1, &model->ibo);
-  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, model->ibo);
-  glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(indices), indices, GL_STATIC_DRAW);
-
-  model->numIndices = ARRAY_SIZE(indices);
-
-  /* unbind to prevent modification */
-  glBindBuffer(GL_ARRAY_BUFFER, 0);
-  glBindVertexArray(0);
+  gfxModelUpload(model, &format, staticData, ARRAY_SIZE(staticData), indices, GL_UNSIGNED_BYTE, ARRAY_SIZE(indices));
+  gfxModelBounds(model, staticData[0].vertices, ARRAY_SIZE(staticData), sizeof(staticData[0]) / sizeof(float));
 }
 
-void gfxCube(struct gfxModel *model) {
+/* with a geometry, the cube gets added to it instead of getting its own
+ * buffers (unless it doesn't fit). The geometry has to be in the
+ * gfxCubeFormat() format. */
+void gfxCube(struct gfxModel *model, struct gfxGeometry *geometry) {
   memset(model, 0x0, sizeof(struct gfxModel));
 
   /* clang-format off */
 
-  static const struct {
+  /* not const, the optimizer reorders them */
+  struct {
     float vertices[4];
     float color[4];
-  } staticData[] = {
+  } data[] = {
     { { -.5f, -.5f,  .5f, 1 }, { 0, 0, 1, 1 } },
     { { -.5f,  .5f,  .5f, 1 }, { 1, 0, 0, 1 } },
     { {  .5f,  .5f,  .5f, 1 }, { 0, 1, 0, 1 } },
@@ -108,7 +84,7 @@ void gfxCube(struct gfxModel *model) {
     { {  .5f, -.5f, -.5f, 1 }, { 0, 0, 1, 1 } }
   };
 
-  const GLubyte indices[] = {
+  GLubyte indices[] = {
     0,2,1,  0,3,2,
     4,3,0,  4,7,3,
     4,1,5,  4,0,1,
@@ -119,42 +95,29 @@ void gfxCube(struct gfxModel *model) {
 
   /* clang-format on */
 
-  /* generate and bind VAO */
-  glGenVertexArrays(1, &(model->vao));
-  glBindVertexArray(model->vao);
+  gfxOptimizeMesh(data, sizeof(data[0]), ARRAY_SIZE(data), indices, GL_UNSIGNED_BYTE, ARRAY_SIZE(indices));
+  gfxModelBounds(model, data[0].vertices, ARRAY_SIZE(data), sizeof(data[0]) / sizeof(float));
 
-  GL_ERROR("create VAO");
-
-  /* generate all VBO's */
-  glGenBuffers(GFX_VBO_NUM, model->vbo);
-
-  /* send vertices to GPU */
-  glBindBuffer(GL_ARRAY_BUFFER, model->vbo[GFX_VBO_VERTEX]);
-  glBufferData(GL_ARRAY_BUFFER, sizeof(staticData), staticData, GL_STATIC_DRAW);
-  // glVertexAttribPointer(GFX_VERTEX, 4, GL_FLOAT, GL_FALSE, 0, 0);
-  glVertexAttribPointer(GFX_VERTEX, 4, GL_FLOAT, GL_FALSE, sizeof(staticData[0]), (GLvoid *)0);
-  glVertexAttribPointer(GFX_COLOR, 4, GL_FLOAT, GL_FALSE, sizeof(staticData[0]), (GLvoid *)sizeof(staticData[0].vertices));
-  glEnableVertexAttribArray(GFX_VERTEX);
-  glEnableVertexAttribArray(GFX_COLOR);
+  if (geometry) {
+    if (gfxGeometryAdd(geometry, model, data, ARRAY_SIZE(data), indices, GL_UNSIGNED_BYTE, ARRAY_SIZE(indices))) {
+      return;
+    }
 
-  /* colors */
-  // glBindBuffer(GL_ARRAY_BUFFER, model->vbo[GFX_VBO_COLOR]);
-  // glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
-  // glVertexAttribPointer(GFX_COLOR, 4, GL_FLOAT, GL_FALSE, 0, 0);
-  // glEnableVertexAttribArray(GFX_COLOR);
+    trace("[WARNING] geometry %u has no room, the model gets its own buffers\n", geometry->vao);
+  }
 
-  GL_ERROR("load model VBO's");
+  struct gfxVertexFormat format;
+  gfxCubeFormat(&format);
 
-  /* send vertex indices to the GPU */
-  glGenBuffers(1, &model->ibo);
-  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, model->ibo);
-  glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(indices), indices, GL_STATIC_DRAW);
+  gfxModelUpload(model, &format, data, ARRAY_SIZE(data), indices, GL_UNSIGNED_BYTE, ARRAY_SIZE(indices));
+}
 
-  model->numIndices = ARRAY_SIZE(indices);
+/* interleaved position and color, like the cube */
+void gfxCubeFormat(struct gfxVertexFormat *format) {
+  memset(format, 0x0, sizeof(struct gfxVertexFormat));
 
-  /* unbind to prevent modification */
-  glBindBuffer(GL_ARRAY_BUFFER, 0);
-  glBindVertexArray(0);
+  gfxVertexFormatAdd(format, GFX_VERTEX, 4, GL_FLOAT, GL_FALSE);
+  gfxVertexFormatAdd(format, GFX_COLOR, 4, GL_FLOAT, GL_FALSE);
 }
 
 void gfxCrystal(struct gfxModel *model) {
@@ -231,58 +194,28 @@ void gfxCrystal(struct gfxModel *model) {
 
   /* clang-format on */
 
-  /* generate and bind VAO */
-  glGenVertexArrays(1, &(model->vao));
-  glBindVertexArray(model->vao);
-
-  GL_ERROR("create VAO");
-
-  /* generate all VBO's */
-  glGenBuffers(GFX_VBO_NUM, model->vbo);
-
-  /* send vertices to GPU */
-  glBindBuffer(GL_ARRAY_BUFFER, model->vbo[GFX_VBO_VERTEX]);
-  glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
-  glVertexAttribPointer(GFX_VERTEX, 4, GL_FLOAT, GL_FALSE, 0, 0);
-  glEnableVertexAttribArray(GFX_VERTEX);
-
-  /* send normals to GPU */
-  glBindBuffer(GL_ARRAY_BUFFER, model->vbo[GFX_VBO_NORMAL]);
-  glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
-  glVertexAttribPointer(GFX_NORMAL, 4, GL_FLOAT, GL_FALSE, 0, 0);
-  glEnableVertexAttribArray(GFX_NORMAL);
-
-  /* send texcoords to GPU */
-  glBindBuffer(GL_ARRAY_BUFFER, model->vbo[GFX_VBO_TEXCOORD]);
-  glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
-  glVertexAttribPointer(GFX_TEXCOORD, 4, GL_FLOAT, GL_FALSE, 0, 0);
-  glEnableVertexAttribArray(GFX_TEXCOORD);
-
-  /* send colors to GPU */
-  glBindBuffer(GL_ARRAY_BUFFER, model->vbo[GFX_VBO_COLOR]);
-  glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
-  glVertexAttribPointer(GFX_COLOR, 4, GL_FLOAT, GL_FALSE, 0, 0);
-  glEnableVertexAttribArray(GFX_COLOR);
-
-  GL_ERROR("load model VBO's");
-
-  /* send vertex indices to the GPU */
-  glGenBuffers(1, &model->ibo);
-  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, model->ibo);
-  glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(indices), indices, GL_STATIC_DRAW);
-
-  model->numIndices = ARRAY_SIZE(indices);
+  /* the position doubles as normal, texcoord and color */
+  const struct gfxVertexFormat format = {
+    .stride = 4 * sizeof(GLfloat),
+    .numAttribs = 4,
+    .attribs = {
+      {GFX_VERTEX, 4, GL_FLOAT, GL_FALSE, 0},
+      {GFX_NORMAL, 4, GL_FLOAT, GL_FALSE, 0},
+      {GFX_TEXCOORD, 4, GL_FLOAT, GL_FALSE, 0},
+      {GFX_COLOR, 4, GL_FLOAT, GL_FALSE, 0},
+    },
+  };
 
-  /* unbind to prevent modification */
-  glBindBuffer(GL_ARRAY_BUFFER, 0);
-  glBindVertexArray(0);
+  gfxModelUpload(model, &format, vertices, ARRAY_SIZE(vertices) / 4, indices, GL_UNSIGNED_BYTE, ARRAY_SIZE(indices));
+  gfxModelBounds(model, vertices, ARRAY_SIZE(vertices) / 4, 4);
 }
 
 #define AXIS_WIDTH      0.1f
 #define AXIS_HALF_WIDTH (AXIS_WIDTH * 0.5f)
 #define AXIS_LENGTH     0.8f
 
-void gfxAxis(struct gfxModel *model) {
+/* same as gfxCube, the geometry is optional */
+void gfxAxis(struct gfxModel *model, struct gfxGeometry *geometry) {
   memset(model, 0x0, sizeof(struct gfxModel));
 
   /* clang-format off */
@@ -329,35 +262,20 @@ void gfxAxis(struct gfxModel *model) {
 
   /* clang-format on */
 
-  /* generate and bind VAO */
-  glGenVertexArrays(1, &(model->vao));
-  glBindVertexArray(model->vao);
+  gfxModelBounds(model, staticData[0].vertices, ARRAY_SIZE(staticData), sizeof(staticData[0]) / sizeof(float));
 
-  GL_ERROR("create VAO");
-
-  /* generate all VBO's */
-  glGenBuffers(GFX_VBO_NUM, model->vbo);
-
-  /* send vertices to GPU */
-  glBindBuffer(GL_ARRAY_BUFFER, model->vbo[GFX_VBO_VERTEX]);
-  glBufferData(GL_ARRAY_BUFFER, sizeof(staticData), staticData, GL_STATIC_DRAW);
-  glVertexAttribPointer(GFX_VERTEX, 4, GL_FLOAT, GL_FALSE, sizeof(staticData[0]), (GLvoid *)0);
-  glVertexAttribPointer(GFX_COLOR, 4, GL_FLOAT, GL_FALSE, sizeof(staticData[0]), (GLvoid *)sizeof(staticData[0].vertices));
-  glEnableVertexAttribArray(GFX_VERTEX);
-  glEnableVertexAttribArray(GFX_COLOR);
-
-  GL_ERROR("load model VBO's");
+  if (geometry) {
+    if (gfxGeometryAdd(geometry, model, staticData, ARRAY_SIZE(staticData), indices, GL_UNSIGNED_BYTE, ARRAY_SIZE(indices))) {
+      return;
+    }
 
-  /* send vertex indices to the GPU */
-  glGenBuffers(1, &model->ibo);
-  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, model->ibo);
-  glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(indices), indices, GL_STATIC_DRAW);
+    trace("[WARNING] geometry %u has no room, the model gets its own buffers\n", geometry->vao);
+  }
 
-  model->numIndices = ARRAY_SIZE(indices);
+  struct gfxVertexFormat format;
+  gfxCubeFormat(&format);
 
-  /* unbind to prevent modification */
-  glBindBuffer(GL_ARRAY_BUFFER, 0);
-  glBindVertexArray(0);
+  gfxModelUpload(model, &format, staticData, ARRAY_SIZE(staticData), indices, GL_UNSIGNED_BYTE, ARRAY_SIZE(indices));
 }
 
 /**
@@ -381,13 +299,20 @@ void gfxAxis(struct gfxModel *model) {
 void gfxSheet(struct gfxModel *model, float width, float height, unsigned int subdiv) {
   memset(model, 0x0, sizeof(struct gfxModel));
 
-  /* vertex * number of vertices */
+  /* vertex * number of vertices, only xyz: the wave shader makes its own
+   * w (and y, for that matter) */
   const size_t nverts = (subdiv + 1) * (subdiv + 1);
-  const size_t vsize = (sizeof(GLfloat) * 4) * nverts;
-  GLfloat *vertices = zmalloc(vsize);
+  const size_t vsize = (sizeof(GLfloat) * 3) * nverts;
+
+  /* only needed until the upload, so it comes from the scratch arena */
+  struct wfArena *scratch = wfScratch();
+  struct wfArenaMarker marker;
+  wfArenaMark(scratch, &marker);
+
+  GLfloat *vertices = wfArenaAlloc(scratch, vsize);
   GLfloat *vertex = vertices;
 
-  const GLubyte stride = (GLubyte)(subdiv + 1);
+  const GLuint stride = subdiv + 1;
 
   const float startx = 0.0f;
   const float starty = 0.0f;
@@ -403,19 +328,19 @@ void gfxSheet(struct gfxModel *model, float width, float height, unsigned int su
       vertex[0] = startx + (float)i * tileWidth;
       vertex[1] = starty;                         // + (i * tileWidth - j * tileHeight);
       vertex[2] = startz - (float)j * tileHeight; //startz;
-      vertex[3] = 1.0f;
 
-      // trace("generated vertex %d: [%3.2f %3.2f %3.2f %3.2f]\n", counter, vertex[0], vertex[1], vertex[2], vertex[3]);
+      // trace("generated vertex %d: [%3.2f %3.2f %3.2f]\n", counter, vertex[0], vertex[1], vertex[2]);
       ++counter;
 
-      vertex += 4;
+      vertex += 3;
     }
   }
 
-  /* triangle * number of triangles  */
-  const size_t isize = (sizeof(GLubyte) * 3) * (subdiv * subdiv * 2);
-  GLubyte *indices = zmalloc(isize);
-  GLubyte *index = indices;
+  /* triangle * number of triangles, generated as GLuint's and narrowed to
+   * the smallest type that fits afterwards */
+  const size_t nindices = 3 * (size_t)(subdiv * subdiv * 2);
+  GLuint *indices = wfArenaAlloc(scratch, sizeof(GLuint) * nindices);
+  GLuint *index = indices;
 
   counter = 0;
 
@@ -433,19 +358,19 @@ void gfxSheet(struct gfxModel *model, float width, float height, unsigned int su
        * upper-left  = offset + 1
        * upper-right = offset + stride + 1
        */
-      const GLubyte offset = (GLubyte)(i * stride + j);
+      const GLuint offset = (GLuint)i * stride + (GLuint)j;
 
       /* first triangle */
-      index[0] = (GLubyte)(offset);
-      index[1] = (GLubyte)(offset + 1);
-      index[2] = (GLubyte)(offset + stride);
+      index[0] = offset;
+      index[1] = offset + 1;
+      index[2] = offset + stride;
 
       index += 3;
 
       /* second triangle */
-      index[0] = (GLubyte)(offset + 1);
-      index[1] = (GLubyte)(offset + stride + 1);
-      index[2] = (GLubyte)(offset + stride);
+      index[0] = offset + 1;
+      index[1] = offset + stride + 1;
+      index[2] = offset + stride;
 
       index += 3;
 
@@ -456,35 +381,21 @@ void gfxSheet(struct gfxModel *model, float width, float height, unsigned int su
     /* insert degenerate triangle, only when generating triangle strips */
   }
 
-  /* generate and bind VAO */
-  glGenVertexArrays(1, &(model->vao));
-  glBindVertexArray(model->vao);
-
-  GL_ERROR("create VAO");
-
-  /* generate all VBO's */
-  glGenBuffers(GFX_VBO_NUM, model->vbo);
+  gfxOptimizeMesh(vertices, 3 * sizeof(GLfloat), nverts, indices, GL_UNSIGNED_INT, nindices);
 
-  /* send vertices to GPU */
-  glBindBuffer(GL_ARRAY_BUFFER, model->vbo[GFX_VBO_VERTEX]);
-  glBufferData(GL_ARRAY_BUFFER, (GLsizeiptr)vsize, vertices, GL_STATIC_DRAW);
-  glVertexAttribPointer(GFX_VERTEX, 4, GL_FLOAT, GL_FALSE, 0, 0);
-  glEnableVertexAttribArray(GFX_VERTEX);
+  const GLenum indexType = gfxIndexType(nverts);
+  const size_t isize = gfxIndexSize(indexType) * nindices;
 
-  GL_ERROR("load model VBO's");
+  gfxConvertIndices(indices, indexType, indices, GL_UNSIGNED_INT, nindices);
 
-  /* send vertex indices to the GPU */
-  glGenBuffers(1, &model->ibo);
-  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, model->ibo);
-  glBufferData(GL_ELEMENT_ARRAY_BUFFER, (GLsizeiptr)isize, indices, GL_STATIC_DRAW);
+  struct gfxVertexFormat format;
+  memset(&format, 0x0, sizeof(format));
+  gfxVertexFormatAdd(&format, GFX_VERTEX, 3, GL_FLOAT, GL_FALSE);
 
-  trace("loaded %lu indices (%lu bytes) and %lu vertices (%lu bytes). (%lu bytes total)\n", isize, isize, nverts, vsize, isize + vsize);
-  model->numIndices = (int)isize;
+  gfxModelUpload(model, &format, vertices, nverts, indices, indexType, nindices);
+  gfxModelBounds(model, vertices, nverts, 3);
 
-  /* unbind to prevent modification */
-  glBindBuffer(GL_ARRAY_BUFFER, 0);
-  glBindVertexArray(0);
+  trace("loaded %zu indices (%zu bytes) and %zu vertices (%zu bytes). (%zu bytes total)\n", nindices, isize, nverts, vsize, isize + vsize);
 
-  zfree(vertices);
-  zfree(indices);
+  wfArenaRewind(scratch, &marker);
 }
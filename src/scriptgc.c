@@ -0,0 +1,83 @@
+/**
+ * This file is part of prototype.
+ *
+ * (c) 2014 Nicolas Hillegeer <nicolas@hillegeer.com>
+ *
+ * For the full copyright and license information, please view the LICENSE
+ * file that was distributed with the source code.
+ *
+ * The frame-budgeted Lua collector (see scriptgc.h). LUA_GCSTEP sets the
+ * collector's threshold again, which would turn the automatic collector
+ * back on, so it gets stopped again after every frame.
+ *
+ * Doesn't touch GL.
+ */
+
+#include <lua.h>
+
+#include "util.h"
+
+static unsigned int elapsedUs(uint64_t since) {
+  return (unsigned int)((SDL_GetPerformanceCounter() - since) * 1000000 / SDL_GetPerformanceFrequency());
+}
+
+void wfScriptGcInit(struct wfScriptGc *gc, struct lua_State *lua, size_t allocated) {
+  memset(gc, 0x0, sizeof(struct wfScriptGc));
+
+  gc->lua = lua;
+  gc->allocated = allocated;
+  gc->cycleKb = lua_gc(lua, LUA_GCCOUNT, 0);
+  gc->stats.stepKb = WF_SCRIPT_GC_STEP_MIN;
+
+  lua_gc(lua, LUA_GCSTOP, 0);
+}
+
+/* follows the allocation rate, smoothed over a few frames */
+static unsigned int stepSize(struct wfScriptGc *gc, size_t allocated) {
+  const size_t allocKb = (allocated - gc->allocated) / 1024;
+  gc->allocated = allocated;
+
+  const unsigned int target = (unsigned int)MIN(MAX(allocKb / WF_SCRIPT_GC_SLICES, WF_SCRIPT_GC_STEP_MIN), WF_SCRIPT_GC_STEP_MAX);
+  unsigned int step = (3 * gc->stats.stepKb + target + 3) / 4;
+
+  if (lua_gc(gc->lua, LUA_GCCOUNT, 0) > 2 * gc->cycleKb) {
+    step *= 2;
+  }
+
+  return MIN(step, WF_SCRIPT_GC_STEP_MAX);
+}
+
+unsigned int wfScriptGcFrame(struct wfScriptGc *gc, unsigned int remainingUs, size_t allocated) {
+  struct wfScriptGcStats *stats = &gc->stats;
+  const uint64_t start = SDL_GetPerformanceCounter();
+
+  const unsigned int budget = MIN(MAX(remainingUs / WF_SCRIPT_GC_SHARE, WF_SCRIPT_GC_MIN_US), WF_SCRIPT_GC_MAX_US);
+  stats->stepKb = stepSize(gc, allocated);
+
+  unsigned int elapsed = 0;
+
+  do {
+    const uint64_t slice = SDL_GetPerformanceCounter();
+    const int finished = lua_gc(gc->lua, LUA_GCSTEP, (int)stats->stepKb);
+
+    gc->sliceUs = (3 * gc->sliceUs + elapsedUs(slice) + 3) / 4;
+    ++stats->steps;
+
+    /* starting the next cycle right away would only find what was
+     * allocated since */
+    if (finished) {
+      gc->cycleKb = lua_gc(gc->lua, LUA_GCCOUNT, 0);
+      ++stats->cycles;
+      break;
+    }
+
+    elapsed = elapsedUs(start);
+  } while (elapsed + gc->sliceUs <= budget);
+
+  lua_gc(gc->lua, LUA_GCSTOP, 0);
+
+  stats->frameUs = elapsedUs(start);
+  stats->totalUs += stats->frameUs;
+
+  return stats->frameUs;
+}
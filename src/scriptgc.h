@@ -0,0 +1,70 @@
+/**
+ * This file is part of prototype.
+ *
+ * (c) 2014 Nicolas Hillegeer <nicolas@hillegeer.com>
+ *
+ * For the full copyright and license information, please view the LICENSE
+ * file that was distributed with the source code.
+ */
+
+#ifndef __scriptgc_h__
+#define __scriptgc_h__
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Runs the Lua garbage collector on the engine's schedule instead of its
+ * own. Left alone, Lua collects whenever an allocation crosses its
+ * threshold, which can be in the middle of any frame, and a whole cycle
+ * at once can take milliseconds.
+ *
+ * wfScriptGcInit() stops the automatic collector. From then on
+ * wfScriptGcFrame() has to be called once per frame, with however much
+ * time the frame has left. It takes a share of that as its budget and
+ * steps the collector in small slices until the budget is used up (or the
+ * cycle is done), measuring every slice so it doesn't start one it has
+ * no time for. It always does at least one slice, so the collector keeps
+ * moving on frames that are already late.
+ *
+ * How much work a slice does follows how much Lua allocated in the last
+ * frame: the more garbage the scripts make, the bigger the steps. When
+ * the memory grows to more than twice what it was after the last cycle,
+ * the collector is falling behind and the step size doubles.
+ */
+
+#define WF_SCRIPT_GC_MIN_US   50   /* budget when the frame has no time left */
+#define WF_SCRIPT_GC_MAX_US   2000
+#define WF_SCRIPT_GC_SHARE    4    /* a quarter of the time that's left */
+#define WF_SCRIPT_GC_SLICES   4    /* slices to get through a frame's allocations */
+#define WF_SCRIPT_GC_STEP_MIN 4    /* kb */
+#define WF_SCRIPT_GC_STEP_MAX 1024
+
+struct lua_State;
+
+struct wfScriptGcStats {
+  unsigned int frameUs; /* spent collecting in the last frame */
+  unsigned int stepKb;
+  uint64_t totalUs;
+  size_t steps;
+  size_t cycles;
+};
+
+struct wfScriptGc {
+  struct lua_State *lua;
+
+  size_t allocated;     /* what Lua had allocated in total at the last frame */
+  int cycleKb;          /* memory after the last finished cycle */
+  unsigned int sliceUs; /* how long a slice takes, on average */
+
+  struct wfScriptGcStats stats;
+};
+
+/* allocated is the number of bytes Lua allocated since it started (it
+ * only goes up), 0 if it's not known */
+void wfScriptGcInit(struct wfScriptGc *gc, struct lua_State *lua, size_t allocated);
+
+/* returns the time it took */
+unsigned int wfScriptGcFrame(struct wfScriptGc *gc, unsigned int remainingUs, size_t allocated);
+
+#endif
@@ -13,12 +13,35 @@
 
 #include "util.h"
 
+/* how much memory Lua gets, unless wfScriptSetBudget() says otherwise */
+#ifndef WF_SCRIPT_BUDGET
+#define WF_SCRIPT_BUDGET (64 * 1024 * 1024)
+#endif
+
 lua_State *gLua;
 
+static struct wfScriptHeap gHeap;
+static struct wfScriptGc gGc;
+
 static void wfScriptLoadLibraries(lua_State *lua);
 
+/* luaL_newstate() sets one of these up as well */
+static int wfScriptPanic(lua_State *lua) {
+  trace("[ERROR] unprotected error in call to Lua API (%s)\n", lua_tostring(lua, -1));
+  return 0;
+}
+
 void wfScriptInit(void) {
-  gLua = luaL_newstate();
+  wfScriptHeapCreate(&gHeap, WF_SCRIPT_BUDGET);
+
+  /* a 64-bit LuaJIT without GC64 only runs on its own allocator */
+  gLua = lua_newstate(wfScriptHeapAlloc, &gHeap);
+  if (gLua == NULL) {
+    trace("[WARNING] lua refused the engine allocator, its memory won't be pooled or budgeted\n");
+    gLua = luaL_newstate();
+  } else {
+    lua_atpanic(gLua, wfScriptPanic);
+  }
 
   ERROR_EXIT(gLua == NULL, 0, "could not initialize the lua interpreter");
 
@@ -35,6 +58,9 @@ void wfScriptInit(void) {
 
   trace("initialization script ran, memory usage: %d kb\n", wfScriptMemUsed());
 
+  /* from now on the collector only runs when wfScriptCollect() says so */
+  wfScriptGcInit(&gGc, gLua, gHeap.stats.allocated);
+
   return;
 error:
   /* pop error message from the stack */
@@ -49,7 +75,30 @@ error:
 void wfScriptDestroy(void) {
   if (gLua) {
     lua_close(gLua);
+    gLua = NULL;
   }
+
+  wfScriptHeapDestroy(&gHeap);
+}
+
+/* 0 takes the limit away. Lowering it under what Lua already uses doesn't
+ * free anything, the next allocations will just fail until the collector
+ * has made enough room. */
+void wfScriptSetBudget(size_t bytes) {
+  gHeap.stats.budget = bytes;
+}
+
+void wfScriptGetMemStats(struct wfScriptMemStats *stats) {
+  *stats = gHeap.stats;
+}
+
+/* call once per frame, with the time the frame has left */
+unsigned int wfScriptCollect(unsigned int remainingUs) {
+  return wfScriptGcFrame(&gGc, remainingUs, gHeap.stats.allocated);
+}
+
+void wfScriptGetGcStats(struct wfScriptGcStats *stats) {
+  *stats = gGc.stats;
 }
 
 static void wfScriptLoadLibraries(lua_State *lua) {
@@ -0,0 +1,130 @@
+/**
+ * This file is part of prototype.
+ *
+ * (c) 2014 Nicolas Hillegeer <nicolas@hillegeer.com>
+ *
+ * For the full copyright and license information, please view the LICENSE
+ * file that was distributed with the source code.
+ *
+ * The allocator of the Lua state (see scriptmem.h). The size classes go up
+ * in steps of 16 bytes to 128, then 32 to 256 and 64 to 512, so a small
+ * allocation wastes at most a fifth of what it gets. Lua always tells how
+ * big the block it frees or reallocates was, that's enough to find its
+ * pool again without a header in front of it.
+ *
+ * Lua can't handle an allocation that fails while it's collecting or
+ * raising the error for the one that went over the budget (it panics), so
+ * once an allocation got refused, the heap lets Lua go WF_SCRIPT_RESERVE
+ * bytes over the budget, until it's back under it.
+ *
+ * Doesn't touch GL.
+ */
+
+#include <assert.h>
+#include <string.h>
+
+#include "scriptmem.h"
+#include "zmalloc.h"
+
+static const size_t gClassSizes[WF_SCRIPT_CLASSES] = {
+  16, 32, 48, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320, 384, 448, 512
+};
+
+/* -1 for allocations that don't come from a pool */
+static int sizeClass(const struct wfScriptHeap *heap, size_t size) {
+  return (size <= WF_SCRIPT_SMALL) ? heap->classes[(size + 15) / 16] : -1;
+}
+
+void wfScriptHeapCreate(struct wfScriptHeap *heap, size_t budget) {
+  memset(heap, 0x0, sizeof(struct wfScriptHeap));
+
+  for (int i = 0; i < WF_SCRIPT_CLASSES; ++i) {
+    wfPoolCreate(&heap->pools[i], gClassSizes[i], 16, WF_MEM_SCRIPT);
+    wfPoolCacheInit(&heap->caches[i], &heap->pools[i]);
+  }
+
+  int cls = 0;
+  for (size_t i = 0; i <= WF_SCRIPT_SMALL / 16; ++i) {
+    while (gClassSizes[cls] < i * 16) ++cls;
+    heap->classes[i] = (unsigned char)cls;
+  }
+
+  heap->stats.budget = budget;
+}
+
+/* the Lua state has to be closed already */
+void wfScriptHeapDestroy(struct wfScriptHeap *heap) {
+  for (int i = 0; i < WF_SCRIPT_CLASSES; ++i) {
+    wfPoolCacheFlush(&heap->caches[i]);
+    wfPoolDestroy(&heap->pools[i]);
+  }
+}
+
+static void *take(struct wfScriptHeap *heap, size_t size) {
+  const int cls = sizeClass(heap, size);
+  return (cls >= 0) ? wfPoolCacheAlloc(&heap->caches[cls]) : wfTagMalloc(WF_MEM_SCRIPT, size);
+}
+
+static void release(struct wfScriptHeap *heap, void *ptr, size_t size) {
+  const int cls = sizeClass(heap, size);
+
+  if (cls >= 0) {
+    wfPoolCacheFree(&heap->caches[cls], ptr);
+  } else {
+    wfTagFree(WF_MEM_SCRIPT, ptr);
+  }
+}
+
+void *wfScriptHeapAlloc(void *ud, void *ptr, size_t osize, size_t nsize) {
+  struct wfScriptHeap *heap = ud;
+  struct wfScriptMemStats *stats = &heap->stats;
+
+  /* for a new block, osize is not a size */
+  if (!ptr) osize = 0;
+
+  if (nsize == 0) {
+    if (ptr) release(heap, ptr, osize);
+    stats->used -= osize;
+
+    if (heap->overdrawn && stats->used < stats->budget) heap->overdrawn = 0;
+
+    return NULL;
+  }
+
+  if (nsize > osize) {
+    const size_t limit = stats->budget + (heap->overdrawn ? WF_SCRIPT_RESERVE : 0);
+
+    if (stats->budget && stats->used + (nsize - osize) > limit) {
+      ++stats->rejected;
+      heap->overdrawn = 1;
+      return NULL;
+    }
+
+    stats->allocated += nsize - osize;
+  }
+
+  const int ocls = ptr ? sizeClass(heap, osize) : -2;
+  const int ncls = sizeClass(heap, nsize);
+  void *obj;
+
+  if (ocls == ncls && ncls >= 0) {
+    /* still fits in the same class */
+    obj = ptr;
+  } else if (ocls == -1 && ncls == -1) {
+    obj = wfTagRealloc(WF_MEM_SCRIPT, ptr, nsize);
+  } else {
+    obj = take(heap, nsize);
+
+    if (ptr) {
+      memcpy(obj, ptr, (osize < nsize) ? osize : nsize);
+      release(heap, ptr, osize);
+    }
+  }
+
+  if (!ptr) ++stats->allocs;
+
+  stats->used += nsize - osize;
+  if (stats->used > stats->peak) stats->peak = stats->used;
+
+  return obj;
+}
@@ -0,0 +1,68 @@
+/**
+ * This file is part of prototype.
+ *
+ * (c) 2014 Nicolas Hillegeer <nicolas@hillegeer.com>
+ *
+ * For the full copyright and license information, please view the LICENSE
+ * file that was distributed with the source code.
+ */
+
+#ifndef __scriptmem_h__
+#define __scriptmem_h__
+
+#include <stddef.h>
+
+#include "pool.h"
+
+/**
+ * The memory of the Lua state, which gets it through wfScriptHeapAlloc()
+ * (a lua_Alloc) instead of from the libc heap.
+ *
+ * Lua allocates lots of small objects (strings, tables, closures, upvalues)
+ * and frees them again on every collection, so everything up to
+ * WF_SCRIPT_SMALL bytes comes from a pool per size class, which keeps them
+ * out of the main heap. Bigger allocations (arrays and hash parts of
+ * tables, long strings) go to zmalloc. Everything is counted under the
+ * WF_MEM_SCRIPT tag.
+ *
+ * The heap has a budget: an allocation (or a realloc that grows) that
+ * would take Lua over it fails, which Lua reports as a "not enough memory"
+ * error in the script that tried. Shrinking and freeing always work, as
+ * Lua expects.
+ *
+ * Lua runs on a single thread, so the heap takes no locks: it allocates
+ * through a cache in front of every pool.
+ */
+
+/* allocations up to this size come from the pools */
+#define WF_SCRIPT_SMALL   512
+#define WF_SCRIPT_CLASSES 16
+
+/* how far Lua can go over the budget to clean up after going over it */
+#define WF_SCRIPT_RESERVE (64 * 1024)
+
+struct wfScriptMemStats {
+  size_t used;      /* bytes Lua asked for and hasn't given back yet */
+  size_t peak;
+  size_t budget;    /* 0 is no limit */
+  size_t allocated; /* bytes Lua asked for since the start, only goes up */
+  size_t allocs;
+  size_t rejected;  /* allocations that would have gone over the budget */
+};
+
+struct wfScriptHeap {
+  struct wfPool pools[WF_SCRIPT_CLASSES];
+  struct wfPoolCache caches[WF_SCRIPT_CLASSES];
+  unsigned char classes[WF_SCRIPT_SMALL / 16 + 1]; /* size class per 16 bytes */
+  int overdrawn;
+
+  struct wfScriptMemStats stats;
+};
+
+void wfScriptHeapCreate(struct wfScriptHeap *heap, size_t budget);
+void wfScriptHeapDestroy(struct wfScriptHeap *heap);
+
+/* a lua_Alloc, the user data is the heap */
+void *wfScriptHeapAlloc(void *ud, void *ptr, size_t osize, size_t nsize);
+
+#endif
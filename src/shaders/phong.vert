@@ -1,7 +1,22 @@
 #version 150
 
 in vec3 in_position;
+
+/* quantized meshes (see quantize.h) store their normals as an octahedron
+ * in 2 x snorm16, the vertex fetch hands us the [-1, 1] floats */
+#ifdef GFX_OCT_NORMALS
+in vec2 in_normal;
+
+vec3 octDecode(vec2 e) {
+    vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+    if (n.z < 0.0) {
+        n.xy = (1.0 - abs(n.yx)) * vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);
+    }
+    return normalize(n);
+}
+#else
 in vec3 in_normal;
+#endif
 
 vec3 lightPos = vec3(0.0, 1.0, -2.0);
 out vec3 normal;
@@ -10,6 +25,10 @@ out vec3 lightDir;
 void main() {
     vec4 worldPos = vec4(in_position, 1.0); gl_Position = worldPos;
 
+#ifdef GFX_OCT_NORMALS
+    normal   = octDecode(in_normal);
+#else
     normal   = normalize(in_normal);
+#endif
     lightDir = normalize(lightPos - worldPos.xyz);
-}
\ No newline at end of file
+}
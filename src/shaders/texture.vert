@@ -11,6 +11,7 @@
  * layout(location = 2) = texcoord
  * layout(location = 3) = color
  * layout(location = 4) = tangent
+ * layout(location = 5) = instance modelview matrix (GFX_INSTANCED, 5-8)
  */
 
 #version 150
@@ -28,7 +29,14 @@ layout(std140) uniform StaticMatrices {
 };
 
 /* uniforms */
-uniform mat4 modelviewMatrix;
+#ifdef GFX_INSTANCED
+layout(location = 5) in mat4 in_modelviewMatrix;
+#define modelviewMatrix in_modelviewMatrix
+#else
+layout(std140) uniform DrawMatrices {
+    mat4 modelviewMatrix;
+};
+#endif
 
 /* in */
 layout(location = 0) in vec3 in_position;
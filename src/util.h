@@ -31,9 +31,20 @@
 
 #include "SDL.h"
 #include "zmalloc.h"
+#include "arena.h"
+#include "pool.h"
+#include "scriptmem.h"
+#include "scriptgc.h"
 
 #include "drawlist.h"
 #include "gfx.h"
+#include "vcache.h"
+#include "mesh.h"
+#include "quantize.h"
+#include "cull.h"
+#include "bvh.h"
+#include "grid.h"
+#include "occlusion.h"
 
 #ifdef DEBUG
 #define DEBUG_TEST 1
@@ -134,6 +145,10 @@
 void wfScriptInit(void);
 void wfScriptDestroy(void);
 int wfScriptMemUsed(void);
+void wfScriptSetBudget(size_t bytes);
+void wfScriptGetMemStats(struct wfScriptMemStats *stats);
+unsigned int wfScriptCollect(unsigned int remainingUs);
+void wfScriptGetGcStats(struct wfScriptGcStats *stats);
 const char *wfScriptVersion(void);
 #endif
 
@@ -165,19 +180,77 @@ void gfxShaderPrintUboLayout(const struct gfxShaderProgram *shader, const char *
 void gfxSetShaderParams(
     const struct gfxShaderProgram *shader,
     const struct gfxLayer *layer,
-    const struct gfxRenderParams *params,
-    const struct gfxRenderParams *prev);
+    const struct gfxRenderParams *params);
+
+/* gfx/state.c */
+void gfxStateInvalidate();
+void gfxStateReset();
+void gfxStateGetStats(struct gfxStateStats *stats);
+int gfxStateValidate();
+
+void gfxStateUseProgram(GLuint program);
+void gfxStateBindVertexArray(GLuint vao);
+void gfxStateBindTexture(GLuint unit, GLuint texture);
+void gfxStateBlend(unsigned int blend);
+void gfxStateCull(unsigned int cull);
+void gfxStateDepthTest(int enable, GLenum func);
+void gfxStateDepthWrite(int enable);
+
+void gfxStateUniform1i(GLint loc, GLint value);
+void gfxStateUniform1f(GLint loc, GLfloat value);
+void gfxStateUniformMatrix4fv(GLint loc, const GLfloat *value);
+
+/* gfx/ring.c */
+void gfxRingInit(const struct gfxRenderer *renderer);
+void gfxRingDestroy();
+size_t gfxRingAligned(size_t size);
+void gfxRingBegin(size_t size);
+GLintptr gfxRingPush(const void *data, size_t size);
+void gfxRingEnd();
+void gfxRingBind(GLuint index, GLintptr offset, size_t size);
+void gfxRingGetStats(struct gfxRingStats *stats);
+
+/* gfx/geometry.c */
+void gfxCreateGeometry(struct gfxGeometry *geometry, const struct gfxVertexFormat *format, GLenum indexType,
+                       size_t vertexCapacity, size_t indexCapacity);
+void gfxDestroyGeometry(struct gfxGeometry *geometry);
+int gfxGeometryAdd(struct gfxGeometry *geometry, struct gfxModel *model,
+                   const void *vertices, size_t numVertices,
+                   const void *indices, GLenum indexType, size_t numIndices);
+void gfxGeometryRemove(struct gfxGeometry *geometry, struct gfxModel *model);
+void gfxGeometryDefrag(struct gfxGeometry *geometry);
 
 /* gfx/model.c */
 void gfxDestroyModel(struct gfxModel *model);
+void gfxModelBounds(struct gfxModel *model, const float *positions, size_t count, size_t stride);
+void gfxModelUpload(struct gfxModel *model, const struct gfxVertexFormat *format,
+                    const void *vertices, size_t numVertices,
+                    const void *indices, GLenum indexType, size_t numIndices);
+GLuint gfxVertexFormatAdd(struct gfxVertexFormat *format, GLuint index, GLint size, GLenum type, GLboolean normalized);
+GLenum gfxIndexType(size_t numVertices);
+size_t gfxIndexSize(GLenum type);
+void gfxConvertIndices(void *dst, GLenum dstType, const void *src, GLenum srcType, size_t count);
+void gfxOptimizeMesh(void *vertices, size_t stride, size_t numVertices, void *indices, GLenum indexType, size_t numIndices);
+int gfxUploadMesh(struct gfxModel *model, struct gfxGeometry *geometry, const struct gfxMesh *mesh);
+int gfxLoadMesh(struct gfxModel *model, struct gfxGeometry *geometry, const char *filename);
 
 /* gfx/renderer.c */
 void gfxCreateLayer(struct gfxLayer *layer);
 void gfxUploadLayer(const struct gfxLayer *layer);
+void gfxUpdateLayerFrustum(struct gfxLayer *layer, const mat4 *view);
 void gfxDestroyLayer(struct gfxLayer *layer);
 void gfxCreateRenderParams(struct gfxRenderParams *params);
 void gfxDestroyRenderParams(struct gfxRenderParams *params);
+struct gfxRenderParams *gfxNewRenderParams(void);
+void gfxDeleteRenderParams(struct gfxRenderParams *params);
+struct gfxModel *gfxNewModel(void);
+void gfxDeleteModel(struct gfxModel *model);
+struct gfxDrawOperation *gfxNewDrawOperation(void);
+void gfxDeleteDrawOperation(struct gfxDrawOperation *op);
+void gfxDestroyPools(void);
 void gfxBatch(const struct gfxLayer *layer);
+void gfxCmdClear(const struct gfxDrawOperation *op, void *userdata);
+void gfxCmdBindFramebuffer(const struct gfxDrawOperation *op, void *userdata);
 
 /* gfx/perf.c */
 void gfxGenQueries(struct gfxQuerySet *set);
@@ -190,9 +263,10 @@ uint64_t gfxPerfGetu64(struct gfxQuerySet *set, gfx_query_t type);
 
 /* scratch.c */
 void gfxQuad(struct gfxModel *model);
-void gfxCube(struct gfxModel *model);
+void gfxCube(struct gfxModel *model, struct gfxGeometry *geometry);
+void gfxCubeFormat(struct gfxVertexFormat *format);
 void gfxCrystal(struct gfxModel *model);
-void gfxAxis(struct gfxModel *model);
+void gfxAxis(struct gfxModel *model, struct gfxGeometry *geometry);
 void gfxSheet(struct gfxModel *model, float width, float height, unsigned int subdiv);
 
 #endif
@@ -0,0 +1,103 @@
+/**
+ * This file is part of prototype.
+ *
+ * (c) 2014 Nicolas Hillegeer <nicolas@hillegeer.com>
+ *
+ * For the full copyright and license information, please view the LICENSE
+ * file that was distributed with the source code.
+ */
+
+#ifndef __radix_sort_h__
+#define __radix_sort_h__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "macros.h"
+
+/* 8-bit digits, which means 8 passes for a 64-bit key in the worst case.
+ * 11-bit digits would get that down to 6 passes, but the histograms would
+ * no longer fit comfortably in L1, and in practice most of the high digits
+ * (layer, viewport, ...) are constant across the list so they get skipped
+ * anyway. */
+#define RADIX_BITS    8
+#define RADIX_BUCKETS (1 << RADIX_BITS)
+#define RADIX_MASK    (RADIX_BUCKETS - 1)
+#define RADIX_PASSES  ((int)(sizeof(uint64_t) * 8) / RADIX_BITS)
+
+/* read the key through memcpy, so we don't break strict aliasing. The
+ * compiler turns this into a plain load. */
+static inline ALWAYS_INLINE uint64_t radix_key(const unsigned char *element) {
+  uint64_t key;
+  memcpy(&key, element, sizeof(key));
+  return key;
+}
+
+/**
+ * stable LSD radix sort over n elements of `size` bytes, the first 8 bytes
+ * of every element being a native uint64_t sort key (e.g.: a struct that
+ * starts with a union gfxDrawlistKey). `scratch` must be able to hold n
+ * elements as well, the sorted result always ends up in `array`.
+ *
+ * Because this is always inlined, `size` is a compile-time constant at
+ * every call site and the memcpy's get turned into plain moves.
+ *
+ * All histograms are built in a single pass over the data. Afterwards we
+ * skip every pass for which all keys have the same digit, since that pass
+ * would just be a (very expensive) copy.
+ */
+static inline ALWAYS_INLINE void radix_sort_u64(void *restrict array, void *restrict scratch, size_t n, size_t size) {
+  if (n < 2) return;
+
+  uint32_t counts[RADIX_PASSES][RADIX_BUCKETS];
+  memset(counts, 0, sizeof(counts));
+
+  unsigned char *src = array;
+  unsigned char *dst = scratch;
+
+  for (size_t i = 0; i < n; ++i) {
+    const uint64_t key = radix_key(src + i * size);
+
+    for (int pass = 0; pass < RADIX_PASSES; ++pass) {
+      ++counts[pass][(key >> (pass * RADIX_BITS)) & RADIX_MASK];
+    }
+  }
+
+  const uint64_t first = radix_key(src);
+
+  for (int pass = 0; pass < RADIX_PASSES; ++pass) {
+    uint32_t *count = counts[pass];
+    const int shift = pass * RADIX_BITS;
+
+    /* every key has the same digit, nothing would move */
+    if (count[(first >> shift) & RADIX_MASK] == n) continue;
+
+    /* turn the histogram into starting offsets (exclusive prefix sum) */
+    uint32_t sum = 0;
+    for (int b = 0; b < RADIX_BUCKETS; ++b) {
+      const uint32_t c = count[b];
+      count[b] = sum;
+      sum += c;
+    }
+
+    /* scatter, walking the source in order is what keeps this stable */
+    for (size_t i = 0; i < n; ++i) {
+      const unsigned char *element = src + i * size;
+      const size_t digit = (size_t)((radix_key(element) >> shift) & RADIX_MASK);
+
+      memcpy(dst + (size_t)count[digit]++ * size, element, size);
+    }
+
+    unsigned char *tmp = src;
+    src = dst;
+    dst = tmp;
+  }
+
+  /* an odd number of passes left the result in the scratch buffer */
+  if (src != array) {
+    memcpy(array, src, n * size);
+  }
+}
+
+#endif
@@ -70,52 +70,164 @@ void zlibc_free(void *ptr) {
 #endif
 
 /**
+ * The statistics are sharded per thread: every thread that allocates gets
+ * a shard of its own (on its own cache line), which only it writes to, so
+ * allocating doesn't need a single atomic read-modify-write and threads
+ * don't fight over a shared counter. The shards only get added up when
+ * someone asks, see zmalloc_used_memory().
+ *
+ * When a thread exits, its shard gets folded into the retired totals and
+ * is free for the next thread. If there are more threads than shards, the
+ * rest share one last shard, with atomics. Before
+ * zmalloc_enable_thread_safeness() everything goes into that shared shard
+ * without atomics, like before.
+ *
+ * A shard counts what its thread allocated minus what it freed, which can
+ * go negative for a thread that frees what others allocated, that's why
+ * only the sum over all shards is the memory in use. A realloc counts as a
+ * free and an allocation.
+ *
  * updated the intrinsics to something more C11'ish
  * (new) http://gcc.gnu.org/onlinedocs/gcc-4.7.3/gcc/_005f_005fatomic-Builtins.html
  * (old) http://gcc.gnu.org/onlinedocs/gcc-4.4.6/gcc/Atomic-Builtins.html
  */
+#define ZMALLOC_SHARDS 64
+#define ZMALLOC_SHARED ZMALLOC_SHARDS
+
+typedef struct zmalloc_shard {
+    size_t used;
+    size_t peak;
+    size_t allocs;
+    size_t frees;
+    size_t histogram[ZMALLOC_HISTOGRAM_BUCKETS];
+    int in_use;
+} __attribute__((aligned(64))) zmalloc_shard;
+
+static zmalloc_shard shards[ZMALLOC_SHARDS + 1];
+static zmalloc_shard retired;
+static int zmalloc_thread_safe = 0;
+static pthread_mutex_t shards_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t shard_key;
+static pthread_once_t shard_once = PTHREAD_ONCE_INIT;
+
+/* the key is only there to retire the shard when the thread exits, looking
+ * it up on every allocation would cost more than the counting */
+static _Thread_local zmalloc_shard *thread_shard;
+
 #ifdef HAVE_ATOMIC
-#define update_zmalloc_stat_add(__n) __atomic_add_fetch(&used_memory, (__n), __ATOMIC_SEQ_CST)
-#define update_zmalloc_stat_sub(__n) __atomic_sub_fetch(&used_memory, (__n), __ATOMIC_SEQ_CST)
+#define zmalloc_load(__p) __atomic_load_n((__p), __ATOMIC_RELAXED)
+#define zmalloc_store(__p, __n) __atomic_store_n((__p), (__n), __ATOMIC_RELAXED)
+#define zmalloc_add(__p, __n) __atomic_add_fetch((__p), (__n), __ATOMIC_RELAXED)
 #else
-#define update_zmalloc_stat_add(__n) do { \
-    pthread_mutex_lock(&used_memory_mutex); \
-    used_memory += (__n); \
-    pthread_mutex_unlock(&used_memory_mutex); \
+#define zmalloc_load(__p) (*(volatile size_t *)(__p))
+#define zmalloc_store(__p, __n) (*(volatile size_t *)(__p) = (__n))
+#define zmalloc_add(__p, __n) do { \
+    pthread_mutex_lock(&shards_mutex); \
+    *(__p) += (__n); \
+    pthread_mutex_unlock(&shards_mutex); \
 } while(0)
+#endif
 
-#define update_zmalloc_stat_sub(__n) do { \
-    pthread_mutex_lock(&used_memory_mutex); \
-    used_memory -= (__n); \
-    pthread_mutex_unlock(&used_memory_mutex); \
-} while(0)
+/* allocations of up to 16 bytes go in the first bucket, up to 32 in the
+ * second and so on, the last bucket takes everything that's bigger */
+static int zmalloc_bucket(size_t size) {
+    if (size <= 16) return 0;
 
-#endif
+    const int bucket = (int)(sizeof(unsigned long) * 8) - __builtin_clzl((unsigned long)(size - 1)) - 4;
+    return (bucket < ZMALLOC_HISTOGRAM_BUCKETS - 1) ? bucket : ZMALLOC_HISTOGRAM_BUCKETS - 1;
+}
+
+/* the thread is going, what it allocated and freed stays counted. This
+ * runs on the thread itself, whatever it frees after this (in other
+ * destructors) goes to the shared shard, the retired one can already
+ * belong to a new thread by then. */
+static void zmalloc_retire_shard(void *arg) {
+    zmalloc_shard *shard = arg;
+
+    thread_shard = &shards[ZMALLOC_SHARED];
+
+    pthread_mutex_lock(&shards_mutex);
+    retired.used += shard->used;
+    retired.allocs += shard->allocs;
+    retired.frees += shard->frees;
+    for (int i = 0; i < ZMALLOC_HISTOGRAM_BUCKETS; ++i) {
+        retired.histogram[i] += shard->histogram[i];
+    }
+
+    memset(shard, 0, sizeof(zmalloc_shard));
+    pthread_mutex_unlock(&shards_mutex);
+}
+
+static void zmalloc_create_key(void) {
+    pthread_key_create(&shard_key, zmalloc_retire_shard);
+}
+
+static zmalloc_shard *zmalloc_claim_shard(void) {
+    zmalloc_shard *shard = &shards[ZMALLOC_SHARED];
+
+    pthread_once(&shard_once, zmalloc_create_key);
+
+    pthread_mutex_lock(&shards_mutex);
+    for (int i = 0; i < ZMALLOC_SHARDS; ++i) {
+        if (!shards[i].in_use) {
+            shard = &shards[i];
+            shard->in_use = 1;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&shards_mutex);
+
+    /* the shared shard doesn't get retired */
+    if (shard != &shards[ZMALLOC_SHARED]) {
+        pthread_setspecific(shard_key, shard);
+    }
+
+    return thread_shard = shard;
+}
+
+static zmalloc_shard *zmalloc_thread_shard(void) {
+    if (!zmalloc_thread_safe) return &shards[ZMALLOC_SHARED];
+
+    return thread_shard ? thread_shard : zmalloc_claim_shard();
+}
+
+static void zmalloc_stat_update(size_t n, int alloc) {
+    zmalloc_shard *shard = zmalloc_thread_shard();
+
+    if (zmalloc_thread_safe && shard == &shards[ZMALLOC_SHARED]) {
+        zmalloc_add(&shard->used, alloc ? n : -n);
+        zmalloc_add(alloc ? &shard->allocs : &shard->frees, 1);
+        if (alloc) zmalloc_add(&shard->histogram[zmalloc_bucket(n)], 1);
+        return;
+    }
+
+    /* only this thread writes to its shard, the stores just have to be
+     * atomic for whoever reads them */
+    if (alloc) {
+        const size_t used = shard->used + n;
+        const int bucket = zmalloc_bucket(n);
+        zmalloc_store(&shard->used, used);
+        zmalloc_store(&shard->allocs, shard->allocs + 1);
+        zmalloc_store(&shard->histogram[bucket], shard->histogram[bucket] + 1);
+        if ((ptrdiff_t)used > (ptrdiff_t)shard->peak) zmalloc_store(&shard->peak, used);
+    } else {
+        zmalloc_store(&shard->used, shard->used - n);
+        zmalloc_store(&shard->frees, shard->frees + 1);
+    }
+}
 
 #define update_zmalloc_stat_alloc(__n) do { \
     size_t _n = (__n); \
     if (_n&(sizeof(long)-1)) _n += sizeof(long)-(_n&(sizeof(long)-1)); \
-    if (zmalloc_thread_safe) { \
-        update_zmalloc_stat_add(_n); \
-    } else { \
-        used_memory += _n; \
-    } \
+    zmalloc_stat_update(_n, 1); \
 } while(0)
 
 #define update_zmalloc_stat_free(__n) do { \
     size_t _n = (__n); \
     if (_n&(sizeof(long)-1)) _n += sizeof(long)-(_n&(sizeof(long)-1)); \
-    if (zmalloc_thread_safe) { \
-        update_zmalloc_stat_sub(_n); \
-    } else { \
-        used_memory -= _n; \
-    } \
+    zmalloc_stat_update(_n, 0); \
 } while(0)
 
-static size_t used_memory = 0;
-static int zmalloc_thread_safe = 0;
-pthread_mutex_t used_memory_mutex = PTHREAD_MUTEX_INITIALIZER;
-
 static void zmalloc_default_oom(size_t size) {
     fprintf(stderr, "zmalloc: Out of memory trying to allocate %zu bytes\n",
         size);
@@ -222,25 +334,59 @@ char *zstrdup(const char *s) {
     return p;
 }
 
+/* adds up the shards, the result is exact if no other thread allocates
+ * or frees while it's adding */
 size_t zmalloc_used_memory(void) {
     size_t um;
 
-    if (zmalloc_thread_safe) {
-#ifdef HAVE_ATOMIC
-        um = __atomic_add_fetch(&used_memory, 0, __ATOMIC_SEQ_CST);
-#else
-        pthread_mutex_lock(&used_memory_mutex);
-        um = used_memory;
-        pthread_mutex_unlock(&used_memory_mutex);
-#endif
-    }
-    else {
-        um = used_memory;
+    pthread_mutex_lock(&shards_mutex);
+    um = retired.used;
+    for (int i = 0; i <= ZMALLOC_SHARDS; ++i) {
+        um += zmalloc_load(&shards[i].used);
     }
+    pthread_mutex_unlock(&shards_mutex);
 
     return um;
 }
 
+static void zmalloc_read_shard(const zmalloc_shard *shard, zmalloc_stats *stats) {
+    stats->used = (ptrdiff_t)zmalloc_load(&shard->used);
+    stats->peak = zmalloc_load(&shard->peak);
+    stats->allocs = zmalloc_load(&shard->allocs);
+    stats->frees = zmalloc_load(&shard->frees);
+    for (int i = 0; i < ZMALLOC_HISTOGRAM_BUCKETS; ++i) {
+        stats->histogram[i] = zmalloc_load(&shard->histogram[i]);
+    }
+}
+
+/* the statistics of the calling thread, or of all threads together when
+ * they share a shard */
+void zmalloc_get_thread_stats(zmalloc_stats *stats) {
+    zmalloc_read_shard(zmalloc_thread_shard(), stats);
+}
+
+/* the statistics of every thread that has allocated something and is
+ * still running (and of the shared shard, last, if it's been used), up to
+ * max of them. Returns how many there were. */
+size_t zmalloc_get_all_thread_stats(zmalloc_stats *stats, size_t max) {
+    size_t count = 0;
+
+    pthread_mutex_lock(&shards_mutex);
+    for (int i = 0; i <= ZMALLOC_SHARDS && count < max; ++i) {
+        const int used = (i == ZMALLOC_SHARED) ? zmalloc_load(&shards[i].allocs) != 0 : shards[i].in_use;
+        if (used) zmalloc_read_shard(&shards[i], &stats[count++]);
+    }
+    pthread_mutex_unlock(&shards_mutex);
+
+    return count;
+}
+
+/* the biggest allocation that goes in a bucket of the histogram, 0 for the
+ * last one, which has no limit */
+size_t zmalloc_histogram_limit(int bucket) {
+    return (bucket < ZMALLOC_HISTOGRAM_BUCKETS - 1) ? (size_t)16 << bucket : 0;
+}
+
 void zmalloc_enable_thread_safeness(void) {
     zmalloc_thread_safe = 1;
 }
@@ -31,6 +31,8 @@
 #ifndef __ZMALLOC_H
 #define __ZMALLOC_H
 
+#include <stddef.h>
+
 /* Double expansion needed for stringification of macro values. */
 #define __xstr(s) __str(s)
 #define __str(s) #s
@@ -65,12 +67,27 @@
 #define ZMALLOC_LIB "libc"
 #endif
 
+/* allocations are counted per size: up to 16 bytes, up to 32, ..., up to
+ * 256 KiB and bigger than that */
+#define ZMALLOC_HISTOGRAM_BUCKETS 16
+
+typedef struct zmalloc_stats {
+    ptrdiff_t used; /* allocated minus freed by this thread */
+    size_t peak;
+    size_t allocs;
+    size_t frees;
+    size_t histogram[ZMALLOC_HISTOGRAM_BUCKETS];
+} zmalloc_stats;
+
 void *zmalloc(size_t size);
 void *zcalloc(size_t size);
 void *zrealloc(void *ptr, size_t size);
 void zfree(void *ptr);
 char *zstrdup(const char *s);
 size_t zmalloc_used_memory(void);
+void zmalloc_get_thread_stats(zmalloc_stats *stats);
+size_t zmalloc_get_all_thread_stats(zmalloc_stats *stats, size_t max);
+size_t zmalloc_histogram_limit(int bucket);
 void zmalloc_enable_thread_safeness(void);
 void zmalloc_set_oom_handler(void (*oom_handler)(size_t));
 float zmalloc_get_fragmentation_ratio(void);
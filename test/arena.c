@@ -0,0 +1,226 @@
+/**
+ * This file is part of prototype.
+ *
+ * (c) 2014 Nicolas Hillegeer <nicolas@hillegeer.com>
+ *
+ * For the full copyright and license information, please view the LICENSE
+ * file that was distributed with the source code.
+ *
+ * Runs a few frames worth of allocations through an arena with small
+ * blocks: everything has to be aligned and not overlap, and once the
+ * biggest frame has been seen, resetting and rewinding must not allocate
+ * any new blocks. The memory tags have to add up, also when a bunch of
+ * threads allocate under the same tag at once. Doesn't need a GL context.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "util.h"
+
+#define TEST_NAME "arena"
+
+#define BLOCK       1024
+#define NUM_ALLOCS  256
+#define NUM_FRAMES  8
+#define NUM_THREADS 4
+#define NUM_TAGGED  10000
+
+struct allocation {
+    unsigned char *ptr;
+    size_t size;
+};
+
+static uint64_t xorshift(uint64_t *state) {
+    uint64_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    return *state = x;
+}
+
+/* fills every allocation with its own byte, if two of them overlap one of
+ * them won't have its byte anymore */
+static int checkAllocations(const struct allocation *allocs, size_t count) {
+    for (size_t i = 0; i < count; ++i) {
+        memset(allocs[i].ptr, (int) (i & 0xFF), allocs[i].size);
+    }
+
+    for (size_t i = 0; i < count; ++i) {
+        if ((uintptr_t) allocs[i].ptr % WF_ARENA_ALIGN) {
+            trace("allocation %zu at %p is not aligned\n", i, (void *) allocs[i].ptr);
+            return 1;
+        }
+
+        for (size_t b = 0; b < allocs[i].size; ++b) {
+            if (allocs[i].ptr[b] != (unsigned char) (i & 0xFF)) {
+                trace("allocation %zu of %zu bytes got overwritten\n", i, allocs[i].size);
+                return 1;
+            }
+        }
+    }
+
+    return 0;
+}
+
+/* a frame: mostly small allocations, now and then one that's bigger than
+ * a block */
+static int frame(struct wfArena *arena, struct allocation *allocs, uint64_t seed) {
+    uint64_t state = seed;
+
+    for (size_t i = 0; i < NUM_ALLOCS; ++i) {
+        const size_t size = (i % 64 == 63) ? BLOCK * 3 : 1 + (size_t) (xorshift(&state) % 200);
+        allocs[i].ptr = wfArenaAlloc(arena, size);
+        allocs[i].size = size;
+    }
+
+    return checkAllocations(allocs, NUM_ALLOCS);
+}
+
+static size_t tagUsed(enum wfMemTag tag) {
+    struct wfMemTagStats stats;
+    wfMemTagGetStats(tag, &stats);
+    return stats.used;
+}
+
+static void *tagged(void *arg) {
+    void **ptrs = arg;
+
+    for (int i = 0; i < NUM_TAGGED; ++i) {
+        ptrs[i] = wfTagMalloc(WF_MEM_SCRIPT, (size_t) (i % 100) + 1);
+    }
+
+    for (int i = 0; i < NUM_TAGGED; ++i) {
+        wfTagFree(WF_MEM_SCRIPT, ptrs[i]);
+    }
+
+    return NULL;
+}
+
+int main(int argc, char const *argv[]) {
+    trace("setting up test: " TEST_NAME "\n");
+
+    zmalloc_enable_thread_safeness();
+
+    static struct allocation allocs[NUM_ALLOCS];
+
+    struct wfArena arena;
+    wfArenaCreate(&arena, BLOCK, WF_MEM_FRAME);
+
+    trace("starting test: " TEST_NAME "\n");
+
+    int failed = 0;
+
+    /* the same frame over and over, after the first one the arena has all
+     * the blocks it needs */
+    failed |= frame(&arena, allocs, 42);
+    const size_t reserved = arena.reserved;
+    const size_t used = arena.used;
+
+    if (tagUsed(WF_MEM_FRAME) != reserved) {
+        trace("the frame tag says %zu bytes, the arena holds %zu\n", tagUsed(WF_MEM_FRAME), reserved);
+        failed = 1;
+    }
+
+    for (int f = 1; f < NUM_FRAMES; ++f) {
+        wfArenaReset(&arena);
+        failed |= frame(&arena, allocs, 42);
+
+        if (arena.reserved != reserved || arena.used != used) {
+            trace("frame %d: %zu bytes used in %zu reserved, the first frame used %zu in %zu\n",
+                f, arena.used, arena.reserved, used, reserved);
+            failed = 1;
+        }
+    }
+
+    if (arena.peak != used) {
+        trace("the peak should be %zu bytes, found %zu\n", used, arena.peak);
+        failed = 1;
+    }
+
+    /* a stack: whatever comes after the marker gets the same memory again
+     * after rewinding */
+    wfArenaReset(&arena);
+    void *bottom = wfArenaAlloc(&arena, 100);
+    struct wfArenaMarker marker;
+    wfArenaMark(&arena, &marker);
+
+    void *first = wfArenaAlloc(&arena, 500);
+    wfArenaAlloc(&arena, 600);
+    wfArenaAlloc(&arena, 600);
+    wfArenaRewind(&arena, &marker);
+    void *again = wfArenaAlloc(&arena, 500);
+
+    if (first != again || arena.reserved != reserved) {
+        trace("rewinding should hand out %p again without allocating, got %p\n", first, again);
+        failed = 1;
+    }
+
+    /* what came before the marker stays */
+    memset(bottom, 0xAB, 100);
+    wfArenaRewind(&arena, &marker);
+    memset(wfArenaAlloc(&arena, 500), 0xCD, 500);
+
+    if (((unsigned char *) bottom)[99] != 0xAB) {
+        trace("the allocation before the marker got overwritten\n");
+        failed = 1;
+    }
+
+    /* trimming gives back everything after the current block */
+    wfArenaReset(&arena);
+    wfArenaAlloc(&arena, 16);
+    wfArenaTrim(&arena);
+
+    if (arena.reserved >= reserved || tagUsed(WF_MEM_FRAME) != arena.reserved) {
+        trace("after trimming, %zu bytes are reserved (the tag says %zu)\n", arena.reserved, tagUsed(WF_MEM_FRAME));
+        failed = 1;
+    }
+
+    wfArenaDestroy(&arena);
+
+    if (tagUsed(WF_MEM_FRAME) != 0) {
+        trace("the arena is gone but the frame tag still has %zu bytes\n", tagUsed(WF_MEM_FRAME));
+        failed = 1;
+    }
+
+    /* single allocations under a tag, from a bunch of threads */
+    const size_t before = tagUsed(WF_MEM_SCRIPT);
+
+    pthread_t threads[NUM_THREADS];
+    void **ptrs = zmalloc(NUM_THREADS * NUM_TAGGED * sizeof(void *));
+
+    for (int t = 0; t < NUM_THREADS; ++t) {
+        pthread_create(&threads[t], NULL, tagged, ptrs + t * NUM_TAGGED);
+    }
+
+    for (int t = 0; t < NUM_THREADS; ++t) {
+        pthread_join(threads[t], NULL);
+    }
+
+    struct wfMemTagStats script;
+    wfMemTagGetStats(WF_MEM_SCRIPT, &script);
+
+    if (script.used != before || script.allocs < NUM_THREADS * NUM_TAGGED || script.peak == 0) {
+        trace("the script tag has %zu bytes (was %zu) after %zu allocations\n", script.used, before, script.allocs);
+        failed = 1;
+    }
+
+    void *grown = wfTagRealloc(WF_MEM_SCRIPT, NULL, 10);
+    grown = wfTagRealloc(WF_MEM_SCRIPT, grown, 10000);
+
+    if (tagUsed(WF_MEM_SCRIPT) != before + zmalloc_size(grown)) {
+        trace("after growing, the script tag has %zu bytes\n", tagUsed(WF_MEM_SCRIPT));
+        failed = 1;
+    }
+
+    wfTagFree(WF_MEM_SCRIPT, grown);
+    zfree(ptrs);
+
+    printf("%s: %s (%zu bytes reserved for %zu bytes per frame)\n", TEST_NAME,
+        failed ? "FAILED" : "ok", reserved, used);
+
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,734 @@
+/**
+ * This file is part of prototype.
+ *
+ * (c) 2014 Nicolas Hillegeer <nicolas@hillegeer.com>
+ *
+ * For the full copyright and license information, please view the LICENSE
+ * file that was distributed with the source code.
+ *
+ * Renders a grid of identical cubes through the drawlist (cleared by a
+ * drawlist command), once with and once without instancing, and checks the
+ * draw call counter and that both images are the same. Without instancing
+ * the matrices come from the uniform ring, which is tested both
+ * persistently mapped and orphaned. Then the same grid is drawn from
+ * shared geometry, half cubes and half axes, which multi-draw indirect
+ * should draw in a single call. Last, the cubes are swapped for a cube with
+ * quantized positions, which has to come out the same, both with and
+ * without instancing. And a sphere with a LOD chain is drawn big and tiny,
+ * which should pick different LODs and so take two instanced calls. And
+ * the grid gets frustum culled from a camera that sees only half of it,
+ * linearly and through a BVH.
+ * Run it from the root of the repository (it loads the shaders from
+ * src/shaders). Works headless on Mesa llvmpipe with:
+ *
+ * SDL_VIDEODRIVER=offscreen LIBGL_ALWAYS_SOFTWARE=1 ./drawcalls
+ */
+
+#include <math.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "math/math.h"
+
+#include "util.h"
+#include "SDL.h"
+
+#define TEST_NAME "drawcalls"
+
+#define GRID_SIZE 32
+#define NUM_PROPS (GRID_SIZE * GRID_SIZE)
+
+static void init() {
+    glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+    glClearDepth(1.0f);
+    glDisable(GL_DITHER);
+    glEnable(GL_DEPTH_TEST);
+    glDepthFunc(GL_LEQUAL);
+}
+
+/* the clear is a command in the drawlist, so this is the whole frame */
+static void renderFrame(GLubyte *pixels, int width, int height, struct gfxDrawlistStats *stats) {
+    gfxDrawlistRender();
+    glFinish();
+
+    glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, pixels);
+    GL_ERROR("read pixels");
+
+    gfxDrawlistGetStats(stats);
+
+    /* the drawlist plans the frame in the frame arena */
+    wfFrameEnd();
+}
+
+static size_t countLit(const GLubyte *pixels, int width, int height) {
+    size_t lit = 0;
+    for (int i = 0; i < width * height; ++i) {
+        lit += (pixels[i * 4] | pixels[i * 4 + 1] | pixels[i * 4 + 2]) != 0;
+    }
+
+    return lit;
+}
+
+/* the cube of gfxCube(), as a mesh on the heap with snorm16 positions */
+static int quantizedCube(struct gfxModel *model) {
+    static const float vertices[][8] = {
+        { -.5f, -.5f,  .5f, 1, 0, 0, 1, 1 },
+        { -.5f,  .5f,  .5f, 1, 1, 0, 0, 1 },
+        {  .5f,  .5f,  .5f, 1, 0, 1, 0, 1 },
+        {  .5f, -.5f,  .5f, 1, 1, 1, 0, 1 },
+        { -.5f, -.5f, -.5f, 1, 1, 1, 1, 1 },
+        { -.5f,  .5f, -.5f, 1, 1, 0, 0, 1 },
+        {  .5f,  .5f, -.5f, 1, 1, 0, 1, 1 },
+        {  .5f, -.5f, -.5f, 1, 0, 0, 1, 1 }
+    };
+
+    static const GLubyte indices[] = {
+        0,2,1,  0,3,2,
+        4,3,0,  4,7,3,
+        4,1,5,  4,0,1,
+        3,6,2,  3,7,6,
+        1,6,5,  1,2,6,
+        7,5,6,  7,4,5
+    };
+
+    struct gfxMesh mesh;
+    memset(&mesh, 0x0, sizeof(mesh));
+
+    struct gfxMeshHeader *header = &mesh.header;
+    header->stride = sizeof(vertices[0]);
+    header->numAttribs = 2;
+    header->attribs[0] = (struct gfxMeshAttrib) { GFX_VERTEX, 4, GFX_MESH_FLOAT, 0, 0 };
+    header->attribs[1] = (struct gfxMeshAttrib) { GFX_COLOR, 4, GFX_MESH_FLOAT, 0, 4 * sizeof(float) };
+    header->numVertices = ARRAY_SIZE(vertices);
+    header->numIndices = ARRAY_SIZE(indices);
+    header->indexType = GFX_MESH_UNSIGNED_BYTE;
+
+    mesh.vertices = zmalloc(sizeof(vertices));
+    mesh.indices = zmalloc(sizeof(indices));
+    memcpy(mesh.vertices, vertices, sizeof(vertices));
+    memcpy(mesh.indices, indices, sizeof(indices));
+
+    gfxQuantizeMesh(&mesh);
+
+    const uint32_t stride = header->stride;
+    const int ok = gfxUploadMesh(model, NULL, &mesh);
+
+    gfxFreeMesh(&mesh);
+
+    if (!ok || !model->quantized || stride >= sizeof(vertices[0])) {
+        trace("the quantized cube did not work out: %d, %u bytes per vertex\n", ok, stride);
+        return 0;
+    }
+
+    return 1;
+}
+
+/* a sphere with a diameter of 1, with a LOD chain */
+static int lodSphere(struct gfxModel *model) {
+    enum { RINGS = 24, SEGMENTS = 48 };
+
+    struct vertex {
+        float position[3];
+        float color[4];
+    };
+
+    struct gfxMesh mesh;
+    memset(&mesh, 0x0, sizeof(mesh));
+
+    struct gfxMeshHeader *header = &mesh.header;
+    header->stride = sizeof(struct vertex);
+    header->numAttribs = 2;
+    header->attribs[0] = (struct gfxMeshAttrib) { GFX_VERTEX, 3, GFX_MESH_FLOAT, 0, 0 };
+    header->attribs[1] = (struct gfxMeshAttrib) { GFX_COLOR, 4, GFX_MESH_FLOAT, 0, 3 * sizeof(float) };
+    header->numVertices = (RINGS + 1) * (SEGMENTS + 1);
+    header->numIndices = RINGS * SEGMENTS * 6;
+    header->indexType = GFX_MESH_UNSIGNED_INT;
+
+    struct vertex *vertices = zmalloc(header->numVertices * sizeof(struct vertex));
+    uint32_t *indices = zmalloc(header->numIndices * sizeof(uint32_t));
+
+    for (int i = 0; i <= RINGS; ++i) {
+        for (int j = 0; j <= SEGMENTS; ++j) {
+            const float theta = GFX_PI * (float) i / RINGS;
+            const float phi = 2.0f * GFX_PI * (float) j / SEGMENTS;
+
+            vertices[i * (SEGMENTS + 1) + j] = (struct vertex) {
+                { 0.5f * sinf(theta) * cosf(phi), 0.5f * cosf(theta), 0.5f * sinf(theta) * sinf(phi) },
+                { (float) i / RINGS, (float) j / SEGMENTS, 1.0f, 1.0f }
+            };
+        }
+    }
+
+    uint32_t *index = indices;
+
+    for (uint32_t i = 0; i < RINGS; ++i) {
+        for (uint32_t j = 0; j < SEGMENTS; ++j) {
+            const uint32_t a = i * (SEGMENTS + 1) + j;
+            const uint32_t b = a + SEGMENTS + 1;
+
+            *index++ = a; *index++ = b;     *index++ = b + 1;
+            *index++ = a; *index++ = b + 1; *index++ = a + 1;
+        }
+    }
+
+    mesh.vertices = vertices;
+    mesh.indices = indices;
+
+    gfxMeshBuildLods(&mesh);
+    gfxMeshNarrowIndices(&mesh);
+
+    const int ok = gfxUploadMesh(model, NULL, &mesh);
+
+    gfxFreeMesh(&mesh);
+
+    if (!ok || model->numLods < 3) {
+        trace("the sphere did not work out: %d, %u LODs\n", ok, model->numLods);
+        return 0;
+    }
+
+    return 1;
+}
+
+int main(int argc, char const *argv[]) {
+    trace("setting up test: " TEST_NAME "\n");
+
+    int width  = 256;
+    int height = 256;
+
+    SDL_Init(SDL_INIT_VIDEO);
+
+    SDL_GL_SetAttribute(SDL_GL_CONTEXT_MAJOR_VERSION, 3);
+    SDL_GL_SetAttribute(SDL_GL_CONTEXT_MINOR_VERSION, 2);
+    SDL_GL_SetAttribute(SDL_GL_CONTEXT_PROFILE_MASK, SDL_GL_CONTEXT_PROFILE_CORE);
+
+    SDL_GL_SetAttribute(SDL_GL_DOUBLEBUFFER, 1);
+    SDL_GL_SetAttribute(SDL_GL_DEPTH_SIZE, 24);
+
+    SDL_Window *window = SDL_CreateWindow(
+        "drawcalls test",
+        SDL_WINDOWPOS_UNDEFINED,
+        SDL_WINDOWPOS_UNDEFINED,
+        width, height,
+        SDL_WINDOW_OPENGL | SDL_WINDOW_HIDDEN
+    );
+
+    if (!window) {
+        trace("could not create a window: %s\n", SDL_GetError());
+        return EXIT_FAILURE;
+    }
+
+    SDL_GLContext glcontext = SDL_GL_CreateContext(window);
+
+    if (!glcontext) {
+        trace("could not create an OpenGL context: %s\n", SDL_GetError());
+        return EXIT_FAILURE;
+    }
+
+    trace("renderer: %s, version: %s\n", glGetString(GL_RENDERER), glGetString(GL_VERSION));
+
+    glViewport(0, 0, (GLsizei) width, (GLsizei) height);
+    init();
+
+    GLint major;
+    GLint minor;
+    glGetIntegerv(GL_MAJOR_VERSION, &major);
+    glGetIntegerv(GL_MINOR_VERSION, &minor);
+
+    struct gfxRenderer renderer = {0};
+    glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &renderer.uboOffsetAlign);
+    renderer.instancing = (major > 3 || (major == 3 && minor >= 3)) ||
+        SDL_GL_ExtensionSupported("GL_ARB_instanced_arrays");
+    renderer.bufferStorage = (major > 4 || (major == 4 && minor >= 4)) ||
+        SDL_GL_ExtensionSupported("GL_ARB_buffer_storage");
+    const int multiDrawIndirect = (major > 4 || (major == 4 && minor >= 3)) ||
+        SDL_GL_ExtensionSupported("GL_ARB_multi_draw_indirect");
+
+    if (!renderer.instancing) {
+        trace("instancing is not supported by this context, can't test\n");
+        return EXIT_FAILURE;
+    }
+
+    struct gfxShaderProgram shader;
+    gfxLoadShaderFromFile(&shader, "./src/shaders/color.vert", "./src/shaders/color.frag");
+
+    if (!shader.instanced) {
+        trace("the color shader should have an instanced variant\n");
+        return EXIT_FAILURE;
+    }
+
+    struct gfxLayer layer;
+    gfxCreateLayer(&layer);
+    layer.projection = GFX_ORTHO;
+    layer.uniforms.projectionMatrix = mat_ortho(0.0f, (float) GRID_SIZE, 0.0f, (float) GRID_SIZE, -10.0f, 10.0f);
+    gfxUploadLayer(&layer);
+
+    struct gfxModel cube;
+    gfxCube(&cube, NULL);
+
+    struct gfxVertexFormat format;
+    gfxCubeFormat(&format);
+
+    struct gfxGeometry geometry;
+    gfxCreateGeometry(&geometry, &format, GL_UNSIGNED_SHORT, 1024, 1024);
+
+    struct gfxModel sharedCube;
+    struct gfxModel sharedAxis;
+    gfxCube(&sharedCube, &geometry);
+    gfxAxis(&sharedAxis, &geometry);
+
+    /* a forest of identical props, only the modelview matrix differs. These
+     * are static because the matrices need 16-byte alignment, which zmalloc
+     * doesn't guarantee everywhere */
+    static struct gfxRenderParams params[NUM_PROPS];
+    static struct gfxDrawOperation ops[NUM_PROPS];
+    static struct gfxDrawOperation sharedOps[NUM_PROPS];
+    static struct gfxDrawOperation quantizedOps[NUM_PROPS];
+
+    for (int i = 0; i < NUM_PROPS; ++i) {
+        const float x = (float) (i % GRID_SIZE) + 0.5f;
+        const float y = (float) (i / GRID_SIZE) + 0.5f;
+
+        gfxCreateRenderParams(&params[i]);
+        params[i].modelviewMatrix = mmmul(mtranslate(vec(x, y, 0.0f, 1.0f)), mscale(vec(0.8f, 0.8f, 0.8f, 1.0f)));
+
+        ops[i] = (struct gfxDrawOperation) {
+            .model   = &cube,
+            .params  = &params[i],
+            .program = &shader,
+            .layer   = &layer,
+        };
+        gfxGenRenderKey(&ops[i]);
+        gfxDrawlistAdd(&ops[i]);
+
+        sharedOps[i] = ops[i];
+        sharedOps[i].model = (i < NUM_PROPS / 2) ? &sharedCube : &sharedAxis;
+        gfxGenRenderKey(&sharedOps[i]);
+    }
+
+    struct gfxClear clear = {
+        .mask  = GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT,
+        .color = { 0.0f, 0.0f, 0.0f, 1.0f },
+        .depth = 1.0f,
+    };
+    struct gfxDrawOperation cleard = {0};
+    gfxGenCommandKey(&cleard, LAYER_0, gfxDrawlistRegisterCommand(gfxCmdClear, &clear), 0);
+    gfxDrawlistAdd(&cleard);
+
+    GLubyte *instanced = zmalloc((size_t) (width * height * 4));
+    GLubyte *single    = zmalloc((size_t) (width * height * 4));
+    GLubyte *orphaned  = zmalloc((size_t) (width * height * 4));
+    GLubyte *indirect  = zmalloc((size_t) (width * height * 4));
+    GLubyte *quantized = zmalloc((size_t) (width * height * 4));
+    GLubyte *lods      = zmalloc((size_t) (width * height * 4));
+
+    trace("starting test: " TEST_NAME "\n");
+
+    int failed = 0;
+    struct gfxDrawlistStats stats;
+
+    gfxDrawlistInit(&renderer);
+    gfxRingInit(&renderer);
+    renderFrame(instanced, width, height, &stats);
+
+    printf("instanced: %u draw calls for %u entries (%u instanced calls, %u instances)\n",
+        stats.drawCalls, stats.entries, stats.instancedDrawCalls, stats.instances);
+
+    if (stats.entries != NUM_PROPS + 1 || stats.commands != 1 || stats.drawCalls != 1 || stats.instances != NUM_PROPS) {
+        trace("expected all %d props in one instanced draw call\n", NUM_PROPS);
+        failed = 1;
+    }
+
+    renderer.instancing = 0;
+    gfxDrawlistInit(&renderer);
+
+    /* a few frames, so the ring wraps around and the fences get waited on */
+    for (int frame = 0; frame < 2 * GFX_RING_FRAMES; ++frame) {
+        renderFrame(single, width, height, &stats);
+    }
+
+    struct gfxStateStats state;
+    gfxStateGetStats(&state);
+
+    printf("not instanced: %u draw calls for %u entries (gl state: %u issued, %u filtered)\n",
+        stats.drawCalls, stats.entries, state.issued, state.filtered);
+
+    if (stats.drawCalls != NUM_PROPS || stats.instancedDrawCalls != 0) {
+        trace("expected one draw call per prop without instancing\n");
+        failed = 1;
+    }
+
+    /* every prop has the same program, VAO, blend and cull state, only the
+     * modelview matrix should make it through to GL */
+    if (state.filtered < (NUM_PROPS - 1) * 4) {
+        trace("expected the redundant per-prop state changes to be filtered\n");
+        failed = 1;
+    }
+
+    if (memcmp(instanced, single, (size_t) (width * height * 4)) != 0) {
+        trace("the instanced image differs from the non-instanced one\n");
+        failed = 1;
+    }
+
+    if (renderer.bufferStorage) {
+        renderer.bufferStorage = 0;
+        gfxRingInit(&renderer);
+        renderFrame(orphaned, width, height, &stats);
+
+        if (memcmp(orphaned, single, (size_t) (width * height * 4)) != 0) {
+            trace("the image differs when the uniform ring is orphaned instead of persistently mapped\n");
+            failed = 1;
+        }
+    }
+    else {
+        printf("no buffer storage, only tested the orphaning uniform ring\n");
+    }
+
+    /* the same props with quantized positions, the decode ends up in the
+     * modelview matrices, the image should not change */
+    struct gfxModel qcube;
+
+    if (quantizedCube(&qcube)) {
+        gfxDrawlistClear();
+        gfxDrawlistAdd(&cleard);
+        for (int i = 0; i < NUM_PROPS; ++i) {
+            quantizedOps[i] = ops[i];
+            quantizedOps[i].model = &qcube;
+            gfxGenRenderKey(&quantizedOps[i]);
+            gfxDrawlistAdd(&quantizedOps[i]);
+        }
+
+        for (int instancing = 0; instancing < 2; ++instancing) {
+            renderer.instancing = instancing;
+            gfxDrawlistInit(&renderer);
+            renderFrame(quantized, width, height, &stats);
+
+            if (memcmp(quantized, single, (size_t) (width * height * 4)) != 0) {
+                trace("the image of the quantized cubes differs (instancing: %d)\n", instancing);
+                failed = 1;
+            }
+        }
+
+        gfxDestroyModel(&qcube);
+    }
+    else {
+        failed = 1;
+    }
+
+    /* the shared geometry scene, without multi-draw indirect as the
+     * reference: one instanced call per model */
+    gfxDrawlistClear();
+    gfxDrawlistAdd(&cleard);
+    for (int i = 0; i < NUM_PROPS; ++i) {
+        gfxDrawlistAdd(&sharedOps[i]);
+    }
+
+    renderer.instancing = 1;
+    renderer.multiDrawIndirect = 0;
+    gfxDrawlistInit(&renderer);
+    renderFrame(instanced, width, height, &stats);
+
+    if (stats.drawCalls != 2 || stats.instancedDrawCalls != 2) {
+        trace("expected one instanced draw call per shared model, got %u\n", stats.drawCalls);
+        failed = 1;
+    }
+
+    if (multiDrawIndirect) {
+        renderer.multiDrawIndirect = 1;
+        gfxDrawlistInit(&renderer);
+        renderFrame(indirect, width, height, &stats);
+
+        printf("multi-draw indirect: %u draw calls for %u entries (%u indirect calls, %u commands)\n",
+            stats.drawCalls, stats.entries, stats.indirectDrawCalls, stats.indirectCommands);
+
+        if (stats.drawCalls != 1 || stats.indirectDrawCalls != 1 || stats.indirectCommands != 2) {
+            trace("expected both shared models in one multi-draw indirect call\n");
+            failed = 1;
+        }
+
+        if (memcmp(indirect, instanced, (size_t) (width * height * 4)) != 0) {
+            trace("the multi-draw indirect image differs from the instanced one\n");
+            failed = 1;
+        }
+    }
+    else {
+        printf("no multi-draw indirect, only tested instancing from shared geometry\n");
+    }
+
+    /* the spheres in the first half of the grid get the size of the cubes,
+     * the rest are specks. With an ortho projection an object-space unit
+     * covers scale * P[1][1] * height / 2 pixels, anywhere. The allowed
+     * error is half of what LOD 1 gets wrong on the big spheres. */
+    struct gfxModel sphere;
+
+    if (lodSphere(&sphere)) {
+        static struct gfxRenderParams lodParams[NUM_PROPS];
+        static struct gfxDrawOperation lodOps[NUM_PROPS];
+
+        const float bigScale = 0.8f;
+        const float tinyScale = 0.005f;
+        const float pixelsPerUnit = bigScale * layer.uniforms.projectionMatrix.cols[1][1] * (float) height / 2.0f;
+
+        gfxDrawlistSetLodError(0.5f * sphere.lods[1].error * pixelsPerUnit, (float) height);
+
+        gfxDrawlistClear();
+        gfxDrawlistAdd(&cleard);
+
+        for (int i = 0; i < NUM_PROPS; ++i) {
+            const float s = (i < NUM_PROPS / 2) ? bigScale : tinyScale;
+
+            lodParams[i] = params[i];
+            lodParams[i].modelviewMatrix = mmmul(mtranslate(vec((float) (i % GRID_SIZE) + 0.5f, (float) (i / GRID_SIZE) + 0.5f, 0.0f, 1.0f)),
+                                                 mscale(vec(s, s, s, 1.0f)));
+
+            lodOps[i] = ops[i];
+            lodOps[i].model = &sphere;
+            lodOps[i].params = &lodParams[i];
+            gfxGenRenderKey(&lodOps[i]);
+            gfxDrawlistAdd(&lodOps[i]);
+        }
+
+        const unsigned int bigLod = lodOps[0].key.mod.lod;
+        const unsigned int tinyLod = lodOps[NUM_PROPS - 1].key.mod.lod;
+
+        printf("LODs: %u in the chain, LOD %u for the big spheres, LOD %u for the tiny ones\n",
+            sphere.numLods, bigLod, tinyLod);
+
+        if (bigLod != 0 || tinyLod != sphere.numLods - 1) {
+            trace("expected LOD 0 for the big spheres and LOD %u for the tiny ones\n", sphere.numLods - 1);
+            failed = 1;
+        }
+
+        renderer.multiDrawIndirect = 0;
+        gfxDrawlistInit(&renderer);
+        renderFrame(lods, width, height, &stats);
+
+        if (stats.drawCalls != 2 || stats.instancedDrawCalls != 2 || stats.instances != NUM_PROPS) {
+            trace("expected one instanced draw call per LOD, got %u\n", stats.drawCalls);
+            failed = 1;
+        }
+
+        /* without LODs, the per-frame pass should put them all back together */
+        gfxDrawlistSetLodError(0.0f, (float) height);
+        gfxDrawlistUpdateDepth();
+        renderFrame(lods, width, height, &stats);
+
+        if (stats.drawCalls != 1 || lodOps[NUM_PROPS - 1].key.mod.lod != 0) {
+            trace("expected all spheres at LOD 0 in one draw call, got %u\n", stats.drawCalls);
+            failed = 1;
+        }
+
+        gfxDestroyModel(&sphere);
+    }
+    else {
+        failed = 1;
+    }
+
+    /* translucent props that alternate between two models, at depths that
+     * have nothing to do with their state: they have to come out back to
+     * front anyway (up to the precision of the coarse depth in the key) */
+    {
+        static struct gfxRenderParams blendParams[NUM_PROPS];
+        static struct gfxDrawOperation blendOps[NUM_PROPS];
+        static struct gfxDrawOperation *order[NUM_PROPS + 1];
+
+        /* copies that only differ in their id, which is in the key */
+        struct gfxModel first = cube, second = cube;
+        first.id = 1;
+        second.id = 2;
+
+        gfxDrawlistClear();
+        gfxDrawlistAdd(&cleard);
+
+        for (int i = 0; i < NUM_PROPS; ++i) {
+            blendParams[i] = params[i];
+            blendParams[i].blend = GFX_BLEND_ALPHA;
+            blendParams[i].modelviewMatrix.cols[3][2] = -1.0f - 0.05f * (float) ((i * 7) % NUM_PROPS);
+
+            blendOps[i] = ops[i];
+            blendOps[i].model = (i % 2) ? &first : &second;
+            blendOps[i].params = &blendParams[i];
+            gfxGenRenderKey(&blendOps[i]);
+            gfxDrawlistAdd(&blendOps[i]);
+        }
+
+        const size_t count = gfxDrawlistCollect(NULL, order, NUM_PROPS + 1);
+        float last = INFINITY;
+
+        for (size_t i = 0; i < count; ++i) {
+            if (order[i] == &cleard) continue;
+
+            const float depth = -order[i]->params->modelviewMatrix.cols[3][2];
+            if (depth > last * 1.01f) {
+                trace("translucent prop %zu is at depth %f, behind the one before it (%f)\n", i, depth, last);
+                failed = 1;
+                break;
+            }
+
+            last = depth;
+        }
+    }
+
+    /* culling: moving the camera half the grid to the right leaves half of
+     * the props in the frustum of the layer. The culled props have to leave
+     * the drawlist, and come back when the camera does. */
+    {
+        static struct gfxDrawOperation *cullOps[NUM_PROPS];
+        static gfxDrawHandle handles[NUM_PROPS];
+        uint32_t visible[GFX_CULL_WORDS(NUM_PROPS)];
+
+        struct gfxBoxes boxes;
+        gfxBoxesInit(&boxes, NUM_PROPS);
+
+        for (int i = 0; i < NUM_PROPS; ++i) {
+            const float x = (float) (i % GRID_SIZE) + 0.5f;
+            const float y = (float) (i / GRID_SIZE) + 0.5f;
+            const aabb box = { vec(x - 0.4f, y - 0.4f, -0.4f, 1.0f), vec(x + 0.4f, y + 0.4f, 0.4f, 1.0f) };
+
+            gfxBoxesAdd(&boxes, &box);
+            cullOps[i] = &ops[i];
+        }
+
+        const mat4 view = mtranslate(vec(-(float) GRID_SIZE / 2.0f, 0.0f, 0.0f, 1.0f));
+        const mat4 *views[] = { &view, NULL, &view };
+        const unsigned int expected[] = { NUM_PROPS / 2, NUM_PROPS, NUM_PROPS / 2 };
+
+        gfxDrawlistClear();
+        gfxDrawlistAdd(&cleard);
+
+        for (int pass = 0; pass < 3; ++pass) {
+            gfxUpdateLayerFrustum(&layer, views[pass]);
+            gfxCullBoxes(&boxes, &layer.frustum, visible);
+            gfxDrawlistSetVisibility(cullOps, handles, visible, NUM_PROPS);
+            renderFrame(lods, width, height, &stats);
+
+            if (stats.entries != expected[pass] + 1) {
+                trace("culling pass %d: expected %u props in the drawlist, got %u\n",
+                    pass, expected[pass], stats.entries - 1);
+                failed = 1;
+            }
+        }
+
+        printf("culling: %u of %d props left in the frustum\n", stats.entries - 1, NUM_PROPS);
+
+        /* the same through a BVH, which fills a bucket for the frame */
+        struct gfxBvh bvh;
+        gfxBvhBuild(&bvh, &boxes);
+
+        gfxDrawlistClear();
+        gfxDrawlistAdd(&cleard);
+
+        struct gfxDrawVisible frame = { gfxDrawBucketCreate(), cullOps };
+        gfxUpdateLayerFrustum(&layer, &view);
+        const size_t found = gfxBvhCullFrustum(&bvh, &layer.frustum, gfxDrawBucketAddVisible, &frame);
+        gfxDrawBucketSubmit(frame.bucket);
+        renderFrame(lods, width, height, &stats);
+
+        if (found != NUM_PROPS / 2 || stats.entries != NUM_PROPS / 2 + 1) {
+            trace("expected the BVH to find %d props, found %zu and drew %u\n",
+                NUM_PROPS / 2, found, stats.entries - 1);
+            failed = 1;
+        }
+
+        /* picking straight down on a prop */
+        const int target = 3 * GRID_SIZE + 7;
+        const float origin[3] = { 7.5f, 3.5f, 10.0f };
+        const float down[3] = { 0.0f, 0.0f, -1.0f };
+        float t = 0.0f;
+        const uint32_t picked = gfxBvhRaycast(&bvh, origin, down, 100.0f, NULL, NULL, &t);
+
+        if (picked != (uint32_t) target || fabsf(t - 9.6f) > 1e-4f) {
+            trace("expected the ray to hit prop %d at 9.6, got %u at %f\n", target, picked, (double) t);
+            failed = 1;
+        }
+
+        gfxDrawBucketDestroy(frame.bucket);
+        gfxBvhDestroy(&bvh);
+        gfxBoxesDestroy(&boxes);
+    }
+
+    /* the forest again, but everything comes from the pools: the same
+     * image, and the matrices in the pooled params are aligned */
+    {
+        static struct gfxDrawOperation *pooledOps[NUM_PROPS];
+        static struct gfxRenderParams *pooledParams[NUM_PROPS];
+
+        gfxDrawlistClear();
+        gfxDrawlistAdd(&cleard);
+        for (int i = 0; i < NUM_PROPS; ++i) gfxDrawlistAdd(&ops[i]);
+        renderFrame(indirect, width, height, &stats);
+
+        struct gfxModel *pooledCube = gfxNewModel();
+        gfxCube(pooledCube, NULL);
+        pooledCube->id = cube.id;
+
+        gfxDrawlistClear();
+        gfxDrawlistAdd(&cleard);
+
+        for (int i = 0; i < NUM_PROPS; ++i) {
+            pooledParams[i] = gfxNewRenderParams();
+            pooledParams[i]->modelviewMatrix = params[i].modelviewMatrix;
+
+            pooledOps[i] = gfxNewDrawOperation();
+            *pooledOps[i] = ops[i];
+            pooledOps[i]->model = pooledCube;
+            pooledOps[i]->params = pooledParams[i];
+            gfxGenRenderKey(pooledOps[i]);
+            gfxDrawlistAdd(pooledOps[i]);
+
+            if ((uintptr_t) pooledParams[i] % _Alignof(mat4)) {
+                trace("pooled render params at %p are not aligned\n", (void *) pooledParams[i]);
+                failed = 1;
+            }
+        }
+
+        renderFrame(lods, width, height, &stats);
+
+        if (stats.entries != NUM_PROPS + 1 || memcmp(lods, indirect, (size_t) (width * height * 4)) != 0) {
+            trace("the pooled props (%u entries) don't look like the static ones\n", stats.entries - 1);
+            failed = 1;
+        }
+
+        gfxDrawlistClear();
+
+        for (int i = 0; i < NUM_PROPS; ++i) {
+            gfxDeleteDrawOperation(pooledOps[i]);
+            gfxDeleteRenderParams(pooledParams[i]);
+        }
+        gfxDeleteModel(pooledCube);
+    }
+
+    /* make sure we didn't just compare black images */
+    size_t lit = countLit(single, width, height);
+    size_t litShared = countLit(instanced, width, height);
+
+    if (lit < (size_t) (width * height) / 4 || litShared < (size_t) (width * height) / 8) {
+        trace("only %zu (%zu shared) pixels were drawn, expected a lot more\n", lit, litShared);
+        failed = 1;
+    }
+
+    zfree(instanced);
+    zfree(single);
+    zfree(orphaned);
+    zfree(indirect);
+    zfree(quantized);
+    zfree(lods);
+
+    gfxDrawlistDestroy();
+    gfxRingDestroy();
+    gfxDestroyPools();
+    gfxDestroyModel(&cube);
+    gfxDestroyModel(&sharedCube);
+    gfxDestroyModel(&sharedAxis);
+    gfxDestroyGeometry(&geometry);
+    gfxDestroyLayer(&layer);
+    gfxDestroyShader(&shader);
+
+    SDL_GL_DeleteContext(glcontext);
+    SDL_DestroyWindow(window);
+    SDL_Quit();
+
+    printf("%s: %s\n", TEST_NAME, failed ? "FAILED" : "ok");
+
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
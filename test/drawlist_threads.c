@@ -0,0 +1,242 @@
+/**
+ * This file is part of prototype.
+ *
+ * (c) 2014 Nicolas Hillegeer <nicolas@hillegeer.com>
+ *
+ * For the full copyright and license information, please view the LICENSE
+ * file that was distributed with the source code.
+ *
+ * Fills the drawlist from a bunch of threads through per-thread buckets
+ * and checks that the merged frame comes out in the same order as when
+ * everything is submitted from a single thread. Doesn't need a GL context,
+ * the frame is collected instead of rendered.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "util.h"
+
+#define TEST_NAME "drawlist threads"
+
+#define NUM_THREADS  8
+#define NUM_OPS      (1 << 16)
+#define NUM_RETAINED 1024
+#define NUM_FRAMES   16
+
+struct worker {
+    pthread_t thread;
+    struct gfxDrawBucket *bucket;
+    struct gfxDrawOperation *ops;
+    int index;
+};
+
+static uint64_t xorshift(uint64_t *state) {
+    uint64_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    return *state = x;
+}
+
+/* a limited range of keys, so there's plenty of duplicates, both within
+ * one bucket and across buckets */
+static void fillOps(struct gfxDrawOperation *ops, size_t n, uint64_t seed) {
+    uint64_t state = seed;
+
+    for (size_t i = 0; i < n; ++i) {
+        union gfxDrawlistKey key = {0};
+        uint64_t r = xorshift(&state);
+
+        key.gen.layer   = (unsigned int) (r % 3);
+        key.gen.type    = KEY_TYPE_MODEL;
+        key.mod.shader  = (unsigned int) ((r >> 8) % 4);
+        key.mod.texture = (unsigned int) ((r >> 16) % 8);
+        key.mod.model   = (unsigned int) ((r >> 24) % 16);
+        key.mod.depth   = (unsigned int) ((r >> 32) % 64);
+
+        memset(&ops[i], 0, sizeof(ops[i]));
+        ops[i].key = key;
+    }
+}
+
+/* every thread takes every NUM_THREADS'th operation, so that the buckets
+ * really need to be interleaved by the merge */
+static void *submit(void *arg) {
+    struct worker *w = arg;
+
+    for (size_t i = (size_t) w->index; i < NUM_OPS; i += NUM_THREADS) {
+        gfxDrawBucketAdd(w->bucket, &w->ops[i]);
+    }
+
+    gfxDrawBucketSubmit(w->bucket);
+
+    return NULL;
+}
+
+static int comparePtr(const void *p1, const void *p2) {
+    uintptr_t a = (uintptr_t) *(struct gfxDrawOperation * const *) p1;
+    uintptr_t b = (uintptr_t) *(struct gfxDrawOperation * const *) p2;
+
+    return (a < b) ? -1 : (a > b) ? 1 : 0;
+}
+
+/* the keys have to be in exactly the same order. Operations with equal
+ * keys are interchangeable for the renderer, and which bucket they came
+ * from depends on the thread count, so within a run of equal keys only the
+ * set of operations has to match */
+static int compareFrames(
+    union gfxDrawlistKey *expectedKeys, struct gfxDrawOperation **expectedOps,
+    union gfxDrawlistKey *keys, struct gfxDrawOperation **ops, size_t n) {
+    for (size_t i = 0; i < n; ++i) {
+        if (keys[i].intrep != expectedKeys[i].intrep) {
+            trace("key mismatch at %zu\n", i);
+            return 0;
+        }
+
+        if (i != 0 && keys[i - 1].intrep > keys[i].intrep) {
+            trace("frame not sorted at %zu\n", i);
+            return 0;
+        }
+    }
+
+    for (size_t start = 0; start < n;) {
+        size_t end = start + 1;
+        while (end < n && keys[end].intrep == keys[start].intrep) ++end;
+
+        qsort(&expectedOps[start], end - start, sizeof(expectedOps[0]), comparePtr);
+        qsort(&ops[start], end - start, sizeof(ops[0]), comparePtr);
+
+        if (memcmp(&expectedOps[start], &ops[start], (end - start) * sizeof(ops[0])) != 0) {
+            trace("operation mismatch in the run [%zu, %zu)\n", start, end);
+            return 0;
+        }
+
+        start = end;
+    }
+
+    return 1;
+}
+
+int main(int argc, char const *argv[]) {
+    trace("setting up test: " TEST_NAME "\n");
+
+    zmalloc_enable_thread_safeness();
+
+    const size_t total = NUM_OPS + NUM_RETAINED;
+
+    struct gfxDrawOperation *ops      = zmalloc(NUM_OPS * sizeof(struct gfxDrawOperation));
+    struct gfxDrawOperation *retained = zmalloc(NUM_RETAINED * sizeof(struct gfxDrawOperation));
+
+    union gfxDrawlistKey *expectedKeys    = zmalloc(total * sizeof(union gfxDrawlistKey));
+    union gfxDrawlistKey *keys            = zmalloc(total * sizeof(union gfxDrawlistKey));
+    struct gfxDrawOperation **expectedOps = zmalloc(total * sizeof(struct gfxDrawOperation *));
+    struct gfxDrawOperation **frameOps    = zmalloc(total * sizeof(struct gfxDrawOperation *));
+
+    /* some static geometry in the retained drawlist, it gets merged too */
+    fillOps(retained, NUM_RETAINED, 0xDEADBEEFULL);
+    for (size_t i = 0; i < NUM_RETAINED; ++i) {
+        gfxDrawlistAdd(&retained[i]);
+    }
+
+    struct gfxDrawBucket *single = gfxDrawBucketCreate();
+
+    struct worker workers[NUM_THREADS];
+    for (int t = 0; t < NUM_THREADS; ++t) {
+        workers[t].bucket = gfxDrawBucketCreate();
+        workers[t].ops    = ops;
+        workers[t].index  = t;
+    }
+
+    trace("starting test: " TEST_NAME "\n");
+
+    int failed = 0;
+
+    /* the buckets get reused every frame, like they would in the engine */
+    for (int frame = 0; frame < NUM_FRAMES && !failed; ++frame) {
+        fillOps(ops, NUM_OPS, 0x9E3779B97F4A7C15ULL + (uint64_t) frame);
+
+        /* reference: everything from this thread, in a single bucket */
+        for (size_t i = 0; i < NUM_OPS; ++i) {
+            gfxDrawBucketAdd(single, &ops[i]);
+        }
+        gfxDrawBucketSubmit(single);
+
+        size_t expected = gfxDrawlistCollect(expectedKeys, expectedOps, total);
+
+        for (int t = 0; t < NUM_THREADS; ++t) {
+            pthread_create(&workers[t].thread, NULL, submit, &workers[t]);
+        }
+
+        for (int t = 0; t < NUM_THREADS; ++t) {
+            pthread_join(workers[t].thread, NULL);
+        }
+
+        size_t count = gfxDrawlistCollect(keys, frameOps, total);
+
+        if (count != total || expected != total) {
+            trace("frame %d: expected %zu entries, got %zu (reference %zu)\n", frame, total, count, expected);
+            failed = 1;
+        }
+        else if (!compareFrames(expectedKeys, expectedOps, keys, frameOps, total)) {
+            trace("frame %d: merged order differs from the single-threaded order\n", frame);
+            failed = 1;
+        }
+    }
+
+    /* the buckets were released by the last collect, nothing should linger */
+    size_t remaining = gfxDrawlistCollect(NULL, NULL, 0);
+    if (!failed && remaining != NUM_RETAINED) {
+        trace("expected only the retained entries after releasing, got %zu\n", remaining);
+        failed = 1;
+    }
+
+    /* one bucket more than the drawlist takes in a frame: the last one
+     * gets dropped, but it can be used again next frame */
+    static struct gfxDrawBucket *many[DRAWLIST_MAX_BUCKETS + 1];
+    for (int b = 0; b <= DRAWLIST_MAX_BUCKETS; ++b) {
+        many[b] = gfxDrawBucketCreate();
+        gfxDrawBucketAdd(many[b], &ops[b]);
+        gfxDrawBucketSubmit(many[b]);
+    }
+
+    remaining = gfxDrawlistCollect(NULL, NULL, 0);
+    if (remaining != NUM_RETAINED + DRAWLIST_MAX_BUCKETS) {
+        trace("with too many buckets, expected %d entries, got %zu\n", NUM_RETAINED + DRAWLIST_MAX_BUCKETS, remaining);
+        failed = 1;
+    }
+
+    gfxDrawBucketAdd(many[DRAWLIST_MAX_BUCKETS], &ops[0]);
+    gfxDrawBucketSubmit(many[DRAWLIST_MAX_BUCKETS]);
+
+    remaining = gfxDrawlistCollect(NULL, NULL, 0);
+    if (remaining != NUM_RETAINED + 1) {
+        trace("the dropped bucket should work again, expected %d entries, got %zu\n", NUM_RETAINED + 1, remaining);
+        failed = 1;
+    }
+
+    for (int b = 0; b <= DRAWLIST_MAX_BUCKETS; ++b) {
+        gfxDrawBucketDestroy(many[b]);
+    }
+
+    for (int t = 0; t < NUM_THREADS; ++t) {
+        gfxDrawBucketDestroy(workers[t].bucket);
+    }
+    gfxDrawBucketDestroy(single);
+
+    gfxDrawlistDestroy();
+
+    zfree(ops);
+    zfree(retained);
+    zfree(expectedKeys);
+    zfree(keys);
+    zfree(expectedOps);
+    zfree(frameOps);
+
+    printf("%s: %s (%d threads, %d operations, %d frames)\n",
+        TEST_NAME, failed ? "FAILED" : "ok", NUM_THREADS, NUM_OPS, NUM_FRAMES);
+
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
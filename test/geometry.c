@@ -0,0 +1,507 @@
+/**
+ * This file is part of prototype.
+ *
+ * (c) 2014 Nicolas Hillegeer <nicolas@hillegeer.com>
+ *
+ * For the full copyright and license information, please view the LICENSE
+ * file that was distributed with the source code.
+ *
+ * Adds and removes lots of models of different sizes to a shared geometry
+ * that starts out way too small, so that it has to reuse holes, grow and
+ * defragment. Afterwards every model that's still alive has to find its
+ * own vertices and indices back. The geometry has 16-bit indices, the
+ * models are added with 8-bit ones, so they get widened on the way in.
+ * Also checks that big sheets get wide enough, optimized indices and that
+ * binary mesh files make it to the GPU unharmed. Needs a GL context,
+ * works headless on Mesa llvmpipe with:
+ *
+ * SDL_VIDEODRIVER=offscreen LIBGL_ALWAYS_SOFTWARE=1 ./geometry
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "util.h"
+#include "SDL.h"
+
+#define TEST_NAME "geometry"
+
+#define NUM_MODELS   256
+#define MAX_VERTICES 32
+#define MAX_INDICES  96
+#define NUM_ROUNDS   8
+
+/* same layout as the cube, see gfxCubeFormat() */
+struct vertex {
+    float position[4];
+    float color[4];
+};
+
+struct slot {
+    struct gfxModel model;
+    int alive;
+
+    struct vertex vertices[MAX_VERTICES];
+    GLubyte indices[MAX_INDICES];
+    size_t numVertices;
+    size_t numIndices;
+};
+
+static uint64_t xorshift(uint64_t *state) {
+    uint64_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    return *state = x;
+}
+
+/* every model gets recognizable contents */
+static void fillSlot(struct slot *slot, int id, uint64_t *rng) {
+    slot->numVertices = 1 + (size_t) (xorshift(rng) % MAX_VERTICES);
+    slot->numIndices = 1 + (size_t) (xorshift(rng) % MAX_INDICES);
+
+    for (size_t i = 0; i < slot->numVertices; ++i) {
+        for (int c = 0; c < 4; ++c) {
+            slot->vertices[i].position[c] = (float) id + (float) i * 0.25f + (float) c;
+            slot->vertices[i].color[c] = (float) -id - (float) i;
+        }
+    }
+
+    for (size_t i = 0; i < slot->numIndices; ++i) {
+        slot->indices[i] = (GLubyte) ((size_t) id * 7 + i);
+    }
+}
+
+static int checkSlot(const struct gfxGeometry *geometry, const struct slot *slot) {
+    const struct gfxModel *model = &slot->model;
+
+    struct vertex vertices[MAX_VERTICES];
+    GLushort indices[MAX_INDICES];
+
+    if (model->geometry != geometry || model->vao != geometry->vao) {
+        trace("model is not in the geometry anymore\n");
+        return 0;
+    }
+
+    glBindBuffer(GL_COPY_READ_BUFFER, geometry->vbo);
+    glGetBufferSubData(GL_COPY_READ_BUFFER, (GLintptr) (model->baseVertex * (GLint) sizeof(struct vertex)),
+        (GLsizeiptr) (slot->numVertices * sizeof(struct vertex)), vertices);
+
+    glBindBuffer(GL_COPY_READ_BUFFER, geometry->ibo);
+    glGetBufferSubData(GL_COPY_READ_BUFFER, (GLintptr) (model->firstIndex * sizeof(GLushort)),
+        (GLsizeiptr) (slot->numIndices * sizeof(GLushort)), indices);
+    glBindBuffer(GL_COPY_READ_BUFFER, 0);
+
+    GL_ERROR("read back geometry");
+
+    if (memcmp(vertices, slot->vertices, slot->numVertices * sizeof(struct vertex)) != 0) {
+        trace("vertices of the model at %d got corrupted\n", model->baseVertex);
+        return 0;
+    }
+
+    for (size_t i = 0; i < slot->numIndices; ++i) {
+        if (indices[i] != slot->indices[i]) {
+            trace("indices of the model at %u got corrupted\n", model->firstIndex);
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+/* the allocated ranges can't overlap and have to add up to what the
+ * allocators think is in use */
+static int checkRanges(const struct gfxGeometry *geometry, const struct slot *slots) {
+    static unsigned char vertexOwner[1 << 16];
+    static unsigned char indexOwner[1 << 16];
+
+    if (geometry->vertices.capacity > sizeof(vertexOwner) || geometry->indices.capacity > sizeof(indexOwner)) {
+        trace("geometry grew way more than expected\n");
+        return 0;
+    }
+
+    memset(vertexOwner, 0, sizeof(vertexOwner));
+    memset(indexOwner, 0, sizeof(indexOwner));
+
+    size_t vertices = 0;
+    size_t indices = 0;
+
+    for (int i = 0; i < NUM_MODELS; ++i) {
+        const struct gfxModel *model = &slots[i].model;
+        if (!slots[i].alive) continue;
+
+        for (size_t v = 0; v < model->numVertices; ++v) {
+            if (vertexOwner[(size_t) model->baseVertex + v]++) {
+                trace("vertex ranges overlap at %zu\n", (size_t) model->baseVertex + v);
+                return 0;
+            }
+        }
+
+        for (size_t j = 0; j < (size_t) model->numIndices; ++j) {
+            if (indexOwner[model->firstIndex + j]++) {
+                trace("index ranges overlap at %zu\n", model->firstIndex + j);
+                return 0;
+            }
+        }
+
+        vertices += model->numVertices;
+        indices += (size_t) model->numIndices;
+    }
+
+    if (vertices != geometry->vertices.used || indices != geometry->indices.used) {
+        trace("%zu vertices and %zu indices in use, the geometry thinks %zu and %zu\n",
+            vertices, indices, geometry->vertices.used, geometry->indices.used);
+        return 0;
+    }
+
+    return 1;
+}
+
+/* a sheet with more vertices than a GLubyte can address has to pick a
+ * wider index type, it has to reach every vertex, and it should come out
+ * of the vertex cache optimizer */
+static int checkSheet(unsigned int subdiv, GLenum expected) {
+    struct gfxModel sheet;
+    gfxSheet(&sheet, 1.0f, 1.0f, subdiv);
+
+    const size_t numVertices = (size_t) (subdiv + 1) * (subdiv + 1);
+    const size_t numIndices = 6 * (size_t) subdiv * subdiv;
+
+    if (sheet.indexType != expected || sheet.numIndices != (int) numIndices) {
+        trace("sheet of %u: index type %#x and %d indices\n", subdiv, sheet.indexType, sheet.numIndices);
+        gfxDestroyModel(&sheet);
+        return 0;
+    }
+
+    GLuint *indices = zmalloc(numIndices * sizeof(GLuint));
+
+    glBindBuffer(GL_COPY_READ_BUFFER, sheet.ibo);
+    glGetBufferSubData(GL_COPY_READ_BUFFER, 0, (GLsizeiptr) (numIndices * gfxIndexSize(sheet.indexType)), indices);
+    glBindBuffer(GL_COPY_READ_BUFFER, 0);
+
+    gfxConvertIndices(indices, GL_UNSIGNED_INT, indices, sheet.indexType, numIndices);
+
+    GLuint max = 0;
+    for (size_t i = 0; i < numIndices; ++i) {
+        if (indices[i] > max) max = indices[i];
+    }
+
+    struct gfxVertexCacheStats stats;
+    gfxVertexCacheStats(&stats, indices, numIndices, numVertices, GFX_VCACHE_SIZE);
+
+    zfree(indices);
+    gfxDestroyModel(&sheet);
+
+    if (max != numVertices - 1) {
+        trace("sheet of %u: the highest index is %u instead of %zu\n", subdiv, max, numVertices - 1);
+        return 0;
+    }
+
+    /* generation order gets an ACMR of about 1.0 */
+    if (stats.acmr > 0.8f) {
+        trace("sheet of %u: ACMR of %.3f, not optimized\n", subdiv, stats.acmr);
+        return 0;
+    }
+
+    return 1;
+}
+
+/* writes a binary mesh in the cube format and loads it into the geometry,
+ * its vertices and indices have to end up in the buffers as they were */
+static int checkMeshFile(struct gfxGeometry *geometry) {
+    const char *filename = "geometry_test.mesh";
+
+    static struct vertex vertices[MAX_VERTICES];
+    GLushort indices[MAX_INDICES];
+
+    for (int i = 0; i < MAX_VERTICES; ++i) {
+        for (int c = 0; c < 4; ++c) {
+            vertices[i].position[c] = (float) (i * 4 + c);
+            vertices[i].color[c] = 1.0f / (float) (i + c + 1);
+        }
+    }
+
+    for (int i = 0; i < MAX_INDICES; ++i) {
+        indices[i] = (GLushort) ((i * 5) % MAX_VERTICES);
+    }
+
+    struct gfxMesh mesh;
+    memset(&mesh, 0x0, sizeof(mesh));
+
+    struct gfxMeshHeader *header = &mesh.header;
+    header->stride = (uint32_t) geometry->format.stride;
+    header->numAttribs = geometry->format.numAttribs;
+
+    for (unsigned int i = 0; i < geometry->format.numAttribs; ++i) {
+        const struct gfxVertexAttrib *attrib = &geometry->format.attribs[i];
+        header->attribs[i] = (struct gfxMeshAttrib) {
+            attrib->index, (uint32_t) attrib->size, attrib->type, attrib->normalized, attrib->offset
+        };
+    }
+
+    header->numVertices = MAX_VERTICES;
+    header->numIndices = MAX_INDICES;
+    header->indexType = GFX_MESH_UNSIGNED_SHORT;
+
+    mesh.vertices = vertices;
+    mesh.indices = indices;
+
+    if (gfxWriteMesh(&mesh, filename) != GFX_MESH_OK) {
+        trace("could not write %s\n", filename);
+        return 0;
+    }
+
+    struct slot slot;
+    memset(&slot, 0x0, sizeof(slot));
+
+    int ok = gfxLoadMesh(&slot.model, geometry, filename);
+    remove(filename);
+
+    if (!ok) {
+        trace("could not load %s\n", filename);
+        return 0;
+    }
+
+    memcpy(slot.vertices, vertices, sizeof(vertices));
+    for (int i = 0; i < MAX_INDICES; ++i) slot.indices[i] = (GLubyte) indices[i];
+    slot.numVertices = MAX_VERTICES;
+    slot.numIndices = MAX_INDICES;
+
+    ok = checkSlot(geometry, &slot);
+
+    gfxDestroyModel(&slot.model);
+
+    return ok;
+}
+
+/* writes an OBJ with one polygon, optionally after a comment that's too
+ * long to parse, and returns what parsing it says */
+static gfx_mesh_error_t parsePolygon(const char *filename, int corners, int longLine) {
+    FILE *file = fopen(filename, "w");
+
+    if (longLine) fprintf(file, "# %0600d\n", 0);
+
+    for (int i = 0; i < corners; ++i) fprintf(file, "v %d %d 0\n", i, i * i);
+
+    fprintf(file, "f");
+    for (int i = 1; i <= corners; ++i) fprintf(file, " %d", i);
+    fprintf(file, "\n");
+
+    fclose(file);
+
+    struct gfxMesh mesh;
+    const gfx_mesh_error_t error = gfxParseObj(&mesh, filename);
+    if (error == GFX_MESH_OK) gfxFreeMesh(&mesh);
+
+    return error;
+}
+
+/* meshes that would have the GPU read out of bounds, and OBJ files that
+ * would get cut short, must not load */
+static int checkBrokenFiles(void) {
+    const char *filename = "geometry_test.broken";
+    int ok = 1;
+
+    float vertices[3][4] = { { 0 } };
+    GLubyte indices[3] = { 0, 1, 3 };
+
+    struct gfxMesh mesh;
+    memset(&mesh, 0x0, sizeof(mesh));
+
+    mesh.header.stride = sizeof(vertices[0]);
+    mesh.header.numAttribs = 1;
+    mesh.header.attribs[0] = (struct gfxMeshAttrib) { GFX_VERTEX, 4, GFX_MESH_FLOAT, 0, 0 };
+    mesh.header.numVertices = 3;
+    mesh.header.numIndices = 3;
+    mesh.header.indexType = GFX_MESH_UNSIGNED_BYTE;
+    mesh.vertices = vertices;
+    mesh.indices = indices;
+
+    struct gfxMesh mapped;
+
+    if (gfxWriteMesh(&mesh, filename) != GFX_MESH_OK || gfxMapMesh(&mapped, filename) != GFX_MESH_ERROR_FORMAT) {
+        trace("a mesh with an index past its last vertex got mapped\n");
+        ok = 0;
+    }
+
+    if (parsePolygon(filename, 64, 0) != GFX_MESH_OK) {
+        trace("a polygon with 64 corners didn't parse\n");
+        ok = 0;
+    }
+
+    if (parsePolygon(filename, 65, 0) != GFX_MESH_ERROR_PARSE) {
+        trace("a polygon with 65 corners parsed\n");
+        ok = 0;
+    }
+
+    if (parsePolygon(filename, 3, 1) != GFX_MESH_ERROR_PARSE) {
+        trace("a file with a line that's too long parsed\n");
+        ok = 0;
+    }
+
+    remove(filename);
+
+    return ok;
+}
+
+int main(int argc, char const *argv[]) {
+    trace("setting up test: " TEST_NAME "\n");
+
+    SDL_Init(SDL_INIT_VIDEO);
+
+    SDL_GL_SetAttribute(SDL_GL_CONTEXT_MAJOR_VERSION, 3);
+    SDL_GL_SetAttribute(SDL_GL_CONTEXT_MINOR_VERSION, 2);
+    SDL_GL_SetAttribute(SDL_GL_CONTEXT_PROFILE_MASK, SDL_GL_CONTEXT_PROFILE_CORE);
+
+    SDL_Window *window = SDL_CreateWindow(
+        "geometry test",
+        SDL_WINDOWPOS_UNDEFINED,
+        SDL_WINDOWPOS_UNDEFINED,
+        64, 64,
+        SDL_WINDOW_OPENGL | SDL_WINDOW_HIDDEN
+    );
+
+    if (!window) {
+        trace("could not create a window: %s\n", SDL_GetError());
+        return EXIT_FAILURE;
+    }
+
+    SDL_GLContext glcontext = SDL_GL_CreateContext(window);
+
+    if (!glcontext) {
+        trace("could not create an OpenGL context: %s\n", SDL_GetError());
+        return EXIT_FAILURE;
+    }
+
+    struct gfxVertexFormat format;
+    gfxCubeFormat(&format);
+
+    if (format.stride != sizeof(struct vertex)) {
+        trace("the cube format isn't what this test expects\n");
+        return EXIT_FAILURE;
+    }
+
+    struct gfxGeometry geometry;
+    gfxCreateGeometry(&geometry, &format, GL_UNSIGNED_SHORT, 16, 16);
+
+    static struct slot slots[NUM_MODELS];
+    uint64_t rng = 0x9E3779B97F4A7C15ULL;
+
+    trace("starting test: " TEST_NAME "\n");
+
+    int failed = 0;
+    int id = 0;
+
+    for (int round = 0; round < NUM_ROUNDS && !failed; ++round) {
+        /* fill up every free slot */
+        for (int i = 0; i < NUM_MODELS; ++i) {
+            struct slot *slot = &slots[i];
+            if (slot->alive) continue;
+
+            fillSlot(slot, ++id, &rng);
+
+            if (!gfxGeometryAdd(&geometry, &slot->model, slot->vertices, slot->numVertices,
+                    slot->indices, GL_UNSIGNED_BYTE, slot->numIndices)) {
+                trace("could not add model %d\n", id);
+                failed = 1;
+                break;
+            }
+
+            slot->alive = 1;
+        }
+
+        /* and punch random holes in the geometry */
+        for (int i = 0; i < NUM_MODELS; ++i) {
+            if (slots[i].alive && xorshift(&rng) % 2) {
+                gfxDestroyModel(&slots[i].model);
+                slots[i].alive = 0;
+            }
+        }
+
+        /* the holes should be reused before growing */
+        const size_t vertexCapacity = geometry.vertices.capacity;
+        const size_t indexCapacity = geometry.indices.capacity;
+
+        struct slot *small = NULL;
+        for (int i = 0; i < NUM_MODELS && !small; ++i) {
+            if (!slots[i].alive) small = &slots[i];
+        }
+
+        if (small) {
+            fillSlot(small, ++id, &rng);
+            small->numVertices = 1;
+            small->numIndices = 1;
+
+            gfxGeometryAdd(&geometry, &small->model, small->vertices, 1, small->indices, GL_UNSIGNED_BYTE, 1);
+            small->alive = 1;
+
+            if (geometry.vertices.capacity != vertexCapacity || geometry.indices.capacity != indexCapacity) {
+                trace("round %d: the geometry grew while there were holes\n", round);
+                failed = 1;
+            }
+        }
+
+        if (!checkRanges(&geometry, slots)) failed = 1;
+
+        for (int i = 0; i < NUM_MODELS && !failed; ++i) {
+            if (slots[i].alive && !checkSlot(&geometry, &slots[i])) {
+                trace("round %d: model in slot %d is broken\n", round, i);
+                failed = 1;
+            }
+        }
+    }
+
+    gfxGeometryDefrag(&geometry);
+
+    if (!failed && (geometry.vertices.numFree > 1 || geometry.indices.numFree > 1)) {
+        trace("still fragmented after defragmenting (%zu and %zu free ranges)\n",
+            geometry.vertices.numFree, geometry.indices.numFree);
+        failed = 1;
+    }
+
+    if (!failed && !checkRanges(&geometry, slots)) failed = 1;
+
+    for (int i = 0; i < NUM_MODELS && !failed; ++i) {
+        if (slots[i].alive && !checkSlot(&geometry, &slots[i])) {
+            trace("model in slot %d is broken after defragmenting\n", i);
+            failed = 1;
+        }
+    }
+
+    printf("%d models added, %u alive in %zu/%zu vertices and %zu/%zu indices\n",
+        id, geometry.numModels, geometry.vertices.used, geometry.vertices.capacity,
+        geometry.indices.used, geometry.indices.capacity);
+
+    for (int i = 0; i < NUM_MODELS; ++i) {
+        if (slots[i].alive) gfxDestroyModel(&slots[i].model);
+    }
+
+    if (!failed && (geometry.numModels != 0 || geometry.vertices.used != 0 || geometry.indices.used != 0)) {
+        trace("the geometry isn't empty after destroying all models\n");
+        failed = 1;
+    }
+
+    if (!failed && !checkMeshFile(&geometry)) {
+        trace("the mesh file didn't survive the round trip\n");
+        failed = 1;
+    }
+
+    if (!failed && !checkBrokenFiles()) {
+        failed = 1;
+    }
+
+    gfxDestroyGeometry(&geometry);
+
+    if (!failed && (!checkSheet(12, GL_UNSIGNED_BYTE) || !checkSheet(64, GL_UNSIGNED_SHORT) || !checkSheet(300, GL_UNSIGNED_INT))) {
+        failed = 1;
+    }
+
+    SDL_GL_DeleteContext(glcontext);
+    SDL_DestroyWindow(window);
+    SDL_Quit();
+
+    printf("%s: %s\n", TEST_NAME, failed ? "FAILED" : "ok");
+
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,196 @@
+/**
+ * This file is part of prototype.
+ *
+ * (c) 2014 Nicolas Hillegeer <nicolas@hillegeer.com>
+ *
+ * For the full copyright and license information, please view the LICENSE
+ * file that was distributed with the source code.
+ *
+ * Inserts, moves and removes objects of all sizes in a loose grid, frame
+ * after frame, some of them bigger than the biggest cells. After every
+ * commit the frustum and radius queries have to find exactly what testing
+ * every object finds (gfxCullBoxes for the frustum), and removed objects
+ * and stale handles must not turn up anywhere. Doesn't need a GL context.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "math/math.h"
+
+#include "util.h"
+
+#define TEST_NAME "grid"
+
+#define NUM_OBJECTS 2048
+#define NUM_FRAMES  32
+#define WORLD       50.0f
+
+struct object {
+    aabb box;
+    gfxGridHandle handle;
+};
+
+static const float gCenter[3] = { 5.0f, -2.0f, -20.0f };
+static const float gRadius = 12.0f;
+
+static uint64_t xorshift(uint64_t *state) {
+    uint64_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    return *state = x;
+}
+
+static float randf(uint64_t *state, float lo, float hi) {
+    return lo + (hi - lo) * (float) (xorshift(state) >> 40) / (float) (1 << 24);
+}
+
+static void place(uint64_t *state, struct object *obj, size_t i) {
+    const float cx = randf(state, -WORLD, WORLD);
+    const float cy = randf(state, -WORLD, WORLD);
+    const float cz = randf(state, -WORLD, WORLD);
+
+    float e = randf(state, 0.1f, 1.0f);
+    if (i % 50 == 0) e *= 16.0f;
+    if (i % 500 == 0) e = 1e5f;
+
+    obj->box.min = vec(cx - e, cy - e, cz - e, 1.0f);
+    obj->box.max = vec(cx + e, cy + e, cz + e, 1.0f);
+}
+
+static void setBit(uint32_t id, void *userdata) {
+    uint32_t *mask = userdata;
+    mask[id >> 5] |= 1u << (id & 31);
+}
+
+/* the same test as the grid */
+static int touchesSphere(const aabb *box, const float center[3], float radius) {
+    const vec4 c = vec(center[0], center[1], center[2], 1.0f);
+    const vec4 d = vmax(vmax(box->min - c, c - box->max), vzero());
+    return vdot3(d, d)[0] <= radius * radius;
+}
+
+/* how many objects the grid and brute force disagree on */
+static size_t check(const struct gfxGrid *grid, const struct object *objects, struct gfxBoxes *boxes,
+                    const frustum *fru) {
+    uint32_t expected[GFX_CULL_WORDS(NUM_OBJECTS)];
+    uint32_t found[GFX_CULL_WORDS(NUM_OBJECTS)];
+    uint32_t alive[GFX_CULL_WORDS(NUM_OBJECTS)];
+    size_t wrong = 0;
+
+    memset(alive, 0x0, sizeof(alive));
+    for (size_t i = 0; i < NUM_OBJECTS; ++i) {
+        gfxBoxesSet(boxes, i, &objects[i].box);
+        if (objects[i].handle != GFX_GRID_HANDLE_NONE) setBit((uint32_t) i, alive);
+    }
+
+    gfxCullBoxes(boxes, fru, expected);
+    memset(found, 0x0, sizeof(found));
+    gfxGridCullFrustum(grid, fru, setBit, found);
+
+    for (size_t w = 0; w < ARRAY_SIZE(found); ++w) {
+        wrong += (size_t) __builtin_popcount((expected[w] & alive[w]) ^ found[w]);
+    }
+
+    memset(expected, 0x0, sizeof(expected));
+    memset(found, 0x0, sizeof(found));
+    for (size_t i = 0; i < NUM_OBJECTS; ++i) {
+        if (touchesSphere(&objects[i].box, gCenter, gRadius)) setBit((uint32_t) i, expected);
+    }
+    gfxGridRadius(grid, gCenter, gRadius, setBit, found);
+
+    for (size_t w = 0; w < ARRAY_SIZE(found); ++w) {
+        wrong += (size_t) __builtin_popcount((expected[w] & alive[w]) ^ found[w]);
+    }
+
+    return wrong;
+}
+
+int main(int argc, char const *argv[]) {
+    trace("setting up test: " TEST_NAME "\n");
+
+    static struct object objects[NUM_OBJECTS];
+    uint64_t state = 0x9E3779B97F4A7C15ULL;
+
+    static frustum fru;
+    frustum_from_mat(&fru, mat_perspective_fovy(GFX_PI / 3.0f, 16.0f / 9.0f, 0.1f, 60.0f));
+
+    struct gfxGrid *grid = gfxGridCreate(1.0f);
+
+    struct gfxBoxes boxes;
+    gfxBoxesInit(&boxes, NUM_OBJECTS);
+    boxes.count = NUM_OBJECTS;
+
+    for (size_t i = 0; i < NUM_OBJECTS; ++i) {
+        place(&state, &objects[i], i);
+        objects[i].handle = gfxGridInsert(grid, &objects[i].box, (uint32_t) i);
+    }
+    gfxGridCommit(grid);
+
+    trace("starting test: " TEST_NAME "\n");
+
+    int failed = 0;
+    size_t alive = NUM_OBJECTS;
+
+    for (int frame = 0; frame < NUM_FRAMES && !failed; ++frame) {
+        const size_t wrong = check(grid, objects, &boxes, &fru);
+
+        if (wrong || gfxGridCount(grid) != alive) {
+            trace("frame %d: the grid has %zu of %zu objects and disagrees with brute force on %zu\n",
+                frame, gfxGridCount(grid), alive, wrong);
+            failed = 1;
+        }
+
+        /* most objects drift a little, some jump across the world (and
+         * levels), some die and some come back */
+        for (size_t i = 0; i < NUM_OBJECTS; ++i) {
+            struct object *obj = &objects[i];
+            const uint64_t r = xorshift(&state) % 100;
+
+            if (obj->handle == GFX_GRID_HANDLE_NONE) {
+                if (r < 20) {
+                    place(&state, obj, i);
+                    obj->handle = gfxGridInsert(grid, &obj->box, (uint32_t) i);
+                    ++alive;
+                }
+            } else if (r < 2) {
+                /* the stale handle must be ignored */
+                const gfxGridHandle stale = obj->handle;
+                gfxGridRemove(grid, obj->handle);
+                gfxGridMove(grid, stale, &obj->box);
+                obj->handle = GFX_GRID_HANDLE_NONE;
+                --alive;
+            } else if (r < 5) {
+                place(&state, obj, i);
+                gfxGridMove(grid, obj->handle, &obj->box);
+            } else {
+                const vec4 v = vec(randf(&state, -0.3f, 0.3f), randf(&state, -0.3f, 0.3f), randf(&state, -0.3f, 0.3f), 0.0f);
+                obj->box.min += v;
+                obj->box.max += v;
+                gfxGridMove(grid, obj->handle, &obj->box);
+            }
+        }
+
+        gfxGridCommit(grid);
+    }
+
+    if (!failed) {
+        const size_t wrong = check(grid, objects, &boxes, &fru);
+
+        if (wrong || gfxGridCount(grid) != alive) {
+            trace("at the end, the grid has %zu of %zu objects and disagrees with brute force on %zu\n",
+                gfxGridCount(grid), alive, wrong);
+            failed = 1;
+        }
+    }
+
+    printf("%s: %s (%zu of %d objects alive after %d frames)\n", TEST_NAME,
+        failed ? "FAILED" : "ok", alive, NUM_OBJECTS, NUM_FRAMES);
+
+    gfxGridDestroy(grid);
+    gfxBoxesDestroy(&boxes);
+
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
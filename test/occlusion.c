@@ -0,0 +1,239 @@
+/**
+ * This file is part of prototype.
+ *
+ * (c) 2014 Nicolas Hillegeer <nicolas@hillegeer.com>
+ *
+ * For the full copyright and license information, please view the LICENSE
+ * file that was distributed with the source code.
+ *
+ * Rasterizes a wall and a floor (which crosses the near plane, so it gets
+ * clipped) into the software occlusion buffer and checks which boxes end
+ * up hidden. The tiles get rasterized by a bunch of threads as well, which
+ * has to give exactly the same depth buffer as doing them all on a single
+ * thread. Doesn't need a GL context.
+ */
+
+#include <math.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "math/math.h"
+
+#include "util.h"
+
+#define TEST_NAME "occlusion"
+
+#define WIDTH       256
+#define HEIGHT      128
+#define NUM_THREADS 4
+
+#define NEAR 0.1f
+#define FAR  100.0f
+
+struct worker {
+    pthread_t thread;
+    struct gfxOcclusion *oc;
+    int index;
+};
+
+static const float gWall[] = {
+    -5.0f, -3.0f, -10.0f,
+     5.0f, -3.0f, -10.0f,
+     5.0f,  3.0f, -10.0f,
+    -5.0f,  3.0f, -10.0f
+};
+
+/* at y = 0, it gets moved down by its world matrix */
+static const float gFloor[] = {
+    -100.0f, 0.0f,   10.0f,
+     100.0f, 0.0f,   10.0f,
+     100.0f, 0.0f, -100.0f,
+    -100.0f, 0.0f, -100.0f
+};
+
+static const uint32_t gFront[] = { 0, 1, 2, 0, 2, 3 };
+static const uint32_t gBack[]  = { 0, 2, 1, 0, 3, 2 };
+
+static const struct {
+    const char *name;
+    float min[3];
+    float max[3];
+    int visible;
+} gBoxes[] = {
+    { "behind the wall",            {  -1.0f, -1.0f, -21.0f }, {  1.0f,  1.0f, -19.0f }, 0 },
+    { "in front of the wall",       {  -0.5f, -0.5f,  -5.5f }, {  0.5f,  0.5f,  -4.5f }, 1 },
+    { "peeking around the wall",    {   9.0f, -1.0f, -21.0f }, { 12.0f,  1.0f, -19.0f }, 1 },
+    { "under the floor",            {  -1.0f, -6.0f, -31.0f }, {  1.0f, -4.0f, -29.0f }, 0 },
+    { "crossing the near plane",    {  -1.0f, -1.0f,  -1.0f }, {  1.0f,  1.0f,   1.0f }, 1 },
+    { "next to the wall",           { -31.0f,  0.0f, -41.0f }, {-29.0f,  2.0f, -39.0f }, 1 },
+    { "far behind the wall",        {  -2.0f, -2.0f, -80.0f }, {  2.0f,  2.0f, -70.0f }, 0 },
+};
+
+/* every thread takes every NUM_THREADS'th tile, backwards */
+static void *rasterize(void *arg) {
+    struct worker *w = arg;
+    const int tiles = (int) gfxOcclusionNumTiles(w->oc);
+
+    for (int t = tiles - 1; t >= 0; --t) {
+        if (t % NUM_THREADS == w->index) gfxOcclusionRasterizeTile(w->oc, (unsigned int) t);
+    }
+
+    return NULL;
+}
+
+static void addScene(struct gfxOcclusion *oc, const mat4 *viewproj, const uint32_t *wallIndices) {
+    const mat4 identity = midentity();
+    const mat4 floorWorld = mtranslate(vec(0.0f, -2.0f, 0.0f, 0.0f));
+
+    gfxOcclusionBegin(oc, viewproj);
+    gfxOcclusionAddOccluder(oc, &identity, gWall, 3 * sizeof(float), 4, wallIndices, 6);
+    gfxOcclusionAddOccluder(oc, &floorWorld, gFloor, 3 * sizeof(float), 4, gFront, 6);
+}
+
+static int testBoxes(const struct gfxOcclusion *oc, int wallOccludes) {
+    int failed = 0;
+
+    for (size_t i = 0; i < ARRAY_SIZE(gBoxes); ++i) {
+        aabb box;
+        box.min = vec(gBoxes[i].min[0], gBoxes[i].min[1], gBoxes[i].min[2], 1.0f);
+        box.max = vec(gBoxes[i].max[0], gBoxes[i].max[1], gBoxes[i].max[2], 1.0f);
+
+        /* without the wall, only the box under the floor stays hidden */
+        const int expected = wallOccludes ? gBoxes[i].visible : (gBoxes[i].visible || gBoxes[i].max[1] > -2.0f);
+        const int visible = gfxOcclusionTestBox(oc, &box);
+
+        if (visible != expected) {
+            trace("box %s: expected it to be %s\n", gBoxes[i].name, expected ? "visible" : "occluded");
+            failed = 1;
+        }
+    }
+
+    return failed;
+}
+
+/* the depth of a point at distance d in front of the camera, see
+ * mat_perspective_fovy */
+static float windowDepth(float d) {
+    const float ndc = ((FAR + NEAR) * d - 2.0f * FAR * NEAR) / ((FAR - NEAR) * d);
+    return ndc * 0.5f + 0.5f;
+}
+
+int main(int argc, char const *argv[]) {
+    trace("setting up test: " TEST_NAME "\n");
+
+    zmalloc_enable_thread_safeness();
+
+    /* the camera is in the origin, looking down -z */
+    const mat4 viewproj = mat_perspective_fovy(3.14159265f / 3.0f, (float) WIDTH / (float) HEIGHT, NEAR, FAR);
+
+    struct gfxOcclusion *oc = gfxOcclusionCreate(WIDTH, HEIGHT);
+    float *reference = zmalloc(WIDTH * HEIGHT * sizeof(float));
+
+    trace("starting test: " TEST_NAME "\n");
+
+    int failed = 0;
+    unsigned int width, height;
+
+    /* reference: all tiles on this thread */
+    addScene(oc, &viewproj, gFront);
+    gfxOcclusionRasterize(oc);
+    gfxOcclusionFinish(oc);
+
+    const float *depth = gfxOcclusionDepth(oc, &width, &height);
+    memcpy(reference, depth, WIDTH * HEIGHT * sizeof(float));
+
+    const float center = depth[(HEIGHT / 2) * WIDTH + WIDTH / 2];
+    if (fabsf(center - windowDepth(10.0f)) > 1e-4f) {
+        trace("the wall should be at depth %f in the center, found %f\n", (double) windowDepth(10.0f), (double) center);
+        failed = 1;
+    }
+
+    if (depth[(HEIGHT - 1) * WIDTH + WIDTH / 2] < 1.0f) {
+        trace("there should be nothing at the top of the screen, found depth %f\n",
+            (double) depth[(HEIGHT - 1) * WIDTH + WIDTH / 2]);
+        failed = 1;
+    }
+
+    if (!(depth[WIDTH / 2] < center)) {
+        trace("the floor should be in front of the wall at the bottom of the screen, found depth %f\n",
+            (double) depth[WIDTH / 2]);
+        failed = 1;
+    }
+
+    failed |= testBoxes(oc, 1);
+
+    /* a whole bunch of boxes at once, same answers */
+    struct gfxBoxes boxes;
+    gfxBoxesInit(&boxes, 0);
+
+    for (int x = -20; x < 20; ++x) {
+        for (int y = -8; y < 8; ++y) {
+            const float z = -5.0f - (float) ((x * 7 + y * 13) & 31) * 2.0f;
+            const aabb box = {
+                vec((float) x, (float) y, z - 0.5f, 1.0f),
+                vec((float) x + 0.8f, (float) y + 0.8f, z + 0.5f, 1.0f)
+            };
+            gfxBoxesAdd(&boxes, &box);
+        }
+    }
+
+    uint32_t *visible = zmalloc(GFX_CULL_WORDS(boxes.count) * sizeof(uint32_t));
+    memset(visible, 0xFF, GFX_CULL_WORDS(boxes.count) * sizeof(uint32_t));
+
+    const size_t occluded = gfxOcclusionCullBoxes(oc, &boxes, visible);
+    size_t mismatches = 0;
+
+    for (size_t i = 0; i < boxes.count; ++i) {
+        const aabb box = {
+            vec(boxes.minX[i], boxes.minY[i], boxes.minZ[i], 1.0f),
+            vec(boxes.maxX[i], boxes.maxY[i], boxes.maxZ[i], 1.0f)
+        };
+        mismatches += (size_t) (gfxOcclusionTestBox(oc, &box) != (int) ((visible[i >> 5] >> (i & 31)) & 1));
+    }
+
+    if (mismatches || occluded == 0 || occluded == boxes.count) {
+        trace("culling %zu boxes at once: %zu occluded, %zu mismatches\n", boxes.count, occluded, mismatches);
+        failed = 1;
+    }
+
+    /* the same frame from a bunch of threads */
+    addScene(oc, &viewproj, gFront);
+
+    struct worker workers[NUM_THREADS];
+    for (int t = 0; t < NUM_THREADS; ++t) {
+        workers[t].oc = oc;
+        workers[t].index = t;
+        pthread_create(&workers[t].thread, NULL, rasterize, &workers[t]);
+    }
+
+    for (int t = 0; t < NUM_THREADS; ++t) {
+        pthread_join(workers[t].thread, NULL);
+    }
+
+    gfxOcclusionFinish(oc);
+
+    if (memcmp(reference, gfxOcclusionDepth(oc, &width, &height), WIDTH * HEIGHT * sizeof(float)) != 0) {
+        trace("rasterizing from %d threads gives a different depth buffer\n", NUM_THREADS);
+        failed = 1;
+    }
+
+    failed |= testBoxes(oc, 1);
+
+    /* a wall that faces away doesn't occlude anything */
+    addScene(oc, &viewproj, gBack);
+    gfxOcclusionRasterize(oc);
+    gfxOcclusionFinish(oc);
+
+    failed |= testBoxes(oc, 0);
+
+    gfxBoxesDestroy(&boxes);
+    zfree(visible);
+    zfree(reference);
+    gfxOcclusionDestroy(oc);
+
+    printf("%s: %s (%dx%d, %d threads)\n", TEST_NAME, failed ? "FAILED" : "ok", WIDTH, HEIGHT, NUM_THREADS);
+
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,209 @@
+/**
+ * This file is part of prototype.
+ *
+ * (c) 2014 Nicolas Hillegeer <nicolas@hillegeer.com>
+ *
+ * For the full copyright and license information, please view the LICENSE
+ * file that was distributed with the source code.
+ *
+ * Allocates and frees objects the size of a gfxRenderParams from a pool,
+ * directly and through per-thread caches from a bunch of threads at once.
+ * Objects have to be aligned, never handed out twice, freed objects get
+ * reused before the pool grows, and the poisoning has to leave its marks.
+ * Doesn't need a GL context.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "util.h"
+
+#define TEST_NAME "pool"
+
+#define NUM_OBJECTS 1000
+#define NUM_THREADS 4
+#define NUM_LIVE    256
+#define NUM_OPS     100000
+
+struct object {
+    _Alignas(16) float matrix[16];
+    unsigned int owner;
+    unsigned int serial;
+};
+
+WF_POOL_TYPE(objectPool, struct object)
+
+struct worker {
+    pthread_t thread;
+    struct wfPool *pool;
+    unsigned int index;
+    int failed;
+};
+
+static uint64_t xorshift(uint64_t *state) {
+    uint64_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    return *state = x;
+}
+
+static size_t tagUsed(enum wfMemTag tag) {
+    struct wfMemTagStats stats;
+    wfMemTagGetStats(tag, &stats);
+    return stats.used;
+}
+
+/* every thread keeps a bunch of objects alive through its cache and
+ * checks that nobody else wrote to them in the meantime */
+static void *churn(void *arg) {
+    struct worker *w = arg;
+    struct object *live[NUM_LIVE] = { NULL };
+    uint64_t state = 0x9E3779B97F4A7C15ULL * (w->index + 1);
+
+    struct wfPoolCache cache;
+    wfPoolCacheInit(&cache, w->pool);
+
+    for (unsigned int op = 0; op < NUM_OPS; ++op) {
+        const size_t i = (size_t) (xorshift(&state) % NUM_LIVE);
+
+        if (live[i]) {
+            if (live[i]->owner != w->index || live[i]->serial != (unsigned int) i) {
+                w->failed = 1;
+            }
+            objectPoolCacheFree(&cache, live[i]);
+            live[i] = NULL;
+        } else {
+            live[i] = objectPoolCacheAlloc(&cache);
+            live[i]->owner = w->index;
+            live[i]->serial = (unsigned int) i;
+        }
+    }
+
+    for (size_t i = 0; i < NUM_LIVE; ++i) objectPoolCacheFree(&cache, live[i]);
+    wfPoolCacheFlush(&cache);
+
+    return NULL;
+}
+
+int main(int argc, char const *argv[]) {
+    trace("setting up test: " TEST_NAME "\n");
+
+    zmalloc_enable_thread_safeness();
+
+    static struct object *objects[NUM_OBJECTS];
+
+    struct wfPool pool;
+    wfPoolCreate(&pool, sizeof(struct object), _Alignof(struct object), WF_MEM_GFX);
+    pool.poison = 1;
+
+    trace("starting test: " TEST_NAME "\n");
+
+    int failed = 0;
+
+    for (size_t i = 0; i < NUM_OBJECTS; ++i) {
+        objects[i] = objectPoolAlloc(&pool);
+
+        if ((uintptr_t) objects[i] % _Alignof(struct object)) {
+            trace("object %zu at %p is not aligned\n", i, (void *) objects[i]);
+            failed = 1;
+        }
+
+        const unsigned char *bytes = (const unsigned char *) objects[i];
+        if (bytes[0] != WF_POOL_FRESH || bytes[sizeof(struct object) - 1] != WF_POOL_FRESH) {
+            trace("object %zu doesn't look fresh\n", i);
+            failed = 1;
+        }
+
+        objects[i]->serial = (unsigned int) i;
+    }
+
+    for (size_t i = 0; i < NUM_OBJECTS; ++i) {
+        if (objects[i]->serial != (unsigned int) i) {
+            trace("object %zu got overwritten by another one\n", i);
+            failed = 1;
+        }
+    }
+
+    if (pool.live != NUM_OBJECTS || tagUsed(WF_MEM_GFX) == 0) {
+        trace("%zu objects live in the pool, %zu bytes under its tag\n", pool.live, tagUsed(WF_MEM_GFX));
+        failed = 1;
+    }
+
+    /* freeing every other object and allocating as many again shouldn't
+     * make the pool any bigger */
+    const size_t capacity = pool.capacity;
+
+    for (size_t i = 0; i < NUM_OBJECTS; i += 2) {
+        objectPoolFree(&pool, objects[i]);
+
+        const unsigned char *bytes = (const unsigned char *) objects[i];
+        if (bytes[sizeof(void *)] != WF_POOL_FREED || bytes[sizeof(struct object) - 1] != WF_POOL_FREED) {
+            trace("freed object %zu isn't poisoned\n", i);
+            failed = 1;
+        }
+    }
+
+    for (size_t i = 0; i < NUM_OBJECTS; i += 2) objects[i] = objectPoolAlloc(&pool);
+
+    if (pool.capacity != capacity || pool.live != NUM_OBJECTS) {
+        trace("the pool grew from %zu to %zu objects to reuse freed ones\n", capacity, pool.capacity);
+        failed = 1;
+    }
+
+    for (size_t i = 0; i < NUM_OBJECTS; ++i) objectPoolFree(&pool, objects[i]);
+
+    /* a bunch of threads at once, through their caches */
+    struct worker workers[NUM_THREADS];
+    for (unsigned int t = 0; t < NUM_THREADS; ++t) {
+        workers[t].pool = &pool;
+        workers[t].index = t;
+        workers[t].failed = 0;
+        pthread_create(&workers[t].thread, NULL, churn, &workers[t]);
+    }
+
+    for (int t = 0; t < NUM_THREADS; ++t) {
+        pthread_join(workers[t].thread, NULL);
+
+        if (workers[t].failed) {
+            trace("thread %d found one of its objects overwritten\n", t);
+            failed = 1;
+        }
+    }
+
+    if (pool.live != 0 || pool.capacity > capacity + NUM_THREADS * (NUM_LIVE + 2 * WF_POOL_BATCH)) {
+        trace("after the threads, %zu objects are live and the pool holds %zu\n", pool.live, pool.capacity);
+        failed = 1;
+    }
+
+    /* objects that are only as big as the link */
+    struct wfPool small;
+    wfPoolCreate(&small, sizeof(void *), _Alignof(void *), WF_MEM_GFX);
+    small.poison = 1;
+
+    void *a = wfPoolAlloc(&small);
+    void *b = wfPoolAlloc(&small);
+    wfPoolFree(&small, a);
+
+    if (a == b || wfPoolAlloc(&small) != a) {
+        trace("a pool of pointer-sized objects should hand out the freed one again\n");
+        failed = 1;
+    }
+
+    const size_t holding = pool.capacity;
+    wfPoolDestroy(&small);
+    wfPoolDestroy(&pool);
+
+    if (tagUsed(WF_MEM_GFX) != 0) {
+        trace("the pools are gone, but the gfx tag still has %zu bytes\n", tagUsed(WF_MEM_GFX));
+        failed = 1;
+    }
+
+    printf("%s: %s (%zu objects of %zu bytes, %d threads)\n", TEST_NAME,
+        failed ? "FAILED" : "ok", holding, sizeof(struct object), NUM_THREADS);
+
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,143 @@
+/**
+ * This file is part of prototype.
+ *
+ * (c) 2014 Nicolas Hillegeer <nicolas@hillegeer.com>
+ *
+ * For the full copyright and license information, please view the LICENSE
+ * file that was distributed with the source code.
+ *
+ * Runs a script that makes garbage every frame for a few hundred frames.
+ * Without the scheduler, with the automatic collector stopped, the memory
+ * has to keep growing. With the scheduler stepping it, the memory has to
+ * stay bounded, cycles have to finish, and the time it takes per frame
+ * has to stay near its budget. Doesn't need a GL context.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+
+#include <lauxlib.h>
+#include <lua.h>
+#include <lualib.h>
+
+#include "util.h"
+
+#define TEST_NAME "scriptgc"
+
+#define NUM_FRAMES   300
+#define REMAINING_US 4000
+
+static const char *gScript =
+    "keep = {}\n"
+    "function frame(n)\n"
+    "  for i = 1, 500 do\n"
+    "    local t = { n, i, tostring(n * i) }\n"
+    "    if i % 100 == 0 then keep[#keep % 50 + 1] = t end\n"
+    "  end\n"
+    "end\n";
+
+struct run {
+    int endKb;
+    unsigned int maxUs;
+    uint64_t totalUs;
+    size_t cycles;
+};
+
+static void frames(lua_State *lua, struct wfScriptHeap *heap, struct wfScriptGc *gc, struct run *run) {
+    for (int n = 0; n < NUM_FRAMES; ++n) {
+        lua_getglobal(lua, "frame");
+        lua_pushinteger(lua, n);
+        lua_call(lua, 1, 0);
+
+        if (gc) {
+            const unsigned int us = wfScriptGcFrame(gc, REMAINING_US, heap->stats.allocated);
+            run->maxUs = MAX(run->maxUs, us);
+        }
+    }
+
+    run->endKb = lua_gc(lua, LUA_GCCOUNT, 0);
+
+    if (gc) {
+        run->totalUs = gc->stats.totalUs;
+        run->cycles = gc->stats.cycles;
+    }
+}
+
+static lua_State *newState(struct wfScriptHeap *heap) {
+    wfScriptHeapCreate(heap, 0);
+
+    lua_State *lua = lua_newstate(wfScriptHeapAlloc, heap);
+    luaL_openlibs(lua);
+
+    if (luaL_dostring(lua, gScript) != 0) {
+        trace("script failed: %s\n", lua_tostring(lua, -1));
+        exit(EXIT_FAILURE);
+    }
+
+    lua_gc(lua, LUA_GCCOLLECT, 0);
+
+    return lua;
+}
+
+int main(int argc, char const *argv[]) {
+    trace("setting up test: " TEST_NAME "\n");
+
+    SDL_Init(0);
+
+    static struct wfScriptHeap heap;
+    struct wfScriptGc gc;
+    struct run stopped = {0}, scheduled = {0};
+
+    trace("starting test: " TEST_NAME "\n");
+
+    int failed = 0;
+
+    /* the automatic collector is off, nobody steps it */
+    lua_State *lua = newState(&heap);
+    const int startKb = lua_gc(lua, LUA_GCCOUNT, 0);
+
+    wfScriptGcInit(&gc, lua, heap.stats.allocated);
+    frames(lua, &heap, NULL, &stopped);
+
+    lua_close(lua);
+    wfScriptHeapDestroy(&heap);
+
+    /* the same, with the scheduler */
+    lua = newState(&heap);
+
+    wfScriptGcInit(&gc, lua, heap.stats.allocated);
+    frames(lua, &heap, &gc, &scheduled);
+
+    if (lua_gc(lua, LUA_GCISRUNNING, 0)) {
+        trace("the automatic collector is running again\n");
+        failed = 1;
+    }
+
+    lua_close(lua);
+    wfScriptHeapDestroy(&heap);
+
+    if (stopped.endKb < 8 * startKb) {
+        trace("without stepping, the memory only went from %d to %d kb\n", startKb, stopped.endKb);
+        failed = 1;
+    }
+
+    if (scheduled.cycles == 0 || scheduled.endKb > 4 * startKb) {
+        trace("stepping finished %zu cycles, memory went from %d to %d kb\n",
+            scheduled.cycles, startKb, scheduled.endKb);
+        failed = 1;
+    }
+
+    /* on average, the budget is a quarter of what's left */
+    const unsigned int avgUs = (unsigned int) (scheduled.totalUs / NUM_FRAMES);
+    if (avgUs > REMAINING_US / WF_SCRIPT_GC_SHARE) {
+        trace("collecting took %u us per frame, for a budget of %u us\n", avgUs, REMAINING_US / WF_SCRIPT_GC_SHARE);
+        failed = 1;
+    }
+
+    printf("%s: %s (%d kb without stepping, %d kb with, %zu cycles, %u us/f, max %u us)\n", TEST_NAME,
+        failed ? "FAILED" : "ok", stopped.endKb, scheduled.endKb, scheduled.cycles, avgUs, scheduled.maxUs);
+
+    SDL_Quit();
+
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,126 @@
+/**
+ * This file is part of prototype.
+ *
+ * (c) 2014 Nicolas Hillegeer <nicolas@hillegeer.com>
+ *
+ * For the full copyright and license information, please view the LICENSE
+ * file that was distributed with the source code.
+ *
+ * Runs a Lua state on the engine allocator: a script that churns through
+ * tables and strings has to work like it would on the libc heap, with its
+ * memory counted under the script tag. A script that wants more than the
+ * budget has to fail with a memory error, without taking the state down,
+ * and closing the state has to give everything back. Doesn't need a GL
+ * context.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+
+#include <lauxlib.h>
+#include <lua.h>
+#include <lualib.h>
+
+#include "util.h"
+
+#define TEST_NAME "scriptmem"
+
+#define BUDGET (4 * 1024 * 1024)
+
+static const char *gChurn =
+    "local t = {}\n"
+    "for i = 1, 20000 do\n"
+    "  t[i % 1000 + 1] = { i, tostring(i) .. string.rep('x', i % 700), { x = i } }\n"
+    "end\n"
+    "local sum = 0\n"
+    "for _, v in ipairs(t) do sum = sum + v[3].x end\n"
+    "return sum\n";
+
+static const char *gHog =
+    "local t = {}\n"
+    "for i = 1, 1e7 do t[i] = { i } end\n";
+
+static size_t tagUsed(enum wfMemTag tag) {
+    struct wfMemTagStats stats;
+    wfMemTagGetStats(tag, &stats);
+    return stats.used;
+}
+
+static int run(lua_State *lua, const char *script) {
+    int error = luaL_loadstring(lua, script);
+    if (!error) error = lua_pcall(lua, 0, 1, 0);
+    if (error) trace("script failed: %s\n", lua_tostring(lua, -1));
+    return error;
+}
+
+int main(int argc, char const *argv[]) {
+    trace("setting up test: " TEST_NAME "\n");
+
+    static struct wfScriptHeap heap;
+    wfScriptHeapCreate(&heap, BUDGET);
+
+    lua_State *lua = lua_newstate(wfScriptHeapAlloc, &heap);
+    if (!lua) {
+        printf("%s: FAILED (lua doesn't take a custom allocator)\n", TEST_NAME);
+        return EXIT_FAILURE;
+    }
+
+    luaL_openlibs(lua);
+
+    trace("starting test: " TEST_NAME "\n");
+
+    int failed = 0;
+
+    /* the sum of every 1000th i from 19001 to 20000 */
+    if (run(lua, gChurn) != 0 || lua_tointeger(lua, -1) != 19500500) {
+        trace("the script came up with %ld\n", (long) lua_tointeger(lua, -1));
+        failed = 1;
+    }
+    lua_pop(lua, 1);
+
+    const struct wfScriptMemStats *stats = &heap.stats;
+
+    if (stats->used != (size_t) lua_gc(lua, LUA_GCCOUNT, 0) * 1024 + (size_t) lua_gc(lua, LUA_GCCOUNTB, 0)) {
+        trace("the heap counts %zu bytes, lua %d kb\n", stats->used, lua_gc(lua, LUA_GCCOUNT, 0));
+        failed = 1;
+    }
+
+    if (tagUsed(WF_MEM_SCRIPT) < stats->used || stats->allocated < stats->peak || stats->peak > BUDGET) {
+        trace("%zu bytes under the script tag, %zu used, %zu peak, %zu allocated\n",
+            tagUsed(WF_MEM_SCRIPT), stats->used, stats->peak, stats->allocated);
+        failed = 1;
+    }
+
+    /* over budget: the script gets an error, the state lives on */
+    if (run(lua, gHog) != LUA_ERRMEM || stats->rejected == 0) {
+        trace("a script over budget didn't run out of memory (%zu rejected)\n", stats->rejected);
+        failed = 1;
+    }
+    lua_pop(lua, 1);
+
+    lua_gc(lua, LUA_GCCOLLECT, 0);
+
+    if (run(lua, gChurn) != 0) failed = 1;
+    lua_pop(lua, 1);
+
+    const size_t peak = stats->peak;
+
+    lua_close(lua);
+
+    if (stats->used != 0) {
+        trace("lua is closed, but the heap still counts %zu bytes\n", stats->used);
+        failed = 1;
+    }
+
+    wfScriptHeapDestroy(&heap);
+
+    if (tagUsed(WF_MEM_SCRIPT) != 0) {
+        trace("the heap is gone, but the script tag still has %zu bytes\n", tagUsed(WF_MEM_SCRIPT));
+        failed = 1;
+    }
+
+    printf("%s: %s (peak %zu kb of %d kb, %zu allocations)\n", TEST_NAME,
+        failed ? "FAILED" : "ok", peak / 1024, BUDGET / 1024, stats->allocs);
+
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,160 @@
+/**
+ * This file is part of prototype.
+ *
+ * (c) 2014 Nicolas Hillegeer <nicolas@hillegeer.com>
+ *
+ * For the full copyright and license information, please view the LICENSE
+ * file that was distributed with the source code.
+ *
+ * A bunch of threads allocate and free blocks of known sizes through
+ * zmalloc. Every thread should see exactly its own allocations in its
+ * statistics, in the right buckets of the histogram, and once they're all
+ * done the total should be back to where it started, including the
+ * blocks one thread allocated and another freed. What a thread frees
+ * after its counters were retired must not end up in the counters of the
+ * next thread. Doesn't need a GL context.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <pthread.h>
+
+#include "util.h"
+
+#define TEST_NAME "zmalloc"
+
+#define NUM_THREADS 4
+#define NUM_BLOCKS  1000
+
+struct worker {
+    pthread_t thread;
+    size_t size;
+    void *handover[NUM_BLOCKS];
+    zmalloc_stats stats;
+};
+
+static void *churn(void *arg) {
+    struct worker *w = arg;
+    void *blocks[NUM_BLOCKS];
+
+    for (int i = 0; i < NUM_BLOCKS; ++i) blocks[i] = zmalloc(w->size);
+    for (int i = 0; i < NUM_BLOCKS; ++i) zfree(blocks[i]);
+
+    /* these get freed by the main thread */
+    for (int i = 0; i < NUM_BLOCKS; ++i) w->handover[i] = zmalloc(w->size);
+
+    zmalloc_get_thread_stats(&w->stats);
+
+    return NULL;
+}
+
+static pthread_key_t gLateKey;
+
+/* runs after zmalloc retired the shard of the thread */
+static void lateFree(void *block) {
+    zfree(block);
+}
+
+static void *late(void *arg) {
+    pthread_setspecific(gLateKey, zmalloc(100));
+    return NULL;
+}
+
+/* gets the shard the late thread had */
+static void *fresh(void *arg) {
+    zfree(zmalloc(100));
+    zmalloc_get_thread_stats(arg);
+    return NULL;
+}
+
+int main(int argc, char const *argv[]) {
+    trace("setting up test: " TEST_NAME "\n");
+
+    zmalloc_enable_thread_safeness();
+
+    static struct worker workers[NUM_THREADS];
+    const size_t before = zmalloc_used_memory();
+
+    trace("starting test: " TEST_NAME "\n");
+
+    int failed = 0;
+
+    for (int t = 0; t < NUM_THREADS; ++t) {
+        workers[t].size = (size_t) 24 << (3 * t);
+        pthread_create(&workers[t].thread, NULL, churn, &workers[t]);
+    }
+
+    for (int t = 0; t < NUM_THREADS; ++t) {
+        pthread_join(workers[t].thread, NULL);
+
+        const zmalloc_stats *stats = &workers[t].stats;
+
+        if (stats->allocs != 2 * NUM_BLOCKS || stats->frees != NUM_BLOCKS) {
+            trace("thread %d counted %zu allocations and %zu frees\n", t, stats->allocs, stats->frees);
+            failed = 1;
+        }
+
+        const size_t block = zmalloc_size(workers[t].handover[0]);
+        if (stats->used != (ptrdiff_t) (NUM_BLOCKS * block) || (ptrdiff_t) stats->peak != stats->used) {
+            trace("thread %d has %td bytes in use (peak %zu), expected %zu\n",
+                t, stats->used, stats->peak, NUM_BLOCKS * block);
+            failed = 1;
+        }
+
+        /* all of them are the same size, so they go in the same bucket */
+        for (int i = 0; i < ZMALLOC_HISTOGRAM_BUCKETS; ++i) {
+            const size_t limit = zmalloc_histogram_limit(i);
+            const size_t lower = i ? zmalloc_histogram_limit(i - 1) : 0;
+            const int fits = block > lower && (limit == 0 || block <= limit);
+
+            if (stats->histogram[i] != (fits ? 2 * NUM_BLOCKS : 0)) {
+                trace("thread %d has %zu allocations of %zu bytes in bucket %d\n", t, stats->histogram[i], block, i);
+                failed = 1;
+            }
+        }
+    }
+
+    size_t handedOver = 0;
+    for (int t = 0; t < NUM_THREADS; ++t) {
+        for (int i = 0; i < NUM_BLOCKS; ++i) {
+            handedOver += zmalloc_size(workers[t].handover[i]);
+            zfree(workers[t].handover[i]);
+        }
+    }
+
+    /* the main thread freed more than it allocated */
+    zmalloc_stats mine;
+    zmalloc_get_thread_stats(&mine);
+
+    if (mine.used > -(ptrdiff_t) handedOver) {
+        trace("the main thread has %td bytes in use after freeing %zu of other threads\n", mine.used, handedOver);
+        failed = 1;
+    }
+
+    /* a thread that frees something after its shard was retired, the
+     * next thread to get that shard must not see it */
+    pthread_key_create(&gLateKey, lateFree);
+
+    pthread_t thread;
+    zmalloc_stats next;
+
+    pthread_create(&thread, NULL, late, NULL);
+    pthread_join(thread, NULL);
+    pthread_create(&thread, NULL, fresh, &next);
+    pthread_join(thread, NULL);
+
+    if (next.allocs != 1 || next.frees != 1 || next.used != 0) {
+        trace("a new thread starts with %zu allocations, %zu frees and %td bytes\n", next.allocs, next.frees, next.used);
+        failed = 1;
+    }
+
+    if (zmalloc_used_memory() != before) {
+        trace("%zu bytes are in use, %zu were before\n", zmalloc_used_memory(), before);
+        failed = 1;
+    }
+
+    printf("%s: %s (%d threads, %d blocks each)\n", TEST_NAME,
+        failed ? "FAILED" : "ok", NUM_THREADS, NUM_BLOCKS);
+
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
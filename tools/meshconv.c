@@ -0,0 +1,82 @@
+/**
+ * This file is part of prototype.
+ *
+ * (c) 2014 Nicolas Hillegeer <nicolas@hillegeer.com>
+ *
+ * For the full copyright and license information, please view the LICENSE
+ * file that was distributed with the source code.
+ *
+ * Converts OBJ files to binary meshes (see src/gfx/mesh.h). The triangles
+ * and vertices get reordered for the vertex cache on the way, the LOD
+ * chain gets built (see src/gfx/simplify.c) and the indices get as small
+ * as they can be, so none of that has to happen at load time. With -q
+ * the vertices get quantized as well (see src/gfx/quantize.h), which
+ * takes a position/normal/texcoord vertex from 32 bytes to 16.
+ *
+ * usage: meshconv [-q] input.obj output.mesh
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "util.h"
+
+int main(int argc, char const *argv[]) {
+    const int quantize = argc == 4 && strcmp(argv[1], "-q") == 0;
+
+    if (argc != 3 && !quantize) {
+        fprintf(stderr, "usage: %s [-q] input.obj output.mesh\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    const char *input = argv[argc - 2];
+    const char *output = argv[argc - 1];
+
+    struct gfxMesh mesh;
+    gfx_mesh_error_t error = gfxParseObj(&mesh, input);
+
+    if (error != GFX_MESH_OK) {
+        fprintf(stderr, "%s: %s\n", input, gfxMeshErrorString(error));
+        return EXIT_FAILURE;
+    }
+
+    const struct gfxMeshHeader *header = &mesh.header;
+
+    struct gfxVertexCacheStats before, after;
+    gfxVertexCacheStats(&before, mesh.indices, header->numIndices, header->numVertices, GFX_VCACHE_SIZE);
+
+    /* the same as generated meshes, which keeps the original order if it's
+     * better for the cache */
+    gfxOptimizeMesh(mesh.vertices, header->stride, header->numVertices, mesh.indices, GL_UNSIGNED_INT, header->numIndices);
+
+    gfxVertexCacheStats(&after, mesh.indices, header->numIndices, header->numVertices, GFX_VCACHE_SIZE);
+
+    const uint32_t numTriangles = header->numIndices / 3;
+
+    gfxMeshBuildLods(&mesh);
+    gfxMeshNarrowIndices(&mesh);
+
+    if (quantize) gfxQuantizeMesh(&mesh);
+
+    error = gfxWriteMesh(&mesh, output);
+
+    if (error != GFX_MESH_OK) {
+        fprintf(stderr, "%s: %s\n", output, gfxMeshErrorString(error));
+        gfxFreeMesh(&mesh);
+        return EXIT_FAILURE;
+    }
+
+    printf("%s: %u vertices (%u bytes each), %u triangles, %u-bit indices, ACMR %.3f -> %.3f, ATVR %.3f -> %.3f\n",
+        output, header->numVertices, header->stride, numTriangles,
+        header->indexType == GFX_MESH_UNSIGNED_BYTE ? 8 : header->indexType == GFX_MESH_UNSIGNED_SHORT ? 16 : 32,
+        before.acmr, after.acmr, before.atvr, after.atvr);
+
+    for (uint32_t i = 1; i < header->numLods; ++i) {
+        printf("    LOD %u: %u triangles, off by at most %g\n", i, header->lods[i].numIndices / 3, header->lods[i].error);
+    }
+
+    gfxFreeMesh(&mesh);
+
+    return EXIT_SUCCESS;
+}